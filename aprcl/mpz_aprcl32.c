@@ -1324,24 +1324,33 @@ int aiT[] =  {
   1396755360};/* | 4.0165 E1913 | 424 |  232792561 | p={2,3,5,7,11,13,17,19} */
 
 
-int aiInv[PWmax];
-mpz_t biTmp;
-mpz_t biExp;
-mpz_t biN;
-mpz_t biR;
-mpz_t biS;
-mpz_t biT;
-mpz_t biU;
-mpz_t *aiJS; /* [PWmax] */
-mpz_t *aiJW; /* [PWmax] */
-mpz_t *aiJX; /* [PWmax] */
-mpz_t *aiJ0; /* [PWmax] */
-mpz_t *aiJ1; /* [PWmax] */
-mpz_t *aiJ2; /* [PWmax] */
-mpz_t *aiJ00; /* [PWmax] */
-mpz_t *aiJ01; /* [PWmax] */
-int NumberLength; /* Length of multiple precision nbrs */
-mpz_t TestNbr;
+/* the test state below is global, so make it thread-local
+   in order for several threads to run APRCL tests at once */
+
+#if defined(_MSC_VER)
+#define APRCL_TLS __declspec(thread)
+#else
+#define APRCL_TLS __thread
+#endif
+
+static APRCL_TLS int aiInv[PWmax];
+static APRCL_TLS mpz_t biTmp;
+static APRCL_TLS mpz_t biExp;
+static APRCL_TLS mpz_t biN;
+static APRCL_TLS mpz_t biR;
+static APRCL_TLS mpz_t biS;
+static APRCL_TLS mpz_t biT;
+static APRCL_TLS mpz_t biU;
+static APRCL_TLS mpz_t *aiJS; /* [PWmax] */
+static APRCL_TLS mpz_t *aiJW; /* [PWmax] */
+static APRCL_TLS mpz_t *aiJX; /* [PWmax] */
+static APRCL_TLS mpz_t *aiJ0; /* [PWmax] */
+static APRCL_TLS mpz_t *aiJ1; /* [PWmax] */
+static APRCL_TLS mpz_t *aiJ2; /* [PWmax] */
+static APRCL_TLS mpz_t *aiJ00; /* [PWmax] */
+static APRCL_TLS mpz_t *aiJ01; /* [PWmax] */
+static APRCL_TLS int NumberLength; /* Length of multiple precision nbrs */
+static APRCL_TLS mpz_t TestNbr;
 
 /* ============================================================================================== */
 
@@ -74,7 +74,7 @@ static void fill_sieve_block(sieve_conf_t *conf,
 	   will update many locations within the block, and this
 	   phase will run very fast */
 
-	TIME1(sieve_small_time)
+	TIME1(conf, QS_TIME_SIEVE_SMALL)
 
 	for (i = sieve_small_fb_start; i < sieve_large_fb_start; i++) {
 		packed_fb_t *pfbptr = packed_fb + i;
@@ -118,7 +118,7 @@ static void fill_sieve_block(sieve_conf_t *conf,
 		pfbptr->next_loc2 = root2 - sieve_block_size;
 	}
 
-	TIME2(sieve_small_time)
+	TIME2(conf, QS_TIME_SIEVE_SMALL)
 
 	/* Now update the sieve block with the rest of the
 	   factor base. All of the offsets to update have
@@ -128,7 +128,7 @@ static void fill_sieve_block(sieve_conf_t *conf,
 	   previous loop, and memory access to the hashtable
 	   entry is predictable and can be prefetched */
 
-	TIME1(sieve_large_time)
+	TIME1(conf, QS_TIME_SIEVE_LARGE)
 	list = hash_bucket->list;
 	num_large = hash_bucket->num_used;
 
@@ -148,7 +148,7 @@ static void fill_sieve_block(sieve_conf_t *conf,
 	for (; i < num_large; i++) {
 		sieve_array[list[i].sieve_offset] -= list[i].logprime;
 	}
-	TIME2(sieve_large_time)
+	TIME2(conf, QS_TIME_SIEVE_LARGE)
 }
 
 /*--------------------------------------------------------------------*/
@@ -167,7 +167,7 @@ static uint32 scan_sieve_block(sieve_conf_t *conf,
 	uint64 *packed_sieve = (uint64 *)conf->sieve_array;
 	uint32 relations_found = 0;
 
-	TIME1(tf_plus_scan_time)
+	TIME1(conf, QS_TIME_SCAN)
 	for (i = 0; i < sieve_block_size / 8; i += 8) {
 
 		/* test 64 sieve values at a time for large
@@ -239,17 +239,17 @@ static uint32 scan_sieve_block(sieve_conf_t *conf,
 		for (j = 0; j < 64; j++) {
 			uint32 bits = sieve_array[8 * i + j];
 			if (bits > cutoff1) {
-				TIME1(tf_total_time)
+				TIME1(conf, QS_TIME_TF)
 				relations_found += check_sieve_val(conf, 
 						block_start + (int32)(8*i+j), 
 						cutoff1 + 257 - bits,
 						a, b, c, poly_index,
 						hashtable);
-				TIME2(tf_total_time)
+				TIME2(conf, QS_TIME_TF)
 			}
 		}
 	}
-	TIME2(tf_plus_scan_time)
+	TIME2(conf, QS_TIME_SCAN)
 
 #if defined(MSC_ASM32X) && (defined(HAS_AMD_MMX) || defined(HAS_SSE))
 	ASM_M emms
@@ -371,7 +371,7 @@ static uint32 sieve_core_vc8(sieve_conf_t *conf,
 			uint32 next_action;
 			uint32 *poly_b_start;
 
-			TIME1(bucket_time)
+			TIME1(conf, QS_TIME_BUCKET)
 			for (k = 0; k < fb_block; k++) {
 				fb_t *fbptr = fb_start + k;
 				uint32 prime = fbptr->prime;
@@ -407,7 +407,7 @@ static uint32 sieve_core_vc8(sieve_conf_t *conf,
 					root2 += prime;
 				}
 			}
-			TIME2(bucket_time)
+			TIME2(conf, QS_TIME_BUCKET)
 
 			/* this block has finished sieving for polynomial
 			   j; now select the new roots for polynomial j+1.
@@ -429,7 +429,7 @@ static uint32 sieve_core_vc8(sieve_conf_t *conf,
 			   branch required to do so takes a large fraction 
 			   of the total poly initialization time! */
 
-			TIME1(next_poly_large_time)
+			TIME1(conf, QS_TIME_NEXT_POLY_LARGE)
 			if (next_action & 0x80) {
 				for (k = 0; k < fb_block; 
 					k++, poly_b_start += num_factors) {
@@ -462,7 +462,7 @@ static uint32 sieve_core_vc8(sieve_conf_t *conf,
 					fbptr->root2 = root2;
 				}
 			}
-			TIME2(next_poly_large_time)
+			TIME2(conf, QS_TIME_NEXT_POLY_LARGE)
 
 			/* polynomial j is finished; point to the
 			   hash bins for polynomial j+1 */
@@ -501,7 +501,7 @@ static uint32 sieve_core_vc8(sieve_conf_t *conf,
 		   got to do, so we must update the temporary roots as
 		   we go from sieve block to sieve block */
 
-		TIME1(plus_init_time)
+		TIME1(conf, QS_TIME_POLY_SETUP)
 		for (j = MIN_FB_OFFSET + 1; 
 				j < conf->sieve_large_fb_start; j++) {
 			fb_t *fbptr = factor_base + j;
@@ -539,7 +539,7 @@ static uint32 sieve_core_vc8(sieve_conf_t *conf,
 		else
 			cutoff1 = 0;
 
-		TIME2(plus_init_time)
+		TIME2(conf, QS_TIME_POLY_SETUP)
 
 		/* for each sieve block */
 
@@ -580,7 +580,7 @@ static uint32 sieve_core_vc8(sieve_conf_t *conf,
 		poly_b_array = conf->poly_b_small[next_action & 0x7f];
 		k = conf->sieve_large_fb_start;
 
-		TIME1(next_poly_small_time)
+		TIME1(conf, QS_TIME_NEXT_POLY_SMALL)
 		if (next_action & 0x80) {
 			for (j = MIN_FB_OFFSET + 1; j < k; j++) {
 	
@@ -629,7 +629,7 @@ static uint32 sieve_core_vc8(sieve_conf_t *conf,
 				}
 			}
 		}
-		TIME2(next_poly_small_time)
+		TIME2(conf, QS_TIME_NEXT_POLY_SMALL)
 		buckets += num_sieve_blocks;
 	}
 
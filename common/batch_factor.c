@@ -13,6 +13,13 @@ $Id$
 --------------------------------------------------------------------*/
 
 #include <batch_factor.h>
+#include <thread.h>
+
+/* limits on the parallel computation of the top
+   of the product and remainder trees */
+
+#define MAX_BATCH_THREADS 32
+#define MAX_BATCH_DEPTH 12
 
 /*------------------------------------------------------------------*/
 #define BREAKOVER_WORDS 50
@@ -136,6 +143,34 @@ static void multiply_relations(uint32 first, uint32 last,
 	mpz_clear(half_prod);
 }
 
+/*------------------------------------------------------------------*/
+/* two-word cofactors up to this size are split with SQUFOF,
+   which is faster than tinyecm for them */
+
+#define SQUFOF_MAX_BITS 50
+
+static uint32 split_cofactor(relation_batch_t *rb, mp_t *n) {
+
+	/* find a factor of a two-word composite; returns the
+	   factor if it fits in a word and 0 or 1 on failure,
+	   the same as squfof */
+
+	mp_t f1, f2;
+
+	if (mp_bits(n) <= SQUFOF_MAX_BITS ||
+	    rb->cofactor_engine == BATCH_COFACTOR_QS)
+		return squfof(n);
+
+	if (tinyecm(rb->tinyecm_data, n, &f1, &f2) == 0)
+		return 0;
+
+	if (mp_cmp(&f1, &f2) > 0)
+		mp_copy(&f2, &f1);
+	if (f1.nwords > 1)
+		return 0;
+	return f1.val[0];
+}
+
 /*------------------------------------------------------------------*/
 static mp_t two = {1, {2}};
 
@@ -284,9 +319,9 @@ static void check_relation(relation_batch_t *rb,
 			return;
 	}
 
-	/* now perform all the factorizations that
-	   require SQUFOF, since it is much faster than the
-	   QS code. We have to check all of f[1|2][r|a] but
+	/* now perform all the factorizations of two-word
+	   cofactors, which are much faster than the three-word
+	   ones. We have to check all of f[1|2][r|a] but
 	   for relations with three large primes then at most
 	   two of the four choices need factoring */
 
@@ -295,7 +330,7 @@ static void check_relation(relation_batch_t *rb,
 			lp_r[num_r++] = f1r.val[0];
 	}
 	else if (f1r.nwords == 2) {
-		i = squfof(&f1r);
+		i = split_cofactor(rb, &f1r);
 		if (i <= 1 || i > rb->lp_cutoff_r)
 			return;
 		lp_r[num_r++] = i;
@@ -310,7 +345,7 @@ static void check_relation(relation_batch_t *rb,
 			lp_r[num_r++] = f2r.val[0];
 	}
 	else if (f2r.nwords == 2) {
-		i = squfof(&f2r);
+		i = split_cofactor(rb, &f2r);
 		if (i <= 1 || i > rb->lp_cutoff_r)
 			return;
 		lp_r[num_r++] = i;
@@ -325,7 +360,7 @@ static void check_relation(relation_batch_t *rb,
 			lp_a[num_a++] = f1a.val[0];
 	}
 	else if (f1a.nwords == 2) {
-		i = squfof(&f1a);
+		i = split_cofactor(rb, &f1a);
 		if (i <= 1 || i > rb->lp_cutoff_a)
 			return;
 		lp_a[num_a++] = i;
@@ -340,7 +375,7 @@ static void check_relation(relation_batch_t *rb,
 			lp_a[num_a++] = f2a.val[0];
 	}
 	else if (f2a.nwords == 2) {
-		i = squfof(&f2a);
+		i = split_cofactor(rb, &f2a);
 		if (i <= 1 || i > rb->lp_cutoff_a)
 			return;
 		lp_a[num_a++] = i;
@@ -358,7 +393,11 @@ static void check_relation(relation_batch_t *rb,
 	   this happens extremely rarely */
 
 	if (f1r.nwords == 3) {
-		if (tinyqs(&f1r, &t0, &t1) == 0)
+		if (rb->cofactor_engine == BATCH_COFACTOR_QS)
+			i = tinyqs(rb->tinyqs_data, &f1r, &t0, &t1);
+		else
+			i = tinyecm(rb->tinyecm_data, &f1r, &t0, &t1);
+		if (i == 0)
 			return;
 
 		small = &t0;
@@ -371,7 +410,7 @@ static void check_relation(relation_batch_t *rb,
 		if (small->nwords > 1 || small->val[0] > rb->lp_cutoff_r)
 			return;
 		lp_r[num_r++] = small->val[0];
-		i = squfof(large);
+		i = split_cofactor(rb, large);
 		if (i <= 1 || i > rb->lp_cutoff_r)
 			return;
 		lp_r[num_r++] = i;
@@ -382,7 +421,11 @@ static void check_relation(relation_batch_t *rb,
 	}
 
 	if (f1a.nwords == 3) {
-		if (tinyqs(&f1a, &t0, &t1) == 0)
+		if (rb->cofactor_engine == BATCH_COFACTOR_QS)
+			i = tinyqs(rb->tinyqs_data, &f1a, &t0, &t1);
+		else
+			i = tinyecm(rb->tinyecm_data, &f1a, &t0, &t1);
+		if (i == 0)
 			return;
 
 		small = &t0;
@@ -395,7 +438,7 @@ static void check_relation(relation_batch_t *rb,
 		if (small->nwords > 1 || small->val[0] > rb->lp_cutoff_a)
 			return;
 		lp_a[num_a++] = small->val[0];
-		i = squfof(large);
+		i = split_cofactor(rb, large);
 		if (i <= 1 || i > rb->lp_cutoff_a)
 			return;
 		lp_a[num_a++] = i;
@@ -407,8 +450,13 @@ static void check_relation(relation_batch_t *rb,
 
 	/* yay! Another relation found */
 
+	if (rb->verify != NULL) {
+		rb->verify[index] |= rb->verify_mark;
+		if (rb->verify_mark == 1)
+			return;
+	}
 	rb->num_success++;
-	rb->print_relation(rb->savefile, c->a, c->b,
+	rb->print_relation(rb->print_data, c->a, c->b,
 			f, c->num_factors_r, lp_r,
 			f + c->num_factors_r, c->num_factors_a, lp_a);
 }
@@ -462,15 +510,488 @@ static void compute_remainder_tree(uint32 first, uint32 last,
 	mpz_clear(remainder);
 }
 
+/*------------------------------------------------------------------*/
+/* The scaled remainder tree. Instead of the remainder of the
+   prime product X modulo the product P of a range of relations,
+   each node receives y = X/P mod 1 as a fixed-point number with
+   a few more bits than P. If P = P1 * P2 for the two halves of
+   the range, then X/P1 mod 1 = (y * P2) mod 1, so going down the
+   tree only needs multiplications and truncations. Once P is
+   small enough, X mod P is recovered as y * P, rounded. 
+   
+   Each level at most doubles the error in y (the product of the
+   halves can have one bit fewer than the two together), so the
+   number of guard bits has to exceed the depth of the tree.
+
+   Unlike the classic tree, the products of relations are built
+   once and stored, since each node needs the products of both
+   of its halves. Leaves hold a few relations, few enough that 
+   their product always fits in an mp_t */
+
+#define SCALED_GUARD_BITS 64
+#define SCALED_LEAF_SIZE 4
+
+typedef struct {
+	relation_batch_t *rb;
+	mpz_t *prod;		/* products, node 1 is the root and
+				   nodes 2n and 2n+1 are the halves
+				   of node n */
+	uint32 num_nodes;
+	mpz_t tmp;
+} scaled_tree_t;
+
+/*------------------------------------------------------------------*/
+static void build_scaled_tree(scaled_tree_t *t, uint32 node,
+				uint32 first, uint32 last) {
+
+	uint32 mid = (first + last) / 2;
+
+	if (last - first < SCALED_LEAF_SIZE) {
+		multiply_relations(first, last, t->rb, t->prod[node]);
+		return;
+	}
+
+	build_scaled_tree(t, 2 * node, first, mid);
+	build_scaled_tree(t, 2 * node + 1, mid + 1, last);
+	mpz_mul(t->prod[node], t->prod[2 * node], t->prod[2 * node + 1]);
+}
+
+/*------------------------------------------------------------------*/
+static void scaled_remainder_tree(scaled_tree_t *t, uint32 node,
+				uint32 first, uint32 last,
+				mpz_t y, uint32 y_bits) {
+
+	uint32 mid = (first + last) / 2;
+	uint32 bits1, bits2;
+	mpz_t *prod = t->prod;
+	mpz_t y1, y2;
+
+	/* recursion base case: the remainder fits in an mp_t,
+	   so recover it and postprocess each relation */
+
+	if (mpz_size(prod[node]) * GMP_LIMB_BITS/32 <= MAX_MP_WORDS) {
+		mpz_t *rem = &t->tmp;
+
+		mpz_mul(*rem, y, prod[node]);
+		mpz_tdiv_q_2exp(*rem, *rem, y_bits - 1);
+		mpz_add_ui(*rem, *rem, 1);
+		mpz_tdiv_q_2exp(*rem, *rem, 1);
+		if (mpz_cmp(*rem, prod[node]) >= 0)
+			mpz_sub(*rem, *rem, prod[node]);
+
+		if (mpz_sgn(*rem) > 0) {
+			mp_t num;
+			gmp2mp(*rem, &num);
+			while (first <= last)
+				check_relation(t->rb, first++, &num);
+		}
+		return;
+	}
+
+	/* find the fractions to use for each half */
+
+	mpz_init(y1);
+	mpz_init(y2);
+	bits1 = mpz_sizeinbase(prod[2 * node], 2) + SCALED_GUARD_BITS;
+	bits2 = mpz_sizeinbase(prod[2 * node + 1], 2) + SCALED_GUARD_BITS;
+
+	mpz_mul(y1, y, prod[2 * node + 1]);
+	mpz_tdiv_r_2exp(y1, y1, y_bits);
+	mpz_tdiv_q_2exp(y1, y1, y_bits - bits1);
+
+	mpz_mul(y2, y, prod[2 * node]);
+	mpz_tdiv_r_2exp(y2, y2, y_bits);
+	mpz_tdiv_q_2exp(y2, y2, y_bits - bits2);
+
+	/* the product at this node is not needed anymore */
+
+	mpz_realloc2(prod[node], 1);
+
+	scaled_remainder_tree(t, 2 * node, first, mid, y1, bits1);
+	mpz_clear(y1);
+	scaled_remainder_tree(t, 2 * node + 1, mid + 1, last, y2, bits2);
+	mpz_clear(y2);
+}
+
+/*------------------------------------------------------------------*/
+static void remainder_tree(uint32 first, uint32 last,
+				relation_batch_t *rb,
+				mpz_t numerator) {
+
+	/* compute numerator % (each relation in rb->relations)
+	   with the chosen engine */
+
+	uint32 i, y_bits;
+	uint32 size = last - first + 1;
+	scaled_tree_t t;
+	mpz_t y;
+
+	if (rb->remainder_engine == BATCH_REMAINDER_CLASSIC ||
+	    mpz_size(numerator) * GMP_LIMB_BITS/32 <= MAX_MP_WORDS) {
+		compute_remainder_tree(first, last, rb, numerator);
+		return;
+	}
+
+	/* the halves of a range differ in size by at most one,
+	   so the tree has depth d, for the smallest d such that
+	   splitting d times leaves at most SCALED_LEAF_SIZE 
+	   relations in every range */
+
+	t.rb = rb;
+	t.num_nodes = 2;
+	while ((size + t.num_nodes / 2 - 1) / (t.num_nodes / 2) > 
+						SCALED_LEAF_SIZE) {
+		t.num_nodes *= 2;
+	}
+	t.prod = (mpz_t *)xmalloc(t.num_nodes * sizeof(mpz_t));
+	for (i = 0; i < t.num_nodes; i++)
+		mpz_init(t.prod[i]);
+	mpz_init(t.tmp);
+
+	build_scaled_tree(&t, 1, first, last);
+
+	/* the only division: find the fraction for the root */
+
+	mpz_init(y);
+	y_bits = mpz_sizeinbase(t.prod[1], 2) + SCALED_GUARD_BITS;
+	mpz_mul_2exp(y, numerator, y_bits);
+	mpz_tdiv_q(y, y, t.prod[1]);
+	mpz_tdiv_r_2exp(y, y, y_bits);
+
+	scaled_remainder_tree(&t, 1, first, last, y, y_bits);
+
+	mpz_clear(y);
+	mpz_clear(t.tmp);
+	for (i = 0; i < t.num_nodes; i++)
+		mpz_clear(t.prod[i]);
+	free(t.prod);
+}
+
+/*------------------------------------------------------------------*/
+/* With more than one thread, the top of the product tree of
+   relations is built explicitly, with node 1 the root and nodes
+   2n and 2n+1 the children of node n. Every level is computed
+   in parallel, first bottom-up to form the products and then
+   top-down to replace each product with the remainder of its
+   parent's remainder. Each subtree below the bottom level is
+   then finished by one thread using the ordinary recursion,
+   with its own copy of the relation batch */
+
+typedef struct {
+	relation_batch_t rb;	/* shallow copy, with its own tinyqs
+				   and tinyecm data and count of
+				   relations found */
+	mutex_t *print_lock;
+	void *print_data;
+	print_relation_t print_relation;
+} batch_thread_t;
+
+typedef struct {
+	relation_batch_t *rb;
+	uint32 num_leaves;
+	uint32 *first;		/* relations below each tree node */
+	uint32 *last;
+	mpz_t *piece_rem;	/* prime_pieces mod the root */
+	batch_thread_t threads[MAX_BATCH_THREADS];
+	mutex_t print_lock;
+} batch_tree_t;
+
+typedef struct {
+	batch_tree_t *t;
+	uint32 node;
+} tree_task_t;
+
+/*------------------------------------------------------------------*/
+static void print_relation_locked(void *print_data, int64 a, uint32 b,
+			uint32 *factors_r, uint32 num_factors_r, 
+			uint32 lp_r[MAX_LARGE_PRIMES],
+			uint32 *factors_a, uint32 num_factors_a, 
+			uint32 lp_a[MAX_LARGE_PRIMES]) {
+
+	batch_thread_t *thread = (batch_thread_t *)print_data;
+
+	mutex_lock(thread->print_lock);
+	thread->print_relation(thread->print_data, a, b,
+			factors_r, num_factors_r, lp_r,
+			factors_a, num_factors_a, lp_a);
+	mutex_unlock(thread->print_lock);
+}
+
+/*------------------------------------------------------------------*/
+static void batch_thread_init(void *data, int thread_num) {
+
+	batch_tree_t *t = (batch_tree_t *)data;
+	batch_thread_t *thread = t->threads + thread_num;
+
+	thread->rb = *t->rb;
+	thread->rb.num_success = 0;
+	thread->rb.tinyqs_data = tinyqs_init();
+	thread->rb.tinyecm_data = tinyecm_init();
+	thread->rb.print_data = thread;
+	thread->rb.print_relation = print_relation_locked;
+	thread->print_lock = &t->print_lock;
+	thread->print_data = t->rb->print_data;
+	thread->print_relation = t->rb->print_relation;
+}
+
+/*------------------------------------------------------------------*/
+static void batch_thread_free(void *data, int thread_num) {
+
+	batch_tree_t *t = (batch_tree_t *)data;
+	batch_thread_t *thread = t->threads + thread_num;
+
+	thread->rb.tinyqs_data = tinyqs_free(thread->rb.tinyqs_data);
+	thread->rb.tinyecm_data = tinyecm_free(thread->rb.tinyecm_data);
+}
+
+/*------------------------------------------------------------------*/
+static void leaf_product_run(void *data, int thread_num) {
+
+	tree_task_t *task = (tree_task_t *)data;
+	batch_tree_t *t = task->t;
+	uint32 n = task->node;
+
+	multiply_relations(t->first[n], t->last[n], 
+			t->rb, t->rb->tree[n]);
+}
+
+/*------------------------------------------------------------------*/
+static void node_product_run(void *data, int thread_num) {
+
+	tree_task_t *task = (tree_task_t *)data;
+	mpz_t *tree = task->t->rb->tree;
+	uint32 n = task->node;
+
+	mpz_mul(tree[n], tree[2 * n], tree[2 * n + 1]);
+}
+
+/*------------------------------------------------------------------*/
+static void piece_remainder_run(void *data, int thread_num) {
+
+	tree_task_t *task = (tree_task_t *)data;
+	batch_tree_t *t = task->t;
+	uint32 n = task->node;
+
+	mpz_tdiv_r(t->piece_rem[n], t->rb->prime_pieces[n], 
+			t->rb->tree[1]);
+}
+
+/*------------------------------------------------------------------*/
+static void node_remainder_run(void *data, int thread_num) {
+
+	tree_task_t *task = (tree_task_t *)data;
+	mpz_t *tree = task->t->rb->tree;
+	uint32 n = task->node;
+
+	/* as in compute_remainder_tree, skip the division
+	   if the remainder is already small enough */
+
+	if (mpz_cmp(tree[n / 2], tree[n]) < 0)
+		mpz_set(tree[n], tree[n / 2]);
+	else
+		mpz_tdiv_r(tree[n], tree[n / 2], tree[n]);
+}
+
+/*------------------------------------------------------------------*/
+static void leaf_remainder_run(void *data, int thread_num) {
+
+	tree_task_t *task = (tree_task_t *)data;
+	batch_tree_t *t = task->t;
+	uint32 n = task->node;
+	uint32 first = t->first[n];
+	uint32 last = t->last[n];
+	uint32 mid = (first + last) / 2;
+	relation_batch_t *rb = &t->threads[thread_num].rb;
+
+	/* the node already holds the remainder modulo the
+	   product of its relations, so go straight to the
+	   two halves */
+
+	remainder_tree(first, mid, rb, t->rb->tree[n]);
+	remainder_tree(mid + 1, last, rb, t->rb->tree[n]);
+}
+
+/*------------------------------------------------------------------*/
+static void run_tree_level(struct threadpool *pool, batch_tree_t *t,
+			tree_task_t *tasks, uint32 first_node, 
+			uint32 num_nodes, run_func run) {
+
+	/* perform the same operation on a range of
+	   nodes, and wait for all of them to finish */
+
+	uint32 i;
+	task_control_t task = {NULL, NULL, NULL, NULL};
+
+	task.run = run;
+	for (i = 0; i < num_nodes; i++) {
+		tasks[i].t = t;
+		tasks[i].node = first_node + i;
+		task.data = tasks + i;
+		threadpool_add_task(pool, &task, 1);
+	}
+	threadpool_drain(pool, 1);
+}
+
+/*------------------------------------------------------------------*/
+static void reduce_prime_product(struct threadpool *pool, 
+			batch_tree_t *t, tree_task_t *tasks) {
+
+	/* replace the root of the tree with prime_product
+	   modulo the root */
+
+	uint32 i;
+	relation_batch_t *rb = t->rb;
+	mpz_t *tree = rb->tree;
+
+	if (mpz_cmp(rb->prime_product, tree[1]) < 0) {
+		mpz_set(tree[1], rb->prime_product);
+		return;
+	}
+
+	/* if every piece of prime_product is larger than the 
+	   root, the pieces are reduced in parallel and the
+	   results multiplied together. Otherwise the pieces
+	   are too small to save any work */
+
+	for (i = 0; i < rb->num_prime_pieces; i++) {
+		if (mpz_cmp(rb->prime_pieces[i], tree[1]) < 0)
+			break;
+	}
+
+	if (rb->num_prime_pieces < 2 || i < rb->num_prime_pieces) {
+		mpz_tdiv_r(tree[1], rb->prime_product, tree[1]);
+		return;
+	}
+
+	t->piece_rem = (mpz_t *)xmalloc(rb->num_prime_pieces * 
+					sizeof(mpz_t));
+	for (i = 0; i < rb->num_prime_pieces; i++)
+		mpz_init(t->piece_rem[i]);
+
+	run_tree_level(pool, t, tasks, 0, rb->num_prime_pieces,
+			piece_remainder_run);
+
+	for (i = 1; i < rb->num_prime_pieces; i++) {
+		mpz_mul(t->piece_rem[0], t->piece_rem[0], t->piece_rem[i]);
+		mpz_tdiv_r(t->piece_rem[0], t->piece_rem[0], tree[1]);
+	}
+	mpz_swap(tree[1], t->piece_rem[0]);
+
+	for (i = 0; i < rb->num_prime_pieces; i++)
+		mpz_clear(t->piece_rem[i]);
+	free(t->piece_rem);
+}
+
+/*------------------------------------------------------------------*/
+static void compute_remainder_tree_parallel(relation_batch_t *rb) {
+
+	uint32 i, j;
+	uint32 num_leaves = 1 << rb->tree_depth;
+	uint32 num_nodes = 2 * num_leaves;
+	batch_tree_t t;
+	tree_task_t *tasks;
+	thread_control_t control;
+	struct threadpool *pool;
+
+	/* the nodes of the tree are kept between batches, 
+	   so that their (large) allocations can be reused */
+
+	if (rb->tree_alloc < num_nodes) {
+		rb->tree = (mpz_t *)xrealloc(rb->tree, num_nodes *
+						sizeof(mpz_t));
+		for (i = rb->tree_alloc; i < num_nodes; i++)
+			mpz_init(rb->tree[i]);
+		rb->tree_alloc = num_nodes;
+	}
+
+	/* find the relations below each node */
+
+	t.rb = rb;
+	t.num_leaves = num_leaves;
+	t.first = (uint32 *)xmalloc(num_nodes * sizeof(uint32));
+	t.last = (uint32 *)xmalloc(num_nodes * sizeof(uint32));
+	t.first[1] = 0;
+	t.last[1] = rb->num_relations - 1;
+	for (i = 1; i < num_leaves; i++) {
+		uint32 mid = (t.first[i] + t.last[i]) / 2;
+
+		t.first[2 * i] = t.first[i];
+		t.last[2 * i] = mid;
+		t.first[2 * i + 1] = mid + 1;
+		t.last[2 * i + 1] = t.last[i];
+	}
+
+	tasks = (tree_task_t *)xmalloc(MAX(num_leaves, 
+				rb->num_prime_pieces) * sizeof(tree_task_t));
+	mutex_init(&t.print_lock);
+	control.init = batch_thread_init;
+	control.shutdown = batch_thread_free;
+	control.data = &t;
+	pool = threadpool_init(rb->num_threads, num_leaves, &control);
+
+	/* build the product tree from the leaves up */
+
+	run_tree_level(pool, &t, tasks, num_leaves, num_leaves,
+			leaf_product_run);
+	for (i = num_leaves / 2; i > 0; i /= 2)
+		run_tree_level(pool, &t, tasks, i, i, node_product_run);
+
+	/* then turn it into a remainder tree from the root down */
+
+	reduce_prime_product(pool, &t, tasks);
+	for (i = 2; i < num_nodes; i *= 2)
+		run_tree_level(pool, &t, tasks, i, i, node_remainder_run);
+
+	/* finish each subtree independently */
+
+	run_tree_level(pool, &t, tasks, num_leaves, num_leaves,
+			leaf_remainder_run);
+
+	threadpool_free(pool);
+	mutex_free(&t.print_lock);
+
+	for (i = j = 0; i < (uint32)rb->num_threads; i++)
+		j += t.threads[i].rb.num_success;
+	rb->num_success += j;
+
+	free(tasks);
+	free(t.first);
+	free(t.last);
+}
+
+/*------------------------------------------------------------------*/
+static void free_background(relation_batch_t *rb);
+
+/*------------------------------------------------------------------*/
+static void alloc_batch_lists(relation_batch_t *rb) {
+
+	/* allocate lists for relations and their factors,
+	   and the working space for factoring cofactors */
+
+	rb->tinyqs_data = tinyqs_init();
+	rb->tinyecm_data = tinyecm_init();
+
+	rb->num_relations = 0;
+	rb->num_relations_alloc = 1000;
+	rb->relations = (cofactor_t *)xmalloc(rb->num_relations_alloc *
+						sizeof(cofactor_t));
+
+	rb->num_factors = 0;
+	rb->num_factors_alloc = 10000;
+	rb->factors = (uint32 *)xmalloc(rb->num_factors_alloc *
+						sizeof(uint32));
+}
+
 /*------------------------------------------------------------------*/
 void relation_batch_init(msieve_obj *obj, relation_batch_t *rb,
 			uint32 min_prime, uint32 max_prime,
 			uint32 lp_cutoff_r, uint32 lp_cutoff_a, 
-			savefile_t *savefile,
+			void *print_data,
 			print_relation_t print_relation) {
 
 	prime_sieve_t sieve;
-	uint32 num_primes, p;
+	uint32 i, num_primes, p;
+	char buf[32];
 
 	/* count the number of primes to multiply. Knowing this
 	   in advance makes the recursion a lot easier, at the cost
@@ -485,18 +1006,110 @@ void relation_batch_init(msieve_obj *obj, relation_batch_t *rb,
 	}
 	free_prime_sieve(&sieve);
 
-	/* compute the product of primes */
+	rb->obj = obj;
+
+	/* see how much parallelism to use when factoring */
+
+	rb->num_threads = 1;
+	if (get_arg_string(obj->nfs_args, "batch_threads=",
+				buf, sizeof(buf))) {
+		rb->num_threads = atoi(buf);
+		rb->num_threads = MAX(rb->num_threads, 1);
+		rb->num_threads = MIN(rb->num_threads, MAX_BATCH_THREADS);
+	}
+
+	for (rb->tree_depth = 1; (1U << rb->tree_depth) <
+				2 * rb->num_threads; rb->tree_depth++)
+		;
+	if (get_arg_string(obj->nfs_args, "batch_depth=",
+				buf, sizeof(buf))) {
+		rb->tree_depth = atoi(buf);
+		rb->tree_depth = MAX(rb->tree_depth, 1);
+		rb->tree_depth = MIN(rb->tree_depth, MAX_BATCH_DEPTH);
+	}
+	rb->tree_alloc = 0;
+	rb->tree = NULL;
+
+	rb->use_background = 1;
+	rb->background = NULL;
+	if (get_arg_string(obj->nfs_args, "batch_background=",
+				buf, sizeof(buf))) {
+		rb->use_background = atoi(buf);
+	}
+
+	rb->remainder_engine = BATCH_REMAINDER_CLASSIC;
+	rb->verify_engine = 0;
+	rb->verify = NULL;
+	if (get_arg_string(obj->nfs_args, "batch_engine=",
+				buf, sizeof(buf))) {
+		if (strcmp(buf, "scaled") == 0) {
+			rb->remainder_engine = BATCH_REMAINDER_SCALED;
+		}
+		else if (strcmp(buf, "check") == 0) {
+			rb->remainder_engine = BATCH_REMAINDER_SCALED;
+			rb->verify_engine = 1;
+		}
+		else if (strcmp(buf, "classic") != 0) {
+			logprintf(obj, "warning: unknown batch engine '%s'\n",
+					buf);
+		}
+	}
+
+	rb->cofactor_engine = BATCH_COFACTOR_ECM;
+	if (get_arg_string(obj->nfs_args, "batch_cofactor=",
+				buf, sizeof(buf))) {
+		if (strcmp(buf, "qs") == 0) {
+			rb->cofactor_engine = BATCH_COFACTOR_QS;
+		}
+		else if (strcmp(buf, "ecm") != 0) {
+			logprintf(obj, "warning: unknown cofactor engine "
+					"'%s'\n", buf);
+		}
+	}
+
+	/* compute the product of primes. With multiple threads
+	   the products of one range of primes per thread are 
+	   kept as well, to speed up the first reduction of 
+	   each batch */
 
 	logprintf(obj, "multiplying %u primes from %u to %u\n",
 			num_primes, min_prime, max_prime);
 
 	init_prime_sieve(&sieve, min_prime, max_prime);
 	mpz_init(rb->prime_product);
-	multiply_primes(0, num_primes - 2, &sieve, rb->prime_product);
+	rb->shared_primes = 0;
+	rb->num_prime_pieces = 0;
+	rb->prime_pieces = NULL;
+
+	if (rb->num_threads == 1 || num_primes < 2 * rb->num_threads) {
+		multiply_primes(0, num_primes - 2, &sieve, rb->prime_product);
+	}
+	else {
+		uint32 n = rb->num_threads;
+
+		rb->num_prime_pieces = n;
+		rb->prime_pieces = (mpz_t *)xmalloc(n * sizeof(mpz_t));
+		for (i = 0; i < n; i++) {
+			mpz_init(rb->prime_pieces[i]);
+			multiply_primes((uint64)i * (num_primes - 1) / n,
+					(uint64)(i + 1) * (num_primes - 1) / n - 1,
+					&sieve, rb->prime_pieces[i]);
+		}
+
+		mpz_set(rb->prime_product, rb->prime_pieces[0]);
+		for (i = 1; i < n; i++) {
+			mpz_mul(rb->prime_product, rb->prime_product,
+					rb->prime_pieces[i]);
+		}
+		logprintf(obj, "batch factoring uses %u threads, "
+				"tree depth %u\n", rb->num_threads, 
+				rb->tree_depth);
+	}
+	free_prime_sieve(&sieve);
 	logprintf(obj, "multiply complete, product has %u bits\n", 
 				(uint32)mpz_sizeinbase(rb->prime_product, 2));
 					
-	rb->savefile = savefile;
+	rb->print_data = print_data;
 	rb->print_relation = print_relation;
 
 	/* compute the cutoffs used by the recursion base-case. Large
@@ -523,26 +1136,49 @@ void relation_batch_init(msieve_obj *obj, relation_batch_t *rb,
 	rb->max_prime2.val[0] = max_prime;
 	mp_mul_1(&rb->max_prime2, max_prime, &rb->max_prime2);
 
-	/* allocate lists for relations and their factors */
-
 	rb->target_relations = 500000;
-	rb->num_relations = 0;
-	rb->num_relations_alloc = 1000;
-	rb->relations = (cofactor_t *)xmalloc(rb->num_relations_alloc *
-						sizeof(cofactor_t));
+	alloc_batch_lists(rb);
+}
 
-	rb->num_factors = 0;
-	rb->num_factors_alloc = 10000;
-	rb->factors = (uint32 *)xmalloc(rb->num_factors_alloc *
-						sizeof(uint32));
+/*------------------------------------------------------------------*/
+void relation_batch_init_copy(relation_batch_t *rb,
+			relation_batch_t *src,
+			void *print_data) {
+
+	/* everything but the batched relations is copied, 
+	   and the product of primes is only ever read, so 
+	   all the copies can use the same one */
+
+	*rb = *src;
+	rb->shared_primes = 1;
+	rb->tree_alloc = 0;
+	rb->tree = NULL;
+	rb->background = NULL;
+	rb->print_data = print_data;
+	alloc_batch_lists(rb);
 }
 
 /*------------------------------------------------------------------*/
 void relation_batch_free(relation_batch_t *rb) {
 
-	mpz_clear(rb->prime_product);
+	uint32 i;
+
+	if (rb->background != NULL)
+		free_background(rb);
+
+	if (!rb->shared_primes) {
+		mpz_clear(rb->prime_product);
+		for (i = 0; i < rb->num_prime_pieces; i++)
+			mpz_clear(rb->prime_pieces[i]);
+		free(rb->prime_pieces);
+	}
+	for (i = 0; i < rb->tree_alloc; i++)
+		mpz_clear(rb->tree[i]);
+	free(rb->tree);
 	free(rb->relations);
 	free(rb->factors);
+	rb->tinyqs_data = tinyqs_free(rb->tinyqs_data);
+	rb->tinyecm_data = tinyecm_free(rb->tinyecm_data);
 }
 
 /*------------------------------------------------------------------*/
@@ -622,18 +1258,290 @@ void relation_batch_add(int64 a, uint32 b,
 	}
 }
 	
+/*------------------------------------------------------------------*/
+static void run_one_batch(relation_batch_t *rb) {
+
+	/* small batches are not worth splitting up */
+
+	if (rb->num_threads > 1 && 
+	    rb->num_relations >= (16U << rb->tree_depth)) {
+		compute_remainder_tree_parallel(rb);
+	}
+	else if (rb->num_relations > 0) {
+		remainder_tree(0, rb->num_relations - 1,
+				rb, rb->prime_product);
+	}
+}
+
+/*------------------------------------------------------------------*/
+static void verify_one_batch(relation_batch_t *rb) {
+
+	/* run the classic remainder tree to find out which 
+	   relations to expect, then the scaled remainder tree,
+	   which is the one that saves its relations */
+
+	uint32 i;
+	uint32 num_diff = 0;
+	uint32 engine = rb->remainder_engine;
+
+	rb->verify = (uint8 *)xcalloc((size_t)rb->num_relations, 
+					sizeof(uint8));
+
+	rb->remainder_engine = BATCH_REMAINDER_CLASSIC;
+	rb->verify_mark = 1;
+	run_one_batch(rb);
+
+	rb->remainder_engine = engine;
+	rb->verify_mark = 2;
+	run_one_batch(rb);
+
+	for (i = 0; i < rb->num_relations; i++) {
+		uint8 v = rb->verify[i];
+
+		if (v == 1 || v == 2) {
+			cofactor_t *c = rb->relations + i;
+
+			if (num_diff++ < 10) {
+				logprintf(rb->obj, "batch engine mismatch for "
+					"relation %" PRId64 ",%u: found "
+					"only by the %s tree\n", c->a, c->b,
+					(v == 1) ? "classic" : "scaled");
+			}
+		}
+	}
+	logprintf(rb->obj, "batch engine check: %u relations, %u found, "
+				"%u mismatches\n", rb->num_relations,
+				rb->num_success, num_diff);
+
+	free(rb->verify);
+	rb->verify = NULL;
+}
+
+/*------------------------------------------------------------------*/
+/* Background batch factoring uses two sets of batch lists. The
+   caller fills one of them while a thread with its own copy of
+   the relation batch factors the other. Relations found by the
+   thread are not printed right away, since the print function
+   need not be thread-safe; they are packed into a buffer and
+   printed by the caller once the thread is finished */
+
+typedef struct {
+	relation_batch_t work;	/* the batch being factored */
+	struct threadpool *pool;
+	uint32 busy;		/* a batch has been started */
+
+	uint32 num_found;	/* relations found, and their */
+	uint32 num_words;	/* packed representation */
+	uint32 num_words_alloc;
+	uint32 *found;
+} batch_background_t;
+
+/*------------------------------------------------------------------*/
+static void save_found_relation(void *print_data, int64 a, uint32 b,
+			uint32 *factors_r, uint32 num_factors_r, 
+			uint32 lp_r[MAX_LARGE_PRIMES],
+			uint32 *factors_a, uint32 num_factors_a, 
+			uint32 lp_a[MAX_LARGE_PRIMES]) {
+
+	batch_background_t *bg = (batch_background_t *)print_data;
+	uint32 i;
+	uint32 *f;
+	uint32 num_words = 5 + num_factors_r + num_factors_a +
+				2 * MAX_LARGE_PRIMES;
+
+	if (bg->num_words + num_words > bg->num_words_alloc) {
+		bg->num_words_alloc = 2 * bg->num_words_alloc + num_words;
+		bg->found = (uint32 *)xrealloc(bg->found,
+					bg->num_words_alloc * 
+					sizeof(uint32));
+	}
+
+	f = bg->found + bg->num_words;
+	f[0] = (uint32)a;
+	f[1] = (uint32)((uint64)a >> 32);
+	f[2] = b;
+	f[3] = num_factors_r;
+	f[4] = num_factors_a;
+	f += 5;
+	for (i = 0; i < num_factors_r; i++)
+		*f++ = factors_r[i];
+	for (i = 0; i < MAX_LARGE_PRIMES; i++)
+		*f++ = lp_r[i];
+	for (i = 0; i < num_factors_a; i++)
+		*f++ = factors_a[i];
+	for (i = 0; i < MAX_LARGE_PRIMES; i++)
+		*f++ = lp_a[i];
+
+	bg->num_words += num_words;
+	bg->num_found++;
+}
+
+/*------------------------------------------------------------------*/
+static void background_run(void *data, int thread_num) {
+
+	relation_batch_t *work = (relation_batch_t *)data;
+
+	work->num_success = 0;
+	if (work->verify_engine && work->num_relations > 0)
+		verify_one_batch(work);
+	else
+		run_one_batch(work);
+
+	work->num_relations = 0;
+	work->num_factors = 0;
+}
+
+/*------------------------------------------------------------------*/
+static uint32 finish_background(relation_batch_t *rb) {
+
+	/* wait for the background thread, then print what 
+	   it found in the order it was found */
+
+	uint32 i, j;
+	uint32 num_found;
+	uint32 *f;
+	batch_background_t *bg = (batch_background_t *)rb->background;
+
+	if (bg == NULL || !bg->busy)
+		return 0;
+
+	threadpool_drain(bg->pool, 1);
+	bg->busy = 0;
+
+	for (i = j = 0; i < bg->num_found; i++) {
+		int64 a;
+		uint32 b, num_r, num_a;
+		uint32 *factors_r, *factors_a;
+		uint32 *lp_r, *lp_a;
+
+		f = bg->found + j;
+		a = (int64)((uint64)f[0] | ((uint64)f[1] << 32));
+		b = f[2];
+		num_r = f[3];
+		num_a = f[4];
+		factors_r = f + 5;
+		lp_r = factors_r + num_r;
+		factors_a = lp_r + MAX_LARGE_PRIMES;
+		lp_a = factors_a + num_a;
+
+		rb->print_relation(rb->print_data, a, b,
+				factors_r, num_r, lp_r,
+				factors_a, num_a, lp_a);
+		j += 5 + num_r + num_a + 2 * MAX_LARGE_PRIMES;
+	}
+
+	num_found = bg->num_found;
+	bg->num_found = 0;
+	bg->num_words = 0;
+	return num_found;
+}
+
+/*------------------------------------------------------------------*/
+static void free_background(relation_batch_t *rb) {
+
+	batch_background_t *bg = (batch_background_t *)rb->background;
+
+	if (bg->busy)
+		threadpool_drain(bg->pool, 1);
+	threadpool_free(bg->pool);
+
+	free(bg->work.relations);
+	free(bg->work.factors);
+	bg->work.tinyqs_data = tinyqs_free(bg->work.tinyqs_data);
+	bg->work.tinyecm_data = tinyecm_free(bg->work.tinyecm_data);
+	if (bg->work.tree_alloc > 0) {
+		uint32 i;
+		for (i = 0; i < bg->work.tree_alloc; i++)
+			mpz_clear(bg->work.tree[i]);
+		free(bg->work.tree);
+	}
+	free(bg->found);
+	free(bg);
+	rb->background = NULL;
+}
+
+/*------------------------------------------------------------------*/
+uint32 relation_batch_start(relation_batch_t *rb) {
+
+	uint32 num_found;
+	batch_background_t *bg;
+	relation_batch_t *work;
+	task_control_t task = {NULL, NULL, NULL, NULL};
+
+	if (!rb->use_background)
+		return relation_batch_run(rb);
+
+	/* the background thread and its lists are 
+	   created on first use */
+
+	if (rb->background == NULL) {
+		thread_control_t control = {NULL, NULL, NULL};
+
+		bg = (batch_background_t *)xcalloc((size_t)1, 
+					sizeof(batch_background_t));
+		bg->work = *rb;
+		bg->work.shared_primes = 1;
+		bg->work.tree_alloc = 0;
+		bg->work.tree = NULL;
+		bg->work.background = NULL;
+		bg->work.print_relation = save_found_relation;
+		bg->work.print_data = bg;
+		alloc_batch_lists(&bg->work);
+		bg->pool = threadpool_init(1, 1, &control);
+		rb->background = bg;
+	}
+	bg = (batch_background_t *)rb->background;
+	work = &bg->work;
+
+	num_found = finish_background(rb);
+
+	/* swap batch lists with the thread and start it */
+
+	{
+		cofactor_t *tmp_relations = work->relations;
+		uint32 tmp_relations_alloc = work->num_relations_alloc;
+		uint32 *tmp_factors = work->factors;
+		uint32 tmp_factors_alloc = work->num_factors_alloc;
+
+		work->relations = rb->relations;
+		work->num_relations = rb->num_relations;
+		work->num_relations_alloc = rb->num_relations_alloc;
+		work->factors = rb->factors;
+		work->num_factors = rb->num_factors;
+		work->num_factors_alloc = rb->num_factors_alloc;
+
+		rb->relations = tmp_relations;
+		rb->num_relations = 0;
+		rb->num_relations_alloc = tmp_relations_alloc;
+		rb->factors = tmp_factors;
+		rb->num_factors = 0;
+		rb->num_factors_alloc = tmp_factors_alloc;
+	}
+
+	task.run = background_run;
+	task.data = work;
+	threadpool_add_task(bg->pool, &task, 1);
+	bg->busy = 1;
+	return num_found;
+}
+
 /*------------------------------------------------------------------*/
 uint32 relation_batch_run(relation_batch_t *rb) {
 
+	/* finish the batch in the background first,
+	   so that relations are printed in order */
+
+	uint32 num_found = finish_background(rb);
+
 	rb->num_success = 0;
-	if (rb->num_relations > 0) {
-		compute_remainder_tree(0, rb->num_relations - 1,
-					rb, rb->prime_product);
-	}
+	if (rb->verify_engine && rb->num_relations > 0)
+		verify_one_batch(rb);
+	else
+		run_one_batch(rb);
 
 	/* wipe out batched relations */
 
 	rb->num_relations = 0;
 	rb->num_factors = 0;
-	return rb->num_success;
+	return rb->num_success + num_found;
 }
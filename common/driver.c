@@ -13,6 +13,7 @@ $Id$
 --------------------------------------------------------------------*/
 
 #include <common.h>
+#include <thread.h>
 
 /*--------------------------------------------------------------------*/
 msieve_obj * msieve_obj_new(char *input_integer, uint32 flags,
@@ -112,12 +113,11 @@ static uint32 msieve_run_core(msieve_obj *obj, mp_t *n,
 				n1.val[0] = i;
 				mp_divrem_1(n, i, &n2);
 			}
-			else {
-				tinyqs(n, &n1, &n2);
-			}
 		}
-		else {
-			tinyqs(n, &n1, &n2);
+		if (mp_is_zero(&n1)) {
+			void *tinyqs_data = tinyqs_init();
+			tinyqs(tinyqs_data, n, &n1, &n2);
+			tinyqs_free(tinyqs_data);
 		}
 
 		if (!mp_is_zero(&n1) && !mp_is_zero(&n2) &&
@@ -283,6 +283,172 @@ clean_up:
 				(i % 3600) / 60, i % 60);
 }
 
+/*--------------------------------------------------------------------*/
+typedef struct {
+	mutex_t mutex;
+	msieve_batch_next_t get_next;
+	msieve_batch_report_t report;
+	void *data;
+	uint32 next_index;
+	uint32 done;
+} batch_shared_t;
+
+typedef struct {
+	batch_shared_t *shared;
+	msieve_obj *obj;
+	uint32 flags;
+	char *input;
+	uint32 input_alloc;
+} batch_worker_t;
+
+static void free_factor_list(msieve_obj *obj) {
+
+	msieve_factor *curr_factor = obj->factors;
+
+	while (curr_factor != NULL) {
+		msieve_factor *next_factor = curr_factor->next;
+		free(curr_factor->number);
+		free(curr_factor);
+		curr_factor = next_factor;
+	}
+	obj->factors = NULL;
+}
+
+static void batch_worker_run(void *data, int thread_num) {
+
+	batch_worker_t *w = (batch_worker_t *)data;
+	batch_shared_t *shared = w->shared;
+	msieve_obj *obj = w->obj;
+
+	while (1) {
+		char *next = NULL;
+		uint32 index = 0;
+		uint32 len;
+
+		/* grab the next input; it must be copied before
+		   the lock is released */
+
+		mutex_lock(&shared->mutex);
+		if (!shared->done) {
+			next = shared->get_next(shared->data);
+			if (next == NULL)
+				shared->done = 1;
+			else
+				index = shared->next_index++;
+		}
+		if (next != NULL) {
+			len = strlen(next) + 1;
+			if (len > w->input_alloc) {
+				w->input_alloc = MAX(2 * w->input_alloc, len);
+				w->input = (char *)xrealloc(w->input,
+							w->input_alloc);
+			}
+			memcpy(w->input, next, len);
+		}
+		mutex_unlock(&shared->mutex);
+
+		if (next == NULL)
+			break;
+
+		/* reuse the same object for every input; only the
+		   factors and the (in-memory) savefile need to be
+		   emptied from the previous run */
+
+		free_factor_list(obj);
+		savefile_open(&obj->savefile, SAVEFILE_WRITE);
+		savefile_close(&obj->savefile);
+		obj->input = w->input;
+		obj->flags = w->flags;
+
+		msieve_run(obj);
+
+		mutex_lock(&shared->mutex);
+		shared->report(shared->data, index, obj);
+		mutex_unlock(&shared->mutex);
+	}
+}
+
+void msieve_run_batch(uint32 flags, uint32 seed1, uint32 seed2,
+			enum cpu_type cpu, 
+			uint32 cache_size1, uint32 cache_size2,
+			uint32 num_threads, const char *nfs_args,
+			msieve_batch_next_t get_next,
+			msieve_batch_report_t report,
+			void *data) {
+
+	uint32 i;
+	batch_shared_t shared;
+	batch_worker_t *workers;
+	thread_control_t control = {NULL, NULL, NULL};
+	task_control_t task = {NULL, batch_worker_run, NULL, NULL};
+	struct threadpool *pool = NULL;
+
+	if (num_threads == 0)
+		num_threads = 1;
+
+	shared.get_next = get_next;
+	shared.report = report;
+	shared.data = data;
+	shared.next_index = 0;
+	shared.done = 0;
+	mutex_init(&shared.mutex);
+
+	/* logging and NFS are turned off; each input is factored
+	   single-threaded, since with many small inputs it is
+	   much more efficient to parallelize across inputs */
+
+	flags &= (MSIEVE_FLAG_SKIP_QS_CYCLES | MSIEVE_FLAG_DEEP_ECM);
+
+	workers = (batch_worker_t *)xcalloc((size_t)num_threads,
+					sizeof(batch_worker_t));
+
+	for (i = 0; i < num_threads; i++) {
+		batch_worker_t *w = workers + i;
+		msieve_obj *obj;
+
+		obj = msieve_obj_new(NULL, flags, NULL, NULL, NULL,
+				seed1, seed2, 0, cpu, 
+				cache_size1, cache_size2, 
+				1, 0, nfs_args);
+		savefile_free(&obj->savefile);
+		savefile_init_memory(&obj->savefile);
+
+		w->shared = &shared;
+		w->obj = obj;
+		w->flags = flags;
+
+		/* give each worker its own random stream */
+
+		seed1 = get_rand(&seed1, &seed2);
+	}
+
+	/* the calling thread does the work of the last worker */
+
+	if (num_threads > 1) {
+		pool = threadpool_init(num_threads - 1, 
+					num_threads, &control);
+
+		for (i = 0; i < num_threads - 1; i++) {
+			task.data = workers + i;
+			threadpool_add_task(pool, &task, 1);
+		}
+	}
+	batch_worker_run(workers + num_threads - 1, num_threads - 1);
+
+	if (pool != NULL) {
+		threadpool_drain(pool, 1);
+		threadpool_free(pool);
+	}
+
+	for (i = 0; i < num_threads; i++) {
+		workers[i].obj->input = NULL;
+		msieve_obj_free(workers[i].obj);
+		free(workers[i].input);
+	}
+	free(workers);
+	mutex_free(&shared.mutex);
+}
+
 /*--------------------------------------------------------------------*/
 void add_next_factor(msieve_obj *obj, mp_t *n, 
 			enum msieve_factor_type factor_type) {
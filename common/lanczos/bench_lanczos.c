@@ -0,0 +1,412 @@
+/*--------------------------------------------------------------------
+This source distribution is placed in the public domain by its author,
+Jason Papadopoulos. You may use it for any purpose, free of charge,
+without having to notify anyone. I disclaim any responsibility for any
+errors.
+
+Optionally, please be nice and tell me if you find this source to be
+useful. Again optionally, if you add to the functionality present here
+please consider making those additions public too, so that others may
+benefit from your work.
+
+$Id$
+--------------------------------------------------------------------*/
+
+/* Standalone benchmark for the core of the block Lanczos code.
+   This builds a random sparse matrix that looks like one from
+   NFS filtering, packs it the same way the linear algebra does,
+   and times the matrix multiply and the vector-vector kernels
+   for any combination of thread counts and block sizes. This
+   makes it possible to compare machines and builds without
+   running a real factorization */
+
+#include "lanczos.h"
+
+#define MAX_LIST 16
+
+typedef struct {
+	uint32 ncols;
+	uint32 nrows;
+	uint32 num_dense_rows;
+	uint32 sparse_weight;
+	uint64 nonzeros;
+	la_col_t *cols;
+} bench_matrix_t;
+
+/*--------------------------------------------------------------------*/
+static int compare_uint32(const void *x, const void *y) {
+	uint32 *xx = (uint32 *)x;
+	uint32 *yy = (uint32 *)y;
+	if (*xx > *yy)
+		return 1;
+	if (*xx < *yy)
+		return -1;
+	return 0;
+}
+
+/*--------------------------------------------------------------------*/
+static void make_matrix(bench_matrix_t *m, uint32 *seed1, uint32 *seed2) {
+
+	/* NFS matrices have rows sorted by decreasing weight,
+	   and the weight of a row is roughly proportional to
+	   1/p for the prime p it corresponds to. Pick row indices
+	   log-uniformly from the sparse rows, which gives row
+	   weights that decay like 1/(r + ROW_OFFSET). The dense
+	   rows, which hold the quadratic characters and the
+	   heaviest ideals in a real matrix, are half full */
+
+	#define ROW_OFFSET 64.0
+
+	uint32 i, j, k;
+	uint32 ncols = m->ncols;
+	uint32 num_dense = m->num_dense_rows;
+	uint32 dense_words = (num_dense + 31) / 32;
+	uint32 sparse_rows = m->nrows - num_dense;
+	double log_range = log((sparse_rows + ROW_OFFSET) / ROW_OFFSET);
+	uint32 max_weight = 2 * m->sparse_weight;
+	uint32 *rows = (uint32 *)xmalloc(max_weight * sizeof(uint32));
+
+	m->cols = (la_col_t *)xcalloc((size_t)ncols, sizeof(la_col_t));
+	m->nonzeros = 0;
+
+	for (i = 0; i < ncols; i++) {
+		la_col_t *c = m->cols + i;
+		uint32 weight = m->sparse_weight / 2 +
+				get_rand(seed1, seed2) % m->sparse_weight;
+
+		for (j = 0; j < weight; j++) {
+			double u = (double)get_rand(seed1, seed2) / 4294967296.0;
+			uint32 r = (uint32)(ROW_OFFSET *
+					(exp(u * log_range) - 1.0));
+
+			rows[j] = num_dense + MIN(r, sparse_rows - 1);
+		}
+
+		qsort(rows, (size_t)weight, sizeof(uint32), compare_uint32);
+		for (j = k = 1; j < weight; j++) {
+			if (rows[j] != rows[k - 1])
+				rows[k++] = rows[j];
+		}
+
+		c->weight = k;
+		c->data = (uint32 *)xmalloc((k + dense_words) *
+						sizeof(uint32));
+		memcpy(c->data, rows, k * sizeof(uint32));
+		m->nonzeros += k;
+
+		for (j = 0; j < dense_words; j++) {
+			uint32 word = get_rand(seed1, seed2);
+
+			if (j == dense_words - 1 && num_dense % 32)
+				word &= (1 << (num_dense % 32)) - 1;
+			c->data[k + j] = word;
+			for (; word; word &= word - 1)
+				m->nonzeros++;
+		}
+	}
+
+	free(rows);
+}
+
+/*--------------------------------------------------------------------*/
+static la_col_t * copy_matrix(bench_matrix_t *m) {
+
+	/* packing the matrix destroys the columns */
+
+	uint32 i;
+	uint32 dense_words = (m->num_dense_rows + 31) / 32;
+	la_col_t *cols = (la_col_t *)xmalloc(m->ncols * sizeof(la_col_t));
+
+	for (i = 0; i < m->ncols; i++) {
+		la_col_t *src = m->cols + i;
+		size_t size = (src->weight + dense_words) * sizeof(uint32);
+
+		cols[i] = *src;
+		cols[i].data = (uint32 *)xmalloc(size);
+		memcpy(cols[i].data, src->data, size);
+	}
+	return cols;
+}
+
+/*--------------------------------------------------------------------*/
+static size_t packed_matrix_bytes(packed_matrix_t *p) {
+
+	/* the number of bytes of matrix data read by one
+	   matrix multiply (not counting the vectors) */
+
+	uint32 i;
+	size_t bytes;
+	uint32 num_blocks = p->num_block_rows * p->num_block_cols;
+
+	bytes = p->ncols * sizeof(uint64) * ((p->num_dense_rows + 63) / 64);
+
+	for (i = 0; i < num_blocks; i++) {
+		packed_block_t *b = p->blocks + i;
+
+		if (i < p->num_block_cols)
+			bytes += (b->num_entries + 2 * p->first_block_size) *
+					sizeof(uint16);
+		else
+			bytes += b->num_entries * sizeof(entry_idx_t);
+	}
+	return bytes;
+}
+
+/*--------------------------------------------------------------------*/
+static void bench_matmul(msieve_obj *obj, bench_matrix_t *m,
+			uint32 num_threads, uint32 block_size,
+			uint32 superblock_size, uint32 reps) {
+
+	uint32 i;
+	char args[64];
+	packed_matrix_t packed_matrix;
+	la_col_t *cols = copy_matrix(m);
+	uint32 n = MAX(m->nrows, m->ncols);
+	uint64 *x = (uint64 *)xmalloc(n * sizeof(uint64));
+	uint64 *scratch = (uint64 *)xmalloc(n * sizeof(uint64));
+	double start, elapsed;
+	size_t bytes;
+
+	/* packed_matrix_init picks up the geometry from the
+	   same configuration string the linear algebra uses */
+
+	sprintf(args, "la_block=%u la_superblock=%u",
+			block_size, superblock_size);
+	obj->nfs_args = args;
+	obj->num_threads = num_threads;
+
+	memset(&packed_matrix, 0, sizeof(packed_matrix_t));
+	packed_matrix_init(obj, &packed_matrix, cols,
+			m->nrows, m->nrows, 0, m->ncols, m->ncols, 0,
+			m->num_dense_rows, NUM_MEDIUM_ROWS);
+
+	for (i = 0; i < n; i++) {
+		x[i] = (uint64)get_rand(&obj->seed1, &obj->seed2) << 32 |
+			get_rand(&obj->seed1, &obj->seed2);
+	}
+
+	/* warm up, then time */
+
+	mul_sym_NxN_Nx64(&packed_matrix, x, x, scratch);
+
+	start = get_wall_time();
+	for (i = 0; i < reps; i++)
+		mul_sym_NxN_Nx64(&packed_matrix, x, x, scratch);
+	elapsed = (get_wall_time() - start) / reps;
+
+	/* each multiply by A and by A transpose reads the
+	   whole matrix, reads x and writes b */
+
+	bytes = 2 * (packed_matrix_bytes(&packed_matrix) +
+			(m->nrows + m->ncols) * sizeof(uint64));
+
+	printf("threads %2u block %6u superblock %8u: "
+		"%9.3f ms %7.3f ns/nonzero %7.2f GB/s\n",
+		packed_matrix.num_threads, block_size, superblock_size,
+		1000 * elapsed, 1e9 * elapsed / (2.0 * m->nonzeros),
+		bytes / elapsed / 1e9);
+
+	obj->nfs_args = NULL;
+	packed_matrix_free(&packed_matrix);
+	free(cols);
+	free(x);
+	free(scratch);
+}
+
+/*--------------------------------------------------------------------*/
+static void bench_vv(msieve_obj *obj, bench_matrix_t *m,
+			uint32 num_threads, uint32 reps) {
+
+	/* time the two vector-vector kernels with the
+	   thread pool of a packed matrix */
+
+	uint32 i;
+	packed_matrix_t packed_matrix;
+	la_col_t *cols = copy_matrix(m);
+	uint32 n = m->ncols;
+	uint64 *x = (uint64 *)xmalloc(n * sizeof(uint64));
+	uint64 *y = (uint64 *)xmalloc(n * sizeof(uint64));
+	uint64 xy[64];
+	double start, t_inner, t_outer;
+
+	/* the kernels only need the thread pool of the packed
+	   matrix, but packing is the only way to get one that
+	   matches what the linear algebra would use */
+
+	obj->num_threads = num_threads;
+
+	memset(&packed_matrix, 0, sizeof(packed_matrix_t));
+	packed_matrix_init(obj, &packed_matrix, cols,
+			m->nrows, m->nrows, 0, m->ncols, m->ncols, 0,
+			m->num_dense_rows, NUM_MEDIUM_ROWS);
+
+	for (i = 0; i < n; i++) {
+		x[i] = (uint64)get_rand(&obj->seed1, &obj->seed2) << 32 |
+			get_rand(&obj->seed1, &obj->seed2);
+		y[i] = (uint64)get_rand(&obj->seed1, &obj->seed2) << 32 |
+			get_rand(&obj->seed1, &obj->seed2);
+	}
+
+	tmul_64xN_Nx64(&packed_matrix, x, y, xy, n);
+	start = get_wall_time();
+	for (i = 0; i < reps; i++)
+		tmul_64xN_Nx64(&packed_matrix, x, y, xy, n);
+	t_inner = (get_wall_time() - start) / reps;
+
+	tmul_Nx64_64x64_acc(&packed_matrix, x, xy, y, n);
+	start = get_wall_time();
+	for (i = 0; i < reps; i++)
+		tmul_Nx64_64x64_acc(&packed_matrix, x, xy, y, n);
+	t_outer = (get_wall_time() - start) / reps;
+
+	/* the first kernel reads two vectors, the
+	   second reads two and writes one */
+
+	printf("threads %2u: 64xN*Nx64 %8.3f ms %7.2f GB/s, "
+		"Nx64*64x64 %8.3f ms %7.2f GB/s\n",
+		packed_matrix.num_threads,
+		1000 * t_inner, 2.0 * n * sizeof(uint64) / t_inner / 1e9,
+		1000 * t_outer, 3.0 * n * sizeof(uint64) / t_outer / 1e9);
+
+	packed_matrix_free(&packed_matrix);
+	free(cols);
+	free(x);
+	free(y);
+}
+
+/*--------------------------------------------------------------------*/
+static uint32 parse_list(char *arg, uint32 *list) {
+
+	/* read a comma-separated list of numbers */
+
+	uint32 n = 0;
+
+	while (n < MAX_LIST) {
+		list[n++] = strtoul(arg, &arg, 10);
+		if (*arg != ',')
+			break;
+		arg++;
+	}
+	return n;
+}
+
+/*--------------------------------------------------------------------*/
+static void print_usage(char *progname) {
+
+	printf("usage: %s [options]\n"
+	     "options:\n"
+	     "   -n <num>    number of matrix columns (default 1000000)\n"
+	     "   -w <num>    average nonzeros per column in the sparse part\n"
+	     "               (default 25)\n"
+	     "   -d <num>    number of dense rows, rounded up to a multiple\n"
+	     "               of 64 (default 64)\n"
+	     "   -t <list>   comma-separated thread counts (default 1)\n"
+	     "   -b <list>   comma-separated block sizes (default 8192)\n"
+	     "   -s <list>   comma-separated superblock sizes (default\n"
+	     "               3/4 of the largest cache)\n"
+	     "   -r <num>    multiplies to time for each case (default 10)\n",
+	     progname);
+}
+
+/*--------------------------------------------------------------------*/
+int main(int argc, char **argv) {
+
+	uint32 i, j, k;
+	uint32 seed1 = 0x12345678;
+	uint32 seed2 = 0x9abcdef0;
+	uint32 cache_size1, cache_size2;
+	uint32 threads[MAX_LIST] = {1};
+	uint32 blocks[MAX_LIST] = {8192};
+	uint32 superblocks[MAX_LIST];
+	uint32 num_threads = 1;
+	uint32 num_blocks = 1;
+	uint32 num_superblocks = 0;
+	uint32 reps = 10;
+	bench_matrix_t m;
+	msieve_obj *obj;
+	double start;
+
+	get_cache_sizes(&cache_size1, &cache_size2);
+
+	m.ncols = 1000000;
+	m.sparse_weight = 25;
+	m.num_dense_rows = 64;
+
+	for (i = 1; i < (uint32)argc; i++) {
+		if (argv[i][0] != '-' || argv[i][1] == 0 ||
+		    argv[i][2] != 0 || i + 1 >= (uint32)argc) {
+			print_usage(argv[0]);
+			return -1;
+		}
+
+		switch (argv[i][1]) {
+		case 'n':
+			m.ncols = strtoul(argv[++i], NULL, 10);
+			break;
+		case 'w':
+			m.sparse_weight = strtoul(argv[++i], NULL, 10);
+			break;
+		case 'd':
+			m.num_dense_rows = strtoul(argv[++i], NULL, 10);
+			break;
+		case 't':
+			num_threads = parse_list(argv[++i], threads);
+			break;
+		case 'b':
+			num_blocks = parse_list(argv[++i], blocks);
+			break;
+		case 's':
+			num_superblocks = parse_list(argv[++i], superblocks);
+			break;
+		case 'r':
+			reps = strtoul(argv[++i], NULL, 10);
+			break;
+		default:
+			print_usage(argv[0]);
+			return -1;
+		}
+	}
+
+	if (num_superblocks == 0) {
+		superblocks[0] = 3 * cache_size2 / (4 * sizeof(uint64));
+		num_superblocks = 1;
+	}
+
+	m.num_dense_rows = 64 * ((m.num_dense_rows + 63) / 64);
+	m.nrows = m.ncols - 64;
+	if (m.ncols <= MIN_NROWS_TO_PACK + m.num_dense_rows + 64 ||
+	    m.sparse_weight < 2 || reps == 0) {
+		printf("error: need more than %u columns, a sparse "
+			"weight of at least 2 and at least one multiply\n",
+			MIN_NROWS_TO_PACK + m.num_dense_rows + 64);
+		return -1;
+	}
+
+	obj = msieve_obj_new("1", 0, NULL, NULL, NULL, seed1, seed2, 0,
+			get_cpu_type(), cache_size1, cache_size2, 1, 0, NULL);
+
+	start = get_wall_time();
+	make_matrix(&m, &seed1, &seed2);
+	printf("generated %u x %u matrix with %u dense rows and "
+		"%" PRIu64 " nonzeros in %.1f seconds\n",
+		m.nrows, m.ncols, m.num_dense_rows, m.nonzeros,
+		get_wall_time() - start);
+
+	for (i = 0; i < num_threads; i++) {
+		for (j = 0; j < num_blocks; j++) {
+			for (k = 0; k < num_superblocks; k++) {
+				bench_matmul(obj, &m, threads[i], blocks[j],
+						superblocks[k], reps);
+			}
+		}
+	}
+
+	for (i = 0; i < num_threads; i++)
+		bench_vv(obj, &m, threads[i], reps);
+
+	for (i = 0; i < m.ncols; i++)
+		free(m.cols[i].data);
+	free(m.cols);
+	msieve_obj_free(obj);
+	return 0;
+}
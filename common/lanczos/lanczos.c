@@ -39,6 +39,50 @@ static const uint64 bitmask[64] = {
 	BIT(56), BIT(57), BIT(58), BIT(59), BIT(60), BIT(61), BIT(62), BIT(63),
 };
 
+/*-------------------------------------------------------------------*/
+#ifdef HAS_GFNI_AVX512
+static uint32 widen_dense_rows(uint32 dense_rows, 
+				uint32 ncols, la_col_t *cols) {
+
+	/* the sparse rows of the matrix are sorted in order of
+	   decreasing weight, so the rows immediately after the
+	   dense rows are the heaviest ones. Count the nonzeros
+	   in the next few blocks of 64 rows, and move blocks into
+	   the dense part of the matrix until one is too sparse 
+	   for that to be worthwhile */
+
+	uint32 i, j;
+	uint32 max_blocks = (MAX_DENSE_ROWS - dense_rows) / 64;
+	uint64 counts[MAX_DENSE_ROWS / 64];
+
+	memset(counts, 0, sizeof(counts));
+
+	for (i = 0; i < ncols; i++) {
+		uint32 curr_weight = cols[i].weight;
+		uint32 *curr_row = cols[i].data;
+
+		for (j = 0; j < curr_weight; j++) {
+			uint32 block;
+
+			if (curr_row[j] < dense_rows)
+				continue;
+
+			block = (curr_row[j] - dense_rows) / 64;
+			if (block >= max_blocks)
+				break;
+			counts[block]++;
+		}
+	}
+
+	for (i = 0; i < max_blocks; i++) {
+		if (counts[i] < (uint64)ncols * DENSE_BLOCK_MIN_WEIGHT)
+			break;
+	}
+
+	return dense_rows + 64 * i;
+}
+#endif
+
 /*-------------------------------------------------------------------*/
 static uint32 form_post_lanczos_matrix(msieve_obj *obj, uint32 *nrows, 
 				uint32 *dense_rows_out, 
@@ -101,6 +145,10 @@ static uint32 form_post_lanczos_matrix(msieve_obj *obj, uint32 *nrows,
 
 	new_dense_rows = MAX(num_dense_rows, POST_LANCZOS_ROWS);
 	new_dense_rows += 64 - (new_dense_rows - POST_LANCZOS_ROWS) % 64;
+#ifdef HAS_GFNI_AVX512
+	if (*nrows >= MIN_NROWS_TO_PACK)
+		new_dense_rows = widen_dense_rows(new_dense_rows, ncols, cols);
+#endif
 	new_dense_row_words = (new_dense_rows + 31) / 32;
 	final_dense_row_words = (new_dense_rows - POST_LANCZOS_ROWS) / 32;
 
@@ -368,9 +416,10 @@ static void transpose_vector(uint32 ncols, uint64 *v, uint64 **trans) {
 }
 
 /*-----------------------------------------------------------------------*/
-static uint32 combine_cols(uint32 ncols, 
+static uint32 combine_cols(msieve_obj *obj, uint32 ncols, 
 			uint64 *x, uint64 *v, 
-			uint64 *ax, uint64 *av) {
+			uint64 *ax, uint64 *av,
+			uint32 randomize) {
 
 	/* Once the block Lanczos iteration has finished, 
 	   x[] and v[] will contain mostly nullspace vectors
@@ -384,9 +433,14 @@ static uint32 combine_cols(uint32 ncols,
 	   rored in [x | v] and the columns that are independent
 	   are skipped. Finally, the dependent columns are copied
 	   back into x[] and represent the nullspace vector output
-	   of the block Lanczos code. */
+	   of the block Lanczos code. 
+	   
+	   If randomize is nonzero, the nullspace vectors found
+	   are reduced to a linearly independent set, and random
+	   combinations of that set are returned instead */
 
 	uint32 i, j, k, bitpos, col, col_words;
+	uint32 num_deps;
 	uint64 mask;
 	uint64 *matrix[128], *amatrix[128], *tmp;
 
@@ -454,8 +508,72 @@ static uint32 combine_cols(uint32 ncols,
 		i++;
 	}
 
-	/* transpose rows i to 64 back into x[]. Pack the
-	   dependencies into the low-order bits of x[] */
+	num_deps = (i > 64) ? 0 : 64 - i;
+
+	if (randomize) {
+		/* rows i to 127 of matrix[][] are all in the nullspace
+		   but some of them may be zero, or combinations of the
+		   others. Eliminate again, this time on matrix[][], to
+		   leave a basis in rows i to num_basis-1 */
+
+		uint32 num_basis = i;
+
+		for (bitpos = 0; num_basis < 128 && bitpos < ncols; bitpos++) {
+
+			mask = bitmask[bitpos % 64];
+			col = bitpos / 64;
+			for (j = num_basis; j < 128; j++) {
+				if (matrix[j][col] & mask) {
+					tmp = matrix[num_basis];
+					matrix[num_basis] = matrix[j];
+					matrix[j] = tmp;
+					break;
+				}
+			}
+			if (j == 128)
+				continue;
+
+			for (j++; j < 128; j++) {
+				if (matrix[j][col] & mask) {
+					for (k = 0; k < col_words; k++) {
+						matrix[j][k] ^= 
+							matrix[num_basis][k];
+					}
+				}
+			}
+			num_basis++;
+		}
+
+		/* randomly permute the basis, then add to each 
+		   vector a random subset of the vectors before it.
+		   The result is still a basis */
+
+		for (j = num_basis - 1; j > i; j--) {
+			k = i + get_rand(&obj->seed1, &obj->seed2) % 
+							(j - i + 1);
+			tmp = matrix[j];
+			matrix[j] = matrix[k];
+			matrix[k] = tmp;
+		}
+
+		for (j = i + 1; j < num_basis; j++) {
+			uint32 m;
+
+			for (m = i; m < j; m++) {
+				if (!(get_rand(&obj->seed1, &obj->seed2) & 1))
+					continue;
+
+				for (k = 0; k < col_words; k++)
+					matrix[j][k] ^= matrix[m][k];
+			}
+		}
+
+		num_deps = MIN(num_basis - i, 64);
+	}
+
+	/* transpose the num_deps rows starting at row i back 
+	   into x[]. Pack the dependencies into the low-order 
+	   bits of x[] */
 
 	for (j = 0; j < ncols; j++) {
 		uint64 word = 0;
@@ -463,9 +581,9 @@ static uint32 combine_cols(uint32 ncols,
 		col = j / 64;
 		mask = bitmask[j % 64];
 
-		for (k = i; k < 64; k++) {
-			if (matrix[k][col] & mask)
-				word |= bitmask[k - i];
+		for (k = 0; k < num_deps; k++) {
+			if (matrix[i + k][col] & mask)
+				word |= bitmask[k];
 		}
 		x[j] = word;
 	}
@@ -475,9 +593,99 @@ static uint32 combine_cols(uint32 ncols,
 		free(amatrix[j]);
 	}
 
-	if (i > 64)
-		return 0;
-	return 64 - i;
+	return num_deps;
+}
+
+/*-----------------------------------------------------------------------*/
+/* When the iteration finishes, the NFS linear algebra saves the
+   vectors passed to combine_cols to disk. If none of the resulting 
+   dependencies work in the square root, a different set can be 
+   generated from the saved vectors without running the iteration 
+   again. The file is never deleted, since it is only useful after
+   the square root fails */
+
+static void dump_nullspace_state(msieve_obj *obj, uint32 max_n,
+			uint64 *x, uint64 *v, uint64 *ax, uint64 *av) {
+
+	char buf[256];
+	FILE *fp;
+	uint32 status = 1;
+
+	sprintf(buf, "%s.lvec", obj->savefile.name);
+	fp = fopen(buf, "wb");
+	if (fp == NULL) {
+		logprintf(obj, "warning: cannot save nullspace vectors\n");
+		return;
+	}
+
+	status &= (fwrite(&max_n, sizeof(uint32), (size_t)1, fp) == 1);
+	status &= (fwrite(x, sizeof(uint64), (size_t)max_n, fp) == max_n);
+	status &= (fwrite(v, sizeof(uint64), (size_t)max_n, fp) == max_n);
+	status &= (fwrite(ax, sizeof(uint64), (size_t)max_n, fp) == max_n);
+	status &= (fwrite(av, sizeof(uint64), (size_t)max_n, fp) == max_n);
+	fclose(fp);
+
+	if (status == 0) {
+		logprintf(obj, "warning: cannot save nullspace vectors\n");
+		remove(buf);
+	}
+}
+
+/*-----------------------------------------------------------------------*/
+uint64 * block_lanczos_new_deps(msieve_obj *obj, uint32 *ncols_out,
+				uint32 *num_deps_found) {
+
+	uint32 max_n;
+	uint32 status = 1;
+	uint64 *x, *v, *ax, *av;
+	char buf[256];
+	FILE *fp;
+
+	sprintf(buf, "%s.lvec", obj->savefile.name);
+	fp = fopen(buf, "rb");
+	if (fp == NULL) {
+		logprintf(obj, "error: cannot open nullspace vector file\n");
+		exit(-1);
+	}
+
+	if (fread(&max_n, sizeof(uint32), (size_t)1, fp) != 1) {
+		logprintf(obj, "error: nullspace vector file is corrupt\n");
+		exit(-1);
+	}
+
+	x = (uint64 *)xmalloc(max_n * sizeof(uint64));
+	v = (uint64 *)xmalloc(max_n * sizeof(uint64));
+	ax = (uint64 *)xmalloc(max_n * sizeof(uint64));
+	av = (uint64 *)xmalloc(max_n * sizeof(uint64));
+
+	status &= (fread(x, sizeof(uint64), (size_t)max_n, fp) == max_n);
+	status &= (fread(v, sizeof(uint64), (size_t)max_n, fp) == max_n);
+	status &= (fread(ax, sizeof(uint64), (size_t)max_n, fp) == max_n);
+	status &= (fread(av, sizeof(uint64), (size_t)max_n, fp) == max_n);
+	fclose(fp);
+
+	if (status == 0) {
+		logprintf(obj, "error: nullspace vector file is corrupt\n");
+		exit(-1);
+	}
+
+	logprintf(obj, "generating new dependencies for %u columns\n",
+			max_n);
+
+	*num_deps_found = combine_cols(obj, max_n, x, v, ax, av, 1);
+	free(v);
+	free(ax);
+	free(av);
+
+	if (*num_deps_found == 0)
+		logprintf(obj, "lanczos error: only trivial "
+				"dependencies found\n");
+	else
+		logprintf(obj, "recovered %u nontrivial dependencies\n", 
+				*num_deps_found);
+
+	*ncols_out = max_n;
+	return x;
 }
 
 /*-----------------------------------------------------------------------*/
@@ -492,6 +700,7 @@ static void dump_lanczos_state(msieve_obj *obj,
 	char buf_old[256];
 	FILE *dump_fp;
 	uint32 status = 1;
+	uint32 geometry[3];
 
 #ifdef HAVE_MPI
     
@@ -608,6 +817,13 @@ static void dump_lanczos_state(msieve_obj *obj,
 	status &= (fwrite(v[1], sizeof(uint64), (size_t)max_n, dump_fp)==max_n);
 	status &= (fwrite(v[2], sizeof(uint64), (size_t)max_n, dump_fp)==max_n);
 	status &= (fwrite(v0, sizeof(uint64), (size_t)max_n, dump_fp)==max_n);
+
+	/* record the matrix geometry so a restart can reuse it */
+
+	geometry[0] = packed_matrix->block_size;
+	geometry[1] = packed_matrix->superblock_size;
+	geometry[2] = CHECKPOINT_GEOMETRY_MAGIC;
+	status &= (fwrite(geometry, sizeof(uint32), (size_t)3, dump_fp) == 3);
 	fclose(dump_fp);
 
 	/* only delete an old checkpoint file if the current 
@@ -850,7 +1066,8 @@ static uint64 * block_lanczos_core(msieve_obj *obj,
 				packed_matrix_t *packed_matrix,
 				uint32 *num_deps_found,
 				uint64 *post_lanczos_matrix,
-				uint32 dump_interval) {
+				uint32 dump_interval,
+				uint32 save_vectors) {
 	
 	/* Solve Bx = 0 for some nonzero x; the computed
 	   solution, containing up to 64 of these nullspace
@@ -1482,7 +1699,11 @@ static uint64 * block_lanczos_core(msieve_obj *obj,
 		}
 	}
 
-	*num_deps_found = combine_cols(max_n, x, v[0], v[1], v[2]);
+	if (save_vectors)
+		dump_nullspace_state(obj, max_n, x, v[0], v[1], v[2]);
+
+	*num_deps_found = combine_cols(obj, max_n, x, v[0], 
+					v[1], v[2], 0);
 	MPI_NODE_0_END
 
 	free(scratch);
@@ -1504,9 +1725,13 @@ uint64 * block_lanczos(msieve_obj *obj,
 			uint32 nrows, uint32 max_nrows, uint32 start_row,
 			uint32 num_dense_rows, 
 			uint32 ncols, uint32 max_ncols, uint32 start_col,
-			la_col_t *B, uint32 *num_deps_found) {
+			la_col_t *B, uint32 *num_deps_found,
+			uint32 save_vectors) {
 	
-	/* External interface to the linear algebra */
+	/* External interface to the linear algebra. If
+	   save_vectors is nonzero, the vectors that produce the
+	   dependencies are saved to <savefile>.lvec when the 
+	   iteration finishes */
 
 	uint64 *post_lanczos_matrix = NULL;
 	uint64 *dependencies;
@@ -1656,7 +1881,8 @@ uint64 * block_lanczos(msieve_obj *obj,
 		dependencies = block_lanczos_core(obj, &packed_matrix,
 						num_deps_found,
 						post_lanczos_matrix,
-						dump_interval);
+						dump_interval,
+						save_vectors);
 
 		if (obj->flags & MSIEVE_FLAG_STOP_SIEVING)
 			break;
@@ -51,6 +51,31 @@ extern "C" {
 
 #define NUM_MEDIUM_ROWS 3000
 
+/* the dense rows of the matrix, along with the vector-vector
+   operations, use kernels that multiply by a 64x64 matrix.
+   When the compiler targets a CPU with the GFNI and AVX512
+   VBMI instructions, bit-sliced versions of these kernels
+   are built, which treat the 64x64 matrix as an 8x8 array of
+   8x8 bit matrices and multiply eight of them at once with
+   a single GF(2) affine transform instruction. These are
+   several times faster than the table-driven versions */
+
+#if defined(__GFNI__) && defined(__AVX512F__) && defined(__AVX512VBMI__)
+#define HAS_GFNI_AVX512
+#endif
+
+/* the number of dense rows is limited by the size of the
+   bitfield used to pack them */
+
+#define MAX_DENSE_ROWS (32 * MAX_MP_WORDS)
+
+/* with the bit-sliced kernels, 64 dense rows cost about as
+   much as a few sparse nonzeros per matrix column, so a block
+   of 64 sparse rows is moved into the dense part of the matrix
+   when it contains at least this many nonzeros per column */
+
+#define DENSE_BLOCK_MIN_WEIGHT 2
+
 /* structure representing a nonzero element of
    the matrix after packing into block format. 
    The two fields are the row and column offsets
@@ -163,6 +188,12 @@ typedef struct packed_matrix_t {
 
 } packed_matrix_t;
 
+/* Lanczos checkpoint files end with the block size, the
+   superblock size (in blocks) and this marker, so that a
+   restarted run packs the matrix the same way */
+
+#define CHECKPOINT_GEOMETRY_MAGIC 0x67656f6d
+
 void packed_matrix_init(msieve_obj *obj, 
 			packed_matrix_t *packed_matrix,
 			la_col_t *A, 
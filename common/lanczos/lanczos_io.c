@@ -43,7 +43,7 @@ static mat_idx_t * mat_idx_init(uint64 num_sparse) {
 	return m;
 }
 
-static void mat_idx_update(mat_idx_t *m, FILE *mat_fp,
+static void mat_idx_update(mat_idx_t *m, uint64 stream_offset,
 			uint32 curr_sparse) {
 
 	uint32 i;
@@ -55,7 +55,7 @@ static void mat_idx_update(mat_idx_t *m, FILE *mat_fp,
 			mat_block_t *curr_block = curr_m->idx_entries +
 							curr_m->curr_mpi++;
 			curr_block->col_start = curr_m->curr_col;
-			curr_block->mat_file_offset = ftello(mat_fp);
+			curr_block->mat_file_offset = stream_offset;
 
 			curr_m->target_sparse = curr_m->curr_sparse +
 						curr_m->sparse_per_proc;
@@ -140,6 +140,137 @@ static void find_submatrix_bounds(msieve_obj *obj, uint32 *ncols,
 
 #endif
 
+/*--------------------------------------------------------------------*/
+/* The matrix file written by dump_matrix is split into chunks
+   of consecutive columns. Each chunk stores its columns in the
+   same layout as the original matrix format (a word with the
+   number of sparse entries, the sparse row indices, then the
+   words for the dense rows) and is compressed independently
+   of all the others. An index at the end of the file gives the
+   first column and file offset of every chunk, so a reader can
+   seek straight to the columns it needs, and several threads
+   or MPI processes can each decompress their own part of the
+   matrix in parallel.
+
+   The original format had no header and started with the 
+   number of rows; the first word of a chunked file is a magic 
+   number that can never be a valid row count. read_matrix 
+   accepts both formats, since the initial matrix build still 
+   writes the original format */
+
+#define MAT_CHUNK_MAGIC 0xfffffff1
+
+/* target number of 32-bit words in one uncompressed chunk */
+
+#define MAT_CHUNK_WORDS 1000000
+
+typedef struct {
+	uint32 start_col;
+	uint32 num_cols;
+	uint32 num_words;    /* uncompressed size, in 32-bit words */
+	uint32 disk_bytes;   /* size on disk; if this is 4*num_words
+				then the chunk is not compressed */
+	uint64 file_offset;
+} mat_chunk_t;
+
+typedef struct {
+	FILE *fp;
+	uint32 num_chunks;
+	uint32 num_chunks_alloc;
+	mat_chunk_t *chunks;
+
+	uint32 curr_col;
+	uint32 num_cols;
+	uint32 num_words;
+	uint32 *buf;
+	uint8 *packed;
+	size_t packed_alloc;
+} mat_writer_t;
+
+static void mat_writer_init(mat_writer_t *w, FILE *fp) {
+
+	memset(w, 0, sizeof(mat_writer_t));
+	w->fp = fp;
+	w->num_chunks_alloc = 100;
+	w->chunks = (mat_chunk_t *)xmalloc(w->num_chunks_alloc *
+					sizeof(mat_chunk_t));
+	w->buf = (uint32 *)xmalloc((MAT_CHUNK_WORDS + MAX_COL_IDEALS + 1) *
+					sizeof(uint32));
+#ifndef NO_ZLIB
+	w->packed_alloc = compressBound((uLong)((MAT_CHUNK_WORDS + 
+					MAX_COL_IDEALS + 1) * sizeof(uint32)));
+	w->packed = (uint8 *)xmalloc(w->packed_alloc);
+#endif
+}
+
+static void mat_writer_flush(msieve_obj *obj, mat_writer_t *w) {
+
+	mat_chunk_t *c;
+	uint8 *data = (uint8 *)w->buf;
+	size_t bytes = w->num_words * sizeof(uint32);
+
+	if (w->num_cols == 0)
+		return;
+
+	if (w->num_chunks == w->num_chunks_alloc) {
+		w->num_chunks_alloc *= 2;
+		w->chunks = (mat_chunk_t *)xrealloc(w->chunks,
+					w->num_chunks_alloc *
+					sizeof(mat_chunk_t));
+	}
+	c = w->chunks + w->num_chunks++;
+	c->start_col = w->curr_col - w->num_cols;
+	c->num_cols = w->num_cols;
+	c->num_words = w->num_words;
+
+#ifndef NO_ZLIB
+	{
+		/* only keep the compressed version if it is smaller */
+
+		uLongf packed_bytes = (uLongf)w->packed_alloc;
+
+		if (compress2(w->packed, &packed_bytes, data, 
+				(uLong)bytes, Z_BEST_SPEED) == Z_OK &&
+		    packed_bytes < bytes) {
+			data = w->packed;
+			bytes = packed_bytes;
+		}
+	}
+#endif
+	c->disk_bytes = (uint32)bytes;
+	c->file_offset = (uint64)ftello(w->fp);
+
+	if (fwrite(data, (size_t)1, bytes, w->fp) != bytes) {
+		logprintf(obj, "error: matrix chunk write failed\n");
+		exit(-1);
+	}
+
+	w->num_cols = 0;
+	w->num_words = 0;
+}
+
+static void mat_writer_add(msieve_obj *obj, mat_writer_t *w,
+			la_col_t *c, uint32 dense_row_words) {
+
+	uint32 num = c->weight + dense_row_words;
+
+	w->buf[w->num_words] = c->weight;
+	memcpy(w->buf + w->num_words + 1, c->data, num * sizeof(uint32));
+	w->num_words += num + 1;
+	w->num_cols++;
+	w->curr_col++;
+
+	if (w->num_words >= MAT_CHUNK_WORDS)
+		mat_writer_flush(obj, w);
+}
+
+static void mat_writer_free(mat_writer_t *w) {
+
+	free(w->chunks);
+	free(w->buf);
+	free(w->packed);
+}
+
 /*--------------------------------------------------------------------*/
 void dump_cycles(msieve_obj *obj, la_col_t *cols, uint32 ncols) {
 
@@ -174,10 +305,14 @@ void dump_matrix(msieve_obj *obj,
 
 	uint32 i;
 	uint32 dense_row_words;
+	uint32 magic = MAT_CHUNK_MAGIC;
+	uint64 index_offset = 0;
 	char buf[256];
 	FILE *matrix_fp;
+	mat_writer_t writer;
 #ifdef HAVE_MPI
 	mat_idx_t *mpi_idx_data = mat_idx_init(sparse_weight);
+	uint64 stream_offset = 3 * sizeof(uint32);
 #endif
 
 	dump_cycles(obj, cols, ncols);
@@ -189,25 +324,53 @@ void dump_matrix(msieve_obj *obj,
 		exit(-1);
 	}
 
+	/* the number of chunks and the offset of the chunk
+	   index are not known yet; write placeholders and
+	   fill them in at the end */
+
+	mat_writer_init(&writer, matrix_fp);
+
+	fwrite(&magic, sizeof(uint32), (size_t)1, matrix_fp);
 	fwrite(&nrows, sizeof(uint32), (size_t)1, matrix_fp);
 	fwrite(&num_dense_rows, sizeof(uint32), (size_t)1, matrix_fp);
 	fwrite(&ncols, sizeof(uint32), (size_t)1, matrix_fp);
+	fwrite(&writer.num_chunks, sizeof(uint32), (size_t)1, matrix_fp);
+	fwrite(&index_offset, sizeof(uint64), (size_t)1, matrix_fp);
 	dense_row_words = (num_dense_rows + 31) / 32;
 
 	for (i = 0; i < ncols; i++) {
 		la_col_t *c = cols + i;
-		uint32 num = c->weight + dense_row_words;
 
 #ifdef HAVE_MPI
-		mat_idx_update(mpi_idx_data, matrix_fp, c->weight);
+		/* the MPI index records offsets into the 
+		   uncompressed stream of columns */
+
+		mat_idx_update(mpi_idx_data, stream_offset, c->weight);
+		stream_offset += (c->weight + dense_row_words + 1) *
+					sizeof(uint32);
 #endif
-		fwrite(&c->weight, sizeof(uint32), (size_t)1, matrix_fp);
-		fwrite(c->data, sizeof(uint32), (size_t)num, matrix_fp);
+		mat_writer_add(obj, &writer, c, dense_row_words);
+	}
+	mat_writer_flush(obj, &writer);
+
+	index_offset = (uint64)ftello(matrix_fp);
+	fwrite(writer.chunks, sizeof(mat_chunk_t), 
+			(size_t)writer.num_chunks, matrix_fp);
+
+	fseeko(matrix_fp, (uint64)(4 * sizeof(uint32)), SEEK_SET);
+	fwrite(&writer.num_chunks, sizeof(uint32), (size_t)1, matrix_fp);
+	fwrite(&index_offset, sizeof(uint64), (size_t)1, matrix_fp);
+
+	if (ferror(matrix_fp)) {
+		logprintf(obj, "error: matrix file write failed\n");
+		exit(-1);
 	}
 
 #ifdef HAVE_MPI
-	mat_idx_final(obj, mpi_idx_data, ncols, ftello(matrix_fp));
+	mat_idx_final(obj, mpi_idx_data, ncols, stream_offset);
 #endif
+	logprintf(obj, "wrote matrix in %u chunks\n", writer.num_chunks);
+	mat_writer_free(&writer);
 	fclose(matrix_fp);
 }
 
@@ -422,6 +585,296 @@ static void file_cache_get_next(msieve_obj *obj, FILE *fp,
 	f->read_ptr += num + dense_row_words + 1;
 }
 
+/*--------------------------------------------------------------------*/
+/* state for converting columns read from disk into the form
+   the current process needs */
+
+typedef struct {
+	uint32 dense_row_words;
+	uint32 *rowperm;
+	uint32 start_row;
+	uint32 mpi_resclass;
+	uint32 mpi_nrows;
+	uint32 num_static_rows;
+} col_filter_t;
+
+static void store_column(col_filter_t *f, la_col_t *c,
+			uint32 *tmp_col, uint32 num) {
+
+	uint32 j;
+	uint32 k = num + f->dense_row_words;
+
+	c->data = NULL;
+	c->weight = num;
+
+	/* possibly permute the row numbers */
+
+	if (f->rowperm != NULL) {
+		for (j = 0; j < num; j++)
+			tmp_col[j] = f->rowperm[tmp_col[j]];
+
+		if (num > 1) {
+			qsort(tmp_col, (size_t)num, 
+				sizeof(uint32), compare_uint32);
+		}
+	}
+
+#ifdef HAVE_MPI
+	/* pull out the row numbers that belong in this MPI process */
+
+	for (j = k = 0; j < num; j++) {
+		uint32 curr_row = tmp_col[j];
+
+		if (curr_row < f->num_static_rows) {
+			if (f->start_row == 0)
+				tmp_col[k++] = curr_row;
+		}
+		else {
+			uint32 curr_resclass;
+
+			curr_row -= f->num_static_rows;
+			curr_resclass = curr_row % f->mpi_nrows;
+
+			if (curr_resclass == f->mpi_resclass) {
+				tmp_col[k] = curr_row / f->mpi_nrows;
+				if (f->start_row == 0)
+					tmp_col[k] += f->num_static_rows;
+				k++;
+			}
+		}
+	}
+	c->weight = k;
+
+	if (f->start_row == 0) {
+		for (j = 0; j < f->dense_row_words; j++)
+			tmp_col[k + j] = tmp_col[num + j];
+		k += f->dense_row_words;
+	}
+#endif
+	if (k > 0) {
+		c->data = (uint32 *)xmalloc(k * sizeof(uint32));
+		memcpy(c->data, tmp_col, k * sizeof(uint32));
+	}
+}
+
+/*--------------------------------------------------------------------*/
+/* chunked matrix files are read by a pool of threads, each
+   with its own file handle and decompression buffers; one
+   task loads one chunk */
+
+typedef struct {
+	FILE *fp;
+	uint32 *buf;
+	uint8 *packed;
+} chunk_thread_t;
+
+typedef struct {
+	msieve_obj *obj;
+	char *name;
+	mat_chunk_t *chunks;
+	col_filter_t *filter;
+	la_col_t *cols;
+	uint32 *colperm;
+	uint32 start_col;
+	uint32 end_col;
+	uint32 max_words;
+	uint32 max_disk_bytes;
+	chunk_thread_t thread_data[MAX_THREADS];
+} chunk_reader_t;
+
+typedef struct {
+	chunk_reader_t *reader;
+	uint32 chunk_num;
+} chunk_task_t;
+
+static void chunk_thread_init(void *data, int thread_num) {
+
+	chunk_reader_t *r = (chunk_reader_t *)data;
+	chunk_thread_t *t = r->thread_data + thread_num;
+
+	t->fp = fopen(r->name, "rb");
+	if (t->fp == NULL) {
+		logprintf(r->obj, "error: cannot open matrix file\n");
+		exit(-1);
+	}
+	t->buf = (uint32 *)xmalloc(r->max_words * sizeof(uint32));
+	t->packed = (uint8 *)xmalloc(r->max_disk_bytes);
+}
+
+static void chunk_thread_free(void *data, int thread_num) {
+
+	chunk_reader_t *r = (chunk_reader_t *)data;
+	chunk_thread_t *t = r->thread_data + thread_num;
+
+	fclose(t->fp);
+	free(t->buf);
+	free(t->packed);
+}
+
+static void read_chunk(void *data, int thread_num) {
+
+	chunk_task_t *task = (chunk_task_t *)data;
+	chunk_reader_t *r = task->reader;
+	chunk_thread_t *t = r->thread_data + thread_num;
+	mat_chunk_t *chunk = r->chunks + task->chunk_num;
+	uint32 i, j;
+	uint32 raw_bytes = chunk->num_words * sizeof(uint32);
+	uint32 tmp_col[MAX_COL_IDEALS];
+
+	fseeko(t->fp, chunk->file_offset, SEEK_SET);
+
+	if (chunk->disk_bytes == raw_bytes) {
+		if (fread(t->buf, (size_t)1, (size_t)raw_bytes, 
+					t->fp) != raw_bytes) {
+			printf("error: truncated matrix chunk\n");
+			exit(-1);
+		}
+	}
+	else {
+#ifdef NO_ZLIB
+		printf("error: compressed matrix needs zlib support\n");
+		exit(-1);
+#else
+		uLongf dest_bytes = raw_bytes;
+
+		if (fread(t->packed, (size_t)1, (size_t)chunk->disk_bytes, 
+					t->fp) != chunk->disk_bytes ||
+		    uncompress((Bytef *)t->buf, &dest_bytes, t->packed, 
+		    		(uLong)chunk->disk_bytes) != Z_OK ||
+		    dest_bytes != raw_bytes) {
+			printf("error: corrupt matrix chunk\n");
+			exit(-1);
+		}
+#endif
+	}
+
+	/* unpack the columns in the range this process needs */
+
+	for (i = j = 0; i < chunk->num_cols; i++) {
+		uint32 col = chunk->start_col + i;
+		uint32 num = t->buf[j];
+		la_col_t *c;
+
+		if (num + r->filter->dense_row_words > MAX_COL_IDEALS ||
+		    j + num + r->filter->dense_row_words >= 
+		    			chunk->num_words) {
+			printf("error: column too large; corrupt file?\n");
+			exit(-1);
+		}
+
+		if (col >= r->start_col && col < r->end_col) {
+			if (r->colperm != NULL)
+				c = r->cols + r->colperm[col];
+			else
+				c = r->cols + (col - r->start_col);
+
+			memcpy(tmp_col, t->buf + j + 1, 
+				(num + r->filter->dense_row_words) * 
+				sizeof(uint32));
+			store_column(r->filter, c, tmp_col, num);
+		}
+		j += num + r->filter->dense_row_words + 1;
+	}
+}
+
+static void read_matrix_chunks(msieve_obj *obj, FILE *matrix_fp,
+			char *name, col_filter_t *filter,
+			la_col_t *cols, uint32 *colperm,
+			uint32 start_col, uint32 ncols) {
+
+	uint32 i;
+	uint32 num_chunks;
+	uint32 first_chunk, end_chunk;
+	uint32 num_threads;
+	uint64 index_offset;
+	mat_chunk_t *chunks;
+	chunk_task_t *tasks;
+	chunk_reader_t *r;
+
+	fread(&num_chunks, sizeof(uint32), (size_t)1, matrix_fp);
+	fread(&index_offset, sizeof(uint64), (size_t)1, matrix_fp);
+
+	chunks = (mat_chunk_t *)xmalloc((num_chunks + 1) * 
+					sizeof(mat_chunk_t));
+	fseeko(matrix_fp, index_offset, SEEK_SET);
+	if (fread(chunks, sizeof(mat_chunk_t), (size_t)num_chunks,
+			matrix_fp) != num_chunks) {
+		logprintf(obj, "error: matrix chunk index is corrupt\n");
+		exit(-1);
+	}
+
+	/* find the chunks overlapping the columns we need */
+
+	for (first_chunk = 0; first_chunk < num_chunks; first_chunk++) {
+		mat_chunk_t *c = chunks + first_chunk;
+		if (c->start_col + c->num_cols > start_col)
+			break;
+	}
+	for (end_chunk = first_chunk; end_chunk < num_chunks; end_chunk++) {
+		if (chunks[end_chunk].start_col >= start_col + ncols)
+			break;
+	}
+
+	r = (chunk_reader_t *)xcalloc((size_t)1, sizeof(chunk_reader_t));
+	r->obj = obj;
+	r->name = name;
+	r->chunks = chunks;
+	r->filter = filter;
+	r->cols = cols;
+	r->colperm = colperm;
+	r->start_col = start_col;
+	r->end_col = start_col + ncols;
+	r->max_words = 1;
+	r->max_disk_bytes = 1;
+	for (i = first_chunk; i < end_chunk; i++) {
+		r->max_words = MAX(r->max_words, chunks[i].num_words);
+		r->max_disk_bytes = MAX(r->max_disk_bytes, 
+					chunks[i].disk_bytes);
+	}
+
+	tasks = (chunk_task_t *)xmalloc((end_chunk - first_chunk + 1) *
+					sizeof(chunk_task_t));
+	for (i = first_chunk; i < end_chunk; i++) {
+		tasks[i - first_chunk].reader = r;
+		tasks[i - first_chunk].chunk_num = i;
+	}
+
+	num_threads = MIN(obj->num_threads, MAX_THREADS);
+	num_threads = MIN(num_threads, end_chunk - first_chunk);
+
+	if (num_threads < 2) {
+		chunk_thread_init(r, 0);
+		for (i = first_chunk; i < end_chunk; i++)
+			read_chunk(tasks + (i - first_chunk), 0);
+		chunk_thread_free(r, 0);
+	}
+	else {
+		thread_control_t control;
+		task_control_t task = {NULL, NULL, NULL, NULL};
+		struct threadpool *pool;
+
+		control.init = chunk_thread_init;
+		control.shutdown = chunk_thread_free;
+		control.data = r;
+		pool = threadpool_init(num_threads, 
+				end_chunk - first_chunk, &control);
+
+		task.run = read_chunk;
+		for (i = first_chunk; i < end_chunk; i++) {
+			task.data = tasks + (i - first_chunk);
+			threadpool_add_task(pool, &task, 1);
+		}
+		threadpool_drain(pool, 1);
+		threadpool_free(pool);
+	}
+
+	logprintf(obj, "read %u matrix chunks using %u threads\n",
+			end_chunk - first_chunk, MAX(num_threads, 1));
+	free(tasks);
+	free(chunks);
+	free(r);
+}
+
 /*--------------------------------------------------------------------*/
 void read_matrix(msieve_obj *obj, 
 		uint32 *nrows_out, uint32 *max_nrows_out, 
@@ -431,19 +884,19 @@ void read_matrix(msieve_obj *obj,
 		uint32 *start_col_out, 
 		la_col_t **cols_out, uint32 *rowperm, uint32 *colperm) {
 
-	uint32 i, j, k;
+	uint32 i;
 	uint32 dense_rows, dense_row_words;
 	uint32 ncols, max_ncols, start_col;
 	uint32 nrows, max_nrows, start_row;
-	uint32 mpi_resclass, mpi_nrows;
+	uint32 is_chunked = 0;
 	la_col_t *cols;
 	char buf[256];
 	FILE *matrix_fp;
 	uint32 read_submatrix = (start_row_out != NULL &&
 				start_col_out != NULL);
-	file_cache_t file_cache;
+	col_filter_t filter;
 #ifdef HAVE_MPI
-	uint32 num_static_rows = 0;
+	uint64 mat_file_offset = 0;
 #endif
 
 	if (read_submatrix && colperm != NULL) {
@@ -459,6 +912,10 @@ void read_matrix(msieve_obj *obj,
 	}
 
 	fread(&max_nrows, sizeof(uint32), (size_t)1, matrix_fp);
+	if (max_nrows == MAT_CHUNK_MAGIC) {
+		is_chunked = 1;
+		fread(&max_nrows, sizeof(uint32), (size_t)1, matrix_fp);
+	}
 	fread(&dense_rows, sizeof(uint32), (size_t)1, matrix_fp);
 	fread(&max_ncols, sizeof(uint32), (size_t)1, matrix_fp);
 
@@ -468,21 +925,24 @@ void read_matrix(msieve_obj *obj,
 	nrows = max_nrows;
 	ncols = max_ncols;
 	start_row = start_col = 0;
-	mpi_resclass = 0;
-	mpi_nrows = 1;
+
+	memset(&filter, 0, sizeof(filter));
+	filter.dense_row_words = dense_row_words;
+	filter.rowperm = rowperm;
+	filter.mpi_nrows = 1;
 
 #ifdef HAVE_MPI
 	if (read_submatrix) {
 		/* read in only a subset of the matrix */
 
-		uint64 mat_file_offset;
+		uint32 mpi_nrows;
+		uint32 num_static_rows;
 
 		find_submatrix_bounds(obj, &ncols, &start_col,
 					&mat_file_offset);
-		fseeko(matrix_fp, mat_file_offset, SEEK_SET);
 
-		mpi_resclass = obj->mpi_la_row_rank;
-		mpi_nrows = obj->mpi_nrows;
+		filter.mpi_resclass = obj->mpi_la_row_rank;
+		filter.mpi_nrows = mpi_nrows = obj->mpi_nrows;
 
 		/* we perform an on-the-fly permutation of the rows,
 		   so that row i winds up in MPI row (i % mpi_nrows). 
@@ -513,86 +973,55 @@ void read_matrix(msieve_obj *obj,
 		   current MPI process */
 
 		nrows = (nrows - num_static_rows) / mpi_nrows;
-		if (mpi_resclass == 0)
+		if (filter.mpi_resclass == 0)
 			nrows += num_static_rows;
 		else
-			start_row = num_static_rows + mpi_resclass * nrows;
+			start_row = num_static_rows + 
+					filter.mpi_resclass * nrows;
+
+		filter.num_static_rows = num_static_rows;
+		filter.start_row = start_row;
 	}
 #endif
 	cols = (la_col_t *)xcalloc((size_t)ncols, sizeof(la_col_t));
 
-	file_cache_init(&file_cache);
+	if (is_chunked) {
+		/* every process (and every thread within a 
+		   process) reads its own chunks independently */
 
-	for (i = 0; i < ncols; i++) {
-		la_col_t *c;
-		uint32 tmp_col[MAX_COL_IDEALS];
-		uint32 num;
-		
-		if (colperm != NULL)
-			c = cols + colperm[i];
-		else
-			c = cols + i;
-
-		/* read the whole column */
-
-		file_cache_get_next(obj, matrix_fp, &file_cache,
-				dense_row_words, &num, tmp_col,
-				read_submatrix);
-		k = num + dense_row_words;
-		c->data = NULL;
-		c->weight = num;
-
-		/* possibly permute the row numbers */
-
-		if (rowperm != NULL) {
-			for (j = 0; j < num; j++)
-				tmp_col[j] = rowperm[tmp_col[j]];
-	
-			if (num > 1) {
-				qsort(tmp_col, (size_t)num, 
-					sizeof(uint32), compare_uint32);
-			}
-		}
+		read_matrix_chunks(obj, matrix_fp, buf, &filter,
+				cols, colperm, start_col, ncols);
+	}
+	else {
+		file_cache_t file_cache;
 
 #ifdef HAVE_MPI
-		/* pull out the row numbers that belong in this MPI process */
-
-		for (j = k = 0; j < num; j++) {
-			uint32 curr_row = tmp_col[j];
-
-			if (curr_row < num_static_rows) {
-				if (start_row == 0)
-					tmp_col[k++] = curr_row;
-			}
-			else {
-				uint32 curr_resclass;
-
-				curr_row -= num_static_rows;
-				curr_resclass = curr_row % mpi_nrows;
-
-				if (curr_resclass == mpi_resclass) {
-					tmp_col[k] = curr_row / mpi_nrows;
-					if (start_row == 0)
-						tmp_col[k] += num_static_rows;
-					k++;
-				}
-			}
-		}
-		c->weight = k;
-
-		if (start_row == 0) {
-			for (j = 0; j < dense_row_words; j++)
-				tmp_col[k + j] = tmp_col[num + j];
-			k += dense_row_words;
-		}
+		if (read_submatrix)
+			fseeko(matrix_fp, mat_file_offset, SEEK_SET);
 #endif
-		if (k > 0) {
-			c->data = (uint32 *)xmalloc(k * sizeof(uint32));
-			memcpy(c->data, tmp_col, k * sizeof(uint32));
+		file_cache_init(&file_cache);
+
+		for (i = 0; i < ncols; i++) {
+			la_col_t *c;
+			uint32 tmp_col[MAX_COL_IDEALS];
+			uint32 num;
+			
+			if (colperm != NULL)
+				c = cols + colperm[i];
+			else
+				c = cols + i;
+
+			/* read the whole column */
+
+			file_cache_get_next(obj, matrix_fp, &file_cache,
+					dense_row_words, &num, tmp_col,
+					read_submatrix);
+			store_column(&filter, c, tmp_col, num);
 		}
+
+		file_cache_free(&file_cache);
 	}
 
-	file_cache_free(&file_cache);
 	fclose(matrix_fp);
 	*cols_out = cols;
 	*ncols_out = ncols;
@@ -269,7 +269,8 @@ static void pack_med_block(packed_block_t *b)
 }
 
 /*--------------------------------------------------------------------*/
-static void pack_matrix_core(packed_matrix_t *p, la_col_t *A)
+static void pack_matrix_core(packed_matrix_t *p, la_col_t *A,
+				uint32 free_cols)
 {
 	uint32 i, j, k;
 	uint32 dense_row_blocks;
@@ -375,14 +376,205 @@ static void pack_matrix_core(packed_matrix_t *p, la_col_t *A)
 				e->col_off = j;
 			}
 
-			free(c->data);
-			c->data = NULL;
+			if (free_cols) {
+				free(c->data);
+				c->data = NULL;
+			}
 		}
 
 		pack_med_block(curr_stripe);
 	}
 }
 
+/*--------------------------------------------------------------------*/
+static void set_geometry(packed_matrix_t *p, uint32 block_size,
+			uint32 superblock_size) {
+
+	p->block_size = block_size;
+	p->num_block_cols = (p->ncols + block_size - 1) / block_size;
+	p->num_block_rows = 1 + (p->nrows - p->first_block_size + 
+				block_size - 1) / block_size;
+
+	p->superblock_size = (superblock_size + block_size - 1) / block_size;
+	p->num_superblock_cols = (p->num_block_cols + p->superblock_size - 1) / 
+					p->superblock_size;
+	p->num_superblock_rows = (p->num_block_rows - 1 + p->superblock_size - 1) / 
+					p->superblock_size;
+}
+
+/*--------------------------------------------------------------------*/
+static void free_packed_blocks(packed_matrix_t *p) {
+
+	uint32 i;
+
+	for (i = 0; i < (p->num_dense_rows + 63) / 64; i++)
+		free(p->dense_blocks[i]);
+	free(p->dense_blocks);
+	p->dense_blocks = NULL;
+
+	for (i = 0; i < p->num_block_rows * p->num_block_cols; i++) 
+		free(p->blocks[i].d.entries);
+
+	free(p->blocks);
+	p->blocks = NULL;
+}
+
+/*--------------------------------------------------------------------*/
+static uint32 read_checkpoint_geometry(msieve_obj *obj,
+				uint32 *block_size, 
+				uint32 *superblock_size) {
+
+	/* the block geometry is stored at the very end of
+	   a Lanczos checkpoint file; older checkpoints do 
+	   not have it */
+
+	char buf[256];
+	FILE *fp;
+	uint32 trailer[3];
+	uint32 status = 0;
+
+	sprintf(buf, "%s.chk", obj->savefile.name);
+	fp = fopen(buf, "rb");
+	if (fp == NULL)
+		return 0;
+
+	if (fseeko(fp, -(off_t)sizeof(trailer), SEEK_END) == 0 &&
+	    fread(trailer, sizeof(uint32), (size_t)3, fp) == 3 &&
+	    trailer[2] == CHECKPOINT_GEOMETRY_MAGIC &&
+	    trailer[0] > 0 && trailer[0] <= 65536) {
+		*block_size = trailer[0];
+		*superblock_size = trailer[1] * trailer[0];
+		status = 1;
+	}
+
+	fclose(fp);
+	return status;
+}
+
+/*--------------------------------------------------------------------*/
+#define TUNE_MULS 3
+
+static double time_geometry(packed_matrix_t *p, la_col_t *A,
+			uint32 block_size, uint32 superblock_size,
+			uint64 *x, uint64 *b) {
+
+	/* pack the matrix with the given geometry without 
+	   destroying the unpacked copy, then return the best
+	   time for a few multiplies by the matrix and its 
+	   transpose. The first multiply warms up the caches */
+
+	uint32 i;
+	double best = 0;
+
+	set_geometry(p, block_size, superblock_size);
+	pack_matrix_core(p, A, 0);
+
+	mul_packed(p, x, b);
+	mul_trans_packed(p, b, x);
+
+	for (i = 0; i < TUNE_MULS; i++) {
+		uint64 start = read_clock();
+		double elapsed;
+
+		mul_packed(p, x, b);
+		mul_trans_packed(p, b, x);
+		elapsed = (double)(read_clock() - start);
+		if (i == 0 || elapsed < best)
+			best = elapsed;
+	}
+
+	free_packed_blocks(p);
+	return best;
+}
+
+/*--------------------------------------------------------------------*/
+static void tune_geometry(msieve_obj *obj, packed_matrix_t *p,
+			la_col_t *A, uint32 *block_size_out,
+			uint32 *superblock_size_out) {
+
+	/* choose the block and superblock sizes by timing 
+	   matrix multiplies on the actual matrix. The block 
+	   size is varied first using the default superblock 
+	   size, then the superblock size is varied using the
+	   best block size. This costs a few extra matrix packings,
+	   and the unpacked matrix stays in memory until tuning
+	   is finished */
+
+	static const uint32 block_sizes[] = {4096, 8192, 16384, 32768};
+	static const uint32 superblock_scales[] = {1, 2, 8, 16};
+
+	uint32 i;
+	uint32 n = MAX(p->nrows, p->ncols);
+	uint32 best_block = *block_size_out;
+	uint32 default_superblock = *superblock_size_out;
+	uint32 best_superblock = default_superblock;
+	double best_time, curr_time, default_time;
+	uint64 *x = (uint64 *)xmalloc(n * sizeof(uint64));
+	uint64 *b = (uint64 *)xmalloc(n * sizeof(uint64));
+
+	logprintf(obj, "tuning matrix block geometry\n");
+
+	for (i = 0; i < n; i++)
+		x[i] = (uint64)(get_rand(&obj->seed1, &obj->seed2)) << 32 |
+				get_rand(&obj->seed1, &obj->seed2);
+
+	/* times are reported relative to the default geometry */
+
+	best_time = default_time = time_geometry(p, A, best_block, 
+						best_superblock, x, b);
+
+	for (i = 0; i < sizeof(block_sizes) / sizeof(uint32); i++) {
+		if (block_sizes[i] == *block_size_out)
+			continue;
+
+		curr_time = time_geometry(p, A, block_sizes[i],
+					default_superblock, x, b);
+		logprintf(obj, "block %u superblock %u: relative time %.3f\n", 
+				block_sizes[i], default_superblock, 
+				curr_time / default_time);
+		if (curr_time < best_time) {
+			best_time = curr_time;
+			best_block = block_sizes[i];
+		}
+	}
+
+	/* superblock sizes are scaled by quarters of the default */
+
+	for (i = 0; i < sizeof(superblock_scales) / sizeof(uint32); i++) {
+		uint32 superblock = MAX(best_block, default_superblock * 
+						superblock_scales[i] / 4);
+
+		curr_time = time_geometry(p, A, best_block, 
+					superblock, x, b);
+		logprintf(obj, "block %u superblock %u: relative time %.3f\n", 
+				best_block, superblock, 
+				curr_time / default_time);
+		if (curr_time < best_time) {
+			best_time = curr_time;
+			best_superblock = superblock;
+		}
+	}
+
+#ifdef HAVE_MPI
+	/* all MPI processes use the choice of the first one, 
+	   since that is what the checkpoint will record */
+	{
+		uint32 geometry[2];
+
+		geometry[0] = best_block;
+		geometry[1] = best_superblock;
+		MPI_TRY(MPI_Bcast(geometry, 2, MPI_INT, 0, MPI_COMM_WORLD))
+		best_block = geometry[0];
+		best_superblock = geometry[1];
+	}
+#endif
+
+	free(x);
+	free(b);
+	*block_size_out = best_block;
+	*superblock_size_out = best_superblock;
+}
+
 /*--------------------------------------------------------------------*/
 static void matrix_thread_init(void *data, int thread_num) {
 
@@ -416,10 +608,11 @@ void packed_matrix_init(msieve_obj *obj,
 			uint32 ncols, uint32 max_ncols, uint32 start_col, 
 			uint32 num_dense_rows, uint32 first_block_size) {
 
-	uint32 i, j;
+	uint32 i;
 	uint32 block_size;
 	uint32 superblock_size;
 	uint32 num_threads;
+	uint32 tune;
 	thread_control_t control;
 
 	/* initialize */
@@ -494,6 +687,21 @@ void packed_matrix_init(msieve_obj *obj,
 
 	block_size = 8192;
 	superblock_size = 3 * obj->cache_size2 / (4 * sizeof(uint64));
+	tune = 0;
+
+	/* a restarted run uses the geometry that the checkpoint
+	   was made with; otherwise the defaults can be replaced 
+	   by the fastest geometry for the actual matrix and 
+	   machine, which is found by timing a few candidates */
+
+	if ((obj->flags & MSIEVE_FLAG_NFS_LA_RESTART) &&
+	    read_checkpoint_geometry(obj, &block_size, &superblock_size)) {
+		logprintf(obj, "using block geometry from checkpoint\n");
+	}
+	else if (obj->nfs_args != NULL &&
+		 strstr(obj->nfs_args, "la_tune=1") != NULL) {
+		tune = 1;
+	}
 
 	/* possibly override from the command line */
 
@@ -502,35 +710,33 @@ void packed_matrix_init(msieve_obj *obj,
 		const char *tmp;
 
 		tmp = strstr(obj->nfs_args, "la_block=");
-		if (tmp != NULL)
+		if (tmp != NULL) {
 			block_size = atoi(tmp + 9);
+			tune = 0;
+		}
 
 		tmp = strstr(obj->nfs_args, "la_superblock=");
-		if (tmp != NULL)
+		if (tmp != NULL) {
 			superblock_size = atoi(tmp + 14);
+			tune = 0;
+		}
 	}
 
+	p->unpacked_cols = NULL;
+
+	if (tune)
+		tune_geometry(obj, p, A, &block_size, &superblock_size);
+
 	logprintf(obj, "using block size %u and superblock size %u for "
 			"processor cache size %u kB\n", 
 				block_size, superblock_size,
 				obj->cache_size2 / 1024);
 
-	p->unpacked_cols = NULL;
-
-	p->block_size = block_size;
-	p->num_block_cols = (ncols + block_size - 1) / block_size;
-	p->num_block_rows = 1 + (nrows - first_block_size + 
-				block_size - 1) / block_size;
-
-	p->superblock_size = (superblock_size + block_size - 1) / block_size;
-	p->num_superblock_cols = (p->num_block_cols + p->superblock_size - 1) / 
-					p->superblock_size;
-	p->num_superblock_rows = (p->num_block_rows - 1 + p->superblock_size - 1) / 
-					p->superblock_size;
+	set_geometry(p, block_size, superblock_size);
 
 	/* do the core work of packing the matrix */
 
-	pack_matrix_core(p, A);
+	pack_matrix_core(p, A, 1);
 }
 
 /*-------------------------------------------------------------------*/
@@ -546,13 +752,7 @@ void packed_matrix_free(packed_matrix_t *p) {
 		}
 	}
 	else {
-		for (i = 0; i < (p->num_dense_rows + 63) / 64; i++)
-			free(p->dense_blocks[i]);
-
-		for (i = 0; i < p->num_block_rows * p->num_block_cols; i++) 
-			free(p->blocks[i].d.entries);
-
-		free(p->blocks);
+		free_packed_blocks(p);
 	}
 
 	if (p->num_threads > 1) {
@@ -14,6 +14,133 @@ $Id$
 
 #include "lanczos.h"
 
+#ifdef HAS_GFNI_AVX512
+#include <immintrin.h>
+
+/* vpermb indices that transpose the bytes of eight 64-bit 
+   words, i.e. byte j of word i moves to byte i of word j. 
+   The second version also reverses the order of the bytes
+   in each output word */
+
+static const uint8 byte_transpose[64] = {
+	0,  8, 16, 24, 32, 40, 48, 56,   1,  9, 17, 25, 33, 41, 49, 57,
+	2, 10, 18, 26, 34, 42, 50, 58,   3, 11, 19, 27, 35, 43, 51, 59,
+	4, 12, 20, 28, 36, 44, 52, 60,   5, 13, 21, 29, 37, 45, 53, 61,
+	6, 14, 22, 30, 38, 46, 54, 62,   7, 15, 23, 31, 39, 47, 55, 63,
+};
+
+static const uint8 byte_transpose_rev[64] = {
+	56, 48, 40, 32, 24, 16,  8,  0,  57, 49, 41, 33, 25, 17,  9,  1,
+	58, 50, 42, 34, 26, 18, 10,  2,  59, 51, 43, 35, 27, 19, 11,  3,
+	60, 52, 44, 36, 28, 20, 12,  4,  61, 53, 45, 37, 29, 21, 13,  5,
+	62, 54, 46, 38, 30, 22, 14,  6,  63, 55, 47, 39, 31, 23, 15,  7,
+};
+
+/*-------------------------------------------------------------------*/
+static void core_Nx64_64x64_acc(uint64 *v, uint64 *c,
+			uint64 *y, uint32 n) {
+
+	/* Process v[] eight words at a time. After transposing
+	   the bytes, word K of vt holds byte K of each of the 
+	   eight words of v, and the GF(2) affine transform of 
+	   that word by the 8x8 bit matrix for rows 8*K..8*K+7 
+	   and columns 8*J..8*J+7 of x[][] yields the contribution
+	   to byte J of each of the eight output words. Rotating
+	   vt by r words lines up the blocks (K,J) = (J+r,J) for
+	   all J at once, and c[] holds these blocks for each r */
+
+	uint32 i;
+	uint64 vtail[8], ytail[8];
+	__m512i idx = _mm512_loadu_si512(byte_transpose);
+	__m512i c0 = _mm512_loadu_si512(c + 0*8);
+	__m512i c1 = _mm512_loadu_si512(c + 1*8);
+	__m512i c2 = _mm512_loadu_si512(c + 2*8);
+	__m512i c3 = _mm512_loadu_si512(c + 3*8);
+	__m512i c4 = _mm512_loadu_si512(c + 4*8);
+	__m512i c5 = _mm512_loadu_si512(c + 5*8);
+	__m512i c6 = _mm512_loadu_si512(c + 6*8);
+	__m512i c7 = _mm512_loadu_si512(c + 7*8);
+
+	for (i = 0; i < n; i += 8) {
+
+		uint64 *vi = v + i;
+		uint64 *yi = y + i;
+		__m512i vt, a0, a1, a2, a3, a4, a5, a6, a7;
+
+		if (n - i < 8) {
+			memset(vtail, 0, sizeof(vtail));
+			memset(ytail, 0, sizeof(ytail));
+			memcpy(vtail, vi, (n - i) * sizeof(uint64));
+			memcpy(ytail, yi, (n - i) * sizeof(uint64));
+			vi = vtail;
+			yi = ytail;
+		}
+
+		vt = _mm512_permutexvar_epi8(idx, _mm512_loadu_si512(vi));
+
+		a0 = _mm512_gf2p8affine_epi64_epi8(vt, c0, 0);
+		a1 = _mm512_gf2p8affine_epi64_epi8(
+				_mm512_alignr_epi64(vt, vt, 1), c1, 0);
+		a2 = _mm512_gf2p8affine_epi64_epi8(
+				_mm512_alignr_epi64(vt, vt, 2), c2, 0);
+		a3 = _mm512_gf2p8affine_epi64_epi8(
+				_mm512_alignr_epi64(vt, vt, 3), c3, 0);
+		a4 = _mm512_gf2p8affine_epi64_epi8(
+				_mm512_alignr_epi64(vt, vt, 4), c4, 0);
+		a5 = _mm512_gf2p8affine_epi64_epi8(
+				_mm512_alignr_epi64(vt, vt, 5), c5, 0);
+		a6 = _mm512_gf2p8affine_epi64_epi8(
+				_mm512_alignr_epi64(vt, vt, 6), c6, 0);
+		a7 = _mm512_gf2p8affine_epi64_epi8(
+				_mm512_alignr_epi64(vt, vt, 7), c7, 0);
+
+		/* three-way XORs, then transpose back */
+
+		a0 = _mm512_ternarylogic_epi64(a0, a1, a2, 0x96);
+		a3 = _mm512_ternarylogic_epi64(a3, a4, a5, 0x96);
+		a0 = _mm512_ternarylogic_epi64(a0, a3, 
+					_mm512_xor_si512(a6, a7), 0x96);
+		_mm512_storeu_si512(yi, _mm512_xor_si512(
+					_mm512_loadu_si512(yi),
+					_mm512_permutexvar_epi8(idx, a0)));
+
+		if (yi == ytail)
+			memcpy(y + i, ytail, (n - i) * sizeof(uint64));
+	}
+}
+
+/*-------------------------------------------------------------------*/
+static void mul_Nx64_64x64_precomp(uint64 *c, uint64 *x) {
+
+	/* fill c[] with the 64 8x8 submatrices of the 64x64
+	   matrix x[][], in the order that core_Nx64_64x64_acc
+	   needs them. Word J of group r holds the submatrix
+	   for rows 8*K..8*K+7 and columns 8*J..8*J+7, with
+	   K = (J+r) mod 8, in the format of the affine transform
+	   instruction: bit l of byte 7-j is bit 8*J+j of row 8*K+l */
+
+	uint32 r, j, k, l;
+
+	for (r = 0; r < 8; r++) {
+		for (j = 0; j < 8; j++) {
+			uint64 *xk = x + 8 * ((j + r) % 8);
+			uint64 m = 0;
+
+			for (k = 0; k < 8; k++) {
+				uint32 shift = 8 * j + k;
+				uint64 b = 0;
+
+				for (l = 0; l < 8; l++)
+					b |= ((xk[l] >> shift) & 1) << l;
+				m |= b << (8 * (7 - k));
+			}
+			c[8 * r + j] = m;
+		}
+	}
+}
+
+#else /* !HAS_GFNI_AVX512 */
+
 /*-------------------------------------------------------------------*/
 static void core_Nx64_64x64_acc(uint64 *v, uint64 *c,
 			uint64 *y, uint32 n) {
@@ -188,6 +315,8 @@ static void mul_Nx64_64x64_precomp(uint64 *c, uint64 *x) {
 	}
 }
 
+#endif /* HAS_GFNI_AVX512 */
+
 /*-------------------------------------------------------------------*/
 void mul_Nx64_64x64_acc(uint64 *v, uint64 *x,
 			uint64 *y, uint32 n) {
@@ -254,6 +383,104 @@ void tmul_Nx64_64x64_acc(packed_matrix_t *matrix,
 }
 
 /*-------------------------------------------------------------------*/
+#ifdef HAS_GFNI_AVX512
+
+static void core_64xN_Nx64(uint64 *x, uint64 *c, 
+			uint64 *y, uint32 n) {
+
+	/* Process x[] and y[] eight words at a time. Transposing
+	   the bytes and then the bits of each group of words 
+	   produces words xt and yt, where word K is an 8x8 bit 
+	   matrix whose byte b has bit i equal to bit 8*K+b of word
+	   i, and the affine transform of word K of xt by word J 
+	   of yt multiplies these two matrices. The result is the
+	   contribution to the 8x8 submatrix in rows 8*K..8*K+7 
+	   and columns 8*J..8*J+7 of the product. As with the
+	   Nx64 x 64x64 kernel, rotating yt by r words handles 
+	   submatrices (K,J) = (K,K+r) at once; the 64 submatrices
+	   are accumulated in registers and written to c[] */
+
+	uint32 i;
+	uint64 xtail[8], ytail[8];
+	__m512i idx = _mm512_loadu_si512(byte_transpose_rev);
+	__m512i bit_id = _mm512_set1_epi64(0x8040201008040201ULL);
+	__m512i bit_rev = _mm512_set1_epi64(0x0102040810204080ULL);
+	__m512i a0, a1, a2, a3, a4, a5, a6, a7;
+
+	a0 = a1 = a2 = a3 = a4 = a5 = a6 = a7 = _mm512_setzero_si512();
+
+	for (i = 0; i < n; i += 8) {
+
+		uint64 *xi = x + i;
+		uint64 *yi = y + i;
+		__m512i xt, yt;
+
+		if (n - i < 8) {
+			memset(xtail, 0, sizeof(xtail));
+			memset(ytail, 0, sizeof(ytail));
+			memcpy(xtail, xi, (n - i) * sizeof(uint64));
+			memcpy(ytail, yi, (n - i) * sizeof(uint64));
+			xi = xtail;
+			yi = ytail;
+		}
+
+		xt = _mm512_permutexvar_epi8(idx, _mm512_loadu_si512(xi));
+		yt = _mm512_permutexvar_epi8(idx, _mm512_loadu_si512(yi));
+		xt = _mm512_gf2p8affine_epi64_epi8(bit_id, xt, 0);
+		yt = _mm512_gf2p8affine_epi64_epi8(bit_rev, yt, 0);
+
+		a0 = _mm512_xor_si512(a0, _mm512_gf2p8affine_epi64_epi8(
+				xt, yt, 0));
+		a1 = _mm512_xor_si512(a1, _mm512_gf2p8affine_epi64_epi8(
+				xt, _mm512_alignr_epi64(yt, yt, 1), 0));
+		a2 = _mm512_xor_si512(a2, _mm512_gf2p8affine_epi64_epi8(
+				xt, _mm512_alignr_epi64(yt, yt, 2), 0));
+		a3 = _mm512_xor_si512(a3, _mm512_gf2p8affine_epi64_epi8(
+				xt, _mm512_alignr_epi64(yt, yt, 3), 0));
+		a4 = _mm512_xor_si512(a4, _mm512_gf2p8affine_epi64_epi8(
+				xt, _mm512_alignr_epi64(yt, yt, 4), 0));
+		a5 = _mm512_xor_si512(a5, _mm512_gf2p8affine_epi64_epi8(
+				xt, _mm512_alignr_epi64(yt, yt, 5), 0));
+		a6 = _mm512_xor_si512(a6, _mm512_gf2p8affine_epi64_epi8(
+				xt, _mm512_alignr_epi64(yt, yt, 6), 0));
+		a7 = _mm512_xor_si512(a7, _mm512_gf2p8affine_epi64_epi8(
+				xt, _mm512_alignr_epi64(yt, yt, 7), 0));
+	}
+
+	_mm512_storeu_si512(c + 0*8, a0);
+	_mm512_storeu_si512(c + 1*8, a1);
+	_mm512_storeu_si512(c + 2*8, a2);
+	_mm512_storeu_si512(c + 3*8, a3);
+	_mm512_storeu_si512(c + 4*8, a4);
+	_mm512_storeu_si512(c + 5*8, a5);
+	_mm512_storeu_si512(c + 6*8, a6);
+	_mm512_storeu_si512(c + 7*8, a7);
+}
+
+/*-------------------------------------------------------------------*/
+static void mul_64xN_Nx64_postproc(uint64 *c, uint64 *xy) {
+
+	/* word K of group r in c[] is the 8x8 submatrix of xy[][]
+	   in rows 8*K..8*K+7 and columns 8*J..8*J+7, J = (K+r) mod 8.
+	   Its byte b is byte J of row 8*K+b */
+
+	uint32 r, k, b;
+
+	memset(xy, 0, 64 * sizeof(uint64));
+
+	for (r = 0; r < 8; r++) {
+		for (k = 0; k < 8; k++) {
+			uint64 m = c[8 * r + k];
+			uint32 shift = 8 * ((k + r) % 8);
+
+			for (b = 0; b < 8; b++)
+				xy[8 * k + b] |= ((m >> (8 * b)) & 0xff) << shift;
+		}
+	}
+}
+
+#else /* !HAS_GFNI_AVX512 */
+
 static void core_64xN_Nx64(uint64 *x, uint64 *c, 
 			uint64 *y, uint32 n) {
 
@@ -409,6 +636,8 @@ static void mul_64xN_Nx64_postproc(uint64 *c, uint64 *xy) {
 	}
 }
 
+#endif /* HAS_GFNI_AVX512 */
+
 /*-------------------------------------------------------------------*/
 void mul_64xN_Nx64(uint64 *x, uint64 *y,
 		   uint64 *xy, uint32 n) {
@@ -0,0 +1,272 @@
+/*--------------------------------------------------------------------
+This source distribution is placed in the public domain by its author,
+Jason Papadopoulos. You may use it for any purpose, free of charge,
+without having to notify anyone. I disclaim any responsibility for any
+errors.
+
+Optionally, please be nice and tell me if you find this source to be
+useful. Again optionally, if you add to the functionality present here
+please consider making those additions public too, so that others may
+benefit from your work.
+
+$Id$
+--------------------------------------------------------------------*/
+
+#include <common.h>
+
+/* The QS and NFS sieving code choose their parameters from
+   tables indexed by the size of the input, and interpolate
+   between table entries. The tables compiled into the library
+   can be supplemented by a text file, given with the argument
+   'sieve_params=<file>', whose lines look like
+
+   	<section> <bits> <value1> <value2> ...
+
+   where <section> is 'qs' or 'nfs', and the number and meaning
+   of the values depend on the section. Everything after a '#'
+   is a comment. Entries in the file replace compiled-in entries
+   with the same number of bits and are added to the table
+   otherwise, so a file need only contain the sizes that have
+   been tuned */
+
+#define PARAM_ARG "sieve_params="
+
+/*--------------------------------------------------------------------*/
+uint32 get_arg_string(const char *args, const char *name,
+			char *buf, uint32 buf_size) {
+
+	/* copy the value of 'name=value' in the argument string
+	   to buf, stopping at the first whitespace. Returns the
+	   length of the value, or zero if it is not present */
+
+	uint32 i;
+	const char *tmp;
+
+	buf[0] = 0;
+	if (args == NULL || (tmp = strstr(args, name)) == NULL)
+		return 0;
+
+	for (i = 0, tmp += strlen(name); i < buf_size - 1; i++) {
+		if (*tmp == 0 || isspace(*tmp))
+			break;
+		buf[i] = *tmp++;
+	}
+	buf[i] = 0;
+	return i;
+}
+
+/*--------------------------------------------------------------------*/
+static uint32 parse_param_line(char *buf, const char *section,
+				uint32 num_values, param_row_t *row) {
+
+	/* returns 1 if buf is an entry of the named section
+	   with the right number of values */
+
+	uint32 i;
+	char *tmp;
+	char *next;
+	size_t len = strlen(section);
+
+	if ((tmp = strchr(buf, '#')) != NULL)
+		*tmp = 0;
+
+	for (tmp = buf; isspace(*tmp); tmp++)
+		;
+	if (strncmp(tmp, section, len) != 0 || !isspace(tmp[len]))
+		return 0;
+
+	tmp += len;
+	row->bits = (uint32)strtoul(tmp, &next, 10);
+	if (next == tmp)
+		return 0;
+
+	for (i = 0; i < num_values; i++) {
+		tmp = next;
+		row->values[i] = strtoull(tmp, &next, 10);
+		if (next == tmp)
+			return 0;
+	}
+	return 1;
+}
+
+/*--------------------------------------------------------------------*/
+static int compare_param_rows(const void *x, const void *y) {
+
+	param_row_t *xx = (param_row_t *)x;
+	param_row_t *yy = (param_row_t *)y;
+
+	if (xx->bits < yy->bits)
+		return -1;
+	if (xx->bits > yy->bits)
+		return 1;
+	return 0;
+}
+
+/*--------------------------------------------------------------------*/
+void get_param_row(msieve_obj *obj, const char *section,
+			const param_row_t *builtin, uint32 num_builtin,
+			uint32 num_values, uint32 bits, param_row_t *out) {
+
+	uint32 i, j, k, num_rows;
+	uint32 dist;
+	param_row_t *rows;
+	param_row_t *low, *high;
+	char name[256];
+	char buf[LINE_BUF_SIZE];
+	FILE *fp = NULL;
+
+	/* start with the compiled-in table */
+
+	num_rows = num_builtin;
+	rows = (param_row_t *)xmalloc(num_rows * sizeof(param_row_t));
+	memcpy(rows, builtin, num_rows * sizeof(param_row_t));
+
+	/* merge in the table from the parameter file */
+
+	if (get_arg_string(obj->nfs_args, PARAM_ARG, name, sizeof(name))) {
+		/* when tuning, a missing file is about to be created */
+
+		fp = fopen(name, "r");
+		if (fp == NULL && 
+		    strstr(obj->nfs_args, "qs_tune=1") == NULL &&
+		    strstr(obj->nfs_args, "nfs_tune=1") == NULL) {
+			logprintf(obj, "warning: cannot open sieve parameter "
+					"file '%s'\n", name);
+		}
+	}
+
+	while (fp != NULL && fgets(buf, sizeof(buf), fp) != NULL) {
+		param_row_t row;
+
+		memset(&row, 0, sizeof(row));
+		if (!parse_param_line(buf, section, num_values, &row))
+			continue;
+
+		for (i = 0; i < num_rows; i++) {
+			if (rows[i].bits == row.bits)
+				break;
+		}
+		if (i == num_rows) {
+			rows = (param_row_t *)xrealloc(rows, (num_rows + 1) *
+							sizeof(param_row_t));
+			num_rows++;
+		}
+		else if (i < num_builtin) {
+			logprintf(obj, "using %u-bit %s parameters from "
+					"'%s'\n", row.bits, section, name);
+		}
+		rows[i] = row;
+	}
+	if (fp != NULL)
+		fclose(fp);
+
+	qsort(rows, (size_t)num_rows, sizeof(param_row_t),
+			compare_param_rows);
+
+	/* inputs that are too small or too large use the first
+	   or last table entry. Otherwise the parameters to use
+	   are a weighted average of the two table entries the
+	   input falls between */
+
+	if (bits < rows[0].bits) {
+		*out = rows[0];
+	}
+	else if (bits >= rows[num_rows - 1].bits) {
+		*out = rows[num_rows - 1];
+	}
+	else {
+		for (i = 0; i < num_rows - 1; i++) {
+			if (bits < rows[i+1].bits)
+				break;
+		}
+
+		low = rows + i;
+		high = rows + i + 1;
+		dist = high->bits - low->bits;
+		i = bits - low->bits;
+		j = high->bits - bits;
+
+		memset(out, 0, sizeof(param_row_t));
+		out->bits = bits;
+		for (k = 0; k < num_values; k++) {
+			out->values[k] = (uint64)(
+				((double)low->values[k] * j +
+				 (double)high->values[k] * i) / dist + 0.5);
+		}
+	}
+
+	free(rows);
+}
+
+/*--------------------------------------------------------------------*/
+void save_param_row(msieve_obj *obj, const char *section,
+			uint32 num_values, param_row_t *row) {
+
+	/* write one table entry to the parameter file, replacing
+	   any entry for the same section and size. The rest of
+	   the file, including comments, is preserved */
+
+	uint32 i;
+	uint32 replaced = 0;
+	char name[256];
+	char buf[LINE_BUF_SIZE];
+	char line[LINE_BUF_SIZE];
+	char *contents = NULL;
+	size_t size = 0;
+	size_t alloc = 0;
+	FILE *fp;
+
+	if (!get_arg_string(obj->nfs_args, PARAM_ARG, name, sizeof(name)))
+		return;
+
+	sprintf(line, "%s %u", section, row->bits);
+	for (i = 0; i < num_values; i++) {
+		sprintf(line + strlen(line), " %" PRIu64,
+				row->values[i]);
+	}
+	strcat(line, "\n");
+
+	/* read in the old file, if any */
+
+	fp = fopen(name, "r");
+	while (fp != NULL && fgets(buf, sizeof(buf), fp) != NULL) {
+		char tmp[LINE_BUF_SIZE];
+		param_row_t old_row;
+		char *src = buf;
+
+		strcpy(tmp, buf);
+		if (parse_param_line(tmp, section, num_values, &old_row) &&
+		    old_row.bits == row->bits) {
+			src = line;
+			replaced = 1;
+		}
+
+		if (size + strlen(src) + 1 > alloc) {
+			alloc = 2 * alloc + strlen(src) + 1000;
+			contents = (char *)xrealloc(contents, alloc);
+		}
+		strcpy(contents + size, src);
+		size += strlen(src);
+	}
+	if (fp != NULL)
+		fclose(fp);
+
+	fp = fopen(name, "w");
+	if (fp == NULL) {
+		logprintf(obj, "error: cannot write sieve parameter "
+				"file '%s'\n", name);
+		free(contents);
+		return;
+	}
+	if (size > 0)
+		fputs(contents, fp);
+	if (size > 0 && contents[size - 1] != '\n')
+		fputs("\n", fp);
+	if (!replaced)
+		fputs(line, fp);
+	fclose(fp);
+	free(contents);
+
+	logprintf(obj, "saved %u-bit %s parameters to '%s'\n",
+			row->bits, section, name);
+}
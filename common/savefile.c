@@ -45,6 +45,22 @@ void savefile_init(savefile_t *s, char *savefile_name) {
 	s->buf = (char *)xmalloc((size_t)SAVEFILE_BUF_SIZE);
 }
 
+/*--------------------------------------------------------------------*/
+void savefile_init_memory(savefile_t *s) {
+
+	/* the whole savefile is kept in s->buf, which grows 
+	   as needed. Opening the file for writing empties it,
+	   and opening it for reading or appending does not */
+
+	memset(s, 0, sizeof(savefile_t));
+
+	s->name = "(in memory)";
+	s->in_memory = 1;
+	s->buf_alloc = SAVEFILE_BUF_SIZE;
+	s->buf = (char *)xmalloc((size_t)s->buf_alloc);
+	s->buf[0] = 0;
+}
+
 /*--------------------------------------------------------------------*/
 void savefile_free(savefile_t *s) {
 	
@@ -57,6 +73,29 @@ void savefile_open(savefile_t *s, uint32 flags) {
 	
 #if defined(NO_ZLIB) && (defined(WIN32) || defined(_WIN64))
 	DWORD access_arg, open_arg;
+#else
+	char *open_string;
+#ifndef NO_ZLIB
+	char name_gz[256];
+	#if defined(WIN32) || defined(_WIN64)
+	struct _stati64 dummy;
+	#else
+	struct stat dummy;
+	#endif
+#endif
+#endif
+
+	if (s->in_memory) {
+		if (!(flags & (SAVEFILE_READ | SAVEFILE_APPEND))) {
+			s->buf_off = 0;
+			s->buf[0] = 0;
+		}
+		s->read_off = 0;
+		s->read_eof = 0;
+		return;
+	}
+
+#if defined(NO_ZLIB) && (defined(WIN32) || defined(_WIN64))
 
 	if (flags & SAVEFILE_READ)
 		access_arg = GENERIC_READ;
@@ -92,16 +131,6 @@ void savefile_open(savefile_t *s, uint32 flags) {
 	s->eof = 0;
 
 #else
-	char *open_string;
-#ifndef NO_ZLIB
-	char name_gz[256];
-	#if defined(WIN32) || defined(_WIN64)
-	struct _stati64 dummy;
-	#else
-	struct stat dummy;
-	#endif
-#endif
-
 	if (flags & SAVEFILE_APPEND)
 		open_string = "a";
 	else if ((flags & SAVEFILE_READ) && (flags & SAVEFILE_WRITE))
@@ -175,6 +204,9 @@ void savefile_open(savefile_t *s, uint32 flags) {
 /*--------------------------------------------------------------------*/
 void savefile_close(savefile_t *s) {
 	
+	if (s->in_memory)
+		return;
+
 #if defined(NO_ZLIB) && (defined(WIN32) || defined(_WIN64))
 	CloseHandle(s->file_handle);
 	s->file_handle = INVALID_HANDLE_VALUE;
@@ -187,6 +219,9 @@ void savefile_close(savefile_t *s) {
 /*--------------------------------------------------------------------*/
 uint32 savefile_eof(savefile_t *s) {
 	
+	if (s->in_memory)
+		return s->read_eof;
+
 #if defined(NO_ZLIB) && (defined(WIN32) || defined(_WIN64))
 	return (s->buf_off == s->read_size && s->eof);
 #else
@@ -199,9 +234,16 @@ uint32 savefile_exists(savefile_t *s) {
 	
 #if defined(WIN32) || defined(_WIN64)
 	struct _stati64 dummy;
-	return (_stati64(s->name, &dummy) == 0);
 #else
 	struct stat dummy;
+#endif
+
+	if (s->in_memory)
+		return (s->buf_off > 0);
+
+#if defined(WIN32) || defined(_WIN64)
+	return (_stati64(s->name, &dummy) == 0);
+#else
 	return (stat(s->name, &dummy) == 0);
 #endif
 }
@@ -212,6 +254,29 @@ void savefile_read_line(char *buf, size_t max_len, savefile_t *s) {
 #if defined(NO_ZLIB) && (defined(WIN32) || defined(_WIN64))
 	size_t i, j;
 	char *sbuf = s->buf;
+#endif
+
+	if (s->in_memory) {
+		size_t j = 0;
+		char *sbuf = s->buf + s->read_off;
+		char *end = s->buf + s->buf_off;
+
+		if (sbuf == end) {
+			s->read_eof = 1;
+			buf[0] = 0;
+			return;
+		}
+		while (sbuf < end && j < max_len - 1) {
+			buf[j++] = *sbuf;
+			if (*sbuf++ == '\n')
+				break;
+		}
+		buf[j] = 0;
+		s->read_off = sbuf - s->buf;
+		return;
+	}
+
+#if defined(NO_ZLIB) && (defined(WIN32) || defined(_WIN64))
 
 	for (i = s->buf_off, j = 0; i < s->read_size && 
 				j < max_len - 1; i++, j++) { /* read bytes */
@@ -255,6 +320,19 @@ void savefile_read_line(char *buf, size_t max_len, savefile_t *s) {
 /*--------------------------------------------------------------------*/
 void savefile_write_line(savefile_t *s, char *buf) {
 
+	if (s->in_memory) {
+		uint32 len = strlen(buf);
+
+		if (s->buf_off + len + 1 >= s->buf_alloc) {
+			s->buf_alloc = 2 * (s->buf_alloc + len);
+			s->buf = (char *)xrealloc(s->buf, 
+						(size_t)s->buf_alloc);
+		}
+		memcpy(s->buf + s->buf_off, buf, (size_t)len + 1);
+		s->buf_off += len;
+		return;
+	}
+
 	if (s->buf_off + strlen(buf) + 1 >= SAVEFILE_BUF_SIZE)
 		savefile_flush(s);
 
@@ -264,6 +342,9 @@ void savefile_write_line(savefile_t *s, char *buf) {
 /*--------------------------------------------------------------------*/
 void savefile_flush(savefile_t *s) {
 
+	if (s->in_memory)
+		return;
+
 #if defined(NO_ZLIB) && (defined(WIN32) || defined(_WIN64))
 	if (s->buf_off) {
 		DWORD num_write; /* required because of NULL arg below */
@@ -287,6 +368,12 @@ void savefile_flush(savefile_t *s) {
 /*--------------------------------------------------------------------*/
 void savefile_rewind(savefile_t *s) {
 
+	if (s->in_memory) {
+		s->read_off = 0;
+		s->read_eof = 0;
+		return;
+	}
+
 #if defined(NO_ZLIB) && (defined(WIN32) || defined(_WIN64))
 	LARGE_INTEGER fileptr;
 	fileptr.QuadPart = 0;
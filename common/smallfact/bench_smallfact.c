@@ -0,0 +1,237 @@
+/*--------------------------------------------------------------------
+This source distribution is placed in the public domain by its author,
+Jason Papadopoulos. You may use it for any purpose, free of charge,
+without having to notify anyone. I disclaim any responsibility for any
+errors.
+
+Optionally, please be nice and tell me if you find this source to be
+useful. Again optionally, if you add to the functionality present here
+please consider making those additions public too, so that others may
+benefit from your work.
+
+$Id$
+--------------------------------------------------------------------*/
+
+/* Standalone benchmark for the small factoring routines that
+   do the cofactorization in the QS and in NFS batch factoring.
+   For each requested size, a list of random composites with
+   two (or more) equal-size prime factors is built and then
+   factored repeatedly with SQUFOF (up to 62 bits), with tinyqs
+   (up to 85 bits), the latter both with a context allocated for
+   every call and with a single context reused for all of them,
+   and with tinyecm. The output is the number of calls per
+   second and the fraction of calls that found a factor */
+
+#include <common.h>
+
+#define MAX_LIST 16
+
+/*--------------------------------------------------------------------*/
+static uint32 parse_list(char *arg, uint32 *list) {
+
+	uint32 i = 0;
+
+	while (i < MAX_LIST) {
+		list[i++] = strtoul(arg, &arg, 10);
+		if (*arg != ',')
+			break;
+		arg++;
+	}
+	return i;
+}
+
+/*--------------------------------------------------------------------*/
+static void make_composites(uint32 bits, uint32 num_factors,
+				uint32 count, mp_t *list,
+				uint32 *seed1, uint32 *seed2) {
+	uint32 i, j;
+
+	for (i = 0; i < count; i++) {
+		mp_t p, q;
+
+		do {
+			mp_random_prime(bits - (num_factors - 1) * 
+					(bits / num_factors), 
+					list + i, seed1, seed2);
+			for (j = 1; j < num_factors; j++) {
+				mp_random_prime(bits / num_factors, 
+						&p, seed1, seed2);
+				mp_mul(list + i, &p, &q);
+				mp_copy(&q, list + i);
+			}
+		} while (mp_bits(list + i) != bits || 
+			 mp_iroot(list + i, 2, &p) == 0);
+	}
+}
+
+/*--------------------------------------------------------------------*/
+static void bench_squfof(mp_t *list, uint32 count, uint32 reps) {
+
+	uint32 i, j;
+	uint32 found = 0;
+	double elapsed = get_wall_time();
+
+	for (i = 0; i < reps; i++) {
+		for (j = 0; j < count; j++) {
+			if (squfof(list + j) > 1)
+				found++;
+		}
+	}
+
+	elapsed = get_wall_time() - elapsed;
+	printf("  squfof            %10.0f calls/sec  %5.1f%% success\n",
+			reps * count / elapsed,
+			100.0 * found / (reps * count));
+}
+
+/*--------------------------------------------------------------------*/
+static void bench_tinyqs(mp_t *list, uint32 count,
+			uint32 reps, uint32 reuse) {
+
+	uint32 i, j;
+	uint32 found = 0;
+	void *tinyqs_data = NULL;
+	double elapsed = get_wall_time();
+
+	if (reuse)
+		tinyqs_data = tinyqs_init();
+
+	for (i = 0; i < reps; i++) {
+		for (j = 0; j < count; j++) {
+			mp_t f1, f2;
+
+			if (!reuse)
+				tinyqs_data = tinyqs_init();
+
+			if (tinyqs(tinyqs_data, list + j, &f1, &f2))
+				found++;
+
+			if (!reuse)
+				tinyqs_data = tinyqs_free(tinyqs_data);
+		}
+	}
+
+	if (reuse)
+		tinyqs_data = tinyqs_free(tinyqs_data);
+
+	elapsed = get_wall_time() - elapsed;
+	printf("  tinyqs (%s)  %10.0f calls/sec  %5.1f%% success\n",
+			reuse ? "reused " : "per-call",
+			reps * count / elapsed,
+			100.0 * found / (reps * count));
+}
+
+/*--------------------------------------------------------------------*/
+static void bench_tinyecm(mp_t *list, uint32 count, uint32 reps) {
+
+	uint32 i, j;
+	uint32 found = 0;
+	void *tinyecm_data = tinyecm_init();
+	double elapsed = get_wall_time();
+
+	for (i = 0; i < reps; i++) {
+		for (j = 0; j < count; j++) {
+			mp_t f1, f2;
+
+			if (tinyecm(tinyecm_data, list + j, &f1, &f2))
+				found++;
+		}
+	}
+
+	tinyecm_data = tinyecm_free(tinyecm_data);
+
+	elapsed = get_wall_time() - elapsed;
+	printf("  tinyecm           %10.0f calls/sec  %5.1f%% success\n",
+			reps * count / elapsed,
+			100.0 * found / (reps * count));
+}
+
+/*--------------------------------------------------------------------*/
+static void print_usage(char *progname) {
+
+	printf("usage: %s [options]\n"
+		"options:\n"
+		"   -b <list>  comma-separated input sizes in bits\n"
+		"              (default 50,60,70,80,85)\n"
+		"   -f <num>   prime factors per input (default 2)\n"
+		"   -n <num>   number of inputs of each size (default 200)\n"
+		"   -r <num>   passes through each list of inputs (default 5)\n"
+		"   -s <num>   random seed\n",
+		progname);
+}
+
+/*--------------------------------------------------------------------*/
+int main(int argc, char **argv) {
+
+	uint32 i;
+	uint32 bits[MAX_LIST] = {50, 60, 70, 80, 85};
+	uint32 num_bits = 5;
+	uint32 num_factors = 2;
+	uint32 count = 200;
+	uint32 reps = 5;
+	uint32 seed1 = 0x12345678;
+	uint32 seed2 = 0x9abcdef0;
+	mp_t *list;
+
+	for (i = 1; i < (uint32)argc; i++) {
+		if (argv[i][0] != '-' || argv[i][1] == 0 ||
+		    argv[i][2] != 0 || i + 1 >= (uint32)argc) {
+			print_usage(argv[0]);
+			return -1;
+		}
+
+		switch (argv[i][1]) {
+		case 'b':
+			num_bits = parse_list(argv[++i], bits);
+			break;
+		case 'f':
+			num_factors = strtoul(argv[++i], NULL, 10);
+			break;
+		case 'n':
+			count = strtoul(argv[++i], NULL, 10);
+			break;
+		case 'r':
+			reps = strtoul(argv[++i], NULL, 10);
+			break;
+		case 's':
+			seed1 = strtoul(argv[++i], NULL, 10);
+			break;
+		default:
+			print_usage(argv[0]);
+			return -1;
+		}
+	}
+
+	if (count == 0 || reps == 0 || num_factors < 2) {
+		print_usage(argv[0]);
+		return -1;
+	}
+
+	list = (mp_t *)xmalloc(count * sizeof(mp_t));
+
+	for (i = 0; i < num_bits; i++) {
+		if (bits[i] < 20 * num_factors || 
+		    bits[i] > TINYECM_MAX_BITS) {
+			printf("skipping %u-bit inputs: sizes must be "
+				"between %u and %u bits\n", bits[i],
+				20 * num_factors, TINYECM_MAX_BITS);
+			continue;
+		}
+
+		make_composites(bits[i], num_factors, count, 
+				list, &seed1, &seed2);
+		printf("%u-bit inputs:\n", bits[i]);
+
+		if (bits[i] <= 62)
+			bench_squfof(list, count, reps);
+
+		if (bits[i] <= SMALL_COMPOSITE_CUTOFF_BITS) {
+			bench_tinyqs(list, count, reps, 0);
+			bench_tinyqs(list, count, reps, 1);
+		}
+		bench_tinyecm(list, count, reps);
+	}
+
+	free(list);
+	return 0;
+}
@@ -251,13 +251,16 @@ uint32 squfof(mp_t *n) {
 
 	uint32 num_mult;
 	uint32 factor_found = 0;
-	mp_t scaledn, sqrt_scaledn;
 	uint32 i, num_iter, num_failed;
 	squfof_data_t data;
 
 	/* turn n into a uint64 */
 
+	if (n->nwords > 2)
+		return 0;
 	data.n = (uint64)(n->val[1]) << 32 | (uint64)(n->val[0]);
+	if (n->nwords < 2)
+		data.n = n->val[0];
 
 	/* for each multiplier */
 
@@ -268,23 +271,34 @@ uint32 squfof(mp_t *n) {
 		   initialized in order of increasing size, when
 		   one is too big then all the rest are also too big */
 
-		mp_mul_1(n, multipliers[i], &scaledn);
-		if (mp_bits(&scaledn) > 62)
+		uint64 scaledn;
+		uint32 sqrtn;
+
+		if (data.n > (((uint64)1 << 62) - 1) / multipliers[i])
 			break;
+		scaledn = data.n * multipliers[i];
+
+		/* the square root in double precision is off by 
+		   at most one; correct it using integer arithmetic */
 
-		mp_isqrt(&scaledn, &sqrt_scaledn);
+		sqrtn = (uint32)sqrt((double)scaledn);
+		if ((uint64)sqrtn * sqrtn > scaledn)
+			sqrtn--;
+		else if ((uint64)(sqrtn + 1) * (sqrtn + 1) <= scaledn)
+			sqrtn++;
 
 		/* initialize the rest of the fields for this
 		   multiplier */
 
-		data.sqrtn[i] = sqrt_scaledn.val[0];
+		data.sqrtn[i] = sqrtn;
 		data.cutoff[i] = (uint32)(sqrt(2.0 * (double)data.sqrtn[i]));
 		data.num_saved[i] = 0;
 		data.failed[i] = 0;
 
 		data.q0[i] = 1;
 		data.p1[i] = data.sqrtn[i];
-		data.q1[i] = scaledn.val[0] - data.p1[i] * data.p1[i];
+		data.q1[i] = (uint32)(scaledn - 
+				(uint64)data.p1[i] * data.p1[i]);
 
 		/* if n is a perfect square, don't run the algorithm;
 		   the factorization has already taken place */
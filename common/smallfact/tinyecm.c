@@ -0,0 +1,942 @@
+/*--------------------------------------------------------------------
+This source distribution is placed in the public domain by its author,
+Jason Papadopoulos. You may use it for any purpose, free of charge,
+without having to notify anyone. I disclaim any responsibility for any
+errors.
+
+Optionally, please be nice and tell me if you find this source to be
+useful. Again optionally, if you add to the functionality present here
+please consider making those additions public too, so that others may
+benefit from your work.
+
+$Id$
+--------------------------------------------------------------------*/
+
+#include <common.h>
+
+/* Cofactorization of composites up to 128 bits, the size of
+   the leftovers of NFS relations with three or four large
+   primes. Each input goes through one pass of P-1 and then
+   through ECM with a sequence of curves, with the bounds for
+   both and the maximum number of curves taken from a table
+   indexed by the size of the input.
+
+   All of the arithmetic is on residues of at most four 32-bit
+   words in Montgomery form, so the only calls into the general
+   multiple precision code are the handful of gcds and modular
+   inverses needed per curve. The ECM curves are Suyama curves,
+   whose group orders are divisible by 12, mapped to twisted
+   Edwards form; extended Edwards coordinates need fewer
+   multiplies per bit of the stage 1 multiplier than the
+   Montgomery form, and stage 1 uses a signed-digit (NAF)
+   ladder on top of that. Stage 2 of both methods runs over
+   the primes up to B2, using baby-step giant-step pairing of
+   the primes for ECM and the differences between consecutive
+   primes for P-1 */
+
+#define MAX_WORDS (TINYECM_MAX_BITS / 32)
+
+/* the ECM stage 2 giant step size, and the number of baby
+   steps (1 <= j < STAGE2_W/2 with gcd(j, STAGE2_W) = 1) */
+
+#define STAGE2_W 210
+#define STAGE2_BABY 24
+
+/* the largest gap between consecutive primes in the
+   precomputed table */
+
+#define MAX_PRIME_GAP 72
+
+typedef struct {
+	uint32 bits;		/* largest input size for this entry */
+	uint32 pm1_b1;
+	uint32 pm1_b2;
+	uint32 ecm_b1;
+	uint32 ecm_b2;
+	uint32 max_curves;
+} tinyecm_param_t;
+
+/* The bounds were chosen by timing inputs of each size with
+   two equal-size factors up to 64 bits, and with three or four
+   equal-size factors above that, since larger inputs that are
+   the product of two primes are of no use for NFS */
+
+static const tinyecm_param_t prebuilt_params[] = {
+	{ 52,   300,  10000,    70,   3500,  64},
+	{ 64,   500,  20000,   250,  12500, 128},
+	{ 76,   300,  10000,   100,   5000, 128},
+	{ 88,   500,  20000,   150,   7500, 160},
+	{100,   500,  20000,   400,  20000, 200},
+	{112,   500,  20000,   400,  20000, 256},
+	{128,   500,  20000,   400,  20000, 320},
+};
+
+#define NUM_PARAMS (sizeof(prebuilt_params) / sizeof(tinyecm_param_t))
+
+/* everything that depends only on the bounds is computed
+   the first time an input of the corresponding size is seen:
+   the stage 1 multipliers, packed as products of prime powers
+   into 32-bit words, and for ECM stage 2 a bitmask for each
+   giant step listing the baby steps that pair with it to
+   cover a prime */
+
+typedef struct {
+	uint32 num_pm1_mult;
+	uint32 *pm1_mult;
+	uint32 pm1_b2_start;	/* first prime above pm1_b1 */
+	uint32 pm1_b2_index;	/* its offset in prime_delta */
+
+	uint32 num_ecm_mult;
+	uint32 *ecm_mult;
+	uint32 giant_start;
+	uint32 num_giant;
+	uint32 *giant_mask;
+} tinyecm_plan_t;
+
+typedef struct {
+	uint32 baby[STAGE2_BABY];
+	tinyecm_plan_t plans[NUM_PARAMS];
+} tinyecm_t;
+
+typedef struct {
+	uint32 nwords;
+	uint32 n[MAX_WORDS];
+	uint32 ninv;			/* -1/n mod 2^32 */
+	uint32 one[MAX_WORDS];		/* 2^(32*nwords) mod n */
+	uint32 r2[MAX_WORDS];		/* one^2 mod n */
+	mp_t mp_n;
+} monty_t;
+
+typedef struct {
+	uint32 X[MAX_WORDS];
+	uint32 Y[MAX_WORDS];
+	uint32 Z[MAX_WORDS];
+	uint32 T[MAX_WORDS];
+} ed_point_t;
+
+typedef struct {
+	uint32 a[MAX_WORDS];
+	uint32 d[MAX_WORDS];
+} ed_curve_t;
+
+/*--------------------------------------------------------------------*/
+static INLINE void res_copy(monty_t *m, uint32 *dest, uint32 *src) {
+
+	memcpy(dest, src, m->nwords * sizeof(uint32));
+}
+
+/*--------------------------------------------------------------------*/
+static INLINE uint32 res_is_zero(monty_t *m, uint32 *a) {
+
+	uint32 i;
+	uint32 acc = 0;
+
+	for (i = 0; i < m->nwords; i++)
+		acc |= a[i];
+	return (acc == 0);
+}
+
+/*--------------------------------------------------------------------*/
+static void res_to_mp(monty_t *m, uint32 *a, mp_t *res) {
+
+	/* the raw words of a residue, i.e. still in
+	   Montgomery form */
+
+	uint32 i;
+
+	mp_clear(res);
+	for (i = 0; i < m->nwords; i++)
+		res->val[i] = a[i];
+	res->nwords = m->nwords;
+	while (res->nwords > 0 && res->val[res->nwords - 1] == 0)
+		res->nwords--;
+}
+
+/*--------------------------------------------------------------------*/
+static INLINE void res_reduce(uint32 *a, uint32 carry, uint32 *n,
+				uint32 *res, uint32 nwords) {
+
+	/* res = a - n if carry is set or a >= n, else a. The
+	   choice is made without a branch, since it goes either
+	   way with about equal probability */
+
+	uint32 i;
+	uint32 mask;
+	uint32 borrow = 0;
+	uint32 diff[MAX_WORDS];
+
+	for (i = 0; i < nwords; i++) {
+		uint64 d = (uint64)a[i] - n[i] - borrow;
+		diff[i] = (uint32)d;
+		borrow = (uint32)(d >> 63);
+	}
+
+	mask = 0 - (carry | (borrow ^ 1));
+	for (i = 0; i < nwords; i++)
+		res[i] = (diff[i] & mask) | (a[i] & ~mask);
+}
+
+/* The modular arithmetic below is written for a word count
+   that is a compile-time constant, and each routine dispatches
+   to the copy for the size of n so that the compiler can fully
+   unroll the loops */
+
+#define MONT_DISPATCH(m, func, args) 			\
+	switch ((m)->nwords) {					\
+	case 1: func args(1); break;				\
+	case 2: func args(2); break;				\
+	case 3: func args(3); break;				\
+	default: func args(4); break;				\
+	}
+
+/*--------------------------------------------------------------------*/
+static INLINE void mont_add_core(uint32 *n, uint32 *a, uint32 *b,
+				uint32 *res, uint32 nwords) {
+
+	uint32 i;
+	uint32 carry = 0;
+
+	for (i = 0; i < nwords; i++) {
+		uint64 sum = (uint64)a[i] + b[i] + carry;
+		res[i] = (uint32)sum;
+		carry = (uint32)(sum >> 32);
+	}
+	res_reduce(res, carry, n, res, nwords);
+}
+
+#define mont_add_args(nwords) (m->n, a, b, res, nwords)
+
+static void mont_add(monty_t *m, uint32 *a, uint32 *b, uint32 *res) {
+	MONT_DISPATCH(m, mont_add_core, mont_add_args)
+}
+
+/*--------------------------------------------------------------------*/
+static INLINE void mont_sub_core(uint32 *n, uint32 *a, uint32 *b,
+				uint32 *res, uint32 nwords) {
+
+	uint32 i;
+	uint32 mask;
+	uint32 borrow = 0;
+
+	for (i = 0; i < nwords; i++) {
+		uint64 diff = (uint64)a[i] - b[i] - borrow;
+		res[i] = (uint32)diff;
+		borrow = (uint32)(diff >> 63);
+	}
+
+	mask = 0 - borrow;
+	for (i = 0, borrow = 0; i < nwords; i++) {
+		uint64 sum = (uint64)res[i] + (n[i] & mask) + borrow;
+		res[i] = (uint32)sum;
+		borrow = (uint32)(sum >> 32);
+	}
+}
+
+#define mont_sub_args(nwords) (m->n, a, b, res, nwords)
+
+static void mont_sub(monty_t *m, uint32 *a, uint32 *b, uint32 *res) {
+	MONT_DISPATCH(m, mont_sub_core, mont_sub_args)
+}
+
+/*--------------------------------------------------------------------*/
+static INLINE void mont_mul_core(uint32 *n, uint32 ninv, 
+				uint32 *a, uint32 *b,
+				uint32 *res, uint32 nwords) {
+
+	/* word-by-word (CIOS) Montgomery multiplication;
+	   the inputs are less than n, and so is the output */
+
+	uint32 i, j;
+	uint32 t[MAX_WORDS + 2];
+
+	for (i = 0; i < nwords + 2; i++)
+		t[i] = 0;
+
+	for (i = 0; i < nwords; i++) {
+		uint32 q;
+		uint32 bi = b[i];
+		uint64 acc = 0;
+
+		for (j = 0; j < nwords; j++) {
+			acc = (uint64)a[j] * bi + t[j] + (acc >> 32);
+			t[j] = (uint32)acc;
+		}
+		acc = (uint64)t[nwords] + (acc >> 32);
+		t[nwords] = (uint32)acc;
+		t[nwords + 1] = (uint32)(acc >> 32);
+
+		q = t[0] * ninv;
+		acc = (uint64)q * n[0] + t[0];
+		for (j = 1; j < nwords; j++) {
+			acc = (uint64)q * n[j] + t[j] + (acc >> 32);
+			t[j - 1] = (uint32)acc;
+		}
+		acc = (uint64)t[nwords] + (acc >> 32);
+		t[nwords - 1] = (uint32)acc;
+		t[nwords] = t[nwords + 1] + (uint32)(acc >> 32);
+	}
+
+	res_reduce(t, t[nwords], n, res, nwords);
+}
+
+#define mont_mul_args(nwords) (m->n, m->ninv, a, b, res, nwords)
+
+static void mont_mul(monty_t *m, uint32 *a, uint32 *b, uint32 *res) {
+	MONT_DISPATCH(m, mont_mul_core, mont_mul_args)
+}
+
+/*--------------------------------------------------------------------*/
+static void mont_init(monty_t *m, mp_t *n) {
+
+	uint32 i;
+	uint32 inv;
+	mp_t r, rem;
+
+	m->nwords = n->nwords;
+	mp_copy(n, &m->mp_n);
+	for (i = 0; i < m->nwords; i++)
+		m->n[i] = n->val[i];
+
+	/* Newton iteration for 1/n mod 2^32; each step
+	   doubles the number of correct bits */
+
+	inv = n->val[0];
+	for (i = 0; i < 4; i++)
+		inv = inv * (2 - n->val[0] * inv);
+	m->ninv = 0 - inv;
+
+	mp_clear(&r);
+	r.nwords = m->nwords + 1;
+	r.val[m->nwords] = 1;
+	mp_mod(&r, n, &rem);
+	for (i = 0; i < m->nwords; i++)
+		m->one[i] = rem.val[i];
+
+	mp_clear(&r);
+	r.nwords = 2 * m->nwords + 1;
+	r.val[2 * m->nwords] = 1;
+	mp_mod(&r, n, &rem);
+	for (i = 0; i < m->nwords; i++)
+		m->r2[i] = rem.val[i];
+}
+
+/*--------------------------------------------------------------------*/
+static void mont_set_1(monty_t *m, uint32 a, uint32 *res) {
+
+	/* convert a single word to Montgomery form */
+
+	uint32 x[MAX_WORDS] = {0};
+
+	x[0] = a;
+	if (m->nwords == 1)
+		x[0] = a % m->n[0];
+	mont_mul(m, x, m->r2, res);
+}
+
+/*--------------------------------------------------------------------*/
+static uint32 mont_get_factor(monty_t *m, uint32 *a, mp_t *factor) {
+
+	/* returns 1 if a shares a nontrivial factor with n.
+	   Since 2^32 is coprime to n this works the same
+	   whether or not a is in Montgomery form */
+
+	mp_t tmp;
+
+	if (res_is_zero(m, a))
+		return 0;
+
+	res_to_mp(m, a, &tmp);
+	mp_gcd(&tmp, &m->mp_n, factor);
+	return !mp_is_one(factor);
+}
+
+/*--------------------------------------------------------------------*/
+static uint32 mont_inv(monty_t *m, uint32 *a, uint32 *res,
+			mp_t *factor) {
+
+	/* res = 1/a. Returns 0 on success, or 1 if a is
+	   not invertible, in which case factor is filled
+	   with gcd(a, n); if the latter is n then a is zero */
+
+	uint32 i;
+	uint32 plain[MAX_WORDS] = {0};
+	uint32 one[MAX_WORDS] = {1, 0};
+	mp_t tmp, inv;
+
+	mont_mul(m, a, one, plain);
+	res_to_mp(m, plain, &tmp);
+	if (mp_modinv(&tmp, &m->mp_n, &inv) != 0) {
+		mp_gcd(&tmp, &m->mp_n, factor);
+		return 1;
+	}
+
+	for (i = 0; i < m->nwords; i++)
+		plain[i] = (i < inv.nwords) ? inv.val[i] : 0;
+	mont_mul(m, plain, m->r2, res);
+	return 0;
+}
+
+/*--------------------------------------------------------------------*/
+static void mont_pow_1(monty_t *m, uint32 *base, uint32 e, uint32 *res) {
+
+	/* res = base^e for e > 0 */
+
+	uint32 b[MAX_WORDS];
+	uint32 mask = 0x80000000;
+
+	res_copy(m, b, base);
+	while (!(e & mask))
+		mask >>= 1;
+
+	res_copy(m, res, b);
+	for (mask >>= 1; mask; mask >>= 1) {
+		mont_mul(m, res, res, res);
+		if (e & mask)
+			mont_mul(m, res, b, res);
+	}
+}
+
+/*--------------------------------------------------------------------*/
+static void build_stage1(uint32 b1, uint32 b1_extra,
+			uint32 *num_mult_out, uint32 **mult_out) {
+
+	/* pack the prime powers up to b1, then the primes
+	   up to b1_extra, into as few 32-bit words as possible */
+
+	uint32 i, p;
+	uint32 num_mult = 0;
+	uint32 *mult = (uint32 *)xmalloc(64 * sizeof(uint32));
+	uint32 num_alloc = 64;
+	uint64 curr = 1;
+
+	for (i = p = 0; i < PRECOMPUTED_NUM_PRIMES; i++) {
+		uint64 q;
+
+		p += prime_delta[i];
+		if (p > b1 && p > b1_extra)
+			break;
+
+		q = p;
+		if (p <= b1) {
+			while (q * p <= b1)
+				q *= p;
+		}
+
+		if (curr * q >= ((uint64)1 << 32)) {
+			if (num_mult == num_alloc) {
+				num_alloc *= 2;
+				mult = (uint32 *)xrealloc(mult, num_alloc *
+							sizeof(uint32));
+			}
+			mult[num_mult++] = (uint32)curr;
+			curr = 1;
+		}
+		curr *= q;
+	}
+
+	if (num_mult == num_alloc)
+		mult = (uint32 *)xrealloc(mult, (num_alloc + 1) *
+						sizeof(uint32));
+	mult[num_mult++] = (uint32)curr;
+
+	*num_mult_out = num_mult;
+	*mult_out = mult;
+}
+
+/*--------------------------------------------------------------------*/
+static void build_plan(tinyecm_t *t, const tinyecm_param_t *params,
+			tinyecm_plan_t *plan) {
+
+	uint32 i, j, p;
+	uint32 b1, b2;
+	uint32 giant_end;
+	uint8 baby_index[STAGE2_W / 2 + 1];
+
+	/* P-1 */
+
+	build_stage1(params->pm1_b1, 0, &plan->num_pm1_mult,
+			&plan->pm1_mult);
+
+	for (i = p = 0; i < PRECOMPUTED_NUM_PRIMES; i++) {
+		p += prime_delta[i];
+		if (p > params->pm1_b1)
+			break;
+	}
+	plan->pm1_b2_start = p;
+	plan->pm1_b2_index = i;
+
+	/* ECM. The primes too small to be paired by the
+	   stage 2 giant steps are folded into stage 1 */
+
+	b1 = params->ecm_b1;
+	b2 = MIN(params->ecm_b2, PRECOMPUTED_PRIME_BOUND);
+	build_stage1(b1, STAGE2_W / 2, &plan->num_ecm_mult,
+			&plan->ecm_mult);
+
+	memset(baby_index, 0xff, sizeof(baby_index));
+	for (i = 0; i < STAGE2_BABY; i++)
+		baby_index[t->baby[i]] = i;
+
+	b1 = MAX(b1, STAGE2_W / 2);
+	plan->giant_start = (b1 + STAGE2_W / 2) / STAGE2_W;
+	giant_end = (b2 + STAGE2_W / 2) / STAGE2_W;
+	plan->num_giant = giant_end - plan->giant_start + 1;
+	plan->giant_mask = (uint32 *)xcalloc(plan->num_giant,
+						sizeof(uint32));
+
+	for (i = p = 0; i < PRECOMPUTED_NUM_PRIMES; i++) {
+		uint32 giant;
+
+		p += prime_delta[i];
+		if (p <= b1)
+			continue;
+		if (p > b2)
+			break;
+
+		giant = (p + STAGE2_W / 2) / STAGE2_W;
+		j = abs((int32)p - (int32)(giant * STAGE2_W));
+		plan->giant_mask[giant - plan->giant_start] |=
+					1 << baby_index[j];
+	}
+}
+
+/*--------------------------------------------------------------------*/
+static uint32 pm1(monty_t *m, const tinyecm_param_t *params,
+			tinyecm_plan_t *plan, mp_t *factor) {
+
+	uint32 i, p;
+	uint32 x[MAX_WORDS];
+	uint32 xp[MAX_WORDS];
+	uint32 acc[MAX_WORDS];
+	uint32 tmp[MAX_WORDS];
+	uint32 gap[MAX_PRIME_GAP / 2][MAX_WORDS];
+
+	/* stage 1 */
+
+	mont_set_1(m, 3, x);
+	for (i = 0; i < plan->num_pm1_mult; i++)
+		mont_pow_1(m, x, plan->pm1_mult[i], x);
+
+	mont_sub(m, x, m->one, tmp);
+	if (mont_get_factor(m, tmp, factor))
+		return (mp_cmp(factor, &m->mp_n) != 0);
+
+	/* stage 2: x^p for each prime p comes from the
+	   previous one and x^(gap between the two) */
+
+	mont_mul(m, x, x, gap[0]);
+	for (i = 1; i < MAX_PRIME_GAP / 2; i++)
+		mont_mul(m, gap[i - 1], gap[0], gap[i]);
+
+	p = plan->pm1_b2_start;
+	mont_pow_1(m, x, p, xp);
+	res_copy(m, acc, m->one);
+
+	for (i = plan->pm1_b2_index + 1; i < PRECOMPUTED_NUM_PRIMES; i++) {
+		mont_sub(m, xp, m->one, tmp);
+		mont_mul(m, acc, tmp, acc);
+
+		p += prime_delta[i];
+		if (p > params->pm1_b2)
+			break;
+		mont_mul(m, xp, gap[prime_delta[i] / 2 - 1], xp);
+	}
+
+	if (mont_get_factor(m, acc, factor))
+		return (mp_cmp(factor, &m->mp_n) != 0);
+	return 0;
+}
+
+/*--------------------------------------------------------------------*/
+static void ed_dbl(monty_t *m, ed_curve_t *c, ed_point_t *p,
+			ed_point_t *res, uint32 need_t) {
+
+	/* 'dbl-2008-hwcd'; the T coordinate is only needed
+	   by a following addition */
+
+	uint32 a[MAX_WORDS];
+	uint32 b[MAX_WORDS];
+	uint32 cc[MAX_WORDS];
+	uint32 d[MAX_WORDS];
+	uint32 e[MAX_WORDS];
+	uint32 f[MAX_WORDS];
+	uint32 g[MAX_WORDS];
+	uint32 h[MAX_WORDS];
+
+	mont_mul(m, p->X, p->X, a);
+	mont_mul(m, p->Y, p->Y, b);
+	mont_mul(m, p->Z, p->Z, cc);
+	mont_add(m, cc, cc, cc);
+	mont_mul(m, c->a, a, d);
+	mont_add(m, p->X, p->Y, e);
+	mont_mul(m, e, e, e);
+	mont_sub(m, e, a, e);
+	mont_sub(m, e, b, e);
+	mont_add(m, d, b, g);
+	mont_sub(m, g, cc, f);
+	mont_sub(m, d, b, h);
+
+	mont_mul(m, e, f, res->X);
+	mont_mul(m, g, h, res->Y);
+	mont_mul(m, f, g, res->Z);
+	if (need_t)
+		mont_mul(m, e, h, res->T);
+}
+
+/*--------------------------------------------------------------------*/
+static void ed_add(monty_t *m, ed_curve_t *c, ed_point_t *p1,
+			ed_point_t *p2, ed_point_t *res, uint32 need_t) {
+
+	/* 'add-2008-hwcd', except that the T coordinate
+	   of p2 is premultiplied by the curve constant d */
+
+	uint32 a[MAX_WORDS];
+	uint32 b[MAX_WORDS];
+	uint32 cc[MAX_WORDS];
+	uint32 d[MAX_WORDS];
+	uint32 e[MAX_WORDS];
+	uint32 f[MAX_WORDS];
+	uint32 g[MAX_WORDS];
+	uint32 h[MAX_WORDS];
+
+	mont_mul(m, p1->X, p2->X, a);
+	mont_mul(m, p1->Y, p2->Y, b);
+	mont_mul(m, p1->T, p2->T, cc);
+	mont_mul(m, p1->Z, p2->Z, d);
+	mont_add(m, p1->X, p1->Y, e);
+	mont_add(m, p2->X, p2->Y, f);
+	mont_mul(m, e, f, e);
+	mont_sub(m, e, a, e);
+	mont_sub(m, e, b, e);
+	mont_sub(m, d, cc, f);
+	mont_add(m, d, cc, g);
+	mont_mul(m, c->a, a, a);
+	mont_sub(m, b, a, h);
+
+	mont_mul(m, e, f, res->X);
+	mont_mul(m, g, h, res->Y);
+	mont_mul(m, f, g, res->Z);
+	if (need_t)
+		mont_mul(m, e, h, res->T);
+}
+
+/*--------------------------------------------------------------------*/
+static void ed_mul(monty_t *m, ed_curve_t *c, ed_point_t *p, uint32 k) {
+
+	/* p = k * p for k > 0, using the non-adjacent form
+	   of k. The T coordinate of the result is valid */
+
+	int32 i;
+	int8 naf[34];
+	uint32 num_digits = 0;
+	uint64 kk = k;
+	uint32 zero[MAX_WORDS] = {0};
+	ed_point_t plus, minus;
+
+	while (kk) {
+		int8 digit = 0;
+		if (kk & 1) {
+			digit = 2 - (int8)(kk & 3);
+			kk -= digit;
+		}
+		naf[num_digits++] = digit;
+		kk >>= 1;
+	}
+
+	plus = *p;
+	mont_mul(m, plus.T, c->d, plus.T);
+	res_copy(m, minus.Y, plus.Y);
+	res_copy(m, minus.Z, plus.Z);
+	mont_sub(m, zero, plus.X, minus.X);
+	mont_sub(m, zero, plus.T, minus.T);
+
+	for (i = num_digits - 2; i >= 0; i--) {
+		ed_dbl(m, c, p, p, naf[i] != 0 || i == 0);
+		if (naf[i] > 0)
+			ed_add(m, c, p, &plus, p, i == 0);
+		else if (naf[i] < 0)
+			ed_add(m, c, p, &minus, p, i == 0);
+	}
+}
+
+/*--------------------------------------------------------------------*/
+static uint32 ecm_init_curve(monty_t *m, uint32 sigma, ed_curve_t *c,
+				ed_point_t *p, mp_t *factor) {
+
+	/* Suyama's parametrization gives a Montgomery curve
+	   B*y^2 = x^3 + A*x^2 + x and a point on it with
+
+		u = sigma^2 - 5,  v = 4*sigma
+		x0 = u^3 / v^3
+		A = (v-u)^3 * (3*u+v) / (4*u^3*v) - 2
+
+	   We choose B so that the point has y = 1, and the
+	   twisted Edwards equivalent has a = (A+2)/B,
+	   d = (A-2)/B and the point (x0, (x0-1)/(x0+1)).
+
+	   Returns 1 if a factor turned up along the way,
+	   2 if the curve is unusable and 0 otherwise */
+
+	uint32 u[MAX_WORDS];
+	uint32 v[MAX_WORDS];
+	uint32 u3[MAX_WORDS];
+	uint32 v3[MAX_WORDS];
+	uint32 t0[MAX_WORDS];
+	uint32 t1[MAX_WORDS];
+	uint32 t2[MAX_WORDS];
+	uint32 inv[MAX_WORDS];
+	uint32 x0[MAX_WORDS];
+	uint32 aa[MAX_WORDS];
+	uint32 b[MAX_WORDS];
+	uint32 two[MAX_WORDS];
+
+	mont_set_1(m, sigma, t0);
+	mont_mul(m, t0, t0, u);
+	mont_set_1(m, 5, t1);
+	mont_sub(m, u, t1, u);
+	mont_add(m, t0, t0, v);
+	mont_add(m, v, v, v);
+
+	mont_mul(m, u, u, u3);
+	mont_mul(m, u3, u, u3);
+	mont_mul(m, v, v, v3);
+	mont_mul(m, v3, v, v3);
+
+	/* invert v^3 and 4*u^3*v together */
+
+	mont_mul(m, u3, v, t0);
+	mont_add(m, t0, t0, t0);
+	mont_add(m, t0, t0, t0);
+	mont_mul(m, t0, v3, t1);
+	if (mont_inv(m, t1, inv, factor))
+		goto inv_failed;
+
+	mont_mul(m, inv, t0, t1);
+	mont_mul(m, u3, t1, x0);
+	mont_mul(m, inv, v3, t1);
+
+	mont_sub(m, v, u, t0);
+	mont_mul(m, t0, t0, t2);
+	mont_mul(m, t2, t0, t2);
+	mont_add(m, u, u, t0);
+	mont_add(m, t0, u, t0);
+	mont_add(m, t0, v, t0);
+	mont_mul(m, t2, t0, t2);
+	mont_mul(m, t2, t1, aa);
+	mont_add(m, m->one, m->one, two);
+	mont_sub(m, aa, two, aa);
+
+	/* B = x0 * (x0 * (x0 + A) + 1); invert B and x0+1
+	   together */
+
+	mont_add(m, x0, aa, b);
+	mont_mul(m, b, x0, b);
+	mont_add(m, b, m->one, b);
+	mont_mul(m, b, x0, b);
+	mont_add(m, x0, m->one, t0);
+	mont_mul(m, b, t0, t1);
+	if (mont_inv(m, t1, inv, factor))
+		goto inv_failed;
+
+	mont_mul(m, inv, t0, t1);
+	mont_add(m, aa, two, t2);
+	mont_mul(m, t2, t1, c->a);
+	mont_sub(m, aa, two, t2);
+	mont_mul(m, t2, t1, c->d);
+
+	mont_mul(m, inv, b, t1);
+	mont_sub(m, x0, m->one, t2);
+	res_copy(m, p->X, x0);
+	mont_mul(m, t2, t1, p->Y);
+	res_copy(m, p->Z, m->one);
+	mont_mul(m, p->X, p->Y, p->T);
+	return 0;
+
+inv_failed:
+	if (mp_is_one(factor) || mp_cmp(factor, &m->mp_n) == 0)
+		return 2;
+	return 1;
+}
+
+/*--------------------------------------------------------------------*/
+static uint32 ecm_stage2(tinyecm_t *t, monty_t *m, ed_curve_t *c,
+			tinyecm_plan_t *plan, ed_point_t *p,
+			mp_t *factor) {
+
+	/* baby steps j*p for j coprime to STAGE2_W, giant
+	   steps i*STAGE2_W*p; since negating an Edwards point
+	   only changes the sign of x, (i*STAGE2_W +- j)*p is
+	   the identity mod a factor of n when the y coordinates
+	   of i*STAGE2_W*p and j*p agree mod that factor */
+
+	uint32 i, j, k;
+	uint32 baby_y[STAGE2_BABY][MAX_WORDS];
+	uint32 baby_z[STAGE2_BABY][MAX_WORDS];
+	uint32 acc[MAX_WORDS];
+	uint32 t0[MAX_WORDS];
+	uint32 t1[MAX_WORDS];
+	ed_point_t p2, curr, giant, step;
+
+	ed_dbl(m, c, p, &p2, 1);
+	mont_mul(m, p2.T, c->d, p2.T);
+
+	curr = *p;
+	for (i = 1, j = 0; i <= STAGE2_W / 2; i += 2) {
+		if (j < STAGE2_BABY && t->baby[j] == i) {
+			res_copy(m, baby_y[j], curr.Y);
+			res_copy(m, baby_z[j], curr.Z);
+			j++;
+		}
+		if (i < STAGE2_W / 2)
+			ed_add(m, c, &curr, &p2, &curr, 1);
+	}
+
+	/* curr is now (STAGE2_W/2) * p */
+
+	ed_dbl(m, c, &curr, &step, 1);
+	giant = step;
+	if (plan->giant_start > 1)
+		ed_mul(m, c, &giant, plan->giant_start);
+	mont_mul(m, step.T, c->d, step.T);
+
+	res_copy(m, acc, m->one);
+	for (i = 0; i < plan->num_giant; i++) {
+		uint32 mask = plan->giant_mask[i];
+
+		for (k = 0; mask; k++, mask >>= 1) {
+			if (!(mask & 1))
+				continue;
+
+			mont_mul(m, giant.Y, baby_z[k], t0);
+			mont_mul(m, baby_y[k], giant.Z, t1);
+			mont_sub(m, t0, t1, t0);
+			mont_mul(m, acc, t0, acc);
+		}
+		if (i < plan->num_giant - 1)
+			ed_add(m, c, &giant, &step, &giant, 1);
+	}
+
+	if (mont_get_factor(m, acc, factor))
+		return (mp_cmp(factor, &m->mp_n) != 0);
+	return 0;
+}
+
+/*--------------------------------------------------------------------*/
+static uint32 ecm(tinyecm_t *t, monty_t *m,
+			const tinyecm_param_t *params,
+			tinyecm_plan_t *plan, mp_t *factor) {
+
+	uint32 i, j;
+	uint32 seed1 = 0x13579bdf;
+	uint32 seed2 = 0x2468ace0;
+
+	/* the curves depend only on the curve number, so that
+	   the outcome for a given input is always the same */
+
+	for (i = 0; i < params->max_curves; i++) {
+		ed_curve_t c;
+		ed_point_t p;
+		uint32 sigma = 6 + (get_rand(&seed1, &seed2) >> 2);
+
+		j = ecm_init_curve(m, sigma, &c, &p, factor);
+		if (j == 1)
+			return 1;
+		if (j == 2)
+			continue;
+
+		for (j = 0; j < plan->num_ecm_mult; j++)
+			ed_mul(m, &c, &p, plan->ecm_mult[j]);
+
+		if (mont_get_factor(m, p.X, factor)) {
+			if (mp_cmp(factor, &m->mp_n) != 0)
+				return 1;
+			continue;
+		}
+
+		if (ecm_stage2(t, m, &c, plan, &p, factor))
+			return 1;
+	}
+
+	return 0;
+}
+
+/*--------------------------------------------------------------------*/
+void * tinyecm_init(void) {
+
+	uint32 i, j;
+	tinyecm_t *t = (tinyecm_t *)xcalloc(1, sizeof(tinyecm_t));
+
+	for (i = 1, j = 0; i < STAGE2_W / 2; i++) {
+		if (mp_gcd_1(i, STAGE2_W) == 1)
+			t->baby[j++] = i;
+	}
+
+	return t;
+}
+
+/*--------------------------------------------------------------------*/
+void * tinyecm_free(void *tinyecm_data) {
+
+	uint32 i;
+	tinyecm_t *t = (tinyecm_t *)tinyecm_data;
+
+	if (t == NULL)
+		return NULL;
+
+	for (i = 0; i < NUM_PARAMS; i++) {
+		free(t->plans[i].pm1_mult);
+		free(t->plans[i].ecm_mult);
+		free(t->plans[i].giant_mask);
+	}
+	free(t);
+	return NULL;
+}
+
+/*--------------------------------------------------------------------*/
+uint32 tinyecm(void *tinyecm_data, mp_t *n,
+		mp_t *factor1, mp_t *factor2) {
+
+	uint32 i;
+	uint32 bits = mp_bits(n);
+	tinyecm_t *t = (tinyecm_t *)tinyecm_data;
+	tinyecm_plan_t *plan;
+	const tinyecm_param_t *params;
+	monty_t m;
+
+	if (bits > TINYECM_MAX_BITS || bits < 8)
+		return 0;
+
+	/* the arithmetic needs odd n, and neither P-1 nor
+	   ECM can split a perfect square */
+
+	if (!(n->val[0] & 1)) {
+		mp_clear(factor1);
+		factor1->nwords = 1;
+		factor1->val[0] = 2;
+		mp_divrem_1(n, 2, factor2);
+		return 1;
+	}
+	if (mp_iroot(n, 2, factor1) == 0) {
+		mp_copy(factor1, factor2);
+		return 1;
+	}
+
+	for (i = 0; i < NUM_PARAMS - 1; i++) {
+		if (bits <= prebuilt_params[i].bits)
+			break;
+	}
+	params = prebuilt_params + i;
+	plan = t->plans + i;
+	if (plan->giant_mask == NULL)
+		build_plan(t, params, plan);
+
+	mont_init(&m, n);
+
+	if (pm1(&m, params, plan, factor1) ||
+	    ecm(t, &m, params, plan, factor1)) {
+		mp_div(n, factor1, factor2);
+		return 1;
+	}
+
+	return 0;
+}
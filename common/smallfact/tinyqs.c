@@ -72,6 +72,13 @@ static const uint64 bitmask[64] = {
 #define LARGE_PRIME_HASH(x) (((uint32)(x) * ((uint32)40499 * 65543)) >> \
 				(32 - LOG2_PARTIAL_TABLE_SIZE))
 
+static const uint16 mult_list[] = 
+		{1, 3, 5, 7, 11, 13, 15, 17, 19, 21, 23,
+		 29, 31, 33, 35, 37, 39, 41, 43, 47, 51,
+		 53, 55, 57, 59, 61, 65, 67, 69, 71, 73};
+
+#define NUM_MULTIPLIERS_TINY (sizeof(mult_list) / sizeof(uint16))
+
 typedef struct {
 	uint32 sieve_offset;
 	uint16 large_prime;
@@ -120,92 +127,104 @@ typedef struct {
 
 	uint32 seed1;
 	uint32 seed2;
+
+	/* quantities that do not depend on the input, computed
+	   once when the context is created. Since the Legendre
+	   symbol is multiplicative, choosing a multiplier only
+	   needs the symbols of n and not those of every k*n */
+
+	uint16 primes[NUM_PRIMES_TINY];
+	double prime_score[NUM_PRIMES_TINY];
+	double mult_score[NUM_MULTIPLIERS_TINY];
+	int16 mult_legendre[NUM_MULTIPLIERS_TINY][NUM_PRIMES_TINY];
 } tiny_qs_params;
 
 /*----------------------------------------------------------------------*/
-static uint32 init_one_fb_tiny(uint32 fb_size, 
-			mp_t *n, tiny_fb *factor_base) {
+static void init_fb_tiny(tiny_qs_params *params) {
 
-	uint32 i, j;
-	uint32 prime;
+	uint32 i, j, fb_size;
+	uint32 best_mult = 0;
+	uint32 nmodp[NUM_PRIMES_TINY];
+	int16 n_legendre[NUM_PRIMES_TINY];
+	double score, best_score;
+	tiny_fb *factor_base = params->factor_base;
 
-	i = MIN_FB_OFFSET;
-	prime = 2;
-	factor_base[i].prime = prime;
+	/* find n mod p and the Legendre symbol of n once; the
+	   symbol of k*n is then the product of two table entries */
 
-	for (i++, j = 1; i < fb_size && j < NUM_PRIMES_TINY; j++) {
+	for (j = 1; j < NUM_PRIMES_TINY; j++) {
+		uint32 prime = params->primes[j];
 
-		tiny_fb *fbptr = factor_base + i;
-		uint32 nmodp;
-
-		prime += prime_delta[j];
-		nmodp = mp_mod_1(n, prime);
-		if (nmodp == 0) {
-			fbptr->prime = (uint16)prime;
-			fbptr->logprime = logprime_list[j];
-			i++;
-		}
-		else if (mp_legendre_1(nmodp, prime) == 1) {
-			fbptr->prime = (uint16)prime;
-			fbptr->logprime = logprime_list[j];
-			fbptr->modsqrt = mp_modsqrt_1(nmodp, prime);
-			i++;
-		}
+		nmodp[j] = mp_mod_1(&params->n, prime);
+		if (nmodp[j] == 0)
+			n_legendre[j] = 0;
+		else
+			n_legendre[j] = (int16)mp_legendre_1(nmodp[j], prime);
 	}
 
-	return i;
-}
-
-/*----------------------------------------------------------------------*/
-static void init_fb_tiny(tiny_qs_params *params) {
-
-	uint32 i, j;
-	tiny_fb next_fb_array[MAX_FB_SIZE_TINY];
-	uint32 next_fb_size;
-	double score, best_score;
-	mp_t kn;
-	uint16 mult_list[] = {1, 3, 5, 7, 11, 13, 15, 17, 19, 21, 23,
-			 29, 31, 33, 35, 37, 39, 41, 43, 47, 51,
-			 53, 55, 57, 59, 61, 65, 67, 69, 71, 73};
-
 	best_score = 1000.0;
 	score = 0;
 
-	for (i = 0; i < sizeof(mult_list) / sizeof(uint16); i++) {
+	for (i = 0; i < NUM_MULTIPLIERS_TINY; i++) {
 
-		uint32 curr_mult = mult_list[i];
+		int16 *k_legendre = params->mult_legendre[i];
 
-		mp_mul_1(&params->n, curr_mult, &kn);
-
-		next_fb_size = init_one_fb_tiny(MAX_FB_SIZE_TINY,
-						&kn, next_fb_array);
-		
 		if ((params->n.val[0] & 7) == 1)
-			score = 0.5 * log((double)curr_mult) - 2 * M_LN2;
+			score = params->mult_score[i] - 2 * M_LN2;
 		else if ((params->n.val[0] & 7) == 5)
-			score = 0.5 * log((double)curr_mult) - M_LN2;
+			score = params->mult_score[i] - M_LN2;
 		else
-			score = 0.5 * log((double)curr_mult) - 0.5 * M_LN2;
+			score = params->mult_score[i] - 0.5 * M_LN2;
 
-		for (j = MIN_FB_OFFSET + 1; j < next_fb_size; j++) {
-			tiny_fb *fbptr = next_fb_array + j;
-			uint32 prime = fbptr->prime;
+		for (j = 1, fb_size = MIN_FB_OFFSET + 1; 
+				fb_size < MAX_FB_SIZE_TINY && 
+				j < NUM_PRIMES_TINY; j++) {
 
-			if (prime <= 73 && curr_mult % prime == 0)
-				score -= log((double)prime) / (prime - 1);
+			if (n_legendre[j] * k_legendre[j] == -1)
+				continue;
+
+			if (k_legendre[j] == 0)
+				score -= params->prime_score[j];
 			else
-				score -= 2.0 * log((double)prime) / (prime - 1);
+				score -= 2.0 * params->prime_score[j];
+			fb_size++;
 		}
 
 		if (score < best_score) {
-			memcpy(params->factor_base, next_fb_array,
-					sizeof(params->factor_base));
 			best_score = score;
-			params->fb_size = next_fb_size;
-			params->multiplier = curr_mult;
-			mp_copy(&kn, &params->kn);
+			best_mult = i;
 		}
 	}
+
+	/* build the factor base for the winning multiplier */
+
+	params->multiplier = mult_list[best_mult];
+	mp_mul_1(&params->n, params->multiplier, &params->kn);
+
+	factor_base[MIN_FB_OFFSET].prime = 2;
+
+	for (j = 1, fb_size = MIN_FB_OFFSET + 1; 
+			fb_size < MAX_FB_SIZE_TINY && 
+			j < NUM_PRIMES_TINY; j++) {
+
+		tiny_fb *fbptr = factor_base + fb_size;
+		uint32 prime = params->primes[j];
+		uint32 knmodp;
+
+		if (n_legendre[j] * 
+		    params->mult_legendre[best_mult][j] == -1)
+			continue;
+
+		knmodp = nmodp[j] * params->multiplier % prime;
+		fbptr->prime = (uint16)prime;
+		fbptr->logprime = logprime_list[j];
+		fbptr->modsqrt = 0;
+		if (knmodp != 0)
+			fbptr->modsqrt = mp_modsqrt_1(knmodp, prime);
+		fb_size++;
+	}
+
+	params->fb_size = fb_size;
 }
 
 /*----------------------------------------------------------------------*/
@@ -726,17 +745,57 @@ static uint32 find_factors_tiny(tiny_qs_params *params,
 }
 
 /*----------------------------------------------------------------------*/
-uint32 tinyqs(mp_t *n, mp_t *factor1, mp_t *factor2) {
+void * tinyqs_init(void) {
 
+	uint32 i, j;
 	tiny_qs_params *params;
+
+	params = (tiny_qs_params *)xmalloc(sizeof(tiny_qs_params));
+
+	params->primes[0] = 2;
+	for (j = 1; j < NUM_PRIMES_TINY; j++) {
+		uint32 prime = params->primes[j-1] + prime_delta[j];
+
+		params->primes[j] = (uint16)prime;
+		params->prime_score[j] = log((double)prime) / (prime - 1);
+	}
+
+	for (i = 0; i < NUM_MULTIPLIERS_TINY; i++) {
+		uint32 mult = mult_list[i];
+
+		params->mult_score[i] = 0.5 * log((double)mult);
+		for (j = 1; j < NUM_PRIMES_TINY; j++) {
+			uint32 prime = params->primes[j];
+
+			if (mult % prime == 0)
+				params->mult_legendre[i][j] = 0;
+			else
+				params->mult_legendre[i][j] = (int16)
+					mp_legendre_1(mult % prime, prime);
+		}
+	}
+
+	return params;
+}
+
+/*----------------------------------------------------------------------*/
+void * tinyqs_free(void *tinyqs_data) {
+
+	free(tinyqs_data);
+	return NULL;
+}
+
+/*----------------------------------------------------------------------*/
+uint32 tinyqs(void *tinyqs_data, mp_t *n, 
+		mp_t *factor1, mp_t *factor2) {
+
+	tiny_qs_params *params = (tiny_qs_params *)tinyqs_data;
 	uint32 i, bits;
 	uint32 fb_size, status = 0;
 	uint16 bound;
 	uint16 large_prime_mult;
 	mp_t tmp1, tmp2;
 
-	params = (tiny_qs_params *)xmalloc(sizeof(tiny_qs_params));
-
 	mp_copy(n, &params->n);
 	params->num_relations = 0;
 	params->seed1 = 287643287;
@@ -811,6 +870,5 @@ uint32 tinyqs(mp_t *n, mp_t *factor1, mp_t *factor2) {
 		}
 	}
 
-	free(params);
 	return status;
 }
@@ -110,6 +110,22 @@ get_cpu_time(void) {
 #endif
 }
 
+/*------------------------------------------------------------------*/
+double
+get_wall_time(void) {
+
+#if defined(WIN32) || defined(_WIN64)
+	LARGE_INTEGER freq, count;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&count);
+	return (double)count.QuadPart / freq.QuadPart;
+#else
+	struct timeval t;
+	gettimeofday(&t, NULL);
+	return t.tv_sec + t.tv_usec / 1000000.0;
+#endif
+}
+
 /*--------------------------------------------------------------------*/
 void set_idle_priority(void) {
 
@@ -169,6 +185,10 @@ typedef union {
 			"movl %%esi, %%ebx   \n\t"		\
 			:"=a"(a), "=m"(b), "=c"(c), "=d"(d) 	\
 			:"0"(code1), "2"(code2) : "%esi")
+	#define XGETBV0(a)					\
+	{	uint32 _hi;					\
+		ASM_G volatile("xgetbv" : "=a"(a), "=d"(_hi) : "c"(0)); \
+	}
 
 #elif defined(GCC_ASM64X)
 	#define HAS_CPUID
@@ -188,6 +208,10 @@ typedef union {
 			"movq %%rsi, %%rbx   \n\t"		\
 			:"=a"(a), "=m"(b), "=c"(c), "=d"(d) 	\
 			:"0"(code1), "2"(code2) : "%rsi")
+	#define XGETBV0(a)					\
+	{	uint32 _hi;					\
+		ASM_G volatile("xgetbv" : "=a"(a), "=d"(_hi) : "c"(0)); \
+	}
 
 #elif defined(_MSC_VER)
 	#include <intrin.h>
@@ -208,6 +232,7 @@ typedef union {
 		c = _z[2]; \
 		d = _z[3]; \
 	}
+	#define XGETBV0(a) a = (uint32)_xgetbv(0)
 #endif
 
 void get_cache_sizes(uint32 *level1_size_out,
@@ -468,6 +493,30 @@ enum cpu_type get_cpu_type(void) {
 				cpu = cpu_athlon;
 		}
 	}
+
+	/* CPUs with the AVX2 or AVX512 instruction sets are
+	   classified by those instead, provided the OS saves
+	   the wider registers across context switches */
+
+	CPUID(0, a, b, c, d);
+	if (a >= 7) {
+		uint32 xcr0 = 0;
+
+		CPUID(1, a, b, c, d);
+		if (c & (1 << 27))		/* OSXSAVE */
+			XGETBV0(xcr0);
+
+		CPUID2(7, 0, a, b, c, d);
+		if ((xcr0 & 0x06) == 0x06 &&	/* YMM state */
+		    (b & (1 << 5))) {		/* AVX2 */
+			cpu = cpu_x86_avx2;
+		}
+		if ((xcr0 & 0xe6) == 0xe6 &&	/* ZMM state */
+		    (b & (1 << 16)) &&		/* AVX512F */
+		    (b & (1 << 30))) {		/* AVX512BW */
+			cpu = cpu_x86_avx512;
+		}
+	}
 #endif
 
 	return cpu;
@@ -20,6 +20,8 @@ $Id$
 #endif
 
 msieve_obj *g_curr_factorization = NULL;
+volatile uint32 g_batch_running = 0;
+volatile uint32 g_batch_stop = 0;
 
 /*--------------------------------------------------------------------*/
 void handle_signal(int sig) {
@@ -28,7 +30,12 @@ void handle_signal(int sig) {
 
 	printf("\nreceived signal %d; shutting down\n", sig);
 	
-	if (obj && (obj->flags & MSIEVE_FLAG_SIEVING_IN_PROGRESS))
+	/* in batch mode, finish the numbers already started
+	   but do not start any more */
+
+	if (g_batch_running)
+		g_batch_stop = 1;
+	else if (obj && (obj->flags & MSIEVE_FLAG_SIEVING_IN_PROGRESS))
 		obj->flags |= MSIEVE_FLAG_STOP_SIEVING;
 	else
 		_exit(0);
@@ -97,6 +104,12 @@ void print_usage(char *progname) {
 		 "             <name> (default worktodo.ini) instead of\n"
 		 "             from the command line\n"
 		 "   -m        manual mode: enter numbers via standard input\n"
+		 "   -b        batch mode: factor all the numbers from the\n"
+		 "             input file (or from standard input if -m is\n"
+		 "             also given) across the threads chosen by -t,\n"
+		 "             without any savefile or logfile; one line of\n"
+		 "             factors is printed per number, in the order\n"
+		 "             the numbers finish\n"
 	         "   -q        quiet: do not generate any log information,\n"
 		 "             only print any factors found\n"
 	         "   -d <min>  deadline: if still sieving after <min>\n"
@@ -114,7 +127,9 @@ void print_usage(char *progname) {
 		 " elliptic curve options:\n"
 		 "   -e        perform 'deep' ECM, seek factors > 15 digits\n\n"
 		 " quadratic sieve options:\n"
-		 "   -c        client: only perform sieving\n\n"
+		 "   -c        client: only perform sieving\n"
+		 "   -a <args> use the arguments in the (quoted) string\n"
+		 "             <args> to configure the sieve\n\n"
 		 " number field sieve options:\n\n"
 		 "           [nfs_phase] \"arguments\"\n\n"
 		 " where the first part is one or more of:\n"
@@ -280,6 +295,72 @@ void factor_integer(char *buf, uint32 flags,
 		msieve_obj_free(obj);
 }
 
+/*--------------------------------------------------------------------*/
+typedef struct {
+	FILE *infile;
+	char buf[500];
+} batch_t;
+
+static char * batch_next(void *data) {
+
+	batch_t *b = (batch_t *)data;
+
+	/* return the next line that contains something to factor,
+	   skipping past any leading junk the same way that
+	   factor_integer() does */
+
+	while (!g_batch_stop) {
+		char *int_start, *last;
+
+		b->buf[0] = 0;
+		if (fgets(b->buf, (int)sizeof(b->buf), b->infile) == NULL)
+			break;
+
+		last = strchr(b->buf, '\n');
+		if (last)
+			*last = 0;
+		int_start = b->buf;
+		while (*int_start && !isdigit(*int_start) &&
+				*int_start != '(' ) {
+			int_start++;
+		}
+		if (*int_start != 0)
+			return int_start;
+	}
+	return NULL;
+}
+
+static void batch_report(void *data, uint32 index, msieve_obj *obj) {
+
+	/* each line names its input, so the results need not
+	   appear in input order */
+
+	msieve_factor *factor = obj->factors;
+
+	(void)data;
+	(void)index;
+
+	printf("%s:", obj->input);
+	while (factor != NULL) {
+		char *factor_type;
+
+		if (factor->factor_type == MSIEVE_PRIME)
+			factor_type = "p";
+		else if (factor->factor_type == MSIEVE_COMPOSITE)
+			factor_type = "c";
+		else
+			factor_type = "prp";
+
+		printf(" %s%d:%s", factor_type, 
+				(int32)strlen(factor->number), 
+				factor->number);
+		factor = factor->next;
+	}
+	printf("\n");
+	fflush(stdout);
+}
+
+/*--------------------------------------------------------------------*/
 #ifdef WIN32
 DWORD WINAPI countdown_thread(LPVOID pminutes) {
 	DWORD minutes = *(DWORD *)pminutes;
@@ -316,6 +397,7 @@ int main(int argc, char **argv) {
 	char *nfs_fbfile_name = NULL;
 	uint32 flags;
 	char manual_mode = 0;
+	char batch_mode = 0;
 	int i;
 	int32 deadline = 0;
 	uint32 max_relations = 0;
@@ -390,6 +472,11 @@ int main(int argc, char **argv) {
 				i++;
 				break;
 
+			case 'b':
+				batch_mode = 1;
+				i++;
+				break;
+
 			case 'e':
 				flags |= MSIEVE_FLAG_DEEP_ECM;
 				i++;
@@ -525,6 +612,17 @@ int main(int argc, char **argv) {
 				i++;
 				break;
 
+			case 'a':
+				if (i + 1 < argc && argv[i+1][0] != '-') {
+					nfs_args = argv[i+1];
+					i += 2;
+				}
+				else {
+					print_usage(argv[0]);
+					return -1;
+				}
+				break;
+
 			case 'v':
 				flags |= MSIEVE_FLAG_LOG_TO_STDOUT;
 				i++;
@@ -561,7 +659,30 @@ int main(int argc, char **argv) {
 #endif
 	}
 
-	if (isdigit(buf[0]) || buf[0] == '(' ) {
+	if (batch_mode) {
+		batch_t batch;
+
+		batch.infile = stdin;
+		if (!manual_mode) {
+			batch.infile = fopen(infile_name, "r");
+			if (batch.infile == NULL) {
+				printf("cannot open input file '%s'\n", 
+						infile_name);
+				return 0;
+			}
+		}
+
+		g_batch_running = 1;
+		msieve_run_batch(flags, seed1, seed2, cpu, 
+				cache_size1, cache_size2,
+				MAX(num_threads, 1), nfs_args,
+				batch_next, batch_report, &batch);
+		g_batch_running = 0;
+
+		if (batch.infile != stdin)
+			fclose(batch.infile);
+	}
+	else if (isdigit(buf[0]) || buf[0] == '(' ) {
 		factor_integer(buf, flags, savefile_name, 
 				logfile_name, nfs_fbfile_name,
 				&seed1, &seed2,
@@ -591,6 +591,7 @@ void nfs_solve_linear_system(msieve_obj *obj, mpz_t n) {
 	uint64 *dependencies;
 	uint32 skip_matbuild = 0;
 	uint32 cado_filter = 0;
+	uint32 new_deps = 0;
 	time_t cpu_time = time(NULL);
 #ifdef HAVE_MPI
 	int32 grid_bools[2] = {0};
@@ -635,6 +636,31 @@ void nfs_solve_linear_system(msieve_obj *obj, mpz_t n) {
 			logprintf(obj, "assuming CADO-NFS filtering\n");
 			cado_filter = 1;
 		}
+		if (strstr(obj->nfs_args, "new_deps=1")) {
+			logprintf(obj, "regenerating dependencies\n");
+			new_deps = 1;
+		}
+	}
+
+	if (new_deps) {
+		/* the Krylov vectors from the previous run are 
+		   enough to build the dependencies; the matrix 
+		   is not needed. With MPI only the root process 
+		   has any work to do */
+
+#ifdef HAVE_MPI
+		if (obj->mpi_rank != 0)
+			return;
+#endif
+		dependencies = block_lanczos_new_deps(obj, &ncols, 
+							&deps_found);
+		if (deps_found)
+			dump_dependencies(obj, dependencies, ncols);
+		free(dependencies);
+
+		cpu_time = time(NULL) - cpu_time;
+		logprintf(obj, "BLanczosTime: %u\n", (uint32)cpu_time);
+		return;
 	}
 
 #ifdef HAVE_MPI
@@ -821,7 +847,7 @@ void nfs_solve_linear_system(msieve_obj *obj, mpz_t n) {
 				nrows, max_nrows, start_row,
 				num_dense_rows,
 				ncols, max_ncols, start_col,
-				cols, &deps_found);
+				cols, &deps_found, 1);
 	if (deps_found)
 		dump_dependencies(obj, dependencies, max_ncols);
 	free(dependencies);
@@ -38,7 +38,12 @@ static sieve_param_t prebuilt_params[] = {
 	{520,          30000000, 30000000, 1<<29, 1<<29, 64000000, 0, 0, 1},
 };
 
-static void get_sieve_params(uint32 bits, sieve_param_t *params);
+static void get_sieve_params(msieve_obj *obj, uint32 bits, 
+				sieve_param_t *params);
+
+static void tune_sieve_params(msieve_obj *obj, mpz_t n,
+				mpz_poly_t *rat_poly, mpz_poly_t *alg_poly,
+				sieve_param_t *params);
 
 static uint32 nfs_init_savefile(msieve_obj *obj, mpz_t n);
 
@@ -62,7 +67,7 @@ uint32 factor_gnfs(msieve_obj *obj, mp_t *input_n,
 	/* Calculate the factor base bound */
 
 	bits = mpz_sizeinbase(n, 2);
-	get_sieve_params(bits, &params);
+	get_sieve_params(obj, bits, &params);
 
 	gmp_sprintf(obj->mp_sprintf_buf, "%Zd", n);
 	logprintf(obj, "commencing number field sieve (%d-digit input)\n",
@@ -95,6 +100,14 @@ uint32 factor_gnfs(msieve_obj *obj, mp_t *input_n,
 		goto finished;
 	}
 
+	if ((obj->flags & MSIEVE_FLAG_NFS_SIEVE) &&
+	    obj->nfs_args != NULL &&
+	    strstr(obj->nfs_args, "nfs_tune=1") != NULL) {
+		tune_sieve_params(obj, n, &rat_poly, &alg_poly, &params);
+		if (obj->flags & MSIEVE_FLAG_STOP_SIEVING)
+			goto finished;
+	}
+
 	/* if we're supposed to be sieving, 
 	   initialize the savefile */
 
@@ -135,9 +148,19 @@ uint32 factor_gnfs(msieve_obj *obj, mp_t *input_n,
 
 		if (obj->flags & MSIEVE_FLAG_NFS_SIEVE) {
 			savefile_open(&obj->savefile, SAVEFILE_APPEND);
-			relations_found = do_line_sieving(obj, &params, n, 
+			if (obj->nfs_args != NULL &&
+			    strstr(obj->nfs_args, "lattice") != NULL) {
+				relations_found = do_lattice_sieving(obj,
+							&params, n,
 							relations_found,
 							max_relations);
+			}
+			else {
+				relations_found = do_line_sieving(obj,
+							&params, n, 
+							relations_found,
+							max_relations);
+			}
 			savefile_close(&obj->savefile);
 			if (relations_found == 0)
 				break;
@@ -175,69 +198,246 @@ finished:
 }
 
 /*--------------------------------------------------------------------*/
-static void get_sieve_params(uint32 bits, sieve_param_t *params) {
+static void get_sieve_params(msieve_obj *obj, uint32 bits, 
+				sieve_param_t *params) {
+
+	/* the table entries in the sieve parameter file, if
+	   any, have rfb_limit, afb_limit, rfb_lp_size, 
+	   afb_lp_size and sieve_size in that order */
+
+	uint32 i;
+	uint32 num_builtin = sizeof(prebuilt_params) / 
+				sizeof(sieve_param_t);
+	param_row_t builtin[sizeof(prebuilt_params) / 
+				sizeof(sieve_param_t)];
+	param_row_t row;
+
+	memset(builtin, 0, sizeof(builtin));
+	for (i = 0; i < num_builtin; i++) {
+		builtin[i].bits = prebuilt_params[i].bits;
+		builtin[i].values[0] = prebuilt_params[i].rfb_limit;
+		builtin[i].values[1] = prebuilt_params[i].afb_limit;
+		builtin[i].values[2] = prebuilt_params[i].rfb_lp_size;
+		builtin[i].values[3] = prebuilt_params[i].afb_lp_size;
+		builtin[i].values[4] = prebuilt_params[i].sieve_size;
+	}
 
-	sieve_param_t *low, *high;
-	uint32 max_size;
-	uint32 i, j, dist;
-	int64 sieve_size;
+	get_param_row(obj, "nfs", builtin, num_builtin, 5, bits, &row);
 
-	/* For small inputs, use the first set of precomputed
-	   parameters */
+	params->bits = bits;
+	params->rfb_limit = (uint32)row.values[0];
+	params->afb_limit = (uint32)row.values[1];
+	params->rfb_lp_size = (uint32)row.values[2];
+	params->afb_lp_size = (uint32)row.values[3];
+	params->sieve_size = row.values[4];
+	params->sieve_begin = -(int64)params->sieve_size;
+	params->sieve_end = params->sieve_size;
+	params->skewness = 1;		/* suboptimal but safe default */
+}
 
-	if (bits < prebuilt_params[0].bits) {
-		*params = prebuilt_params[0];
-		return;
+/*--------------------------------------------------------------------*/
+/* when tuning the line siever, each set of parameters sieves
+   TUNE_LINES lines starting at each of these b values. Small
+   b values are the most productive, so a sample that only
+   started at b = 1 would favor parameters that are only good
+   early in the run */
+
+static const uint32 tune_b_start[] = {1, 1000, 5000};
+
+#define TUNE_LINES 8
+
+static double estimate_relations(sieve_param_t *params) {
+
+	/* the same guess factor_gnfs makes for the number of
+	   relations needed when there is no other guidance */
+
+	return 0.8 * (params->rfb_lp_size /
+			(log((double)params->rfb_lp_size) - 1) +
+		      params->afb_lp_size /
+			(log((double)params->afb_lp_size) - 1));
+}
+
+static double time_sieve_params(msieve_obj *obj, mpz_t n,
+				mpz_poly_t *rat_poly, mpz_poly_t *alg_poly,
+				sieve_param_t *params) {
+
+	/* sieve a few short ranges of lines with one set of 
+	   parameters, just as '-ns <b0>,<b1>' would, and estimate
+	   the time for the whole factorization. Relations go to
+	   a savefile kept in memory, and the factor base goes 
+	   to a scratch file next to the real one, since it must 
+	   be rebuilt for every parameter set */
+
+	uint32 i;
+	uint32 relations = 0;
+	sieve_param_t trial = *params;
+	savefile_t savefile = obj->savefile;
+	const char *nfs_args = obj->nfs_args;
+	char *fbfile_name = obj->nfs_fbfile_name;
+	char *args;
+	char name[256];
+	double elapsed;
+	double rate;
+
+	trial.sieve_begin = -(int64)trial.sieve_size;
+	trial.sieve_end = trial.sieve_size;
+
+	sprintf(name, "%.240s.tune", fbfile_name);
+	obj->nfs_fbfile_name = name;
+	write_poly(obj, n, rat_poly, alg_poly, params->skewness);
+
+	args = (char *)xmalloc(strlen(nfs_args) + 32);
+	savefile_init_memory(&obj->savefile);
+
+	elapsed = get_wall_time();
+	for (i = 0; i < sizeof(tune_b_start) / sizeof(uint32); i++) {
+
+		/* the b range comes first in the argument string,
+		   so it is found before any range the user gave */
+
+		sprintf(args, "%u,%u %s", tune_b_start[i],
+				tune_b_start[i] + TUNE_LINES - 1, nfs_args);
+		obj->nfs_args = args;
+
+		savefile_open(&obj->savefile, SAVEFILE_APPEND);
+		relations = do_line_sieving(obj, &trial, n, 
+					relations, (uint32)(-1));
+		savefile_close(&obj->savefile);
+		if (obj->flags & MSIEVE_FLAG_STOP_SIEVING)
+			break;
 	}
+	elapsed = MAX(get_wall_time() - elapsed, 1e-3);
+
+	savefile_free(&obj->savefile);
+	obj->savefile = savefile;
+	obj->nfs_args = nfs_args;
+	obj->nfs_fbfile_name = fbfile_name;
+	remove(name);
+	free(args);
+
+	rate = relations / elapsed;
+	elapsed = 1e30;
+	if (rate > 0)
+		elapsed = estimate_relations(&trial) / rate;
+
+	logprintf(obj, "tune: rfb_limit %u, afb_limit %u, rfb_lp_size %u, "
+			"afb_lp_size %u, sieve_size %" PRIu64 ": "
+			"%.1lf rels/sec, estimated %.1lf seconds\n",
+			params->rfb_limit, params->afb_limit,
+			params->rfb_lp_size, params->afb_lp_size,
+			params->sieve_size, rate, elapsed);
+	return elapsed;
+}
+
+/*--------------------------------------------------------------------*/
+static void tune_sieve_params(msieve_obj *obj, mpz_t n,
+				mpz_poly_t *rat_poly, mpz_poly_t *alg_poly,
+				sieve_param_t *params) {
+
+	/* starting from the table parameters, adjust the factor
+	   base limits, then the sieve size, then the large prime 
+	   bounds, keeping whichever choice is fastest on this 
+	   machine. The result is used for the rest of the 
+	   factorization and saved to the sieve parameter file,
+	   if there is one. Only the line siever is tuned */
+
+	uint32 i, j;
+	sieve_param_t best = *params;
+	double best_time;
+	param_row_t row;
+	char buf[LINE_BUF_SIZE];
+	FILE *fp;
 
-	/* bracket the input size between two table entries */
+	static const double scale[3][2] = {
+		{0.75, 1.33},     /* factor base limits */
+		{0.5, 2.0},       /* sieve size */
+		{0.5, 2.0},       /* large prime bounds */
+	};
 
-	max_size = sizeof(prebuilt_params) / sizeof(sieve_param_t);
-	if (bits >= prebuilt_params[max_size - 1].bits) {
-		*params = prebuilt_params[max_size - 1];
-		params->sieve_begin = -params->sieve_size;
-		params->sieve_end = params->sieve_size;
+	if (strstr(obj->nfs_args, "lattice") != NULL) {
+		logprintf(obj, "only the line siever can be tuned\n");
 		return;
 	}
 
-	/* if the input is too large, just use the last table entry.
-	   This means that the choice of parameters is increasingly
-	   inappropriate as the input becomes larger, but there's no
-	   guidance on what to do in this case anyway. */
+	/* parameters in an existing factor base override
+	   the ones chosen here */
 
-	for (i = 0; i < max_size - 1; i++) {
-		if (bits < prebuilt_params[i+1].bits)
-			break;
+	fp = fopen(obj->nfs_fbfile_name, "r");
+	while (fp != NULL && fgets(buf, sizeof(buf), fp) != NULL) {
+		if (strncmp(buf, "FRNUM", 5) == 0) {
+			logprintf(obj, "factor base file already has a "
+					"factor base, not tuning\n");
+			fclose(fp);
+			return;
+		}
 	}
+	if (fp != NULL)
+		fclose(fp);
 
-	/* Otherwise the parameters to use are a weighted average 
-	   of the two table entries the input falls between */
+	logprintf(obj, "tuning sieve parameters\n");
+	best_time = time_sieve_params(obj, n, rat_poly, alg_poly, &best);
+	if (obj->flags & MSIEVE_FLAG_STOP_SIEVING)
+		return;
 
-	low = &prebuilt_params[i];
-	high = &prebuilt_params[i+1];
-	dist = high->bits - low->bits;
-	i = bits - low->bits;
-	j = high->bits - bits;
+	for (i = 0; i < 3; i++) {
+		sieve_param_t start = best;
+
+		for (j = 0; j < 2; j++) {
+			sieve_param_t trial = start;
+			double t;
+
+			if (i == 0) {
+				trial.rfb_limit = (uint32)(trial.rfb_limit *
+							scale[i][j]);
+				trial.afb_limit = (uint32)(trial.afb_limit *
+							scale[i][j]);
+			}
+			else if (i == 1) {
+				trial.sieve_size = (uint64)(trial.sieve_size *
+							scale[i][j]);
+				if (trial.sieve_size < 1000000)
+					continue;
+			}
+			else {
+				double lp = MIN(trial.rfb_lp_size *
+						scale[i][j], 0xffffffff);
+
+				trial.rfb_lp_size = (uint32)lp;
+				lp = MIN(trial.afb_lp_size * scale[i][j],
+						0xffffffff);
+				trial.afb_lp_size = (uint32)lp;
+				if (trial.rfb_lp_size <= trial.rfb_limit ||
+				    trial.afb_lp_size <= trial.afb_limit)
+					continue;
+			}
+
+			t = time_sieve_params(obj, n, rat_poly, 
+						alg_poly, &trial);
+			if (obj->flags & MSIEVE_FLAG_STOP_SIEVING)
+				return;
+			if (t < best_time) {
+				best_time = t;
+				best = trial;
+			}
+		}
+	}
 
-	params->bits = bits;
-	params->rfb_limit = (uint32)(
-			 ((double)low->rfb_limit * j +
-			  (double)high->rfb_limit * i) / dist + 0.5);
-	params->afb_limit = (uint32)(
-			 ((double)low->afb_limit * j +
-			  (double)high->afb_limit * i) / dist + 0.5);
-	params->rfb_lp_size = (uint32)(
-			 ((double)low->rfb_lp_size * j +
-			  (double)high->rfb_lp_size * i) / dist + 0.5);
-	params->afb_lp_size = (uint32)(
-			 ((double)low->afb_lp_size * j +
-			  (double)high->afb_lp_size * i) / dist + 0.5);
-	sieve_size = (uint64)(
-			 ((double)low->sieve_size * j +
-			  (double)high->sieve_size * i) / dist + 0.5);
-	params->sieve_begin = -sieve_size;
-	params->sieve_end = sieve_size;
-	params->skewness = 1;		/* suboptimal but safe default */
+	logprintf(obj, "using rfb_limit %u, afb_limit %u, rfb_lp_size %u, "
+			"afb_lp_size %u, sieve_size %" PRIu64 "\n",
+			best.rfb_limit, best.afb_limit, best.rfb_lp_size,
+			best.afb_lp_size, best.sieve_size);
+
+	best.sieve_begin = -(int64)best.sieve_size;
+	best.sieve_end = best.sieve_size;
+	*params = best;
+
+	row.bits = params->bits;
+	row.values[0] = params->rfb_limit;
+	row.values[1] = params->afb_limit;
+	row.values[2] = params->rfb_lp_size;
+	row.values[3] = params->afb_lp_size;
+	row.values[4] = params->sieve_size;
+	save_param_row(obj, "nfs", 5, &row);
 }
 
 /*--------------------------------------------------------------------*/
@@ -218,6 +218,13 @@ uint32 do_line_sieving(msieve_obj *obj,
 			mpz_t n, uint32 start_relations,
 			uint32 max_relations);
 
+/* the same, using a special-q lattice siever instead */
+
+uint32 do_lattice_sieving(msieve_obj *obj, 
+			sieve_param_t *params,
+			mpz_t n, uint32 start_relations,
+			uint32 max_relations);
+
 /* the largest prime to be used in free relations */
 
 #define FREE_RELATION_LIMIT (1 << 28)
@@ -225,7 +232,8 @@ uint32 do_line_sieving(msieve_obj *obj,
 /* add free relations to the savefile for this factorization;
    the candidates to add are bit entries in free_bits (which is
    compressed by a factor of 2). Returns the number of relations 
-   that were added */
+   that were added. The candidates are tested in parallel, and
+   the results are cached in <savefile>.fr for later calls */
 
 uint32 add_free_relations(msieve_obj *obj, factor_base_t *fb,
 			  uint8 *free_bits);
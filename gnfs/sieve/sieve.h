@@ -16,6 +16,7 @@ $Id$
 #define _GNFS_SIEVE_SIEVE_H_
 
 #include <batch_factor.h>
+#include <thread.h>
 #include "gnfs.h"
 
 #ifdef __cplusplus
@@ -26,9 +27,9 @@ extern "C" {
 
 #define MAX_SKIPPED_FACTOR 256
 
-/* dump one NFS relation to the savefile */
+/* dump one NFS relation to the savefile (print_data) */
 
-void print_relation(savefile_t *savefile, int64 a, uint32 b, 
+void print_relation(void *print_data, int64 a, uint32 b, 
 		uint32 *factors_r, uint32 num_factors_r, 
 		uint32 large_prime_r[MAX_LARGE_PRIMES],
 		uint32 *factors_a, uint32 num_factors_a, 
@@ -52,9 +53,27 @@ int32 fplog_eval_poly(int64 a, uint32 b, mpz_t scratch,
 double get_log_base(mpz_poly_t *poly, 
 			int64 a0, int64 a1, uint32 b);
 
-uint32 read_last_line(msieve_obj *obj, mpz_t n);
+/* the progress of sieving is saved in <savefile>.<suffix>,
+   with suffix "line" for the line siever and "lat" for the 
+   lattice siever. Sieving threads work on ranges of consecutive
+   b values (or special-q values), so besides the first value 
+   not given to any thread the file lists the ranges that were
+   started but not finished when sieving stopped */
 
-void write_last_line(msieve_obj *obj, mpz_t n, uint32 b);
+typedef struct {
+	uint32 start;
+	uint32 end;
+} line_range_t;
+
+/* returns the first unassigned value (0 if there is no
+   such file for n), and fills *ranges with an array of
+   unfinished ranges to be freed by the caller */
+
+uint32 read_last_line(msieve_obj *obj, mpz_t n, char *suffix,
+			line_range_t **ranges, uint32 *num_ranges);
+
+void write_last_line(msieve_obj *obj, mpz_t n, char *suffix, uint32 b,
+			line_range_t *ranges, uint32 num_ranges);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,1121 @@
+/*--------------------------------------------------------------------
+This source distribution is placed in the public domain by its author,
+Jason Papadopoulos. You may use it for any purpose, free of charge,
+without having to notify anyone. I disclaim any responsibility for any
+errors.
+
+Optionally, please be nice and tell me if you find this source to be
+useful. Again optionally, if you add to the functionality present here
+please consider making those additions public too, so that others may
+benefit from your work.
+
+$Id$
+--------------------------------------------------------------------*/
+
+#include "sieve.h"
+
+/* A special-q lattice siever. For a prime q and a root r of
+   the algebraic polynomial mod q, the (a,b) pairs with
+   a = r*b mod q form a lattice, and the algebraic norm of every
+   pair in it is divisible by q. Given a reduced basis (a0,b0),
+   (a1,b1) of that lattice, the sieve region -I/2 <= i < I/2,
+   0 <= j < J maps to the pairs
+
+	(a,b) = i * (a0,b0) + j * (a1,b1)
+
+   whose norms are about as small as the pairs that a line
+   siever finds near the origin, except that the algebraic
+   norms are known to contain q. Sieving many special-q in turn
+   therefore keeps finding relations long after a line siever
+   has exhausted the small values of b.
+
+   In the (i,j) plane, a factor base prime p with root R hits
+   the points with i = rho * j mod p for some rho. Primes smaller
+   than I are sieved one row at a time. Larger primes hit each
+   row at most once, and their hits across the whole region are
+   enumerated with the reduced-lattice method of Franke and
+   Kleinjung, then dropped into one bucket per sieve block.
+   Sieve values that survive on both sides are resieved by
+   scanning the buckets of their block, trial factored, and saved
+   or batch factored exactly as in the line siever */
+
+/* sieving takes place in blocks of this many bytes, each
+   holding a whole number of rows of the sieve region */
+
+#define LAT_BLOCK_BITS 16
+#define LAT_BLOCK_SIZE (1 << LAT_BLOCK_BITS)
+
+/* limits on log2 of the width I of the sieve region */
+
+#define MIN_LOG_I 9
+#define MAX_LOG_I 15
+
+/* logs of sieve values are scaled so that the largest
+   norm in the region is about this many units */
+
+#define LAT_LOG_TARGET 200
+
+/* the norm estimate is computed once for this many
+   consecutive sieve values in a row */
+
+#define NORM_CHUNK 256
+
+/* sieve values that pass are trial factored this
+   many at a time, and at most this many factors
+   are found per side by resieving */
+
+#define MAX_CANDIDATES 255
+#define NUM_LAT_RESIEVE 20
+
+/* a factor base prime small enough that it is sieved
+   one row of the region at a time */
+
+typedef struct {
+	uint32 p;
+	uint32 rho;	/* hits have i = rho * j mod p, or if
+			   rho == p, every i in rows with j = 0 mod p */
+	uint32 offset;	/* first hit in the current row, or
+			   j mod p if rho == p */
+	uint8 logp;
+} lat_small_t;
+
+/* one sieve update from a large factor base prime */
+
+typedef struct {
+	uint32 p;
+	uint16 offset;
+	uint8 logp;
+} lat_update_t;
+
+typedef struct {
+	uint32 num_updates;
+	uint32 num_alloc;
+	lat_update_t *updates;
+} lat_bucket_t;
+
+/* the state of one side (rational or algebraic) */
+
+typedef struct {
+	mpz_poly_t poly;
+	double dpoly[MAX_POLY_DEGREE + 1]; /* poly, for norm estimates */
+
+	uint32 fb_size;
+	fb_entry_t *fb;		/* the factor base, sorted by p */
+	float *log2_p;		/* log2 of each factor base prime */
+	uint32 max_prime;
+
+	lat_small_t *small;	/* sieve state of primes < I for
+				   the current special-q */
+	uint32 num_small;	/* factor base entries with p < I */
+	uint32 num_small_active;/* entries of 'small' in use */
+
+	lat_bucket_t *buckets;	/* updates from primes >= I,
+				   one bucket per sieve block */
+	uint8 *sieve_block;
+
+	uint32 LP1_max;		/* single large prime bound */
+	mpz_t LP2_min;		/* double large prime bounds */
+	mpz_t LP2_max;
+	uint32 cutoff_bits;	/* log2 of the largest cofactor
+				   worth trial factoring */
+
+	double max_bits;	/* log2 of the largest norm in
+				   the region, for this special-q */
+	double scale;		/* sieve units per bit */
+
+	uint32 num_factors[MAX_CANDIDATES + 1];
+	uint32 factors[MAX_CANDIDATES + 1][NUM_LAT_RESIEVE];
+
+	mpz_t res;
+	mpz_t tmp;
+} lat_side_t;
+
+/* main structure controlling lattice sieving */
+
+typedef struct {
+	msieve_obj *obj;
+
+	uint32 log_I;		/* the region is I values wide */
+	uint32 I;
+	uint32 J;		/* and J rows high */
+	uint32 rows_per_block;
+	uint32 num_blocks;
+	double skewness;
+
+	uint32 q;		/* the current special-q */
+	uint32 r;
+	int64 a0, b0;		/* reduced basis of its lattice */
+	int64 a1, b1;
+
+	lat_side_t rat;
+	lat_side_t alg;
+
+	uint8 *cand_map;	/* index+1 of trial factoring
+				   candidates in a sieve block */
+	uint32 cand_offset[MAX_CANDIDATES + 1];
+
+	relation_batch_t relation_batch;
+} lat_job_t;
+
+static void init_lat_side(lat_job_t *job, lat_side_t *side,
+			fb_side_t *fb, uint32 lp_size);
+
+static void free_lat_side(lat_job_t *job, lat_side_t *side);
+
+static uint32 do_one_special_q(lat_job_t *job, uint32 q, uint32 r);
+
+/*------------------------------------------------------------------*/
+uint32 do_lattice_sieving(msieve_obj *obj, sieve_param_t *params,
+			mpz_t n, uint32 relations_found,
+			uint32 max_relations) {
+
+	uint32 i;
+	uint32 q, min_q, max_q;
+	uint32 last_q = 0;
+	uint32 bits = mpz_sizeinbase(n, 2);
+	lat_job_t job;
+	factor_base_t fb;
+	prime_sieve_t prime_sieve;
+	line_range_t *ranges;
+	uint32 num_ranges;
+	char buf[64];
+	const char *lower_limit = NULL;
+	const char *upper_limit = NULL;
+
+	if (relations_found >= max_relations)
+		return relations_found;
+
+	/* parse arguments; a range X,Y is the range of
+	   special-q to use */
+
+	if (obj->nfs_args != NULL) {
+		upper_limit = strchr(obj->nfs_args, ',');
+		if (upper_limit != NULL) {
+			lower_limit = upper_limit - 1;
+			while (lower_limit > obj->nfs_args &&
+				isdigit(lower_limit[-1])) {
+				lower_limit--;
+			}
+			upper_limit++;
+		}
+	}
+
+	/* generate or read the factor base */
+
+	if (read_factor_base(obj, n, params, &fb)) {
+		create_factor_base(obj, &fb, 1);
+		write_factor_base(obj, n, params, &fb);
+	}
+
+	memset(&job, 0, sizeof(job));
+	job.obj = obj;
+	job.skewness = MAX(params->skewness, 1.0);
+
+	/* choose the size of the sieve region. The region is
+	   half as high as it is wide, and a block holds a whole
+	   number of rows */
+
+	if (bits < 300)
+		job.log_I = 11;
+	else if (bits < 380)
+		job.log_I = 12;
+	else
+		job.log_I = 13;
+
+	if (get_arg_string(obj->nfs_args, "lattice_logI=",
+				buf, sizeof(buf))) {
+		job.log_I = atoi(buf);
+		job.log_I = MAX(job.log_I, MIN_LOG_I);
+		job.log_I = MIN(job.log_I, MAX_LOG_I);
+	}
+
+	job.I = 1 << job.log_I;
+	job.J = job.I / 2;
+	job.rows_per_block = LAT_BLOCK_SIZE / job.I;
+	job.num_blocks = (job.J + job.rows_per_block - 1) /
+				job.rows_per_block;
+
+	/* by default the special-q start at half of the
+	   algebraic factor base bound and go up */
+
+	min_q = fb.afb.max_prime / 2;
+	max_q = 0xffffffff;
+
+	if (lower_limit != NULL && upper_limit != NULL) {
+		min_q = strtoul(lower_limit, NULL, 10);
+		max_q = strtoul(upper_limit, NULL, 10);
+		if (min_q > max_q) {
+			printf("lower bound on q must be <= upper bound\n");
+			return 0;
+		}
+	}
+	else if ((lower_limit == NULL && upper_limit != NULL) ||
+		 (lower_limit != NULL && upper_limit == NULL) ) {
+		printf("lower/upper bounds on q must both be specified\n");
+		return 0;
+	}
+	else {
+		/* resume from the last special-q if possible */
+
+		i = read_last_line(obj, n, "lat", &ranges, &num_ranges);
+		if (i > 0)
+			min_q = i;
+		free(ranges);
+	}
+
+	/* the special-q must be large enough to be listed in
+	   the relation, and must not hit the region twice */
+
+	min_q = MAX(min_q, MAX(MAX_SKIPPED_FACTOR, job.I));
+
+	logprintf(obj, "lattice sieving special-q: [%u, %u]\n",
+				min_q, max_q);
+	logprintf(obj, "sieve region: %u x %u, %u blocks\n",
+				job.I, job.J, job.num_blocks);
+	logprintf(obj, "skewness: %.2lf\n", job.skewness);
+
+	init_lat_side(&job, &job.rat, &fb.rfb, params->rfb_lp_size);
+	init_lat_side(&job, &job.alg, &fb.afb, params->afb_lp_size);
+	job.cand_map = (uint8 *)xmalloc(LAT_BLOCK_SIZE * sizeof(uint8));
+
+	logprintf(obj, "RFB: %u entries, %u sieved by rows, "
+			"trial factoring cutoff %u bits\n",
+			job.rat.fb_size, job.rat.num_small,
+			job.rat.cutoff_bits);
+	logprintf(obj, "AFB: %u entries, %u sieved by rows, "
+			"trial factoring cutoff %u bits\n",
+			job.alg.fb_size, job.alg.num_small,
+			job.alg.cutoff_bits);
+	logprintf(obj, "\n");
+
+	/* batch factoring works exactly as in the line siever */
+
+	i = MAX(job.rat.LP1_max, job.alg.LP1_max);
+	i = MIN(3 << 27, i / 4);
+	relation_batch_init(obj, &job.relation_batch,
+			MIN(fb.rfb.max_prime, fb.afb.max_prime), i,
+			job.rat.LP1_max, job.alg.LP1_max,
+			&obj->savefile, print_relation);
+	free_factor_base(&fb);
+
+	if (obj->flags & (MSIEVE_FLAG_USE_LOGFILE |
+	    		   MSIEVE_FLAG_LOG_TO_STDOUT)) {
+		fprintf(stderr, "\nsieving in progress "
+				"(press Ctrl-C to pause)\n");
+	}
+
+	/* sieve each root of each special-q in turn */
+
+	obj->flags |= MSIEVE_FLAG_SIEVING_IN_PROGRESS;
+	init_prime_sieve(&prime_sieve, min_q, max_q);
+
+	while (1) {
+		uint32 roots[MAX_POLY_DEGREE];
+		uint32 num_roots;
+		uint32 high_coeff;
+
+		q = get_next_prime(&prime_sieve);
+		if (q < min_q || q > max_q)
+			break;
+
+		num_roots = poly_get_zeros(roots, &job.alg.poly, q,
+						&high_coeff, 0);
+		if (high_coeff == 0)
+			num_roots = 0;
+
+		for (i = 0; i < num_roots; i++) {
+			relations_found += do_one_special_q(&job,
+							q, roots[i]);
+		}
+		last_q = q;
+
+		if (obj->flags & (MSIEVE_FLAG_USE_LOGFILE |
+	    		   	  MSIEVE_FLAG_LOG_TO_STDOUT)) {
+			fprintf(stderr, "q = %u, %u complete / "
+				"%u batched relations (need %u)\r",
+				q, relations_found,
+				job.relation_batch.num_relations,
+				max_relations);
+			fflush(stderr);
+		}
+
+		if (relations_found >= max_relations ||
+		    (obj->flags & MSIEVE_FLAG_STOP_SIEVING))
+			break;
+	}
+
+	free_prime_sieve(&prime_sieve);
+	obj->flags &= ~MSIEVE_FLAG_SIEVING_IN_PROGRESS;
+
+	/* finish up any batch factoring that's left */
+
+	relations_found += relation_batch_run(&job.relation_batch);
+
+	if (obj->flags & (MSIEVE_FLAG_USE_LOGFILE |
+		     	MSIEVE_FLAG_LOG_TO_STDOUT))
+		fprintf(stderr, "\n");
+
+	logprintf(obj, "completed q = %u, found %u relations\n",
+			last_q, relations_found);
+
+	/* a special-q interrupted partway through is not
+	   repeated; restarting from the next prime is simpler
+	   and loses very little */
+
+	write_last_line(obj, n, "lat", (last_q ? last_q : min_q) + 1,
+			NULL, 0);
+
+	savefile_flush(&obj->savefile);
+	relation_batch_free(&job.relation_batch);
+	free_lat_side(&job, &job.rat);
+	free_lat_side(&job, &job.alg);
+	free(job.cand_map);
+	return relations_found;
+}
+
+/*------------------------------------------------------------------*/
+static int compare_fb_entries(const void *x, const void *y) {
+
+	fb_entry_t *xx = (fb_entry_t *)x;
+	fb_entry_t *yy = (fb_entry_t *)y;
+
+	if (xx->p < yy->p)
+		return -1;
+	if (xx->p > yy->p)
+		return 1;
+	return 0;
+}
+
+/*------------------------------------------------------------------*/
+static void init_lat_side(lat_job_t *job, lat_side_t *side,
+			fb_side_t *fb, uint32 lp_size) {
+
+	uint32 i;
+	uint32 num_small;
+	double updates_per_block = 0;
+
+	mpz_poly_init(&side->poly);
+	side->poly.degree = fb->poly.degree;
+	for (i = 0; i <= fb->poly.degree; i++) {
+		mpz_set(side->poly.coeff[i], fb->poly.coeff[i]);
+		side->dpoly[i] = mpz_get_d(fb->poly.coeff[i]);
+	}
+
+	side->fb_size = fb->num_entries;
+	side->max_prime = fb->max_prime;
+	side->fb = (fb_entry_t *)xmalloc(fb->num_entries *
+					sizeof(fb_entry_t));
+	memcpy(side->fb, fb->entries, fb->num_entries *
+					sizeof(fb_entry_t));
+	qsort(side->fb, (size_t)side->fb_size, sizeof(fb_entry_t),
+			compare_fb_entries);
+
+	side->log2_p = (float *)xmalloc(side->fb_size * sizeof(float));
+	for (num_small = i = 0; i < side->fb_size; i++) {
+		uint32 p = side->fb[i].p;
+
+		side->log2_p[i] = (float)(log((double)p) / M_LN2);
+		if (p < job->I)
+			num_small = i + 1;
+		else
+			updates_per_block += 1.0 / p;
+	}
+	side->small = (lat_small_t *)xmalloc(MAX(num_small, 1) *
+					sizeof(lat_small_t));
+
+	/* the buckets start out a little larger than the
+	   expected number of updates in one block, and grow
+	   if needed */
+
+	updates_per_block = 1.2 * updates_per_block * LAT_BLOCK_SIZE + 1000;
+	side->buckets = (lat_bucket_t *)xmalloc(job->num_blocks *
+					sizeof(lat_bucket_t));
+	for (i = 0; i < job->num_blocks; i++) {
+		lat_bucket_t *b = side->buckets + i;
+
+		b->num_updates = 0;
+		b->num_alloc = (uint32)updates_per_block;
+		b->updates = (lat_update_t *)xmalloc(b->num_alloc *
+						sizeof(lat_update_t));
+	}
+	side->sieve_block = (uint8 *)xmalloc(LAT_BLOCK_SIZE *
+						sizeof(uint8));
+
+	/* the large prime bounds are those of the line
+	   siever, without the triple large primes */
+
+	side->LP1_max = lp_size;
+	mpz_init_set_ui(side->LP2_min, fb->max_prime);
+	mpz_mul_ui(side->LP2_min, side->LP2_min, fb->max_prime);
+	mpz_init_set_ui(side->LP2_max, lp_size);
+	mpz_mul_ui(side->LP2_max, side->LP2_max, lp_size);
+	mpz_tdiv_q_2exp(side->LP2_max, side->LP2_max, 3);
+
+	/* prime powers are not sieved, so leave a few extra
+	   bits of room for them */
+
+	side->cutoff_bits = 4 + mpz_sizeinbase(side->LP2_max, 2);
+
+	mpz_init(side->res);
+	mpz_init(side->tmp);
+
+	/* num_small is the number of factor base entries
+	   sieved by rows; the array is refilled per special-q */
+
+	side->num_small = num_small;
+}
+
+/*------------------------------------------------------------------*/
+static void free_lat_side(lat_job_t *job, lat_side_t *side) {
+
+	uint32 i;
+
+	for (i = 0; i < job->num_blocks; i++)
+		free(side->buckets[i].updates);
+	free(side->buckets);
+	free(side->sieve_block);
+	free(side->small);
+	free(side->fb);
+	free(side->log2_p);
+	mpz_poly_free(&side->poly);
+	mpz_clear(side->LP2_min);
+	mpz_clear(side->LP2_max);
+	mpz_clear(side->res);
+	mpz_clear(side->tmp);
+}
+
+/*------------------------------------------------------------------*/
+static void reduce_qlattice(lat_job_t *job) {
+
+	/* find a reduced basis for the lattice of (a,b) with
+	   a = r*b mod q, starting from the basis (q,0), (r,1).
+	   This is Gauss reduction with the 'a' coordinate
+	   divided by the skewness, so that the region maps to
+	   (a,b) pairs of about the right shape */
+
+	double s = job->skewness;
+	int64 a0 = job->q, b0 = 0;
+	int64 a1 = job->r, b1 = 1;
+
+	while (1) {
+		double n0 = (double)a0 * a0 / s + (double)b0 * b0 * s;
+		double n1 = (double)a1 * a1 / s + (double)b1 * b1 * s;
+		double dot = (double)a0 * a1 / s + (double)b0 * b1 * s;
+		int64 k, t;
+
+		if (n0 > n1) {
+			t = a0; a0 = a1; a1 = t;
+			t = b0; b0 = b1; b1 = t;
+			continue;
+		}
+
+		k = (int64)floor(dot / n0 + 0.5);
+		if (k == 0)
+			break;
+		a1 -= k * a0;
+		b1 -= k * b0;
+	}
+
+	job->a0 = a0;
+	job->b0 = b0;
+	job->a1 = a1;
+	job->b1 = b1;
+}
+
+/*------------------------------------------------------------------*/
+static double norm_bits(lat_side_t *side, double a, double b) {
+
+	/* log2 of the homogeneous form of the polynomial */
+
+	int32 i;
+	double res = side->dpoly[side->poly.degree];
+	double bpow = b;
+
+	for (i = (int32)side->poly.degree - 1; i >= 0; i--) {
+		res = res * a + side->dpoly[i] * bpow;
+		bpow *= b;
+	}
+	res = fabs(res);
+	return log(MAX(res, 1.0)) / M_LN2;
+}
+
+/*------------------------------------------------------------------*/
+static double region_norm_bits(lat_job_t *job, lat_side_t *side,
+				int32 i, uint32 j) {
+
+	double a = (double)i * job->a0 + (double)j * job->a1;
+	double b = (double)i * job->b0 + (double)j * job->b1;
+
+	return norm_bits(side, a, b);
+}
+
+/*------------------------------------------------------------------*/
+static uint32 lattice_root(lat_job_t *job, fb_entry_t *entry,
+				uint32 *rho) {
+
+	/* map the root of one factor base entry into the
+	   (i,j) plane. Returns 0 if the entry does not need
+	   sieving, and sets rho to p if it hits entire rows */
+
+	uint32 p = entry->p;
+	uint32 r = entry->r;
+	uint32 am0 = (uint32)(job->a0 % (int64)p + p) % p;
+	uint32 bm0 = (uint32)(job->b0 % (int64)p + p) % p;
+	uint32 am1 = (uint32)(job->a1 % (int64)p + p) % p;
+	uint32 bm1 = (uint32)(job->b1 % (int64)p + p) % p;
+	uint32 u, v;
+
+	/* the entry hits (a,b) with a - r*b = 0 mod p, or
+	   b = 0 mod p for a projective root */
+
+	if (r == p) {
+		u = bm0;
+		v = bm1;
+	}
+	else {
+		u = am0 + p - mp_modmul_1(r, bm0, p);
+		v = am1 + p - mp_modmul_1(r, bm1, p);
+		if (u >= p)
+			u -= p;
+		if (v >= p)
+			v -= p;
+	}
+
+	/* i*u + j*v = 0 mod p. If u and v both vanish
+	   then p must be the special-q */
+
+	if (u == 0) {
+		*rho = p;
+		return (v != 0);
+	}
+
+	v = mp_modmul_1(v, mp_modinv_1(u, p), p);
+	*rho = (v == 0) ? 0 : p - v;
+	return 1;
+}
+
+/*------------------------------------------------------------------*/
+static void reduce_plattice(uint32 p, uint32 rho, uint32 I,
+			int32 *alpha, uint32 *beta,
+			int32 *gamma, uint32 *delta) {
+
+	/* find a basis (alpha,beta), (gamma,delta) of the lattice
+	   of (i,j) with i = rho*j mod p such that -I < alpha <= 0,
+	   0 <= gamma < I, gamma - alpha >= I and beta, delta > 0.
+	   Franke and Kleinjung show that the next point of the
+	   lattice in the region above any given point then comes
+	   from adding one of the two vectors or their sum. This
+	   needs p >= I and rho != 0 */
+
+	int64 a = -(int64)p, b = 0;
+	int64 c = rho, d = 1;
+	int64 k;
+
+	while (1) {
+		if (-a < (int64)I) {
+			if (c >= (int64)I) {
+				k = (c - I) / (-a) + 1;
+				c += k * a;
+				d += k * b;
+			}
+			break;
+		}
+		if (c < (int64)I) {
+			k = (-a - I) / c + 1;
+			a += k * c;
+			b += k * d;
+			break;
+		}
+
+		if (-a >= c) {
+			k = (-a) / c;
+			a += k * c;
+			b += k * d;
+		}
+		else {
+			k = c / (-a);
+			c += k * a;
+			d += k * b;
+		}
+	}
+
+	*alpha = (int32)a;
+	*beta = (uint32)b;
+	*gamma = (int32)c;
+	*delta = (uint32)d;
+}
+
+/*------------------------------------------------------------------*/
+static void fill_buckets(lat_job_t *job, lat_side_t *side) {
+
+	/* enumerate the hits of all the large factor base
+	   primes in the sieve region, and drop each into the
+	   bucket for its sieve block */
+
+	uint32 i;
+	uint32 I = job->I;
+	uint32 J = job->J;
+	uint32 log_I = job->log_I;
+	lat_bucket_t *buckets = side->buckets;
+
+	for (i = 0; i < job->num_blocks; i++)
+		buckets[i].num_updates = 0;
+
+	for (i = side->num_small; i < side->fb_size; i++) {
+		fb_entry_t *entry = side->fb + i;
+		uint32 p = entry->p;
+		uint32 rho;
+		int32 alpha, gamma;
+		uint32 beta, delta;
+		uint32 x, j;
+		uint8 logp;
+
+		/* rows with j = 0 mod p only include j = 0, and
+		   the column i = 0 only has the pair (a1,b1)
+		   with no common factor; skip both */
+
+		if (!lattice_root(job, entry, &rho) ||
+		    rho == p || rho == 0)
+			continue;
+
+		reduce_plattice(p, rho, I, &alpha, &beta, &gamma, &delta);
+		logp = (uint8)(side->log2_p[i] * side->scale + 0.5);
+
+		/* start from the point at i = 0 in row 0, which
+		   is not sieved */
+
+		x = I / 2;
+		j = 0;
+		while (1) {
+			uint32 loc;
+			lat_bucket_t *b;
+
+			if (x >= (uint32)(-alpha)) {
+				x += alpha;
+				j += beta;
+			}
+			else if (x < I - gamma) {
+				x += gamma;
+				j += delta;
+			}
+			else {
+				x += alpha + gamma;
+				j += beta + delta;
+			}
+			if (j >= J)
+				break;
+
+			loc = (j << log_I) + x;
+			b = buckets + (loc >> LAT_BLOCK_BITS);
+			if (b->num_updates == b->num_alloc) {
+				b->num_alloc *= 2;
+				b->updates = (lat_update_t *)xrealloc(
+						b->updates, b->num_alloc *
+						sizeof(lat_update_t));
+			}
+			b->updates[b->num_updates].p = p;
+			b->updates[b->num_updates].offset =
+					(uint16)(loc & (LAT_BLOCK_SIZE - 1));
+			b->updates[b->num_updates].logp = logp;
+			b->num_updates++;
+		}
+	}
+}
+
+/*------------------------------------------------------------------*/
+static void init_special_q_side(lat_job_t *job, lat_side_t *side,
+				double q_bits) {
+
+	/* prepare one side for sieving the current special-q */
+
+	uint32 i, k;
+	int32 half = job->I / 2;
+	uint32 num_small = 0;
+	double max_bits = 0;
+
+	/* choose a scale for logarithms from the size of
+	   norms across the region */
+
+	for (i = 0; i < 3; i++) {
+		static const int32 cols[3] = {-1, 0, 1};
+
+		for (k = 1; k <= 4; k++) {
+			double bits = region_norm_bits(job, side,
+					cols[i] * (half - 1),
+					k * (job->J / 4) - 1);
+			max_bits = MAX(max_bits, bits);
+		}
+	}
+	side->max_bits = MAX(max_bits - q_bits, 1.0);
+	side->scale = LAT_LOG_TARGET / side->max_bits;
+
+	/* find the row sieving state of the small primes */
+
+	for (i = 0; i < side->fb_size; i++) {
+		fb_entry_t *entry = side->fb + i;
+		lat_small_t *s = side->small + num_small;
+		uint32 rho;
+
+		if (entry->p >= job->I)
+			break;
+
+		if (!lattice_root(job, entry, &rho))
+			continue;
+
+		s->p = entry->p;
+		s->rho = rho;
+		s->offset = (rho == entry->p) ? 0 : half % entry->p;
+		s->logp = (uint8)(side->log2_p[i] * side->scale + 0.5);
+		num_small++;
+	}
+	side->num_small = i;
+	side->num_small_active = num_small;
+
+	fill_buckets(job, side);
+}
+
+/*------------------------------------------------------------------*/
+static void sieve_one_block(lat_job_t *job, lat_side_t *side,
+				uint32 block) {
+
+	uint32 i, j;
+	uint32 I = job->I;
+	uint8 *sieve = side->sieve_block;
+	lat_bucket_t *bucket = side->buckets + block;
+	lat_update_t *updates = bucket->updates;
+	uint32 num_updates = bucket->num_updates;
+
+	memset(sieve, 0, LAT_BLOCK_SIZE);
+
+	/* sieve the small primes one row at a time; the
+	   offsets carry over from the previous block */
+
+	for (j = 0; j < job->rows_per_block; j++) {
+		uint8 *row = sieve + j * I;
+
+		for (i = 0; i < side->num_small_active; i++) {
+			lat_small_t *s = side->small + i;
+			uint32 p = s->p;
+			uint32 x = s->offset;
+			uint8 logp = s->logp;
+
+			if (s->rho == p) {
+				if (x == 0) {
+					for (x = 0; x < I; x++)
+						row[x] += logp;
+				}
+				s->offset = (s->offset + 1 == p) ?
+						0 : s->offset + 1;
+				continue;
+			}
+
+			while (x < I) {
+				row[x] += logp;
+				x += p;
+			}
+
+			x = s->offset + s->rho;
+			s->offset = (x >= p) ? x - p : x;
+		}
+	}
+
+	/* then apply the updates from the large primes */
+
+	for (i = 0; i < (num_updates & (uint32)(~7)); i += 8) {
+		sieve[updates[i+0].offset] += updates[i+0].logp;
+		sieve[updates[i+1].offset] += updates[i+1].logp;
+		sieve[updates[i+2].offset] += updates[i+2].logp;
+		sieve[updates[i+3].offset] += updates[i+3].logp;
+		sieve[updates[i+4].offset] += updates[i+4].logp;
+		sieve[updates[i+5].offset] += updates[i+5].logp;
+		sieve[updates[i+6].offset] += updates[i+6].logp;
+		sieve[updates[i+7].offset] += updates[i+7].logp;
+	}
+	for (; i < num_updates; i++)
+		sieve[updates[i].offset] += updates[i].logp;
+}
+
+/*------------------------------------------------------------------*/
+static void resieve_one_side(lat_job_t *job, lat_side_t *side,
+				uint32 block) {
+
+	/* find the large factor base primes of the
+	   candidates in one block by scanning its bucket */
+
+	uint32 i;
+	uint8 *cand_map = job->cand_map;
+	lat_bucket_t *bucket = side->buckets + block;
+	lat_update_t *updates = bucket->updates;
+	uint32 num_updates = bucket->num_updates;
+
+	for (i = 0; i < num_updates; i++) {
+		uint32 c = cand_map[updates[i].offset];
+
+		if (c != 0 && side->num_factors[c] < NUM_LAT_RESIEVE)
+			side->factors[c][side->num_factors[c]++] =
+							updates[i].p;
+	}
+}
+
+/*------------------------------------------------------------------*/
+static uint32 divide_out_p(lat_side_t *side, uint32 p) {
+
+	uint32 count = 0;
+
+	while (mpz_tdiv_q_ui(side->tmp, side->res, p) == 0) {
+		mpz_swap(side->res, side->tmp);
+		count++;
+	}
+	return count;
+}
+
+/*------------------------------------------------------------------*/
+static uint32 factor_one_side(lat_job_t *job, lat_side_t *side,
+			uint32 cand, uint32 x, uint32 j,
+			int64 a, uint32 b, uint32 q,
+			uint32 *factors, uint32 *num_factors_out) {
+
+	/* trial factor the norm of (a,b) on one side. Returns
+	   1 if the cofactor is small enough to keep */
+
+	uint32 i;
+	uint32 num_factors = 0;
+
+	eval_poly(side->res, a, b, &side->poly);
+	mpz_abs(side->res, side->res);
+
+	if (q != 0) {
+		if (divide_out_p(side, q) == 0)
+			return 0;
+		factors[num_factors++] = q;
+	}
+
+	/* the small primes lie on known progressions in
+	   the (i,j) plane */
+
+	for (i = 0; i < side->num_small_active; i++) {
+		lat_small_t *s = side->small + i;
+		uint32 p = s->p;
+
+		if (s->rho == p) {
+			if (j % p != 0)
+				continue;
+		}
+		else if ((uint32)(((uint64)s->rho * j + job->I / 2) % p) !=
+				x % p) {
+			continue;
+		}
+
+		if (divide_out_p(side, p) && p >= MAX_SKIPPED_FACTOR &&
+		    p != q)
+			factors[num_factors++] = p;
+	}
+
+	/* the large primes were found by resieving */
+
+	for (i = 0; i < side->num_factors[cand]; i++) {
+		uint32 p = side->factors[cand][i];
+
+		if (divide_out_p(side, p) && p != q)
+			factors[num_factors++] = p;
+	}
+	*num_factors_out = num_factors;
+
+	/* keep the cofactor if it is 1, a single large prime,
+	   or a composite that could split into two large primes */
+
+	if (mpz_cmp_ui(side->res, side->LP1_max) <= 0)
+		return 1;
+
+	if (mpz_cmp(side->res, side->LP2_min) < 0 ||
+	    mpz_cmp(side->res, side->LP2_max) > 0)
+		return 0;
+
+	mpz_set_ui(side->tmp, 2);
+	mpz_sub_ui(side->res, side->res, 1);
+	mpz_powm(side->tmp, side->tmp, side->res, side->res);
+	mpz_add_ui(side->res, side->res, 1);
+	return mpz_cmp_ui(side->tmp, 1) != 0;
+}
+
+/*------------------------------------------------------------------*/
+static uint32 factor_candidates(lat_job_t *job, uint32 block,
+				uint32 num_cand) {
+
+	uint32 i;
+	uint32 rels = 0;
+	lat_side_t *rat = &job->rat;
+	lat_side_t *alg = &job->alg;
+
+	resieve_one_side(job, rat, block);
+	resieve_one_side(job, alg, block);
+
+	for (i = 1; i <= num_cand; i++) {
+		uint32 loc = block * LAT_BLOCK_SIZE + job->cand_offset[i];
+		uint32 x = loc & (job->I - 1);
+		uint32 j = loc >> job->log_I;
+		int64 ii = (int64)x - job->I / 2;
+		int64 a = ii * job->a0 + (int64)j * job->a1;
+		int64 b = ii * job->b0 + (int64)j * job->b1;
+		uint32 factors_r[100];
+		uint32 factors_a[100];
+		uint32 num_factors_r, num_factors_a;
+		uint64 abs_a;
+
+		if (b < 0) {
+			a = -a;
+			b = -b;
+		}
+		if (b == 0 || b > (int64)0xffffffff)
+			continue;
+
+		abs_a = (a < 0) ? (uint64)(-a) : (uint64)a;
+		if (mp_gcd_1((uint32)(abs_a % (uint64)b), (uint32)b) != 1)
+			continue;
+
+		/* the algebraic side first, since it is less
+		   likely to succeed */
+
+		if (!factor_one_side(job, alg, i, x, j, a, (uint32)b, job->q,
+					factors_a, &num_factors_a))
+			continue;
+
+		if (!factor_one_side(job, rat, i, x, j, a, (uint32)b, 0,
+					factors_r, &num_factors_r))
+			continue;
+
+		if (mpz_cmp_ui(rat->res, (uint32)(-1)) < 0 &&
+		    mpz_cmp_ui(alg->res, (uint32)(-1)) < 0) {
+
+			uint32 k;
+			uint32 lp_r[MAX_LARGE_PRIMES];
+			uint32 lp_a[MAX_LARGE_PRIMES];
+
+			lp_r[0] = mpz_get_ui(rat->res);
+			lp_a[0] = mpz_get_ui(alg->res);
+			for (k = 1; k < MAX_LARGE_PRIMES; k++)
+				lp_r[k] = lp_a[k] = 1;
+
+			print_relation(&job->obj->savefile, a, (uint32)b,
+					factors_r, num_factors_r, lp_r,
+					factors_a, num_factors_a, lp_a);
+			rels++;
+			continue;
+		}
+
+		relation_batch_add(a, (uint32)b,
+				factors_r, num_factors_r, rat->res,
+				factors_a, num_factors_a, alg->res,
+				&job->relation_batch);
+
+		if (job->relation_batch.num_relations >=
+				job->relation_batch.target_relations) {
+			rels += relation_batch_start(&job->relation_batch);
+		}
+	}
+
+	return rels;
+}
+
+/*------------------------------------------------------------------*/
+static uint32 scan_one_block(lat_job_t *job, uint32 block) {
+
+	/* compare the sieve values on both sides with the
+	   estimated size of the norms, and trial factor the
+	   ones that may be smooth enough */
+
+	uint32 i, j, k;
+	uint32 I = job->I;
+	uint32 half = I / 2;
+	uint32 rels = 0;
+	uint32 num_cand = 0;
+	lat_side_t *rat = &job->rat;
+	lat_side_t *alg = &job->alg;
+	uint8 *sieve_r = rat->sieve_block;
+	uint8 *sieve_a = alg->sieve_block;
+	uint32 first_row = block * job->rows_per_block;
+	double q_bits = log((double)job->q) / M_LN2;
+
+	memset(job->cand_map, 0, LAT_BLOCK_SIZE);
+	memset(rat->num_factors, 0, sizeof(rat->num_factors));
+	memset(alg->num_factors, 0, sizeof(alg->num_factors));
+
+	for (j = 0; j < job->rows_per_block; j++) {
+		uint32 row = first_row + j;
+
+		/* the pairs in row 0 are multiples of (a0,b0) */
+
+		if (row == 0)
+			continue;
+
+		for (k = 0; k < I; k += NORM_CHUNK) {
+			uint32 off = j * I + k;
+			int32 mid = (int32)(k + NORM_CHUNK / 2) - (int32)half;
+			double bits_r = region_norm_bits(job, rat, mid, row) -
+						rat->cutoff_bits;
+			double bits_a = region_norm_bits(job, alg, mid, row) -
+						q_bits - alg->cutoff_bits;
+			uint32 cutoff_r = (uint32)MAX(bits_r * rat->scale, 0);
+			uint32 cutoff_a = (uint32)MAX(bits_a * alg->scale, 0);
+
+			for (i = 0; i < NORM_CHUNK; i++) {
+				if (sieve_a[off + i] < cutoff_a ||
+				    sieve_r[off + i] < cutoff_r)
+					continue;
+
+				/* skip pairs with i and j both even,
+				   since a and b are then both even */
+
+				if ((row & 1) == 0 && ((k + i + half) & 1) == 0)
+					continue;
+
+				num_cand++;
+				job->cand_offset[num_cand] = off + i;
+				job->cand_map[off + i] = num_cand;
+
+				if (num_cand == MAX_CANDIDATES) {
+					rels += factor_candidates(job, block,
+								num_cand);
+					num_cand = 0;
+					memset(job->cand_map, 0,
+							LAT_BLOCK_SIZE);
+					memset(rat->num_factors, 0,
+						sizeof(rat->num_factors));
+					memset(alg->num_factors, 0,
+						sizeof(alg->num_factors));
+				}
+			}
+		}
+	}
+
+	if (num_cand > 0)
+		rels += factor_candidates(job, block, num_cand);
+	return rels;
+}
+
+/*------------------------------------------------------------------*/
+static uint32 do_one_special_q(lat_job_t *job, uint32 q, uint32 r) {
+
+	uint32 i;
+	uint32 rels = 0;
+	uint32 num_blocks = job->num_blocks;
+	double q_bits = log((double)q) / M_LN2;
+
+	job->q = q;
+	job->r = r;
+	reduce_qlattice(job);
+
+	init_special_q_side(job, &job->rat, 0);
+	init_special_q_side(job, &job->alg, q_bits);
+
+	for (i = 0; i < num_blocks; i++) {
+		sieve_one_block(job, &job->rat, i);
+		sieve_one_block(job, &job->alg, i);
+		rels += scan_one_block(job, i);
+
+		if (job->obj->flags & MSIEVE_FLAG_STOP_SIEVING)
+			break;
+	}
+
+	return rels;
+}
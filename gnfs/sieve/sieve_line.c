@@ -16,7 +16,31 @@ $Id$
 
 /* sieving takes place in L1-cache-size blocks */
 #define BLOCK_SIZE 65536
-#define BLOCK_HASH(x) ((uint64)(x) / BLOCK_SIZE)
+
+/* the smallest factor base primes and prime powers are not
+   sieved one update at a time; all the updates they make in
+   a line are periodic, so groups of them are combined into
+   byte patterns whose period is the least common multiple of
+   the group. Each sieve block then gets the patterns added
+   to it a whole vector at a time */
+
+#define PATTERN_P_LIMIT 32
+#define MAX_PATTERN_PERIOD 16384
+#define MAX_PATTERNS 16
+
+#if defined(__AVX2__)
+	#include <immintrin.h>
+	#define PATTERN_VEC 32
+#elif defined(HAS_SSE2)
+	#include <emmintrin.h>
+	#define PATTERN_VEC 16
+#else
+	#define PATTERN_VEC 8
+#endif
+
+/* the number of sieve values checked at once when
+   scanning a block for survivors */
+#define SCAN_WIDTH 64
 
 /* how often the log targets for the algebraic sieve are
    recalculated. Currently the rational sieve is only
@@ -27,7 +51,8 @@ $Id$
 typedef struct {
 	uint32 p;
 	uint32 r;
-	uint32 next;
+	uint32 next_hit;  /* for p > BLOCK_SIZE, the offset of the next
+			     update from the start of the bucket region */
 	uint16 offset;
 	uint8 logp;
 	uint8 skip;
@@ -52,6 +77,42 @@ typedef struct {
 	uint8 logp;	/* scaled logarithm of 'prime' */
 } packed_fb_t;
 
+/* one group of small factor base entries sieved as a pattern.
+   The group consists of a range of entries in the factor base
+   and a range of entries in the list of prime powers */
+typedef struct {
+	uint16 fb_start;
+	uint16 fb_end;
+	uint16 power_start;
+	uint16 power_end;
+	uint32 period;		/* pattern length in bytes */
+	uint32 phase;		/* pattern offset of the next block start */
+	uint8 *pattern;		/* period bytes, then PATTERN_VEC more
+				   bytes that repeat the start */
+} small_pattern_t;
+
+/* factor base primes larger than BLOCK_SIZE are bucket
+   sieved: a sieve line is divided into regions of several
+   sieve blocks, and all the updates for one region are
+   sorted into one bucket per block before any block of
+   the region is sieved. Filling the buckets reads the 
+   factor base in order and writes to only a few places at
+   a time, and each bucket is then read in order, so there
+   are very few cache misses. Regions are sized so that all
+   of their buckets stay in the L2 cache */
+
+typedef struct {
+	uint32 num_updates;
+	uint32 num_alloc;
+	packed_fb_t *updates;
+} line_bucket_t;
+
+/* limits on the number of blocks in one bucket region;
+   filling many more buckets at once than the upper limit
+   runs out of TLB entries */
+#define MIN_REGION_BLOCKS 4
+#define MAX_REGION_BLOCKS 32
+
 /* structure for projective roots */
 typedef struct {
 	uint32 p;			 /* factor base prime */
@@ -73,10 +134,13 @@ typedef struct {
 	
 /* main structure controlling rational or algebraic sieving */
 typedef struct {
-	mpz_poly_t *poly;	/* the sieve polynomial */
+	mpz_poly_t poly;	/* the sieve polynomial (each thread
+				   needs its own, for the scratch space) */
 
 	uint8 *sieve_block;	/* piece of sieve interval (one block worth) */
-	uint32 *bucket_list; /* head of linked list of updates (per bucket) */
+	line_bucket_t *buckets;	/* updates from primes above BLOCK_SIZE,
+				   one bucket per block of a region */
+	uint32 num_buckets;	/* the number of blocks in a region */
 
 	uint32 curr_num_lp;	/* the number of large primes for this side */
 	uint32 LP1_max;		/* single large prime max bound */
@@ -113,47 +177,168 @@ typedef struct {
 	uint32 powers_fb_size;   /* the number of such entries */
 	uint32 powers_fb_alloc;  /* space allocated for list of powers */
 
+	uint32 pattern_fb_size;	    /* entries sieved with patterns */
+	uint32 pattern_powers_size; /* powers sieved with patterns */
+	uint32 num_patterns;
+	small_pattern_t patterns[MAX_PATTERNS];
+	uint8 *pattern_buf;	/* storage for all the patterns */
+
 	packed_fb_t *update_list; /* list of updates to current block */
-	uint32 num_updates_alloc; /* number of allocated updates */
 	uint32 num_updates;	  /* the current number of updates */
 } sieve_t;
 	
-/* main sieving structure */
+/* sieving threads are handed this many consecutive
+   b values at a time */
+#define LINE_RANGE_SIZE 16
+
+#define MAX_LINE_THREADS 32
+
+/* statistics for tuning the sieve parameters. When the
+   argument string contains nfs_stats=<file>, each sieving
+   thread charges the clock ticks it spends to whichever
+   phase of sieving it is in, and counts what happens to
+   the sieve values that look smooth. The threads add their
+   statistics to a shared copy after every line, and every
+   so often the totals for the interval since the last
+   report are logged and appended to <file> */
+
+enum nfs_timer {
+	NFS_TIME_SIEVE,		/* initializing lines, filling buckets
+				   and sieve blocks */
+	NFS_TIME_SCAN,		/* scanning blocks for survivors */
+	NFS_TIME_RESIEVE,	/* resieving blocks with many survivors */
+	NFS_TIME_TF,		/* trial division and primality tests */
+	NFS_TIME_BATCH,		/* batch factoring, or waiting for the
+				   background batch to finish */
+	NFS_TIME_OTHER,		/* saving relations, waiting for locks */
+	NUM_NFS_TIMERS
+};
+
+enum nfs_count {
+	NFS_COUNT_LINE,		/* sieve lines finished */
+	NFS_COUNT_BLOCK,	/* sieve blocks sieved */
+	NFS_COUNT_REPORT,	/* sieve values above both cutoffs */
+	NFS_COUNT_ALG,		/* ...that pass algebraic trial division */
+	NFS_COUNT_RAT,		/* ...and rational trial division */
+	NFS_COUNT_DIRECT,	/* relations with no cofactors to split */
+	NFS_COUNT_BATCHED,	/* relations sent to batch factoring */
+	NFS_COUNT_BATCH_RELS,	/* relations found by batch factoring */
+	NUM_NFS_COUNTS
+};
+
+typedef struct {
+	uint32 enabled;
+	uint32 phase;		/* the timer being charged */
+	uint64 phase_start;	/* clock when the phase started */
+	uint64 time[NUM_NFS_TIMERS];
+	uint64 count[NUM_NFS_COUNTS];
+} nfs_stats_t;
+
+#define NFS_STATS_INTERVAL 60
+
+/* state shared by all the sieving threads */
 typedef struct {
 	msieve_obj *obj;
-	factor_base_t *fb;
+	mutex_t mutex;		/* protects everything below, and
+				   writes to the savefile */
+
+	uint32 next_b;		/* first b value not given to any thread */
+	uint32 max_b;		/* last b value to sieve */
+	uint32 all_assigned;	/* nonzero if b values are exhausted */
+	uint32 range_size;	/* number of b values handed out at once */
+
+	line_range_t *pending;	/* ranges left unfinished by a previous 
+				   run, which are handed out first */
+	uint32 num_pending;
+	uint32 next_pending;
+
+	uint32 relations_found;
+	uint32 max_relations;
+	uint32 num_batched;	/* relations waiting in all the batches */
+	uint32 last_b;		/* largest b value finished so far */
+	uint32 sieving_done;
+
+	nfs_stats_t stats;	/* statistics since the last report */
+	nfs_stats_t total;	/* statistics for the whole run */
+	FILE *stats_file;
+	double stats_interval;	/* seconds between reports */
+	double start_time;	/* wall time and clock when */
+	uint64 start_clock;	/* sieving started */
+	double last_report;	/* wall time of the last report */
+} line_sieve_t;
+
+/* main sieving structure, one per thread */
+typedef struct {
+	msieve_obj *obj;
+	line_sieve_t *shared;
 
 	int64 min_a;
 	int64 max_a;
-	uint32 min_b;
-	uint32 max_b;
+	uint32 min_b;		/* the range of b values */
+	uint32 max_b;		/* currently owned by this thread */
+	uint32 next_b;
+	uint32 have_range;
 
-	uint32 num_buckets;
+	uint32 region_blocks;	/* sieve blocks per bucket region */
 	sieve_t sieve_rfb;
 	sieve_t sieve_afb;
 
 	resieve_t *resieve_array;
 
 	relation_batch_t relation_batch;
+	uint32 num_batched;	/* batch size last reported to shared */
+
+	savefile_t savefile;	/* relations not yet in the real savefile */
 
+	nfs_stats_t stats;	/* statistics since the last line */
 } sieve_job_t;
 
-static void init_one_fb(msieve_obj *obj, 
-			fb_side_t *fb, sieve_t *out_fb, 
-			uint32 num_buckets, uint32 lp_size,
-			char *string);
+/* switch the timer that the clock ticks of a sieving thread
+   are charged to; the clock is only read when statistics
+   are enabled */
+
+static INLINE void set_phase(sieve_job_t *job, uint32 phase) {
+
+	nfs_stats_t *stats = &job->stats;
+
+	if (stats->enabled) {
+		uint64 now = read_clock();
+		stats->time[stats->phase] += now - stats->phase_start;
+		stats->phase = phase;
+		stats->phase_start = now;
+	}
+}
+
+#define STAT_COUNT(job, c, n) (job)->stats.count[c] += (n)
+
+static void init_one_fb(fb_side_t *fb, sieve_t *out_fb, 
+			uint32 region_blocks, uint32 lp_size);
+
+static double get_updates_per_block(fb_side_t *fb);
+
+static void log_one_fb(msieve_obj *obj, fb_side_t *fb, 
+			sieve_t *out_fb, char *string);
+
+static void init_patterns(sieve_t *out_fb);
 
 static void free_one_sieve_fb(sieve_t *out_fb);
 
+static void sieve_thread_run(void *data, int thread_num);
+
+static void write_stats_header(line_sieve_t *s, sieve_param_t *params,
+			uint32 min_b, uint32 max_b, uint32 num_threads);
+
+static void report_stats(line_sieve_t *s, double now, uint32 final);
+
 static uint32 do_one_line(sieve_job_t *job, uint32 b_offset);
 
 static void init_one_sieve(sieve_t *out_fb,
-			uint32 num_buckets, 
 			int64 min_a, int64 max_a, 
 			uint32 min_b, uint32 b_offset);
 
-static void fill_one_block(sieve_t *sieve_fb, 
-			uint32 block, uint32 num_buckets);
+static void fill_buckets(sieve_t *sieve_fb);
+
+static void fill_one_block(sieve_t *sieve_fb, uint32 block);
 
 static uint32 do_factoring(sieve_job_t *job,
 			int64 block_start, uint32 b,
@@ -180,10 +365,21 @@ uint32 do_line_sieving(msieve_obj *obj, sieve_param_t *params, mpz_t n,
 			uint32 relations_found, uint32 max_relations) {
 
 	uint32 i;
-	sieve_job_t job;
+	uint32 num_threads;
+	uint32 region_blocks;
+	uint32 update_bytes;
+	uint32 num_ranges;
+	uint32 min_b, max_b;
+	line_sieve_t shared;
+	line_range_t *ranges;
+	sieve_job_t *jobs;
 	factor_base_t fb;
+	thread_control_t control = {NULL, NULL, NULL};
+	task_control_t task = {NULL, sieve_thread_run, NULL, NULL};
+	struct threadpool *pool;
 	const char *lower_limit = NULL;
 	const char *upper_limit = NULL;
+	char buf[256];
 
 	if (relations_found >= max_relations)
 		return relations_found;
@@ -209,22 +405,21 @@ uint32 do_line_sieving(msieve_obj *obj, sieve_param_t *params, mpz_t n,
 		write_factor_base(obj, n, params, &fb);
 	}
 
-	/* initialize sieve struct */
+	/* initialize the state shared by sieving threads */
 
-	memset(&job, 0, sizeof(job));
-	job.obj = obj;
-	job.fb = &fb;
-	job.min_a = params->sieve_begin;
-	job.max_a = params->sieve_end;
-	job.min_b = 1;
-	job.max_b = 0xffffffff;     /* default is to sieve forever */
+	memset(&shared, 0, sizeof(shared));
+	shared.obj = obj;
+	shared.relations_found = relations_found;
+	shared.max_relations = max_relations;
+	min_b = 1;
+	max_b = 0xffffffff;     /* default is to sieve forever */
 
 	/* set user-specified limits, if any */
 
 	if (lower_limit != NULL && upper_limit != NULL) {
-		job.min_b = strtoul(lower_limit, NULL, 10);
-		job.max_b = strtoul(upper_limit, NULL, 10);
-		if (job.min_b > job.max_b) {
+		min_b = strtoul(lower_limit, NULL, 10);
+		max_b = strtoul(upper_limit, NULL, 10);
+		if (min_b > max_b) {
 			printf("lower bound on b must be <= upper bound\n");
 			return 0;
 		}
@@ -236,59 +431,147 @@ uint32 do_line_sieving(msieve_obj *obj, sieve_param_t *params, mpz_t n,
 	}
 	else {
 		/* see if there is any guidance on the first b
-		   value to use, i.e. if a run is being resumed */
+		   value to use, i.e. if a run is being resumed.
+		   Ranges that were in progress are finished first */
 
-		i = read_last_line(obj, n);
+		i = read_last_line(obj, n, "line", &shared.pending, 
+					&shared.num_pending);
 		if (i > 0)
-			job.min_b = i;
+			min_b = i;
+		if (shared.num_pending > 0)
+			logprintf(obj, "resuming %u unfinished b ranges\n",
+					shared.num_pending);
 	}
 
-	/* the lower sieve limit is assumed to be even */
-	if (job.min_a & 1)
-		job.min_a--;
+	/* b values are handed out to threads a range at a time;
+	   the ranges are small, since sieve lines with small b
+	   are the most productive, but when the b values to use
+	   are limited they must still be spread over all threads */
 
-	/* perform all one-time initialization. Most of the
-	   factor base will use a bucket sort for cache efficiency,
-	   with the number of buckets chosen to cover the maximum
-	   size of any factor base prime */
+	num_threads = MAX(1, MIN(obj->num_threads, MAX_LINE_THREADS));
 
-	job.num_buckets = MAX(BLOCK_HASH(fb.rfb.max_prime) + 1,
-			      BLOCK_HASH(fb.afb.max_prime) + 1);
+	shared.next_b = min_b;
+	shared.max_b = max_b;
+	shared.range_size = MIN(LINE_RANGE_SIZE - 1, 
+			(max_b - min_b) / num_threads) + 1;
+
+	/* perform all one-time initialization. Most of the
+	   factor base will use a bucket sort for cache efficiency.
+	   The buckets for a region of the sieve line should use
+	   at most a quarter of the largest cache, and while they
+	   are filled the end of each bucket should stay in L1.
+	   Every region reads all of the large factor base primes,
+	   so regions are at least a few blocks long */
+
+	update_bytes = (uint32)((get_updates_per_block(&fb.rfb) +
+				 get_updates_per_block(&fb.afb)) *
+				sizeof(packed_fb_t)) + 1;
+	region_blocks = obj->cache_size2 / 4 / update_bytes;
+	region_blocks = MIN(region_blocks, obj->cache_size1 / 128);
+	region_blocks = MIN(region_blocks, MAX_REGION_BLOCKS);
+	region_blocks = MAX(region_blocks, MIN_REGION_BLOCKS);
 	
 	logprintf(obj, "a range: [%" PRId64 ", %" PRId64 "]\n", 
-					job.min_a, job.max_a);
-	logprintf(obj, "b range: [%u, %u]\n", job.min_b, job.max_b);
-	logprintf(obj, "number of hash buckets: %u\n", job.num_buckets);
+					params->sieve_begin, 
+					params->sieve_end);
+	logprintf(obj, "b range: [%u, %u]\n", min_b, max_b);
 	logprintf(obj, "sieve block size: %u\n", BLOCK_SIZE);
+	logprintf(obj, "blocks per bucket region: %u\n", region_blocks);
+	if (num_threads > 1)
+		logprintf(obj, "sieving with %u threads, %u lines at a "
+				"time\n", num_threads, shared.range_size);
+
+	if (get_arg_string(obj->nfs_args, "nfs_stats=", buf, sizeof(buf))) {
+		shared.stats_file = fopen(buf, "a");
+		if (shared.stats_file == NULL) {
+			logprintf(obj, "error: cannot open NFS statistics "
+					"file '%s'\n", buf);
+		}
+		else {
+			shared.stats.enabled = 1;
+			shared.stats_interval = NFS_STATS_INTERVAL;
+			if (get_arg_string(obj->nfs_args,
+					"nfs_stats_interval=",
+					buf, sizeof(buf))) {
+				shared.stats_interval = MAX(atof(buf), 1);
+			}
+			logprintf(obj, "reporting sieving statistics every "
+					"%.0lf seconds\n",
+					shared.stats_interval);
+			write_stats_header(&shared, params, min_b, max_b,
+					num_threads);
+		}
+	}
 	logprintf(obj, "\n");
 
-	init_one_fb(obj, &fb.rfb, &job.sieve_rfb, job.num_buckets, 
-			params->rfb_lp_size, "RFB");
-	init_one_fb(obj, &fb.afb, &job.sieve_afb, job.num_buckets, 
-			params->afb_lp_size, "AFB");
+	/* every thread gets a complete copy of the sieving 
+	   structures, since the factor base entries hold the
+	   sieving state for the current line */
+
+	jobs = (sieve_job_t *)xcalloc((size_t)num_threads, 
+					sizeof(sieve_job_t));
+
+	for (i = 0; i < num_threads; i++) {
+		sieve_job_t *job = jobs + i;
+
+		job->obj = obj;
+		job->shared = &shared;
+		job->min_a = params->sieve_begin;
+		job->max_a = params->sieve_end;
+		job->region_blocks = region_blocks;
+
+		/* the lower sieve limit is assumed to be even */
+		if (job->min_a & 1)
+			job->min_a--;
 
-	/* every sieve value needs two resieve_t entries, the
-	   first for resieved algebraic factors and the second
-	   for resieved rational factors */
+		init_one_fb(&fb.rfb, &job->sieve_rfb, region_blocks, 
+				params->rfb_lp_size);
+		init_one_fb(&fb.afb, &job->sieve_afb, region_blocks, 
+				params->afb_lp_size);
 
-	job.resieve_array = (resieve_t *)xmalloc(2 * MAX_RESIEVE_ENTRIES *
+		/* every sieve value needs two resieve_t entries, the
+		   first for resieved algebraic factors and the second
+		   for resieved rational factors */
+
+		job->resieve_array = (resieve_t *)xmalloc(2 * 
+						MAX_RESIEVE_ENTRIES *
 						sizeof(resieve_t));
 
+		/* relations found by the thread are buffered in 
+		   memory, then written to the savefile after each
+		   line so that relations from different threads
+		   are not interleaved */
+
+		savefile_init_memory(&job->savefile);
+		job->stats.enabled = shared.stats.enabled;
+	}
+
+	log_one_fb(obj, &fb.rfb, &jobs[0].sieve_rfb, "RFB");
+	log_one_fb(obj, &fb.afb, &jobs[0].sieve_afb, "AFB");
+
 	/* initialize the structures for batch factoring of relations.
 	   We use batch factoring to split the parts of relations
 	   containing large primes, and to do that we have to multiply
 	   together all the primes from the factor base bound to 
-	   somewhere below the large prime bound */
+	   somewhere below the large prime bound. The other threads
+	   copy the product from the first one */
 
-	i = MAX(job.sieve_rfb.LP1_max, job.sieve_afb.LP1_max);
+	i = MAX(jobs[0].sieve_rfb.LP1_max, jobs[0].sieve_afb.LP1_max);
 	i = MIN(3 << 27, i / 4);
 	
-	relation_batch_init(job.obj, &job.relation_batch,
+	relation_batch_init(obj, &jobs[0].relation_batch,
 			MIN(fb.rfb.max_prime, fb.afb.max_prime),
 			i,
-			job.sieve_rfb.LP1_max,
-			job.sieve_afb.LP1_max,
-			&obj->savefile, print_relation);
+			jobs[0].sieve_rfb.LP1_max,
+			jobs[0].sieve_afb.LP1_max,
+			&jobs[0].savefile, print_relation);
+
+	for (i = 1; i < num_threads; i++) {
+		relation_batch_init_copy(&jobs[i].relation_batch,
+					&jobs[0].relation_batch,
+					&jobs[i].savefile);
+	}
+	free_factor_base(&fb);
 
 	if (obj->flags & (MSIEVE_FLAG_USE_LOGFILE |
 	    		   MSIEVE_FLAG_LOG_TO_STDOUT)) {
@@ -300,12 +583,337 @@ uint32 do_line_sieving(msieve_obj *obj, sieve_param_t *params, mpz_t n,
 	   in parallel with k machines available is to start 
 	   with i being some number mod k and to do every k_th
 	   sieve line. Each sieve line is initialized individually,
-	   so this is easy to implement */
+	   so this is easy to implement. On one machine the
+	   threads instead take turns grabbing ranges of lines;
+	   the calling thread does the work of the last thread */
 
+	mutex_init(&shared.mutex);
 	obj->flags |= MSIEVE_FLAG_SIEVING_IN_PROGRESS;
-	for (i = 0; i <= job.max_b - job.min_b; i++) {
 
-		relations_found += do_one_line(&job, i);
+	if (shared.stats.enabled) {
+		shared.start_time = get_wall_time();
+		shared.start_clock = read_clock();
+		shared.last_report = shared.start_time;
+	}
+
+	pool = threadpool_init(num_threads - 1, num_threads, &control);
+	for (i = 0; i < num_threads - 1; i++) {
+		task.data = jobs + i;
+		threadpool_add_task(pool, &task, 1);
+	}
+	sieve_thread_run(jobs + i, i);
+	threadpool_drain(pool, 1);
+	threadpool_free(pool);
+
+	obj->flags &= ~MSIEVE_FLAG_SIEVING_IN_PROGRESS;
+	mutex_free(&shared.mutex);
+
+	if (obj->flags & (MSIEVE_FLAG_USE_LOGFILE |
+		     	MSIEVE_FLAG_LOG_TO_STDOUT))
+		fprintf(stderr, "\n");
+
+	logprintf(obj, "completed b = %u, found %u relations\n", 
+			shared.last_b, shared.relations_found);
+
+	if (shared.stats.enabled) {
+		report_stats(&shared, get_wall_time(), 1);
+		fclose(shared.stats_file);
+	}
+
+	/* save the ranges that were in progress when sieving
+	   stopped, along with any that were never started */
+
+	ranges = (line_range_t *)xmalloc((num_threads + 
+					shared.num_pending + 1) *
+					sizeof(line_range_t));
+	num_ranges = 0;
+	for (i = 0; i < num_threads; i++) {
+		sieve_job_t *job = jobs + i;
+
+		if (job->have_range) {
+			ranges[num_ranges].start = job->next_b;
+			ranges[num_ranges].end = job->max_b;
+			num_ranges++;
+		}
+	}
+	for (i = shared.next_pending; i < shared.num_pending; i++)
+		ranges[num_ranges++] = shared.pending[i];
+
+	if (shared.all_assigned)
+		shared.next_b = max_b + 1;
+	write_last_line(obj, n, "line", shared.next_b, 
+			ranges, num_ranges);
+
+	savefile_flush(&obj->savefile);
+	for (i = 0; i < num_threads; i++) {
+		sieve_job_t *job = jobs + i;
+
+		relation_batch_free(&job->relation_batch);
+		free_one_sieve_fb(&job->sieve_rfb);
+		free_one_sieve_fb(&job->sieve_afb);
+		free(job->resieve_array);
+		savefile_free(&job->savefile);
+	}
+	free(jobs);
+	free(ranges);
+	free(shared.pending);
+	return shared.relations_found;
+}
+
+/*------------------------------------------------------------------*/
+static const char *timer_names[NUM_NFS_TIMERS] = {
+	"sieve", "scan", "resieve", "tf", "batch", "other"
+};
+
+static void write_stats_header(line_sieve_t *s, sieve_param_t *params,
+			uint32 min_b, uint32 max_b, uint32 num_threads) {
+
+	/* start a new run in the statistics file. Each line
+	   after the header has the statistics of one interval,
+	   or of the whole run if the first column is 'total' */
+
+	uint32 i;
+	FILE *fp = s->stats_file;
+
+	fprintf(fp, "# line sieve, %u bits, %u threads, "
+			"a [%" PRId64 ", %" PRId64 "], b [%u, %u]\n",
+			params->bits, num_threads, 
+			params->sieve_begin, params->sieve_end,
+			min_b, max_b);
+	fprintf(fp, "# rfb_limit %u, afb_limit %u, rfb_lp_size %u, "
+			"afb_lp_size %u\n", 
+			params->rfb_limit, params->afb_limit,
+			params->rfb_lp_size, params->afb_lp_size);
+	fprintf(fp, "# kind\telapsed\tseconds\tlast_b\tlines\tblocks\t"
+			"reports\talg\trat\tdirect\tbatched\tbatch_rels\t"
+			"rels_per_sec\treports_per_block\talg_per_block\t"
+			"rat_per_block\tbatched_pct\tbatch_success_pct");
+	for (i = 0; i < NUM_NFS_TIMERS; i++)
+		fprintf(fp, "\t%s", timer_names[i]);
+	fprintf(fp, "\n");
+	fflush(fp);
+}
+
+/*------------------------------------------------------------------*/
+static void print_stats(line_sieve_t *s, nfs_stats_t *stats,
+			char *kind, double now, double seconds, 
+			double clocks_per_sec) {
+
+	/* log one set of statistics and append it to the
+	   statistics file. Phase times are summed over all
+	   the sieving threads and shown as a fraction of the
+	   total; with background batch factoring, the batch
+	   time only counts waiting for a background batch,
+	   and relations from a batch show up in the interval
+	   after the one that filled it */
+
+	uint32 i;
+	msieve_obj *obj = s->obj;
+	uint64 *count = stats->count;
+	uint64 rels = count[NFS_COUNT_DIRECT] + count[NFS_COUNT_BATCH_RELS];
+	double blocks = (double)MAX(count[NFS_COUNT_BLOCK], 1);
+	double rels_per_sec = 0;
+	double batched_pct = 0;
+	double success_pct = 0;
+	double total = 0;
+	double pct[NUM_NFS_TIMERS];
+	FILE *fp = s->stats_file;
+
+	if (seconds > 0)
+		rels_per_sec = rels / seconds;
+	if (count[NFS_COUNT_RAT] > 0)
+		batched_pct = 100.0 * count[NFS_COUNT_BATCHED] /
+				count[NFS_COUNT_RAT];
+	if (count[NFS_COUNT_BATCHED] > 0)
+		success_pct = 100.0 * count[NFS_COUNT_BATCH_RELS] /
+				count[NFS_COUNT_BATCHED];
+
+	for (i = 0; i < NUM_NFS_TIMERS; i++)
+		total += stats->time[i];
+	for (i = 0; i < NUM_NFS_TIMERS; i++)
+		pct[i] = total > 0 ? 100.0 * stats->time[i] / total : 0;
+
+	logprintf(obj, "%s: b = %u, %.2lf rels/sec; per block %.2lf "
+			"reports, %.2lf alg and %.2lf rat survivors\n",
+			kind, s->last_b, rels_per_sec,
+			count[NFS_COUNT_REPORT] / blocks,
+			count[NFS_COUNT_ALG] / blocks,
+			count[NFS_COUNT_RAT] / blocks);
+	logprintf(obj, "%s: %.1lf%% of survivors batched, %.1lf%% "
+			"batch success; time %.1lf%% sieve, %.1lf%% scan, "
+			"%.1lf%% resieve, %.1lf%% tf, %.1lf%% batch\n",
+			kind, batched_pct, success_pct,
+			pct[NFS_TIME_SIEVE], pct[NFS_TIME_SCAN],
+			pct[NFS_TIME_RESIEVE], pct[NFS_TIME_TF],
+			pct[NFS_TIME_BATCH]);
+
+	fprintf(fp, "%s\t%.2lf\t%.2lf\t%u", kind, now - s->start_time,
+			seconds, s->last_b);
+	for (i = 0; i < NUM_NFS_COUNTS; i++)
+		fprintf(fp, "\t%" PRIu64, count[i]);
+	fprintf(fp, "\t%.3lf\t%.4lf\t%.4lf\t%.4lf\t%.2lf\t%.2lf",
+			rels_per_sec, 
+			count[NFS_COUNT_REPORT] / blocks,
+			count[NFS_COUNT_ALG] / blocks,
+			count[NFS_COUNT_RAT] / blocks,
+			batched_pct, success_pct);
+	for (i = 0; i < NUM_NFS_TIMERS; i++) {
+		fprintf(fp, "\t%.3lf", clocks_per_sec > 0 ?
+				stats->time[i] / clocks_per_sec : 0);
+	}
+	fprintf(fp, "\n");
+	fflush(fp);
+}
+
+/*------------------------------------------------------------------*/
+static void add_stats(nfs_stats_t *sum, nfs_stats_t *stats) {
+
+	/* add stats to sum, and clear stats */
+
+	uint32 i;
+
+	for (i = 0; i < NUM_NFS_TIMERS; i++) {
+		sum->time[i] += stats->time[i];
+		stats->time[i] = 0;
+	}
+	for (i = 0; i < NUM_NFS_COUNTS; i++) {
+		sum->count[i] += stats->count[i];
+		stats->count[i] = 0;
+	}
+}
+
+/*------------------------------------------------------------------*/
+static void report_stats(line_sieve_t *s, double now, uint32 final) {
+
+	/* report the statistics for the interval since the
+	   last report, and add them to the totals for the run.
+	   The timers count clock ticks, which are converted to
+	   seconds using the ticks and the wall clock time that
+	   have elapsed since sieving started. When sieving is
+	   finished the totals are reported too; called with
+	   the shared mutex held, or after all threads finish */
+
+	double clocks_per_sec = 0;
+
+	if (now > s->start_time) {
+		clocks_per_sec = (read_clock() - s->start_clock) /
+					(now - s->start_time);
+	}
+
+	print_stats(s, &s->stats, "interval", now, 
+			now - s->last_report, clocks_per_sec);
+	add_stats(&s->total, &s->stats);
+	s->last_report = now;
+
+	if (final) {
+		print_stats(s, &s->total, "total", now, 
+				now - s->start_time, clocks_per_sec);
+	}
+}
+
+/*------------------------------------------------------------------*/
+static void get_line_range(line_sieve_t *s, sieve_job_t *job) {
+
+	/* give the next range of b values to a thread;
+	   called with the shared mutex held */
+
+	if (s->next_pending < s->num_pending) {
+		line_range_t *r = s->pending + s->next_pending++;
+
+		job->min_b = job->next_b = r->start;
+		job->max_b = r->end;
+		job->have_range = 1;
+		return;
+	}
+
+	if (s->all_assigned)
+		return;
+
+	job->min_b = job->next_b = s->next_b;
+	if (s->max_b - s->next_b < s->range_size) {
+		job->max_b = s->max_b;
+		s->all_assigned = 1;
+	}
+	else {
+		job->max_b = s->next_b + s->range_size - 1;
+		s->next_b = job->max_b + 1;
+	}
+	job->have_range = 1;
+}
+
+/*------------------------------------------------------------------*/
+static void save_relations(line_sieve_t *s, sieve_job_t *job,
+				uint32 relations_found) {
+
+	/* move the relations a thread has found into the 
+	   savefile, and update the running totals; called
+	   with the shared mutex held */
+
+	msieve_obj *obj = s->obj;
+	savefile_t *buf = &job->savefile;
+	char line[LINE_BUF_SIZE];
+
+	savefile_open(buf, SAVEFILE_READ);
+	while (1) {
+		savefile_read_line(line, sizeof(line), buf);
+		if (savefile_eof(buf))
+			break;
+		savefile_write_line(&obj->savefile, line);
+	}
+	savefile_open(buf, SAVEFILE_WRITE);
+
+	s->relations_found += relations_found;
+	s->num_batched += job->relation_batch.num_relations;
+	s->num_batched -= job->num_batched;
+	job->num_batched = job->relation_batch.num_relations;
+
+	if (job->stats.enabled)
+		add_stats(&s->stats, &job->stats);
+}
+
+/*------------------------------------------------------------------*/
+static void sieve_thread_run(void *data, int thread_num) {
+
+	/* keep sieving lines until the relations found by all
+	   threads are enough, or the b values run out */
+
+	sieve_job_t *job = (sieve_job_t *)data;
+	line_sieve_t *s = job->shared;
+	msieve_obj *obj = job->obj;
+	uint32 rels;
+	uint32 b;
+
+	if (job->stats.enabled) {
+		job->stats.phase = NFS_TIME_OTHER;
+		job->stats.phase_start = read_clock();
+	}
+
+	while (1) {
+		mutex_lock(&s->mutex);
+		if (!job->have_range)
+			get_line_range(s, job);
+		if (!job->have_range || s->sieving_done ||
+		    (obj->flags & MSIEVE_FLAG_STOP_SIEVING)) {
+			mutex_unlock(&s->mutex);
+			break;
+		}
+		mutex_unlock(&s->mutex);
+
+		b = job->next_b;
+		rels = do_one_line(job, b - job->min_b);
+		set_phase(job, NFS_TIME_OTHER);
+		STAT_COUNT(job, NFS_COUNT_LINE, 1);
+
+		mutex_lock(&s->mutex);
+		if (b == job->max_b)
+			job->have_range = 0;
+		else
+			job->next_b = b + 1;
+
+		save_relations(s, job, rels);
+		s->last_b = MAX(s->last_b, b);
+		if (s->relations_found >= s->max_relations)
+			s->sieving_done = 1;
 
 		/* print a progress message if appropriate */
 
@@ -313,50 +921,54 @@ uint32 do_line_sieving(msieve_obj *obj, sieve_param_t *params, mpz_t n,
 	    		   	  MSIEVE_FLAG_LOG_TO_STDOUT))) {
 			fprintf(stderr, "b = %u, %u complete / "
 				"%u batched relations (need %u)\r", 
-				job.min_b + i, relations_found, 
-				job.relation_batch.num_relations,
-				max_relations);
+				s->last_b, s->relations_found, 
+				s->num_batched, s->max_relations);
 			fflush(stderr);
 		}
 
-		/* quit if appropriate */
-
-		if (relations_found >= max_relations ||
-		    (obj->flags & MSIEVE_FLAG_STOP_SIEVING) ||
-		    i == job.max_b - job.min_b) {
+		if (s->stats.enabled) {
+			double now = get_wall_time();
 
-			/* finish up any batch factoring that's left */
-
-			if (job.relation_batch.num_relations > 0) {
-				relations_found += relation_batch_run(
-							&job.relation_batch);
-			}
-						
-			if (obj->flags & (MSIEVE_FLAG_USE_LOGFILE |
-				     	MSIEVE_FLAG_LOG_TO_STDOUT))
-				fprintf(stderr, "\n");
-
-			logprintf(obj, "completed b = %u, "
-				"found %u relations\n", 
-				job.min_b + i, relations_found);
-			break;
+			if (now - s->last_report >= s->stats_interval)
+				report_stats(s, now, 0);
 		}
+		mutex_unlock(&s->mutex);
 	}
-	obj->flags &= ~MSIEVE_FLAG_SIEVING_IN_PROGRESS;
 
-	relation_batch_free(&job.relation_batch);
-	savefile_flush(&obj->savefile);
-	free_one_sieve_fb(&job.sieve_rfb);
-	free_one_sieve_fb(&job.sieve_afb);
-	free_factor_base(&fb);
-	free(job.resieve_array);
-	write_last_line(obj, n, job.min_b + i + 1);
-	return relations_found;
+	/* finish up any batch factoring that's left */
+
+	set_phase(job, NFS_TIME_BATCH);
+	rels = relation_batch_run(&job->relation_batch);
+	set_phase(job, NFS_TIME_OTHER);
+	STAT_COUNT(job, NFS_COUNT_BATCH_RELS, rels);
+
+	mutex_lock(&s->mutex);
+	save_relations(s, job, rels);
+	mutex_unlock(&s->mutex);
+}
+
+/*------------------------------------------------------------------*/
+static double get_updates_per_block(fb_side_t *fb) {
+
+	/* estimate the number of bucket sieve updates that
+	   the factor base primes larger than the block size
+	   make in one sieve block */
+
+	uint32 i;
+	double updates = 0;
+
+	for (i = 0; i < fb->num_entries; i++) {
+		fb_entry_t *entry = fb->entries + i;
+
+		if (entry->p > BLOCK_SIZE && entry->r != entry->p)
+			updates += 1.0 / entry->p;
+	}
+	return updates * BLOCK_SIZE;
 }
 
 /*------------------------------------------------------------------*/
-static void init_one_fb(msieve_obj *obj, fb_side_t *fb, sieve_t *out_fb, 
-			uint32 num_buckets, uint32 lp_size, char *string) {
+static void init_one_fb(fb_side_t *fb, sieve_t *out_fb, 
+			uint32 region_blocks, uint32 lp_size) {
 
 	/* Set up all of the permanent parameters in 
 	   one factor base */
@@ -364,23 +976,22 @@ static void init_one_fb(msieve_obj *obj, fb_side_t *fb, sieve_t *out_fb,
 	uint32 i, j, k;
 	uint32 largest_p = fb->max_prime;
 	uint32 high_bound;
-	fb_entry_t *aliased;
+	uint32 bucket_alloc;
 
-	out_fb->poly = &fb->poly;
+	mpz_poly_init(&out_fb->poly);
+	out_fb->poly.degree = fb->poly.degree;
+	for (i = 0; i <= fb->poly.degree; i++)
+		mpz_set(out_fb->poly.coeff[i], fb->poly.coeff[i]);
 
-	/* make the version of the factor base used for sieving
-	   alias right on top of the input factor base */
+	/* make the version of the factor base used for sieving */
 
 	out_fb->fb_size = fb->num_entries;
-	out_fb->fb_entries = (fb_sieve_entry_t *)xrealloc(fb->entries,
-						fb->num_entries * 
+	out_fb->fb_entries = (fb_sieve_entry_t *)xmalloc(fb->num_entries * 
 						sizeof(fb_sieve_entry_t));
-	aliased = (fb_entry_t *)(out_fb->fb_entries);
-	for (i = fb->num_entries - 1; (int32)i >= 0; i--) {
-		out_fb->fb_entries[i].p = aliased[i].p;
-		out_fb->fb_entries[i].r = aliased[i].r;
+	for (i = 0; i < fb->num_entries; i++) {
+		out_fb->fb_entries[i].p = fb->entries[i].p;
+		out_fb->fb_entries[i].r = fb->entries[i].r;
 	}
-	fb->entries = NULL;
 
 	/* allocate the rest of the data structures */
 
@@ -388,11 +999,23 @@ static void init_one_fb(msieve_obj *obj, fb_side_t *fb, sieve_t *out_fb,
 	mpz_init(out_fb->tmp2);
 	mpz_init(out_fb->tmp3);
 	out_fb->sieve_block = (uint8 *)xmalloc(BLOCK_SIZE * sizeof(uint8));
-	out_fb->bucket_list = (uint32 *)xmalloc(num_buckets * sizeof(uint32));
-	out_fb->num_updates_alloc = 10000;
-	out_fb->update_list = (packed_fb_t *)xmalloc(
-					out_fb->num_updates_alloc * 
-					sizeof(packed_fb_t));
+
+	/* the buckets start out a little larger than the
+	   expected number of updates in one block, and grow
+	   if needed */
+
+	bucket_alloc = (uint32)(1.1 * get_updates_per_block(fb)) + 1000;
+	out_fb->num_buckets = region_blocks;
+	out_fb->buckets = (line_bucket_t *)xmalloc(region_blocks *
+						sizeof(line_bucket_t));
+	for (i = 0; i < region_blocks; i++) {
+		line_bucket_t *bucket = out_fb->buckets + i;
+
+		bucket->num_updates = 0;
+		bucket->num_alloc = bucket_alloc;
+		bucket->updates = (packed_fb_t *)xmalloc(bucket_alloc *
+						sizeof(packed_fb_t));
+	}
 
 	/* Calculate the large prime cutoffs */
 
@@ -451,7 +1074,7 @@ static void init_one_fb(msieve_obj *obj, fb_side_t *fb, sieve_t *out_fb,
 		for (power = p * p; power < 1400; power *= p) {
 			for (j = 0; j < power; j++) {
 				eval_poly(out_fb->res, (int64)j, 
-						1, out_fb->poly);
+						1, &out_fb->poly);
 				if (mpz_fdiv_ui(out_fb->res, power) != 0)
 					continue;
 
@@ -513,7 +1136,119 @@ static void init_one_fb(msieve_obj *obj, fb_side_t *fb, sieve_t *out_fb,
 		proj_entry->p = p;
 	}
 
-	/* log the choices above */
+	init_patterns(out_fb);
+}
+
+/*------------------------------------------------------------------*/
+static int compare_powers(const void *x, const void *y) {
+
+	fb_power_t *xx = (fb_power_t *)x;
+	fb_power_t *yy = (fb_power_t *)y;
+
+	return (int)xx->p - (int)yy->p;
+}
+
+/*------------------------------------------------------------------*/
+static void init_patterns(sieve_t *out_fb) {
+
+	/* divide the factor base entries and prime powers below
+	   PATTERN_P_LIMIT into groups to be sieved as patterns.
+	   Entries are taken in order of increasing p, and a new
+	   group is started whenever the least common multiple of
+	   the current group would exceed MAX_PATTERN_PERIOD.
+	   With the powers sorted by size, each group is a range
+	   of factor base entries and a range of powers */
+
+	uint32 i, j;
+	uint32 pattern_fb_size;
+	uint32 pattern_powers_size;
+	uint32 period = 0;
+	uint32 total_size = 0;
+	fb_sieve_entry_t *fb_entries = out_fb->fb_entries;
+	fb_power_t *fb_powers = out_fb->fb_powers;
+	small_pattern_t *pat = NULL;
+	uint8 *pattern_buf;
+
+	qsort(fb_powers, (size_t)out_fb->powers_fb_size, 
+			sizeof(fb_power_t), compare_powers);
+
+	for (i = 0; i < out_fb->fb_size; i++) {
+		if (fb_entries[i].p >= PATTERN_P_LIMIT)
+			break;
+	}
+	pattern_fb_size = i;
+
+	for (i = 0; i < out_fb->powers_fb_size; i++) {
+		if (fb_powers[i].p >= PATTERN_P_LIMIT)
+			break;
+	}
+	pattern_powers_size = i;
+
+	out_fb->num_patterns = 0;
+	i = j = 0;
+	while (i < pattern_fb_size || j < pattern_powers_size) {
+		uint32 use_power;
+		uint32 p;
+		uint32 new_period = 0;
+
+		use_power = (i == pattern_fb_size ||
+				(j < pattern_powers_size &&
+				 fb_powers[j].p < fb_entries[i].p));
+		p = use_power ? fb_powers[j].p : fb_entries[i].p;
+
+		if (pat != NULL)
+			new_period = period / mp_gcd_1(period, p) * p;
+
+		if (pat == NULL || new_period > MAX_PATTERN_PERIOD) {
+
+			/* entries that do not fit in any group
+			   are sieved normally */
+
+			if (out_fb->num_patterns == MAX_PATTERNS)
+				break;
+
+			pat = out_fb->patterns + out_fb->num_patterns++;
+			pat->fb_start = pat->fb_end = i;
+			pat->power_start = pat->power_end = j;
+			new_period = p;
+		}
+
+		period = pat->period = new_period;
+		if (use_power)
+			pat->power_end = ++j;
+		else
+			pat->fb_end = ++i;
+	}
+	out_fb->pattern_fb_size = i;
+	out_fb->pattern_powers_size = j;
+
+	/* patterns are read one vector at a time from arbitrary
+	   offsets, so they must be at least one vector long, and 
+	   each is followed by a copy of its first vector */
+
+	for (i = 0; i < out_fb->num_patterns; i++) {
+		pat = out_fb->patterns + i;
+		while (pat->period < PATTERN_VEC)
+			pat->period *= 2;
+		total_size += pat->period + PATTERN_VEC;
+	}
+
+	pattern_buf = out_fb->pattern_buf = (uint8 *)xmalloc(
+						(size_t)MAX(total_size, 1));
+	for (i = 0; i < out_fb->num_patterns; i++) {
+		pat = out_fb->patterns + i;
+		pat->pattern = pattern_buf;
+		pattern_buf += pat->period + PATTERN_VEC;
+	}
+}
+
+/*------------------------------------------------------------------*/
+static void log_one_fb(msieve_obj *obj, fb_side_t *fb, 
+			sieve_t *out_fb, char *string) {
+
+	/* log the choices made in init_one_fb */
+
+	uint32 largest_p = fb->max_prime;
 
 	logprintf(obj, "maximum %s prime: %u\n", string, largest_p);
 	logprintf(obj, "%s entries: %u\n", string, out_fb->fb_size);
@@ -522,6 +1257,10 @@ static void init_one_fb(msieve_obj *obj, fb_side_t *fb, sieve_t *out_fb,
 				out_fb->med_fb_size - out_fb->small_fb_size);
 	logprintf(obj, "small %s prime powers: %u\n", string, 
 					out_fb->powers_fb_size);
+	logprintf(obj, "%s entries sieved as %u patterns: %u\n", string,
+					out_fb->num_patterns,
+					out_fb->pattern_fb_size + 
+					out_fb->pattern_powers_size);
 	logprintf(obj, "projective %s roots: %u\n", string, 
 					out_fb->proj_fb_size);
 	logprintf(obj, "%s trial factoring cutoff: %u or %u bits\n", string, 
@@ -541,7 +1280,10 @@ static void init_one_fb(msieve_obj *obj, fb_side_t *fb, sieve_t *out_fb,
 /*------------------------------------------------------------------*/
 static void free_one_sieve_fb(sieve_t *out_fb) {
 
-	out_fb->fb_entries = NULL;
+	uint32 i;
+
+	mpz_poly_free(&out_fb->poly);
+	free(out_fb->fb_entries);
 	mpz_clear(out_fb->res);
 	mpz_clear(out_fb->tmp2);
 	mpz_clear(out_fb->tmp3);
@@ -550,9 +1292,11 @@ static void free_one_sieve_fb(sieve_t *out_fb) {
 	mpz_clear(out_fb->LP3_min);
 	mpz_clear(out_fb->LP3_max);
 	free(out_fb->sieve_block);
-	free(out_fb->bucket_list);
-	free(out_fb->update_list);
+	for (i = 0; i < out_fb->num_buckets; i++)
+		free(out_fb->buckets[i].updates);
+	free(out_fb->buckets);
 	free(out_fb->fb_powers);
+	free(out_fb->pattern_buf);
 }
 
 /*------------------------------------------------------------------*/
@@ -568,32 +1312,40 @@ static uint32 do_one_line(sieve_job_t *job, uint32 b_offset)
 	uint32 min_b = job->min_b;
 	uint32 b = min_b + b_offset;
 	int64 block_base = min_a;
-	uint32 num_buckets = job->num_buckets;
+	uint32 region_blocks = job->region_blocks;
 	mpz_t log_scratch;
 
 	/* finish off the factor base initialization and fill
 	   in the initial values of all the sieve updates */
 
-	init_one_sieve(&job->sieve_rfb, num_buckets, 
-			min_a, max_a, min_b, b_offset);
-	init_one_sieve(&job->sieve_afb, num_buckets, 
-			min_a, max_a, min_b, b_offset);
+	set_phase(job, NFS_TIME_SIEVE);
+	init_one_sieve(&job->sieve_rfb, min_a, max_a, min_b, b_offset);
+	init_one_sieve(&job->sieve_afb, min_a, max_a, min_b, b_offset);
 	mpz_init(log_scratch);
 
 	while (min_a < max_a) {
 
+		/* sort the updates of the large factor base 
+		   primes for the next region into buckets */
+
+		fill_buckets(&job->sieve_rfb);
+		fill_buckets(&job->sieve_afb);
+
 		/* for each sieve block */
 
-		for (i = 0; i < num_buckets; i++) {
+		for (i = 0; i < region_blocks; i++) {
 
 			/* fill up the sieve block */
 
-			fill_one_block(&job->sieve_rfb, i, num_buckets);
-			fill_one_block(&job->sieve_afb, i, num_buckets);
+			fill_one_block(&job->sieve_rfb, i);
+			fill_one_block(&job->sieve_afb, i);
+			STAT_COUNT(job, NFS_COUNT_BLOCK, 1);
 
 			/* scan it for values to trial factor */
 
+			set_phase(job, NFS_TIME_SCAN);
 			rels += do_factoring(job, block_base, b, log_scratch);
+			set_phase(job, NFS_TIME_SIEVE);
 			if (b % 2 == 0)
 				block_base += 2 * BLOCK_SIZE;
 			else
@@ -616,7 +1368,6 @@ static uint32 do_one_line(sieve_job_t *job, uint32 b_offset)
 
 /*------------------------------------------------------------------*/
 static void init_one_sieve(sieve_t *out_fb,
-			uint32 num_buckets, 
 			int64 min_a, int64 max_a, 
 			uint32 min_b, uint32 b_offset) {
 
@@ -633,7 +1384,7 @@ static void init_one_sieve(sieve_t *out_fb,
 
 		double log_of_base;
 
-		out_fb->base = get_log_base(out_fb->poly, min_a, max_a, 
+		out_fb->base = get_log_base(&out_fb->poly, min_a, max_a, 
 					b + LOG_UPDATE_RATE - 1);
 		log_of_base = out_fb->log_base = log(out_fb->base);
 
@@ -660,14 +1411,8 @@ static void init_one_sieve(sieve_t *out_fb,
 		}
 	}
 
-	/* clear the linked lists of sieve updates */
-
-	memset(out_fb->bucket_list, 0, num_buckets * sizeof(uint32));
-
-	/* initialize the factor base, and put the sieve update
-	   associated with each factor base prime into the correct
-	   bucket. This amount to an in-place radix sort on the
-	   collection of updates */
+	/* initialize the factor base with the first sieve 
+	   update of each factor base prime */
 
 	for (i = 0; i < out_fb->fb_size; i++) {
 		fb_sieve_entry_t *entry = out_fb->fb_entries + i;
@@ -707,19 +1452,12 @@ static void init_one_sieve(sieve_t *out_fb,
 		}
 
 		/* compute the sieve update corresponding to
-		   this factor base prime */
+		   this factor base prime. If p exceeds the block
+		   size, the update is relative to the start of 
+		   the first bucket region */
 
 		entry->offset = (uint16)(rem % BLOCK_SIZE);
-
-		/* if p exceeds the block size, add it to the 
-		   linked list corresponding to the bucket in which the 
-		   update falls */
-
-		if (p > BLOCK_SIZE) {
-			uint32 bucket = BLOCK_HASH(rem);
-			entry->next = out_fb->bucket_list[bucket];
-			out_fb->bucket_list[bucket] = i;
-		}
+		entry->next_hit = (uint32)rem;
 	}
 
 	/* repeat for the powers of small factor base primes */
@@ -757,86 +1495,225 @@ static void init_one_sieve(sieve_t *out_fb,
 	   their combined log value. This is added to the cutoff
 	   for the entire sieve later */
 
-	common = mpz_fdiv_ui(out_fb->poly->coeff[out_fb->poly->degree], b);
+	common = mpz_fdiv_ui(out_fb->poly.coeff[out_fb->poly.degree], b);
 	common = mp_gcd_1(common, b);
 	out_fb->proj_bias = fplog(common, out_fb->log_base);
+
+	/* build the sieve patterns for this line */
+
+	for (i = 0; i < out_fb->num_patterns; i++) {
+		small_pattern_t *pat = out_fb->patterns + i;
+		uint8 *pattern = pat->pattern;
+		uint32 period = pat->period;
+		uint32 j, r;
+
+		memset(pattern, 0, (size_t)period);
+
+		for (j = pat->fb_start; j < pat->fb_end; j++) {
+			fb_sieve_entry_t *entry = out_fb->fb_entries + j;
+
+			if (entry->skip)
+				continue;
+			for (r = entry->offset; r < period; r += entry->p)
+				pattern[r] += entry->logp;
+		}
+
+		for (j = pat->power_start; j < pat->power_end; j++) {
+			fb_power_t *entry = out_fb->fb_powers + j;
+
+			if (entry->skip)
+				continue;
+			for (r = entry->offset; r < period; r += entry->p)
+				pattern[r] += entry->logp;
+		}
+
+		for (j = period; j < period + PATTERN_VEC; j++)
+			pattern[j] = pattern[j - period];
+		pat->phase = 0;
+	}
 }
 
 /*------------------------------------------------------------------*/
-static void fill_one_block(sieve_t *sieve_fb, 
-			uint32 block, uint32 num_buckets) {
+static void init_sieve_block(sieve_t *sieve_fb) {
+
+	/* set the initial log value of every entry in the sieve
+	   block, and add in all of the sieve patterns. Each vector
+	   of the block is written only once */
+
+	uint32 i, j;
+	uint32 num_patterns = sieve_fb->num_patterns;
+	small_pattern_t *patterns = sieve_fb->patterns;
+	uint8 *sieve_block = sieve_fb->sieve_block;
+	uint32 phase[MAX_PATTERNS];
+	uint32 period[MAX_PATTERNS];
+	uint8 *pattern[MAX_PATTERNS];
+
+	for (i = 0; i < num_patterns; i++) {
+		phase[i] = patterns[i].phase;
+		period[i] = patterns[i].period;
+		pattern[i] = patterns[i].pattern;
+	}
+
+#if defined(__AVX2__)
+	{
+		__m256i bias = _mm256_set1_epi8((char)sieve_fb->proj_bias);
+
+		for (i = 0; i < BLOCK_SIZE; i += PATTERN_VEC) {
+			__m256i v = bias;
+
+			for (j = 0; j < num_patterns; j++) {
+				v = _mm256_add_epi8(v, _mm256_loadu_si256(
+					(__m256i *)(pattern[j] + phase[j])));
+				phase[j] += PATTERN_VEC;
+				if (phase[j] >= period[j])
+					phase[j] -= period[j];
+			}
+			_mm256_storeu_si256((__m256i *)(sieve_block + i), v);
+		}
+	}
+#elif defined(HAS_SSE2)
+	{
+		__m128i bias = _mm_set1_epi8((char)sieve_fb->proj_bias);
+
+		for (i = 0; i < BLOCK_SIZE; i += PATTERN_VEC) {
+			__m128i v = bias;
+
+			for (j = 0; j < num_patterns; j++) {
+				v = _mm_add_epi8(v, _mm_loadu_si128(
+					(__m128i *)(pattern[j] + phase[j])));
+				phase[j] += PATTERN_VEC;
+				if (phase[j] >= period[j])
+					phase[j] -= period[j];
+			}
+			_mm_storeu_si128((__m128i *)(sieve_block + i), v);
+		}
+	}
+#else
+	{
+		/* add eight bytes at a time with no carries 
+		   between them */
+
+		uint64 hi = (uint64)0x80808080 << 32 | 0x80808080;
+		uint64 bias = ((uint64)0x01010101 << 32 | 0x01010101) *
+					sieve_fb->proj_bias;
+
+		for (i = 0; i < BLOCK_SIZE; i += PATTERN_VEC) {
+			uint64 v = bias;
+
+			for (j = 0; j < num_patterns; j++) {
+				uint64 t;
+
+				memcpy(&t, pattern[j] + phase[j], sizeof(t));
+				v = ((v & ~hi) + (t & ~hi)) ^ ((v ^ t) & hi);
+				phase[j] += PATTERN_VEC;
+				if (phase[j] >= period[j])
+					phase[j] -= period[j];
+			}
+			memcpy(sieve_block + i, &v, sizeof(v));
+		}
+	}
+#endif
+
+	for (i = 0; i < num_patterns; i++)
+		patterns[i].phase = phase[i];
+}
+
+/*------------------------------------------------------------------*/
+static void fill_buckets(sieve_t *sieve_fb) {
+
+	/* sort the sieve updates of all the factor base primes
+	   larger than the block size that fall in the next
+	   region of the sieve line into one bucket per block. 
+	   The offset of each prime's next update is kept 
+	   relative to the start of the region */
+
+	uint32 i;
+	fb_sieve_entry_t *factor_base = sieve_fb->fb_entries;
+	line_bucket_t *buckets = sieve_fb->buckets;
+	uint32 num_buckets = sieve_fb->num_buckets;
+	uint32 region_size = num_buckets * BLOCK_SIZE;
+	uint32 fb_size = sieve_fb->fb_size;
+
+	for (i = 0; i < num_buckets; i++)
+		buckets[i].num_updates = 0;
+
+	for (i = sieve_fb->med_fb_size; i < fb_size; i++) {
+		fb_sieve_entry_t *entry = factor_base + i;
+		uint32 p = entry->p;
+		uint32 r = entry->next_hit;
+
+#ifdef MANUAL_PREFETCH
+		PREFETCH(entry + 8);
+#endif
+		if (entry->skip)
+			continue;
+
+		while (r < region_size) {
+			line_bucket_t *bucket = buckets + r / BLOCK_SIZE;
+			packed_fb_t *update;
+
+			if (bucket->num_updates == bucket->num_alloc) {
+				bucket->num_alloc *= 2;
+				bucket->updates = (packed_fb_t *)xrealloc(
+						bucket->updates,
+						bucket->num_alloc *
+						sizeof(packed_fb_t));
+			}
+			update = bucket->updates + bucket->num_updates++;
+			update->p = p;
+			update->offset = (uint16)(r & (BLOCK_SIZE - 1));
+			update->logp = entry->logp;
+			r += p;
+		}
+		entry->next_hit = r - region_size;
+	}
+}
+
+/*------------------------------------------------------------------*/
+static void fill_one_block(sieve_t *sieve_fb, uint32 block) {
 
 	/* combine all of the sieve updates for one factor base */
 
 	uint32 i;
 	fb_sieve_entry_t *factor_base = sieve_fb->fb_entries;
-	uint32 *bucket_list = sieve_fb->bucket_list;
 	uint32 med_fb_size = sieve_fb->med_fb_size;
 	uint32 powers_fb_size = sieve_fb->powers_fb_size;
 	uint8 *sieve_block = sieve_fb->sieve_block;
-	packed_fb_t *update_list = sieve_fb->update_list;
-	uint32 num_updates_alloc = sieve_fb->num_updates_alloc;
+	packed_fb_t *update_list;
 	uint32 num_updates;
-	uint32 fb_offset;
-
-	/* first, pack together the sieve updates corresponding
-	   to the large factor base primes. Begin by getting the
-	   head of the linked list of updates. Then set the 
-	   list of updates to empty, so updates that wrap around 
-	   the end of the list of buckets have somewhere to go */
-
-	fb_offset = bucket_list[block];
-	bucket_list[block] = 0;
-	i = 0;
-
-	while (fb_offset != 0) {
-		fb_sieve_entry_t *entry = factor_base + fb_offset;
-		packed_fb_t update;
-		uint32 tmp_offset;
-		uint32 new_bucket;
-		uint64 new_offset;
-
-		PREFETCH(factor_base + entry->next);
-		update.p = entry->p;
-		update.offset = entry->offset;
-		update.logp = entry->logp;
-
-		if (i >= num_updates_alloc) {
-			num_updates_alloc += 5000;
-			sieve_fb->num_updates_alloc = num_updates_alloc;
-			update_list = (packed_fb_t *)xrealloc(update_list, 
-							num_updates_alloc * 
-							sizeof(packed_fb_t));
-			sieve_fb->update_list = update_list;
-		}
-		update_list[i++] = update;
 
-		/* Since the act of packing things will pull the 
-		   factor base entry into cache anyway, also fold 
-		   in the computation of the next update for this 
-		   factor base prime */
+	/* the updates from the large factor base primes are
+	   the contents of the bucket for this block */
 
-		new_offset = (uint64)block * BLOCK_SIZE + 
-					entry->offset + entry->p;
-		entry->offset = (uint16)(new_offset & (BLOCK_SIZE-1));
-		new_bucket = BLOCK_HASH(new_offset);
-		if (new_bucket >= num_buckets)
-			new_bucket -= num_buckets;
+	update_list = sieve_fb->buckets[block].updates;
+	sieve_fb->update_list = update_list;
+	sieve_fb->num_updates = sieve_fb->buckets[block].num_updates;
 
-		tmp_offset = entry->next;
-		entry->next = bucket_list[new_bucket];
-		bucket_list[new_bucket] = fb_offset;
-		fb_offset = tmp_offset;
-	}
-	sieve_fb->num_updates = i;
+	/* now do the sieving. First set the initial log value,
+	   which includes the updates of the smallest primes */
 
-	/* now do the sieving. First set the initial log value */
+	init_sieve_block(sieve_fb);
 
-	memset(sieve_block, sieve_fb->proj_bias, (size_t)BLOCK_SIZE);
+	/* the offsets of the primes sieved with patterns are
+	   still needed for trial factoring, so advance them
+	   to the next block. Offsets of powers are not used
+	   after the patterns are built */
+
+	for (i = 0; i < sieve_fb->pattern_fb_size; i++) {
+		fb_sieve_entry_t *entry = factor_base + i;
+		uint32 p = entry->p;
+		uint32 r = entry->offset;
+
+		if (entry->skip)
+			continue;
+
+		r += (BLOCK_SIZE - r + p - 1) / p * p;
+		entry->offset = (uint16)(r - BLOCK_SIZE);
+	}
 
 	/* add the updates from the small factor base primes */
 
-	for (i = 0; i < med_fb_size; i++) {
+	for (; i < med_fb_size; i++) {
 		fb_sieve_entry_t *entry = factor_base + i;
 		uint32 p = entry->p;
 		uint32 r = entry->offset;
@@ -854,7 +1731,7 @@ static void fill_one_block(sieve_t *sieve_fb,
 
 	/* add the updates from the powers of small factor base primes */
 
-	for (i = 0; i < powers_fb_size; i++) {
+	for (i = sieve_fb->pattern_powers_size; i < powers_fb_size; i++) {
 		fb_power_t *entry = sieve_fb->fb_powers + i;
 		uint32 p = entry->p;
 		uint32 r = entry->offset;
@@ -891,6 +1768,64 @@ static void fill_one_block(sieve_t *sieve_fb,
 		sieve_block[update_list[i].offset] += update_list[i].logp;
 }
 
+/*------------------------------------------------------------------*/
+static uint64 scan_survivors(uint8 *sieve_r, uint8 *sieve_a,
+				uint32 cutoff_r, uint32 cutoff_a) {
+
+	/* compare SCAN_WIDTH values from both sieve blocks to
+	   their cutoffs at once. Returns a bitfield of the values
+	   whose logs exceed both cutoffs, and marks all the other
+	   values invalid in the algebraic sieve block. A byte x
+	   exceeds the cutoff c exactly when the saturating
+	   subtraction x - c is nonzero */
+
+	uint32 i;
+	uint64 survivors = 0;
+
+#if defined(__AVX2__)
+	__m256i zero = _mm256_setzero_si256();
+	__m256i cr = _mm256_set1_epi8((char)cutoff_r);
+	__m256i ca = _mm256_set1_epi8((char)cutoff_a);
+
+	for (i = 0; i < SCAN_WIDTH; i += 32) {
+		__m256i r = _mm256_loadu_si256((__m256i *)(sieve_r + i));
+		__m256i a = _mm256_loadu_si256((__m256i *)(sieve_a + i));
+		__m256i fail = _mm256_or_si256(
+			_mm256_cmpeq_epi8(_mm256_subs_epu8(r, cr), zero),
+			_mm256_cmpeq_epi8(_mm256_subs_epu8(a, ca), zero));
+
+		_mm256_storeu_si256((__m256i *)(sieve_a + i), 
+				_mm256_or_si256(a, fail));
+		survivors |= (uint64)(uint32)~_mm256_movemask_epi8(fail) << i;
+	}
+#elif defined(HAS_SSE2)
+	__m128i zero = _mm_setzero_si128();
+	__m128i cr = _mm_set1_epi8((char)cutoff_r);
+	__m128i ca = _mm_set1_epi8((char)cutoff_a);
+
+	for (i = 0; i < SCAN_WIDTH; i += 16) {
+		__m128i r = _mm_loadu_si128((__m128i *)(sieve_r + i));
+		__m128i a = _mm_loadu_si128((__m128i *)(sieve_a + i));
+		__m128i fail = _mm_or_si128(
+			_mm_cmpeq_epi8(_mm_subs_epu8(r, cr), zero),
+			_mm_cmpeq_epi8(_mm_subs_epu8(a, ca), zero));
+
+		_mm_storeu_si128((__m128i *)(sieve_a + i), 
+				_mm_or_si128(a, fail));
+		survivors |= (uint64)(~_mm_movemask_epi8(fail) & 0xffff) << i;
+	}
+#else
+	for (i = 0; i < SCAN_WIDTH; i++) {
+		if (sieve_a[i] <= cutoff_a || sieve_r[i] <= cutoff_r)
+			sieve_a[i] = RESIEVE_INVALID;
+		else
+			survivors |= (uint64)1 << i;
+	}
+#endif
+
+	return survivors;
+}
+
 /*------------------------------------------------------------------*/
 static uint32 do_factoring(sieve_job_t *job, 
 			int64 block_start, uint32 b,
@@ -898,7 +1833,7 @@ static uint32 do_factoring(sieve_job_t *job,
 
 	/* scan a sieve block for smooth numbers */
 
-	int32 i, j;
+	int32 i, j, k;
 	sieve_t *rfb = &job->sieve_rfb;
 	sieve_t *afb = &job->sieve_afb;
 	uint8 *sieve_r = rfb->sieve_block;
@@ -933,12 +1868,12 @@ static uint32 do_factoring(sieve_job_t *job,
 
 	a = block_start;
 	cutoffL_r = fplog_eval_poly(a, b, log_scratch,
-				rfb->poly, rfb->log_base, &rbits);
+				&rfb->poly, rfb->log_base, &rbits);
 	cutoffR_r = fplog_eval_poly(a + real_block_length, b, log_scratch, 
-				rfb->poly, rfb->log_base, &rbits);
+				&rfb->poly, rfb->log_base, &rbits);
 
 	cutoffL_a = fplog_eval_poly(a, b, log_scratch, 
-				afb->poly, afb->log_base, &abits);
+				&afb->poly, afb->log_base, &abits);
 
 	for (i = 0; i < BLOCK_SIZE; i += num_scanned) {
 
@@ -946,7 +1881,7 @@ static uint32 do_factoring(sieve_job_t *job,
 		   num_scanned sieve values */
 
 		a += A_SAMPLE_RATE;
-		cutoffR_a = fplog_eval_poly(a, b, log_scratch, afb->poly, 
+		cutoffR_a = fplog_eval_poly(a, b, log_scratch, &afb->poly, 
 						afb->log_base, &abits);
 
 		cutoff_r = (cutoffL_r + cutoffR_r) / 2;
@@ -996,71 +1931,79 @@ static uint32 do_factoring(sieve_job_t *job,
 			cutoff_a = 0;
 		cutoffL_a = cutoffR_a;
 
-		for (j = 0; j < num_scanned; j++) {
-			int64 curr_a;
-			resieve_t *r;
+		for (j = 0; j < num_scanned; j += SCAN_WIDTH) {
 
 			/* we gradually increase the amount of effort
 			   expended to find smooth relations. First check
-			   that the logs of both sieve values meet the cutoff.
-			   Check the algebraic value first, since it's less
-			   likely to pass (this keeps the rational sieve
-			   from polluting the cache most of the time) */
-
-			if (sieve_a[i+j] <= cutoff_a ||
-			    sieve_r[i+j] <= cutoff_r) {
-				sieve_a[i+j] = RESIEVE_INVALID;
-				continue;
-			}
+			   that the logs of both sieve values meet the cutoff,
+			   for SCAN_WIDTH values at a time. Values that fail
+			   are marked invalid in the algebraic sieve block */
 
-			if (b % 2 == 0)
-				curr_a = block_start + 2 * (i+j) + 1;
-			else
-				curr_a = block_start + (i+j);
+			uint64 survivors = scan_survivors(sieve_r + i + j, 
+						sieve_a + i + j,
+						(uint32)MIN(cutoff_r, 255),
+						(uint32)MIN(cutoff_a, 255));
 
-			/* do a little more work */
+			for (k = i + j; survivors != 0; k++, survivors >>= 1) {
+				int64 curr_a;
+				resieve_t *r;
 
-			gcda = curr_a % (int64)b;
-			if (gcda < 0)
-				gcda += b;
+				if ((survivors & 1) == 0)
+					continue;
 
-			if (mp_gcd_1((uint32)gcda, b) != 1) {
-				sieve_a[i+j] = RESIEVE_INVALID;
-				continue;
-			}
+				if (b % 2 == 0)
+					curr_a = block_start + 2 * k + 1;
+				else
+					curr_a = block_start + k;
+
+				/* do a little more work */
+
+				gcda = curr_a % (int64)b;
+				if (gcda < 0)
+					gcda += b;
 
-			/* queue this value for resieving. There are a lot
-			   of compromises in the resieving implementation;
-			   the biggest are that we will not buffer too many
-			   values at any given time, and only buffer one
-			   sieve block worth of values. There are many
-			   advantages to this approach: no bitfield is 
-			   necessary to represent queued sieve values, and
-			   no hashtable is needed to identify them. The
-			   byte array for the sieve block can do both of
-			   these functions, and initializing it is cheap.
-			   A small resieve array also fits better in cache.
-
-			   The only disadvantage is that there may not be
-			   enough buffer slots for all the sieve values that
-			   need resieving. Rather than ignoring potentially
-			   good values in this case, we can just resieve a
-			   given block more than once. In cases where it's
-			   needed, the savings from resieving everything
-			   dwarf the extra overhead of sieving more than once */
-
-			r = resieve_array + 2 * num_resieve;
-			r[0].offset = i+j;
-			r[0].num_factors = 0;
-			r[1].num_factors = 0;
-			sieve_a[i+j] = num_resieve++;
-
-			if (num_resieve == MAX_RESIEVE_ENTRIES) {
-				rels += do_resieve(job, resieve_base, 
-						(uint32)(i+j), num_resieve,
-						block_start, b);
-				num_resieve = 0;
-				resieve_base = i+j+1;
+				if (mp_gcd_1((uint32)gcda, b) != 1) {
+					sieve_a[k] = RESIEVE_INVALID;
+					continue;
+				}
+
+				/* queue this value for resieving. There are a
+				   lot of compromises in the resieving
+				   implementation; the biggest are that we will
+				   not buffer too many values at any given time,
+				   and only buffer one sieve block worth of
+				   values. There are many advantages to this
+				   approach: no bitfield is necessary to
+				   represent queued sieve values, and no
+				   hashtable is needed to identify them. The
+				   byte array for the sieve block can do both of
+				   these functions, and initializing it is
+				   cheap. A small resieve array also fits better
+				   in cache.
+
+				   The only disadvantage is that there may not
+				   be enough buffer slots for all the sieve
+				   values that need resieving. Rather than
+				   ignoring potentially good values in this
+				   case, we can just resieve a given block more
+				   than once. In cases where it's needed, the
+				   savings from resieving everything dwarf the
+				   extra overhead of sieving more than once */
+
+				r = resieve_array + 2 * num_resieve;
+				r[0].offset = k;
+				r[0].num_factors = 0;
+				r[1].num_factors = 0;
+				sieve_a[k] = num_resieve++;
+				STAT_COUNT(job, NFS_COUNT_REPORT, 1);
+
+				if (num_resieve == MAX_RESIEVE_ENTRIES) {
+					rels += do_resieve(job, resieve_base, 
+							(uint32)k, num_resieve,
+							block_start, b);
+					num_resieve = 0;
+					resieve_base = k+1;
+				}
 			}
 		}
 	}
@@ -1096,12 +2039,14 @@ static uint32 do_resieve(sieve_job_t *job, uint32 low_offset,
 	   overwhelming */
 
 	if (num_resieve < 10) {
+		set_phase(job, NFS_TIME_TF);
 		for (i = 0; i < num_resieve; i++) {
 			resieve_t *r = resieve_array + 2 * i;
 			r[0].num_factors = RESIEVE_INVALID;
 			r[1].num_factors = RESIEVE_INVALID;
 			rels += do_one_factoring(job, r, block_start, b);
 		}
+		set_phase(job, NFS_TIME_SCAN);
 		return rels;
 	}
 
@@ -1110,6 +2055,7 @@ static uint32 do_resieve(sieve_job_t *job, uint32 low_offset,
 	   indexed entries in resieve_array handle algebraic
 	   factors, odd-indexed values handle the rational side */
 
+	set_phase(job, NFS_TIME_RESIEVE);
 	do_one_resieve(&job->sieve_afb, resieve_array,
 			hashtable, low_offset, high_offset);
 
@@ -1119,9 +2065,11 @@ static uint32 do_resieve(sieve_job_t *job, uint32 low_offset,
 	/* complete the trial factoring of each value 
 	   individually */
 
+	set_phase(job, NFS_TIME_TF);
 	for (i = 0; i < num_resieve; i++)
 		rels += do_one_factoring(job, resieve_array + 2 * i, 
 					block_start, b);
+	set_phase(job, NFS_TIME_SCAN);
 	return rels;
 }
 
@@ -1228,19 +2176,21 @@ static uint32 do_one_factoring(sieve_job_t *job, resieve_t *sieve_value,
 	   vast majority of such trial factoring attempts
 	   will not succeed */
 
-	eval_poly(afb->res, a, b, afb->poly);
+	eval_poly(afb->res, a, b, &afb->poly);
 	mpz_abs(afb->res, afb->res);
 
 	if (!do_one_tf(afb, sieve_value, 
 			factors_a, &num_factors_a, offset, b))
 		return 0;
+	STAT_COUNT(job, NFS_COUNT_ALG, 1);
 
-	eval_poly(rfb->res, a, b, rfb->poly);
+	eval_poly(rfb->res, a, b, &rfb->poly);
 	mpz_abs(rfb->res, rfb->res);
 
 	if (!do_one_tf(rfb, sieve_value + 1, 
 			factors_r, &num_factors_r, offset, b))
 		return 0;
+	STAT_COUNT(job, NFS_COUNT_RAT, 1);
 
 	/* continue only if the cofactors remaining after 
 	   trial division are composite. A base-2 pseudoprime 
@@ -1293,9 +2243,10 @@ static uint32 do_one_factoring(sieve_job_t *job, resieve_t *sieve_value,
 		for (i = 1; i < MAX_LARGE_PRIMES; i++)
 			lp_r[i] = lp_a[i] = 1;
 
-		print_relation(&job->obj->savefile, a, b, 
+		print_relation(&job->savefile, a, b, 
 				factors_r, num_factors_r, lp_r,
 				factors_a, num_factors_a, lp_a);
+		STAT_COUNT(job, NFS_COUNT_DIRECT, 1);
 		return 1;
 	}
 
@@ -1304,13 +2255,20 @@ static uint32 do_one_factoring(sieve_job_t *job, resieve_t *sieve_value,
 	relation_batch_add(a, b, factors_r, num_factors_r, rfb->res,
 				factors_a, num_factors_a, afb->res,
 				&job->relation_batch);
+	STAT_COUNT(job, NFS_COUNT_BATCHED, 1);
 
 	/* if enough unfactored relations have accumulated,
-	   factor them */
+	   factor them while sieving continues */
 
 	if (job->relation_batch.num_relations >= 
 			job->relation_batch.target_relations) {
-		return relation_batch_run(&job->relation_batch);
+		uint32 rels;
+
+		set_phase(job, NFS_TIME_BATCH);
+		rels = relation_batch_start(&job->relation_batch);
+		set_phase(job, NFS_TIME_TF);
+		STAT_COUNT(job, NFS_COUNT_BATCH_RELS, rels);
+		return rels;
 	}
 	return 0;
 }
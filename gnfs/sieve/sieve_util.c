@@ -15,12 +15,13 @@ $Id$
 #include "sieve.h"
 
 /*------------------------------------------------------------------*/
-void print_relation(savefile_t *savefile, int64 a, uint32 b, 
+void print_relation(void *print_data, int64 a, uint32 b, 
 			uint32 *factors_r, uint32 num_factors_r, 
 			uint32 large_prime_r[MAX_LARGE_PRIMES],
 			uint32 *factors_a, uint32 num_factors_a, 
 			uint32 large_prime_a[MAX_LARGE_PRIMES]) {
 	
+	savefile_t *savefile = (savefile_t *)print_data;
 	uint32 i, j;
 	char buf[LINE_BUF_SIZE];
 	char *tmp = buf;
@@ -42,6 +43,12 @@ void print_relation(savefile_t *savefile, int64 a, uint32 b,
 		i++;
 	}
 
+	/* the list of factors on either side may be empty,
+	   if all of them are too small to be listed */
+
+	if (i == 0)
+		tmp += sprintf(tmp, ":");
+
 	for (i = 0; i < num_factors_a; i++) {
 		if (i == 0)
 			tmp += sprintf(tmp, ":%x", factors_a[i]);
@@ -57,6 +64,8 @@ void print_relation(savefile_t *savefile, int64 a, uint32 b,
 			tmp += sprintf(tmp, ",%x", large_prime_a[j]);
 		i++;
 	}
+	if (i == 0)
+		tmp += sprintf(tmp, ":");
 	sprintf(tmp, "\n");
 	savefile_write_line(savefile, buf);
 }
@@ -128,14 +137,18 @@ double get_log_base(mpz_poly_t *poly,
 }
 
 /*------------------------------------------------------------------*/
-uint32 read_last_line(msieve_obj *obj, mpz_t n) {
+uint32 read_last_line(msieve_obj *obj, mpz_t n, char *suffix,
+			line_range_t **ranges, uint32 *num_ranges) {
 
 	uint32 last_line = 0;
+	uint32 num_alloc = 0;
 	char buf[LINE_BUF_SIZE];
 	FILE *linefile;
 	mpz_t read_n;
 
-	sprintf(buf, "%s.line", obj->savefile.name);
+	*ranges = NULL;
+	*num_ranges = 0;
+	sprintf(buf, "%s.%s", obj->savefile.name, suffix);
 	linefile = fopen(buf, "r");
 	if (linefile == NULL)
 		return last_line;
@@ -147,6 +160,24 @@ uint32 read_last_line(msieve_obj *obj, mpz_t n) {
 	if (mpz_cmp(n, read_n) == 0) {
 		fgets(buf, (int)sizeof(buf), linefile);
 		last_line = atoi(buf);
+
+		/* older line files stop here */
+
+		while (fgets(buf, (int)sizeof(buf), linefile) != NULL) {
+			line_range_t r;
+
+			if (sscanf(buf, "%u %u", &r.start, &r.end) != 2 ||
+			    r.start > r.end)
+				continue;
+
+			if (*num_ranges == num_alloc) {
+				num_alloc = 2 * num_alloc + 8;
+				*ranges = (line_range_t *)xrealloc(*ranges,
+						num_alloc * 
+						sizeof(line_range_t));
+			}
+			(*ranges)[(*num_ranges)++] = r;
+		}
 	}
 
 	fclose(linefile);
@@ -155,12 +186,20 @@ uint32 read_last_line(msieve_obj *obj, mpz_t n) {
 }
 
 /*------------------------------------------------------------------*/
-void write_last_line(msieve_obj *obj, mpz_t n, uint32 b) {
+void write_last_line(msieve_obj *obj, mpz_t n, char *suffix, uint32 b,
+			line_range_t *ranges, uint32 num_ranges) {
 
+	uint32 i;
 	char buf[LINE_BUF_SIZE];
 	FILE *linefile;
 
-	sprintf(buf, "%s.line", obj->savefile.name);
+	/* a savefile kept in memory, as when tuning, cannot 
+	   be resumed, so there is nothing to record */
+
+	if (obj->savefile.in_memory)
+		return;
+
+	sprintf(buf, "%s.%s", obj->savefile.name, suffix);
 	linefile = fopen(buf, "w");
 	if (linefile == NULL) {
 		printf("error: cannot open linefile '%s'\n", buf);
@@ -169,35 +208,68 @@ void write_last_line(msieve_obj *obj, mpz_t n, uint32 b) {
 
 	gmp_fprintf(linefile, "N %Zd\n", n);
 	fprintf(linefile, "%u\n", b);
+	for (i = 0; i < num_ranges; i++)
+		fprintf(linefile, "%u %u\n", ranges[i].start, ranges[i].end);
 	fclose(linefile);
 }
 
 /*------------------------------------------------------------------*/
-uint32 add_free_relations(msieve_obj *obj, 
-			factor_base_t *fb, uint8 *free_bits) {
+/* Testing candidate free relations means finding the number
+   of roots of both polynomials modulo each candidate prime,
+   and a large dataset has millions of candidates. The tests
+   are split between threads a range of candidates at a time,
+   and their results are saved in <savefile>.fr, so that later
+   filtering runs with the same polynomials only test primes
+   that are new. The file starts with the polynomial
+   coefficients in text, then has a line 'BITS <bytes> <free>'
+   followed by a bitfield of the primes tested (in the same
+   compressed format as the candidates) and a sorted list of
+   32-bit primes that gave free relations */
+
+#define FREE_TASK_BYTES 65536
+
+typedef struct {
+	factor_base_t *fb;
+	uint8 *candidates;	/* candidate primes */
+	uint8 *tested;		/* candidates that need no testing */
+	uint32 start;		/* range of bytes of the */
+	uint32 end;		/* bitfield to test */
+
+	uint32 num_free;	/* primes giving free relations */
+	uint32 num_alloc;
+	uint32 *free_primes;
+} free_task_t;
+
+static const uint8 free_mask[] = {0x01, 0x02, 0x04, 0x08,
+				  0x10, 0x20, 0x40, 0x80};
 
-	uint32 i, j;
-	uint32 num_relations = 0;
+/*------------------------------------------------------------------*/
+static void test_free_relations(void *data, int thread_num) {
+
+	/* test one range of candidates; the primes that
+	   give free relations are found in ascending order */
+
+	free_task_t *t = (free_task_t *)data;
+	factor_base_t *fb = t->fb;
 	uint32 alg_degree = fb->afb.poly.degree;
 	uint32 rat_degree = fb->rfb.poly.degree;
-	uint32 free_bytes = (FREE_RELATION_LIMIT / 2 + 7) / 8;
+	uint32 i, j;
 
-	savefile_open(&obj->savefile, SAVEFILE_APPEND);
+	for (i = t->start; i < t->end; i++) {
 
-	for (i = 0; i < free_bytes; i++) {
+		uint8 bits = t->candidates[i] & ~t->tested[i];
 
-		if (free_bits[i] == 0)
+		if (bits == 0)
 			continue;
 
 		for (j = 0; j < 8; j++) {
 
-			char buf[LINE_BUF_SIZE];
 			uint32 dummy_roots[MAX_POLY_DEGREE];
 			uint32 high_coeff;
 			uint32 num_roots;
 			uint32 p;
 
-			if (!(free_bits[i] & (1 << j)))
+			if (!(bits & free_mask[j]))
 				continue;
 
 			/* bit 8*i+j could be a new free relation */
@@ -207,26 +279,247 @@ uint32 add_free_relations(msieve_obj *obj,
 						&fb->afb.poly,
 						p, &high_coeff, 1);
 
-			if (num_roots == alg_degree && high_coeff != 0) {
+			if (num_roots != alg_degree || high_coeff == 0)
+				continue;
 
-				num_roots = poly_get_zeros(dummy_roots, 
-							&fb->rfb.poly,
-							p, &high_coeff, 1);
+			num_roots = poly_get_zeros(dummy_roots, 
+						&fb->rfb.poly,
+						p, &high_coeff, 1);
+
+			if (num_roots != rat_degree || high_coeff == 0)
+				continue;
 
-				if (num_roots == rat_degree && 
-						high_coeff != 0) {
-					sprintf(buf, "%u,0:\n", p);
-					savefile_write_line(&obj->savefile, 
-								buf);
-					num_relations++;
-				}
+			if (t->num_free == t->num_alloc) {
+				t->num_alloc = 2 * t->num_alloc + 100;
+				t->free_primes = (uint32 *)xrealloc(
+						t->free_primes,
+						t->num_alloc * sizeof(uint32));
 			}
+			t->free_primes[t->num_free++] = p;
+		}
+	}
+}
+
+/*------------------------------------------------------------------*/
+static void print_poly_key(char *buf, factor_base_t *fb, uint32 i) {
+
+	/* line i of the polynomials that identify a cache file */
+
+	if (i <= fb->rfb.poly.degree)
+		gmp_sprintf(buf, "R%u %Zd\n", i, fb->rfb.poly.coeff[i]);
+	else
+		gmp_sprintf(buf, "A%u %Zd\n", i - fb->rfb.poly.degree - 1,
+			fb->afb.poly.coeff[i - fb->rfb.poly.degree - 1]);
+}
+
+/*------------------------------------------------------------------*/
+static uint32 read_free_cache(msieve_obj *obj, factor_base_t *fb,
+				uint8 *tested, uint32 **free_primes) {
+
+	/* read the results of previous tests into tested and
+	   free_primes; returns the number of free primes */
+
+	uint32 i;
+	uint32 num_key = fb->rfb.poly.degree + fb->afb.poly.degree + 2;
+	uint32 num_bytes = 0;
+	uint32 num_free = 0;
+	uint32 free_bytes = (FREE_RELATION_LIMIT / 2 + 7) / 8;
+	char buf[LINE_BUF_SIZE];
+	char key[LINE_BUF_SIZE];
+	FILE *fp;
+
+	*free_primes = NULL;
+	sprintf(buf, "%s.fr", obj->savefile.name);
+	fp = fopen(buf, "rb");
+	if (fp == NULL)
+		return 0;
+
+	for (i = 0; i < num_key; i++) {
+		print_poly_key(key, fb, i);
+		if (fgets(buf, (int)sizeof(buf), fp) == NULL ||
+		    strcmp(buf, key) != 0)
+			break;
+	}
+	if (i < num_key) {
+		logprintf(obj, "free relation cache is for different "
+				"polynomials, ignoring it\n");
+		fclose(fp);
+		return 0;
+	}
+
+	if (fgets(buf, (int)sizeof(buf), fp) == NULL ||
+	    sscanf(buf, "BITS %u %u", &num_bytes, &num_free) != 2 ||
+	    num_bytes > free_bytes) {
+		logprintf(obj, "error: corrupt free relation cache\n");
+		fclose(fp);
+		return 0;
+	}
+
+	*free_primes = (uint32 *)xmalloc((num_free + 1) * sizeof(uint32));
+	if (fread(tested, (size_t)1, (size_t)num_bytes, fp) != num_bytes ||
+	    fread(*free_primes, sizeof(uint32), 
+	    		(size_t)num_free, fp) != num_free) {
+		logprintf(obj, "error: corrupt free relation cache\n");
+		memset(tested, 0, (size_t)free_bytes);
+		num_free = 0;
+	}
+
+	fclose(fp);
+	return num_free;
+}
+
+/*------------------------------------------------------------------*/
+static void write_free_cache(msieve_obj *obj, factor_base_t *fb,
+				uint8 *tested, uint32 *free_primes,
+				uint32 num_free) {
+
+	uint32 i;
+	uint32 num_key = fb->rfb.poly.degree + fb->afb.poly.degree + 2;
+	uint32 num_bytes = (FREE_RELATION_LIMIT / 2 + 7) / 8;
+	char buf[LINE_BUF_SIZE];
+	FILE *fp;
+
+	sprintf(buf, "%s.fr", obj->savefile.name);
+	fp = fopen(buf, "wb");
+	if (fp == NULL) {
+		logprintf(obj, "error: cannot write free relation "
+				"cache '%s'\n", buf);
+		return;
+	}
+
+	/* leave off the end of the bitfield if nothing there
+	   was tested */
+
+	while (num_bytes > 0 && tested[num_bytes - 1] == 0)
+		num_bytes--;
+
+	for (i = 0; i < num_key; i++) {
+		print_poly_key(buf, fb, i);
+		fputs(buf, fp);
+	}
+	fprintf(fp, "BITS %u %u\n", num_bytes, num_free);
+	fwrite(tested, (size_t)1, (size_t)num_bytes, fp);
+	fwrite(free_primes, sizeof(uint32), (size_t)num_free, fp);
+	fclose(fp);
+}
+
+/*------------------------------------------------------------------*/
+uint32 add_free_relations(msieve_obj *obj, 
+			factor_base_t *fb, uint8 *free_bits) {
+
+	uint32 i, j, k;
+	uint32 num_relations = 0;
+	uint32 num_tasks, num_threads;
+	uint32 num_cached, num_new;
+	uint32 num_tested = 0;
+	uint32 free_bytes = (FREE_RELATION_LIMIT / 2 + 7) / 8;
+	uint32 *cached_primes;
+	uint32 *all_primes;
+	uint8 *tested;
+	free_task_t *tasks;
+
+	/* candidates whose results are cached do not need
+	   testing again */
+
+	tested = (uint8 *)xcalloc((size_t)free_bytes, sizeof(uint8));
+	num_cached = read_free_cache(obj, fb, tested, &cached_primes);
+
+	for (i = 0; i < free_bytes; i++) {
+		for (j = free_bits[i] & ~tested[i]; j; j &= j - 1)
+			num_tested++;
+	}
+
+	/* test the rest of the candidates in parallel */
+
+	num_tasks = (free_bytes + FREE_TASK_BYTES - 1) / FREE_TASK_BYTES;
+	tasks = (free_task_t *)xcalloc((size_t)num_tasks, 
+					sizeof(free_task_t));
+	for (i = 0; i < num_tasks; i++) {
+		tasks[i].fb = fb;
+		tasks[i].candidates = free_bits;
+		tasks[i].tested = tested;
+		tasks[i].start = i * FREE_TASK_BYTES;
+		tasks[i].end = MIN(free_bytes, (i + 1) * FREE_TASK_BYTES);
+	}
+
+	num_threads = MIN(obj->num_threads, num_tasks);
+
+	if (num_tested > 0 && num_threads < 2) {
+		for (i = 0; i < num_tasks; i++)
+			test_free_relations(tasks + i, 0);
+	}
+	else if (num_tested > 0) {
+		thread_control_t control = {NULL, NULL, NULL};
+		task_control_t task = {NULL, test_free_relations, 
+					NULL, NULL};
+		struct threadpool *pool;
+
+		pool = threadpool_init(num_threads, num_tasks, &control);
+		for (i = 0; i < num_tasks; i++) {
+			task.data = tasks + i;
+			threadpool_add_task(pool, &task, 1);
 		}
+		threadpool_drain(pool, 1);
+		threadpool_free(pool);
 	}
 
+	for (i = 0; i < free_bytes; i++)
+		tested[i] |= free_bits[i];
+
+	/* merge the new free primes, which are sorted when
+	   taken one task at a time, with the cached ones */
+
+	for (i = num_new = 0; i < num_tasks; i++)
+		num_new += tasks[i].num_free;
+
+	all_primes = (uint32 *)xmalloc((num_cached + num_new + 1) *
+					sizeof(uint32));
+	for (i = j = k = 0; i < num_tasks; i++) {
+		free_task_t *t = tasks + i;
+		uint32 m;
+
+		for (m = 0; m < t->num_free; m++) {
+			while (j < num_cached && 
+			       cached_primes[j] < t->free_primes[m])
+				all_primes[k++] = cached_primes[j++];
+			all_primes[k++] = t->free_primes[m];
+		}
+		free(t->free_primes);
+	}
+	while (j < num_cached)
+		all_primes[k++] = cached_primes[j++];
+
+	/* every free prime that is still a candidate
+	   becomes a free relation */
+
+	savefile_open(&obj->savefile, SAVEFILE_APPEND);
+
+	for (i = 0; i < k; i++) {
+		char buf[LINE_BUF_SIZE];
+		uint32 p = all_primes[i] / 2;
+
+		if (!(free_bits[p / 8] & free_mask[p % 8]))
+			continue;
+
+		sprintf(buf, "%u,0:\n", all_primes[i]);
+		savefile_write_line(&obj->savefile, buf);
+		num_relations++;
+	}
+
+	if (num_tested > 0) {
+		logprintf(obj, "tested %u free relation candidates "
+				"using %u threads\n", num_tested,
+				MAX(num_threads, 1));
+		write_free_cache(obj, fb, tested, all_primes, k);
+	}
 	if (num_relations)
 		logprintf(obj, "added %u free relations\n", num_relations);
 	savefile_flush(&obj->savefile);
 	savefile_close(&obj->savefile);
+
+	free(tasks);
+	free(all_primes);
+	free(cached_primes);
+	free(tested);
 	return num_relations;
 }
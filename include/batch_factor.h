@@ -29,7 +29,11 @@ extern "C" {
 
 #define MAX_LARGE_PRIMES 3
 
-typedef void (*print_relation_t)(savefile_t *savefile, int64 a, uint32 b,
+/* the callback that receives each relation that batch factoring
+   finds. Its first argument is whatever was passed to 
+   relation_batch_init, usually the savefile for the relation */
+
+typedef void (*print_relation_t)(void *print_data, int64 a, uint32 b,
 			uint32 *factors_r, uint32 num_factors_r, 
 			uint32 lp_r[MAX_LARGE_PRIMES],
 			uint32 *factors_a, uint32 num_factors_a, 
@@ -49,6 +53,24 @@ typedef struct {
 				     all of the above above appear, in order */
 } cofactor_t;
 
+/* ways of computing the remainder tree: the classic one
+   divides at every node, while the scaled remainder tree of
+   Bernstein passes down fixed-point approximations of 
+   (prime product) / (product of relations) mod 1, which
+   only need multiplications */
+
+#define BATCH_REMAINDER_CLASSIC 0
+#define BATCH_REMAINDER_SCALED 1
+
+/* ways of splitting the cofactors that SQUFOF does not
+   handle well: the default uses P-1 and ECM for three-word
+   cofactors and for the larger two-word ones, while the
+   other uses SQUFOF for all two-word cofactors and the QS
+   code for three-word ones */
+
+#define BATCH_COFACTOR_ECM 0
+#define BATCH_COFACTOR_QS 1
+
 /* main structure controlling batch factoring. The main goal
    of batch factoring is to compute gcd(each_relation, 
    product_of_many_primes) much faster than running a conventional
@@ -66,7 +88,14 @@ typedef struct {
    that Bernstein's algorithm computes */
 
 typedef struct {
+	msieve_obj *obj;
 	mpz_t prime_product;  /* product of primes used in the gcd */
+	uint32 num_prime_pieces;  /* number of subproducts below */
+	mpz_t *prime_pieces;      /* prime_product split into products of
+				     consecutive ranges of primes, for
+				     reducing it in parallel */
+	uint32 shared_primes;     /* nonzero if prime_product and its
+				     pieces belong to another batch */
 
 	uint32 num_success;       /* number of surviving relations */
 	uint32 target_relations;  /* number of relations to batch up */
@@ -85,7 +114,29 @@ typedef struct {
 	uint32 num_factors_alloc; /* space for batched factors */
 	uint32 *factors;          /* factors of batched relations */
 
-	savefile_t *savefile;
+	void *tinyqs_data;        /* for splitting three-prime cofactors */
+	void *tinyecm_data;       /* for splitting all the cofactors that
+				     SQUFOF does not handle well */
+	uint32 cofactor_engine;   /* BATCH_COFACTOR_* above */
+
+	uint32 num_threads;       /* threads used by relation_batch_run */
+	uint32 tree_depth;        /* levels of the relation product tree
+				     that are computed in parallel */
+	uint32 tree_alloc;        /* nodes of the top of the product tree,
+				     kept from one batch to the next */
+	mpz_t *tree;
+
+	uint32 remainder_engine;  /* BATCH_REMAINDER_* below */
+	uint32 verify_engine;     /* nonzero to compare the scaled and
+				     classic remainder trees */
+	uint8 *verify;            /* per-relation results when comparing */
+	uint8 verify_mark;
+
+	uint32 use_background;    /* nonzero if relation_batch_start may
+				     factor batches in a background thread */
+	void *background;         /* state of the background thread */
+
+	void *print_data;
 	print_relation_t print_relation;
 } relation_batch_t;
 
@@ -99,14 +150,35 @@ typedef struct {
    large prime cutoffs; making it smaller allows the batch 
    factoring to split most of the cofactors in relations that 
    contain large primes, or at least prove most relations to 
-   be not worth the trouble to do so manually */
+   be not worth the trouble to do so manually.
+
+   The argument 'batch_threads=N' in obj->nfs_args makes 
+   relation_batch_run use N threads, which compute the top
+   'batch_depth=D' levels of the product and remainder trees 
+   one level at a time and then handle the 2^D subtrees below
+   that independently.
+
+   'batch_engine=scaled' uses the scaled remainder tree, and
+   'batch_engine=check' does too but runs the classic tree on
+   each batch first, and logs any relation that the two 
+   handle differently. 'batch_cofactor=qs' splits three-prime
+   cofactors with tinyqs instead of tinyecm */
 
 void relation_batch_init(msieve_obj *obj, relation_batch_t *rb,
 			uint32 min_prime, uint32 max_prime, 
 			uint32 lp_cutoff_r, uint32 lp_cutoff_a, 
-			savefile_t *savefile,
+			void *print_data,
 			print_relation_t print_relation);
 
+/* initialize a relation batch with the same primes and cutoffs
+   as an existing one, e.g. for use by another thread. The product
+   of primes is shared and not copied, so the batch in src must
+   not be freed while this one is still in use */
+
+void relation_batch_init_copy(relation_batch_t *rb,
+			relation_batch_t *src,
+			void *print_data);
+
 void relation_batch_free(relation_batch_t *rb);
 
 /* add one relation to the batch. Note that the relation may
@@ -125,10 +197,24 @@ void relation_batch_add(int64 a, uint32 b,
 	
 /* factor all the batched relations, saving all the ones whose
    largest {rational|algebraic} factors are all less than
-   lp_cutoff_[ra] */
+   lp_cutoff_[ra]. This also finishes any batch that is being
+   factored in the background, and must be called before 
+   relation_batch_free if relations are not to be lost */
 
 uint32 relation_batch_run(relation_batch_t *rb);
 
+/* hand the batched relations to a background thread for 
+   factoring, so that the caller can go on batching up new 
+   relations while that happens. If the previous batch is still 
+   being factored, wait for it first. Relations found in the
+   background are passed to print_relation from the calling 
+   thread, in order, by the next call to relation_batch_start or 
+   relation_batch_run; the number of them is returned. With the 
+   argument 'batch_background=0' this is the same as 
+   relation_batch_run */
+
+uint32 relation_batch_start(relation_batch_t *rb);
+
 #ifdef __cplusplus
 }
 #endif
@@ -48,6 +48,7 @@ extern "C" {
 #define SAVEFILE_APPEND 0x04
 
 void savefile_init(savefile_t *s, char *filename);
+void savefile_init_memory(savefile_t *s);
 void savefile_free(savefile_t *s);
 void savefile_open(savefile_t *s, uint32 flags);
 void savefile_close(savefile_t *s);
@@ -58,6 +59,39 @@ void savefile_read_line(char *buf, size_t max_len, savefile_t *s);
 void savefile_write_line(savefile_t *s, char *buf);
 void savefile_flush(savefile_t *s);
 
+/*--------------SIEVE PARAMETER TABLE DECLARATIONS -------------------*/
+
+/* one entry of a table of sieving parameters, for inputs
+   of a given size. The meaning of the values depends on
+   the sieving code using the table */
+
+#define MAX_PARAM_VALUES 8
+
+typedef struct {
+	uint32 bits;
+	uint64 values[MAX_PARAM_VALUES];
+} param_row_t;
+
+/* find the parameters for an input of the given size, from
+   the compiled-in table plus any entries for 'section' in
+   the file given by the 'sieve_params=<file>' argument */
+
+void get_param_row(msieve_obj *obj, const char *section,
+			const param_row_t *builtin, uint32 num_builtin,
+			uint32 num_values, uint32 bits, param_row_t *out);
+
+/* add or replace one entry of the file given by the
+   'sieve_params=<file>' argument, if there is one */
+
+void save_param_row(msieve_obj *obj, const char *section,
+			uint32 num_values, param_row_t *row);
+
+/* copy the value of 'name' in an argument string of the 
+   form 'name1=value1 name2=value2...' into buf */
+
+uint32 get_arg_string(const char *args, const char *name,
+			char *buf, uint32 buf_size);
+
 /*--------------PRIME SIEVE RELATED DECLARATIONS ---------------------*/
 
 /* many separate places in the code need a list
@@ -243,10 +277,33 @@ uint32 squfof(mp_t *n);
 
 /* Factor a number up to 85 bits in size using MPQS. 
    Returns 0 on failure and nonzero on success, with
-   factor1 and factor2 filled in on success. NOT TO
-   BE USED for high-throughput applications */
+   factor1 and factor2 filled in on success. All the
+   working memory, along with the tables that do not 
+   depend on n, lives in a context from tinyqs_init(); 
+   callers that factor many numbers should create one
+   context per thread and reuse it */
+
+void * tinyqs_init(void);
+
+void * tinyqs_free(void *tinyqs_data);
+
+uint32 tinyqs(void *tinyqs_data, mp_t *n, 
+		mp_t *factor1, mp_t *factor2);
+
+/* Factor a number up to 128 bits in size using P-1 and ECM,
+   with effort scaled to the size of the input. The calling
+   convention matches tinyqs; the factors found are not
+   necessarily prime, and for inputs that tinyqs can also
+   handle the two need not find the same split */
 
-uint32 tinyqs(mp_t *n, mp_t *factor1, mp_t *factor2);
+#define TINYECM_MAX_BITS 128
+
+void * tinyecm_init(void);
+
+void * tinyecm_free(void *tinyecm_data);
+
+uint32 tinyecm(void *tinyecm_data, mp_t *n, 
+		mp_t *factor1, mp_t *factor2);
 
 /* Factor a number using the full MPQS implementation. 
    Returns 1 if any factors were found and 0 if not */
@@ -296,7 +353,15 @@ uint64 * block_lanczos(msieve_obj *obj,
 			uint32 nrows, uint32 max_nrows, uint32 start_row,
 			uint32 num_dense_rows,
 			uint32 ncols, uint32 max_ncols, uint32 start_col,
-			la_col_t *cols, uint32 *deps_found);
+			la_col_t *cols, uint32 *deps_found,
+			uint32 save_vectors);
+
+/* generate a different set of dependencies from the vectors 
+   saved at the end of a previous NFS linear algebra run, 
+   without repeating the Lanczos iteration */
+
+uint64 * block_lanczos_new_deps(msieve_obj *obj, uint32 *ncols,
+				uint32 *deps_found);
 
 uint64 count_matrix_nonzero(msieve_obj *obj,
 			uint32 nrows, uint32 num_dense_rows,
@@ -50,6 +50,10 @@ static INLINE void gmp2mp(mpz_t src, mp_t *dest) {
 static INLINE void uint64_2gmp(uint64 src, mpz_t dest) {
 
 #if GMP_LIMB_BITS == 64
+	/* GMP 6.2 and later do not allocate any limbs
+	   in mpz_init, so there may be nowhere to write */
+	if (dest->_mp_alloc == 0)
+		mpz_realloc2(dest, 64);
 	dest->_mp_d[0] = src;
 	dest->_mp_size = (src ? 1 : 0);
 #else
@@ -108,6 +108,15 @@ typedef struct {
 	char *name;
 	char *buf;
 	uint32 buf_off;
+
+	/* a savefile can also live entirely in memory, with buf
+	   holding the whole file. Batch factoring uses this to 
+	   avoid any disk I/O */
+
+	uint32 in_memory;
+	uint32 buf_alloc;
+	uint32 read_off;
+	uint32 read_eof;
 } savefile_t;
 
 /* One factorization is represented by a msieve_obj
@@ -177,6 +186,36 @@ msieve_obj * msieve_obj_new(char *input_integer,
 msieve_obj * msieve_obj_free(msieve_obj *obj);
 
 void msieve_run(msieve_obj *obj);
+
+/* Batch mode: factor a stream of (usually small) inputs 
+   using num_threads workers. Each worker owns one msieve_obj
+   that is reused for all of the inputs it handles, and which
+   keeps its savefile in memory and logs nothing, so that no
+   file I/O happens per input. get_next() returns the next
+   input expression, or NULL when there are no more; the string
+   is copied before get_next() is called again. report() is
+   passed the index of each input (in the order get_next()
+   produced them) along with a finished msieve_obj whose factor
+   list is valid only for the duration of the call. Results are 
+   reported in completion order. Both callbacks are serialized,
+   so they do not need to be thread-safe */
+
+typedef char * (*msieve_batch_next_t)(void *data);
+
+typedef void (*msieve_batch_report_t)(void *data, uint32 index,
+					msieve_obj *obj);
+
+void msieve_run_batch(uint32 flags,
+			uint32 seed1,
+			uint32 seed2,
+			enum cpu_type cpu,
+			uint32 cache_size1,
+			uint32 cache_size2,
+			uint32 num_threads,
+			const char *nfs_args,
+			msieve_batch_next_t get_next,
+			msieve_batch_report_t report,
+			void *data);
 				
 #define MSIEVE_DEFAULT_LOGFILE "msieve.log"
 #define MSIEVE_DEFAULT_SAVEFILE "msieve.dat"
@@ -66,6 +66,45 @@ static INLINE void mutex_unlock(mutex_t *m)
 #endif
 }
 
+/* atomic operations -----------------------------------------------*/
+
+/* add n to *x, returning the previous value of *x */
+
+static INLINE uint32 atomic_add(volatile uint32 *x, uint32 n)
+{
+#if defined(WIN32) || defined(_WIN64)
+	return (uint32)InterlockedExchangeAdd((volatile LONG *)x, (LONG)n);
+#else
+	return __sync_fetch_and_add(x, n);
+#endif
+}
+
+/* if *x equals old_val, replace it with new_val and return 1,
+   otherwise return 0. Both of these also act as full memory
+   barriers */
+
+static INLINE uint32 atomic_cas(volatile uint32 *x,
+				uint32 old_val, uint32 new_val)
+{
+#if defined(WIN32) || defined(_WIN64)
+	return (uint32)InterlockedCompareExchange((volatile LONG *)x,
+				(LONG)new_val, (LONG)old_val) == old_val;
+#else
+	return __sync_bool_compare_and_swap(x, old_val, new_val);
+#endif
+}
+
+static INLINE uint32 atomic_cas_ptr(void * volatile *x,
+				void *old_val, void *new_val)
+{
+#if defined(WIN32) || defined(_WIN64)
+	return InterlockedCompareExchangePointer(x,
+				new_val, old_val) == old_val;
+#else
+	return __sync_bool_compare_and_swap(x, old_val, new_val);
+#endif
+}
+
 /* a thread pool --------------------------------------------------*/
 
 typedef void (*init_func)(void *data, int thread_num);
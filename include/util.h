@@ -28,6 +28,7 @@ $Id$
 	#include <errno.h>
 	#include <pthread.h>
 	#include <sys/resource.h>
+	#include <sys/time.h>
 	#include <float.h>
 	#include <dlfcn.h>
 #endif
@@ -185,6 +186,7 @@ void * aligned_malloc(size_t len, uint32 align);
 void aligned_free(void *newptr);
 uint64 read_clock(void);
 double get_cpu_time(void);
+double get_wall_time(void);
 void set_idle_priority(void);
 uint64 get_file_size(char *name);
 uint64 get_ram_size(void);
@@ -235,7 +237,9 @@ enum cpu_type {
 	cpu_core,
 	cpu_athlon,
 	cpu_athlon_xp,
-	cpu_opteron
+	cpu_opteron,
+	cpu_x86_avx2,	/* any x86 CPU with AVX2 */
+	cpu_x86_avx512	/* any x86 CPU with AVX512F and AVX512BW */
 };
 
 void get_cache_sizes(uint32 *level1_cache, uint32 *level2_cache);
@@ -40,9 +40,12 @@ sieve_param_t prebuilt_params[] = {
 	{512,1300000, 150, 100 * 65536},
 };
 
-static void get_sieve_params(uint32 bits, 
+static void get_sieve_params(msieve_obj *obj, uint32 bits, 
 			     sieve_param_t *params);
 
+static void tune_sieve_params(msieve_obj *obj, mp_t *n,
+				sieve_param_t *params);
+
 static void build_factor_base(mp_t *n, 
 				prime_list_t *prime_list,
 				fb_t **out_fb,
@@ -76,13 +79,18 @@ uint32 factor_mpqs(msieve_obj *obj, mp_t *n,
 	/* Calculate the factor base bound */
 
 	bits = mp_bits(n);
-	get_sieve_params(bits, &params);
+	get_sieve_params(obj, bits, &params);
 	if (params.fb_size < 100)
 		params.fb_size = 100;
 
 	logprintf(obj, "commencing quadratic sieve (%u-digit input)\n",
 			strlen(mp_sprintf(n, 10, obj->mp_sprintf_buf)));
 
+	if (obj->nfs_args != NULL && 
+	    strstr(obj->nfs_args, "qs_tune=1") != NULL) {
+		tune_sieve_params(obj, n, &params);
+	}
+
 	/* Make a prime list, use it to build a factor base */
 
 	fill_prime_list(&prime_list, 2 * params.fb_size + 100, MAX_FB_PRIME);
@@ -98,7 +106,7 @@ uint32 factor_mpqs(msieve_obj *obj, mp_t *n,
 	do_sieving(obj, n, &poly_a_list, &poly_list, 
 		   factor_base, modsqrt_array, &params, multiplier, 
 		   &relation_list, &num_relations,
-		   &cycle_list, &num_cycles);
+		   &cycle_list, &num_cycles, NULL);
 
 	free(modsqrt_array);
 	if (relation_list == NULL || cycle_list == NULL ||
@@ -317,55 +325,246 @@ static void build_factor_base(mp_t *n,
 }
 
 /*--------------------------------------------------------------------*/
-static void get_sieve_params(uint32 bits, sieve_param_t *params) {
+static void get_sieve_params(msieve_obj *obj, uint32 bits, 
+			sieve_param_t *params) {
+
+	/* the table entries in the sieve parameter file, if
+	   any, have fb_size, large_mult and sieve_size in 
+	   that order */
+
+	uint32 i;
+	uint32 num_builtin = sizeof(prebuilt_params) / 
+				sizeof(sieve_param_t);
+	param_row_t builtin[sizeof(prebuilt_params) / 
+				sizeof(sieve_param_t)];
+	param_row_t row;
+
+	memset(builtin, 0, sizeof(builtin));
+	for (i = 0; i < num_builtin; i++) {
+		builtin[i].bits = prebuilt_params[i].bits;
+		builtin[i].values[0] = prebuilt_params[i].fb_size;
+		builtin[i].values[1] = prebuilt_params[i].large_mult;
+		builtin[i].values[2] = prebuilt_params[i].sieve_size;
+	}
 
-	sieve_param_t *low, *high;
-	uint32 max_size;
-	uint32 i, j, dist;
+	get_param_row(obj, "qs", builtin, num_builtin, 3, bits, &row);
 
-	/* For small inputs, use the first set of precomputed
-	   parameters */
+	params->bits = bits;
+	params->fb_size = (uint32)row.values[0];
+	params->large_mult = (uint32)row.values[1];
+	params->sieve_size = (uint32)row.values[2];
+}
 
-	if (bits < prebuilt_params[0].bits) {
-		*params = prebuilt_params[0];
-		return;
-	}
+/*--------------------------------------------------------------------*/
+/* when tuning, each set of parameters sieves for this fraction
+   of the relations needed, or at least a few hundred relations */
+
+#define TUNE_FRACTION 0.25
+#define TUNE_MIN_RELATIONS 400
+
+static double time_sieve_params(msieve_obj *obj, mp_t *n,
+				sieve_param_t *params) {
+
+	/* sieve briefly with one set of parameters, into a 
+	   savefile kept in memory, and estimate the time the
+	   whole factorization would take. All the sets start 
+	   from the same random seeds. 
+	   
+	   The trial run finds full relations at rate f and partial
+	   relations at rate p, and both rates stay about constant.
+	   The number of cycles among P partial relations grows
+	   like k * P^2 instead, so the rate of a short run cannot
+	   just be scaled up; that would shortchange the parameter
+	   sets that find the most partials, usually the ones with
+	   a larger factor base or large prime bound. If the large 
+	   primes of partials fall between the largest factor base 
+	   prime B and the large prime bound L with probability 
+	   proportional to 1/prime, then two partials share a 
+	   given large prime q with probability 1 / (D*q)^2, where 
+	   D = log(log(L) / log(B)), and summing over all q > B 
+	   makes k about 1 / (2 * D^2 * B * log(B)). The estimate 
+	   is the time T at which f*T + k*(p*T)^2 relations are 
+	   available. This ignores the cycles that need more than
+	   two partials, which only matter near the end and are 
+	   much the same for all the parameter sets */
 
-	/* bracket the input size between two table entries */
+	prime_list_t prime_list;
+	fb_t *factor_base;
+	uint32 *modsqrt_array;
+	sieve_param_t trial = *params;
+	sieve_trial_t result;
+	relation_t *relation_list = NULL;
+	uint32 num_relations = 0;
+	la_col_t *cycle_list = NULL;
+	uint32 num_cycles = 0;
+	poly_t *poly_list = NULL;
+	mp_t *poly_a_list = NULL;
+	uint32 multiplier;
+	uint32 max_relations = obj->max_relations;
+	uint32 seed1 = obj->seed1;
+	uint32 seed2 = obj->seed2;
+	uint32 target;
+	savefile_t savefile = obj->savefile;
+	double elapsed;
+	double full_rate, partial_rate;
+	double log_fb, log_lp, k;
+	mp_t kn;
+
+	/* building the factor base multiplies n by the multiplier */
+
+	mp_copy(n, &kn);
+	fill_prime_list(&prime_list, 2 * trial.fb_size + 100, MAX_FB_PRIME);
+	build_factor_base(&kn, &prime_list, &factor_base, 
+				&modsqrt_array, &trial.fb_size, 
+				&multiplier);
+	free(prime_list.list);
 
-	max_size = sizeof(prebuilt_params) / sizeof(sieve_param_t);
-	if (bits >= prebuilt_params[max_size - 1].bits) {
-		*params = prebuilt_params[max_size - 1];
-		return;
+	target = trial.fb_size + 3 * NUM_EXTRA_RELATIONS / 2;
+	obj->max_relations = MAX((uint32)(TUNE_FRACTION * target),
+				MIN(target, TUNE_MIN_RELATIONS));
+	savefile_init_memory(&obj->savefile);
+
+	elapsed = get_wall_time();
+	do_sieving(obj, &kn, &poly_a_list, &poly_list, 
+		   factor_base, modsqrt_array, &trial, multiplier, 
+		   &relation_list, &num_relations,
+		   &cycle_list, &num_cycles, &result);
+	elapsed = MAX(get_wall_time() - elapsed, 1e-3);
+
+	full_rate = result.num_fulls / elapsed;
+	partial_rate = result.num_partials / elapsed;
+	log_fb = log((double)factor_base[trial.fb_size - 1].prime);
+	log_lp = MIN(log_fb + log((double)trial.large_mult), 
+			32 * M_LN2);
+	k = 0;
+	if (log_lp > log_fb) {
+		double d = log(log_lp / log_fb);
+		k = 1.0 / (2 * d * d * exp(log_fb) * log_fb);
 	}
 
-	/* if the input is too large, just use the last table entry.
-	   This means that the choice of parameters is increasingly
-	   inappropriate as the input becomes larger, but there's no
-	   guidance on what to do in this case anyway. */
+	/* solve f*T + k*p^2*T^2 = target for T, in a form that
+	   stays accurate when k is small */
+
+	k *= partial_rate * partial_rate;
+	if (full_rate + k == 0)
+		elapsed = 1e30;
+	else
+		elapsed = 2 * target / (full_rate + 
+				sqrt(full_rate * full_rate + 4 * k * target));
+
+	savefile_free(&obj->savefile);
+	obj->savefile = savefile;
+	obj->max_relations = max_relations;
+	obj->seed1 = seed1;
+	obj->seed2 = seed2;
+
+	if (relation_list != NULL)
+		qs_free_relation_list(relation_list, num_relations);
+	if (cycle_list != NULL)
+		free_cycle_list(cycle_list, num_cycles);
+	free(poly_list);
+	free(poly_a_list);
+	free(modsqrt_array);
+	free(factor_base);
 
-	for (i = 0; i < max_size - 1; i++) {
-		if (bits < prebuilt_params[i+1].bits)
-			break;
+	logprintf(obj, "tune: fb_size %u, large_mult %u, sieve_size %u: "
+			"%.1lf fulls/sec, %.1lf partials/sec, "
+			"estimated %.1lf seconds\n", params->fb_size,
+			params->large_mult, params->sieve_size, 
+			full_rate, partial_rate, elapsed);
+	return elapsed;
+}
+
+/*--------------------------------------------------------------------*/
+static void tune_sieve_params(msieve_obj *obj, mp_t *n,
+				sieve_param_t *params) {
+
+	/* starting from the table parameters, adjust the factor 
+	   base size, then the sieve size, then the large prime 
+	   multiplier, keeping whichever choice is fastest on 
+	   this machine. The result is used for the rest of the 
+	   factorization and saved to the sieve parameter file,
+	   if there is one */
+
+	uint32 i, j;
+	sieve_param_t best = *params;
+	double best_time;
+	param_row_t row;
+	char buf[LINE_BUF_SIZE];
+
+	static const double scale[3][2] = {
+		{0.75, 1.33},     /* factor base size */
+		{0.5, 2.0},       /* sieve size */
+		{0.5, 2.0},       /* large prime multiplier */
+	};
+
+	/* the factor base cannot change if the savefile 
+	   already has relations for n */
+
+	if (savefile_exists(&obj->savefile)) {
+		savefile_open(&obj->savefile, SAVEFILE_READ);
+		buf[0] = 0;
+		savefile_read_line(buf, sizeof(buf), &obj->savefile);
+		savefile_close(&obj->savefile);
+		if (isxdigit(buf[0])) {
+			mp_t read_n;
+			mp_str2mp(buf, &read_n, 16);
+			if (mp_cmp(n, &read_n) == 0) {
+				logprintf(obj, "savefile has relations for "
+						"this input, not tuning\n");
+				return;
+			}
+		}
 	}
 
-	/* Otherwise the parameters to use are a weighted average 
-	   of the two table entries the input falls between */
+	logprintf(obj, "tuning sieve parameters\n");
+	best_time = time_sieve_params(obj, n, &best);
+	if (obj->flags & MSIEVE_FLAG_STOP_SIEVING)
+		return;
 
-	low = &prebuilt_params[i];
-	high = &prebuilt_params[i+1];
-	dist = high->bits - low->bits;
-	i = bits - low->bits;
-	j = high->bits - bits;
+	for (i = 0; i < 3; i++) {
+		sieve_param_t start = best;
 
-	params->bits = bits;
-	params->fb_size = (uint32)(
-			 ((double)low->fb_size * j +
-			  (double)high->fb_size * i) / dist + 0.5);
-	params->large_mult = (uint32)(
-			 ((double)low->large_mult * j +
-			  (double)high->large_mult * i) / dist + 0.5);
-	params->sieve_size = (uint32)(
-			 ((double)low->sieve_size * j +
-			  (double)high->sieve_size * i) / dist + 0.5);
+		for (j = 0; j < 2; j++) {
+			sieve_param_t trial = start;
+			double t;
+
+			if (i == 0) {
+				trial.fb_size = (uint32)(trial.fb_size * 
+							scale[i][j]);
+				if (trial.fb_size < 100)
+					continue;
+			}
+			else if (i == 1) {
+				trial.sieve_size = (uint32)(trial.sieve_size * 
+							scale[i][j]);
+				if (trial.sieve_size < 65536)
+					continue;
+			}
+			else {
+				trial.large_mult = (uint32)(trial.large_mult * 
+							scale[i][j]);
+				if (trial.large_mult < 10)
+					continue;
+			}
+
+			t = time_sieve_params(obj, n, &trial);
+			if (obj->flags & MSIEVE_FLAG_STOP_SIEVING)
+				return;
+			if (t < best_time) {
+				best_time = t;
+				best = trial;
+			}
+		}
+	}
+
+	logprintf(obj, "using fb_size %u, large_mult %u, sieve_size %u\n",
+			best.fb_size, best.large_mult, best.sieve_size);
+	*params = best;
+
+	row.bits = params->bits;
+	row.values[0] = params->fb_size;
+	row.values[1] = params->large_mult;
+	row.values[2] = params->sieve_size;
+	save_param_row(obj, "qs", 3, &row);
 }
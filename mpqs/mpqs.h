@@ -20,6 +20,8 @@ $Id$
    factorization. */
 
 #include <common.h>
+#include <thread.h>
+#include <batch_factor.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -92,8 +94,9 @@ typedef struct relation_t {
 	uint32 sieve_offset;	/* value of x in a*x+b */
 	uint32 poly_idx;	/* pointer to this relation's MPQS poly */
 	uint32 num_factors;	/* size of list of factors */
-	uint32 large_prime[2];	/* for partial relations, the leftover 
-					factor(s). Either factor may equal 1 */
+	uint32 large_prime[3];	/* for partial relations, the leftover 
+					factor(s) in ascending order. Any
+					factor may equal 1 */
 	uint32 *fb_offsets;	/* The array of offsets into the factor base
 					which contain primes dividing this
 					sieve value. Duplicate offsets are
@@ -106,6 +109,12 @@ typedef struct relation_t {
 
 #define NUM_EXTRA_RELATIONS 64
 
+/* a relation counts as full if its large primes multiply 
+   to a perfect square (usually because they are all 1). The 
+   large primes must be sorted in ascending order */
+
+#define IS_FULL_RELATION(p1, p2, p3) ((p1) == 1 && (p2) == (p3))
+
 /* The sieving phase uses a hashtable to handle the large
    factor base primes. The hashtable is an array of type
    bucket_t, each entry of which contains an array 
@@ -134,23 +143,96 @@ typedef struct {
 } sieve_param_t;
 
 /* The sieving code needs a special structure for determining
-   the number of cycles in a collection of partial relations */
+   the number of cycles in a collection of partial relations.
+   Sieving threads add relations to the graph at the same time
+   without locking it, so the vertices live in chunks that never
+   move once allocated and are referred to by their offset, and 
+   all updates to the graph are atomic (see relation.c) */
 
 #define LOG2_CYCLE_HASH 22
+#define LOG2_CYCLE_CHUNK 16
+#define MAX_CYCLE_CHUNKS (1 << (32 - LOG2_CYCLE_CHUNK))
 
 typedef struct {
 	uint32 next;
 	uint32 prime;
-	uint32 data;
-	uint32 count;
+	volatile uint32 data;
+	volatile uint32 count;
 } cycle_t;
 
+typedef struct {
+	cycle_t **chunks;            /* MAX_CYCLE_CHUNKS pointers, filled
+					in as the graph grows */
+	uint32 *hashtable;           /* offsets of the first vertex with
+					each hash value */
+	volatile uint32 size;        /* vertices allocated so far; offset
+					0 is never used */
+	volatile uint32 components;  /* connected components */
+	volatile uint32 vertices;    /* vertices in graph */
+} cycle_graph_t;
+
+#define CYCLE_ENTRY(g, offset) ((g)->chunks[(offset) >> 		\
+					LOG2_CYCLE_CHUNK] + 		\
+				((offset) & ((1 << LOG2_CYCLE_CHUNK) - 1)))
+
+void cycle_graph_init(cycle_graph_t *g);
+void cycle_graph_free(cycle_graph_t *g);
+
+/* statistics for tuning the sieve. When the argument string
+   contains qs_stats=<file>, every sieving thread times each 
+   phase of the sieve and counts what happens to the sieve 
+   values that look smooth. The totals for all threads are 
+   appended to <file> when sieving finishes */
+
+enum qs_timer {
+	QS_TIME_TOTAL,          /* everything below */
+	QS_TIME_BASE_POLY,      /* choosing 'a' and building its 'b' values */
+	QS_TIME_NEXT_POLY_SMALL,/* switching polynomials, sieved primes */
+	QS_TIME_NEXT_POLY_LARGE,/* switching polynomials, hashtable primes */
+	QS_TIME_POLY_SETUP,     /* per-polynomial setup before sieving */
+	QS_TIME_BUCKET,         /* filling the hashtable */
+	QS_TIME_SIEVE_SMALL,    /* sieving a block with the small primes */
+	QS_TIME_SIEVE_LARGE,    /* adding in the hashtable entries */
+	QS_TIME_SCAN,           /* scanning a block, including QS_TIME_TF */
+	QS_TIME_TF,             /* checking sieve values, including the
+				   next three */
+	QS_TIME_TF_SMALL,       /* trial division by sieved primes */
+	QS_TIME_TF_LARGE,       /* trial division using the hashtable */
+	QS_TIME_COFACTOR,       /* splitting cofactors with SQUFOF/tinyqs */
+	QS_TIME_BATCH,          /* batch factoring of cofactors; mostly
+				   part of QS_TIME_TF too */
+	NUM_QS_TIMERS
+};
+
+enum qs_count {
+	QS_COUNT_POLY,          /* polynomials sieved */
+	QS_COUNT_BLOCK,         /* sieve blocks sieved */
+	QS_COUNT_CUTOFF1,       /* sieve values above the first cutoff */
+	QS_COUNT_CUTOFF2,       /* ...that are still promising after a 
+				   little trial division */
+	QS_COUNT_RES_SMALL,     /* ...whose cofactor is a useless prime */
+	QS_COUNT_RES_BIG,       /* ...whose cofactor is too large */
+	QS_COUNT_COFACTOR,      /* ...whose cofactor needed splitting */
+	QS_COUNT_BATCHED,       /* ...whose cofactor went to the batch */
+	QS_COUNT_FULL,          /* relations with no large primes */
+	QS_COUNT_PARTIAL1,      /* relations with one large prime */
+	QS_COUNT_PARTIAL2,      /* relations with two large primes */
+	QS_COUNT_PARTIAL3,      /* relations with three large primes */
+	NUM_QS_COUNTS
+};
+
+typedef struct {
+	uint32 enabled;
+	uint64 time[NUM_QS_TIMERS];
+	uint64 count[NUM_QS_COUNTS];
+} qs_stats_t;
+
 /* To avoid huge parameter lists passed between sieving
    routines, all of the relevant data used in the sieving
    phase is packed into a single structure. Routines take
    the information they need out of this. */
 
-typedef struct {
+typedef struct sieve_conf_t {
 	msieve_obj *obj;     /* object controlling entire factorization */
 	mp_t *n;             /* the number to factor (scaled by multiplier)*/
 	uint32 multiplier;   /* small multiplier for n (may be composite) */
@@ -203,9 +285,20 @@ typedef struct {
 	uint32 poly_factors[MAX_POLY_FACTORS];  /* factorization of curr. 'a' */
 	uint8 factor_bits[MAX_POLY_FACTORS]; /* size of each factor of 'a' */
 	signed_mp_t poly_tmp_b[MAX_POLY_FACTORS];  /* temporary quantities */
-	uint32 *poly_b_array;      /* precomputed values for all factor base
-	                              primes, used to compute new polynomials */
-	uint32 *poly_b_small[MAX_POLY_FACTORS];
+	uint32 *poly_b_small[MAX_POLY_FACTORS]; /* precomputed values for
+	                              all factor base primes, used to compute
+	                              new polynomials */
+	uint32 *poly_b_large[MAX_POLY_FACTORS]; /* the same, for the factor
+	                              base primes that use the hashtable */
+
+	/* the primes that use the hashtable keep their roots here
+	   instead of in the factor base, one array per quantity
+	   and indexed from sieve_large_fb_start, so that switching
+	   polynomials is a streaming vector add or subtract */
+
+	uint32 *large_prime;
+	uint32 *large_root1;
+	uint32 *large_root2;
 
 	/* bookkeeping information for double large primes */
 
@@ -214,17 +307,88 @@ typedef struct {
 	mp_t max_fb2;          /* the square of the largest factor base prime */
 	mp_t large_prime_max2; /* the cutoff value for factoring partials */
 
+	/* bookkeeping information for triple large primes */
+
+	uint32 use_tlp;        /* nonzero if TLP relations are collected */
+	mp_t max_fb3;          /* the cube of the largest factor base prime */
+	mp_t large_prime_max3; /* the cutoff value for factoring TLP partials */
+	void *tinyqs_data;     /* for splitting TLP cofactors */
+
+	/* bookkeeping for batch factoring the cofactors of
+	   partial relations. A batched relation remembers the 
+	   'A' line of its polynomial, since that line may be 
+	   long gone from the savefile when the batch is run */
+
+	uint32 use_batch;          /* nonzero if cofactors are batched */
+	relation_batch_t relation_batch;
+	mpz_t batch_res;           /* scratch values for relation_batch_add */
+	mpz_t batch_one;
+	char curr_poly_a_line[256]; /* 'A' line of the current polynomials */
+	char *batch_a_lines;       /* 'A' lines used by batched relations */
+	uint32 num_batch_a;
+	uint32 batch_a_alloc;
+	uint32 batch_a_written;    /* 'A' line most recently re-saved */
+
 	relation_t *relation_list;     /* list of full/partial relations */
 	uint32 num_relations;	/* number of relations in list */
 	la_col_t *cycle_list;   /* cycles derived from relations */
 	uint32 num_cycles;	/* number of cycles in list */
 
-	cycle_t *cycle_table;      /* list of all the vertices in the graph */
-	uint32 cycle_table_size;   /* number of vertices filled in the table */
-	uint32 cycle_table_alloc;  /* number of cycle_t structures allocated */
-	uint32 *cycle_hashtable;   /* hashtable to index into cycle_table */
-	uint32 components;         /* connected components (see relation.c) */
-	uint32 vertices;           /* vertices in graph (see relation.c) */
+	cycle_graph_t cycle_graph; /* graph of partial relations */
+
+	/* with triple large primes the graph only gives a lower 
+	   bound on the number of cycles, so the large primes of
+	   all the partial relations are also kept, and the cycles
+	   among them are counted exactly from time to time */
+
+	uint32 *partial_primes;     /* three per relation, or NULL if
+				       not counting exactly */
+	uint32 num_partial_primes;
+	uint32 partial_primes_alloc;
+	uint32 exact_cycles;        /* cycles at the last count */
+	uint32 exact_partials;      /* partial relations at the last count */
+	uint32 prev_cycles;         /* the same, at the count before that */
+	uint32 prev_partials;
+	volatile uint32 counting_cycles; /* nonzero while a thread counts */
+
+	uint32 trial;              /* nonzero when tuning (see do_sieving) */
+
+	uint32 seed1;              /* random state for choosing 'a' values */
+	uint32 seed2;
+
+	/* bookkeeping for multithreaded sieving. Each sieving
+	   thread gets a private copy of this structure, with its
+	   own sieve block, hashtable, factor base roots and 
+	   polynomials. The savefile output of a thread is buffered
+	   and periodically handed to the master copy, which owns
+	   the savefile and the graph of partial relations. The
+	   large primes of buffered relations are kept separately,
+	   so that handing them over needs no parsing. Only the
+	   savefile has a lock; any number of threads can update
+	   the graph and the relation counts at once */
+
+	struct sieve_conf_t *master;  /* NULL if not a sieving thread */
+	uint32 thread_num;
+	char *relation_buf;        /* buffered savefile lines */
+	uint32 relation_buf_size;
+	uint32 relation_buf_alloc;
+	char poly_a_line[256];     /* 'A' line in effect at the start 
+				      of relation_buf */
+	uint32 buf_fulls;          /* full relations in relation_buf */
+	uint32 *buf_partials;      /* large primes of the partial relations
+				      in relation_buf, three per relation */
+	uint32 num_buf_partials;
+	uint32 buf_partials_alloc;
+
+	/* used by the master copy only */
+
+	mutex_t relation_mutex;    /* protects the savefile */
+	uint32 last_writer;        /* thread that last wrote the savefile */
+	volatile uint32 sieving_done; /* set when enough relations exist */
+
+	qs_stats_t stats;          /* see above; a sieving thread adds its
+				      statistics to the master copy when
+				      sieving finishes */
 
 } sieve_conf_t;
 
@@ -253,6 +417,17 @@ typedef uint32 (*qs_core_sieve_fcn)(sieve_conf_t *conf,
 DECLARE_SIEVE_FCN(qs_core_sieve_generic_32k);
 DECLARE_SIEVE_FCN(qs_core_sieve_generic_64k);
 
+/* versions that use AVX2 or AVX512BW, selected at runtime.
+   The build system defines HAS_AVX_SIEVE_CORE if it compiled 
+   these */
+
+#if defined(HAS_AVX_SIEVE_CORE)
+	DECLARE_SIEVE_FCN(qs_core_sieve_avx2_32k);
+	DECLARE_SIEVE_FCN(qs_core_sieve_avx2_64k);
+	DECLARE_SIEVE_FCN(qs_core_sieve_avx512_32k);
+	DECLARE_SIEVE_FCN(qs_core_sieve_avx512_64k);
+#endif
+
 #if defined(_MSC_VER) && (_MSC_VER >= 1400)
 	#define HAS_MSVC_SIEVE_CORE
 	DECLARE_SIEVE_FCN(qs_core_sieve_vc8_32k);
@@ -272,35 +447,54 @@ DECLARE_SIEVE_FCN(qs_core_sieve_generic_64k);
 	DECLARE_SIEVE_FCN(qs_core_sieve_k8_64k);
 #endif
 
-/* lightweight profiling of the sieve routines */
-#ifdef SIEVE_TIMING
-#define TIME1(var) { uint64 tmp_##var = read_clock();
-#define TIME2(var) (var) += read_clock() - tmp_##var; }
-extern uint64 next_poly_small_time;
-extern uint64 next_poly_large_time;
-extern uint64 plus_init_time;
-extern uint64 bucket_time;
-extern uint64 sieve_small_time;
-extern uint64 sieve_large_time;
-extern uint64 tf_plus_scan_time;
-extern uint64 tf_total_time;
-#else
-#define TIME1(var) /* nothing */
-#define TIME2(var) /* nothing */
-#endif
+/* lightweight profiling of the sieve routines. TIME1 and
+   TIME2 bracket a phase of sieving and add the clock ticks
+   spent in it to one of the timers below; they only read the
+   clock when the statistics of the sieve_conf_t are enabled */
+
+#define TIME1(conf, t) { uint64 tmp_##t = 0;			\
+		if ((conf)->stats.enabled) tmp_##t = read_clock();
+#define TIME2(conf, t) if ((conf)->stats.enabled)		\
+		(conf)->stats.time[t] += read_clock() - tmp_##t; }
+
+#define STAT_COUNT(conf, c) (conf)->stats.count[c]++
 
 /* pull out the large primes from a relation read from
    the savefile */
 
-void read_large_primes(char *buf, uint32 *prime1, uint32 *prime2);
+void read_large_primes(char *buf, uint32 *prime1, 
+			uint32 *prime2, uint32 *prime3);
 
 /* given the primes from a sieve relation, add
    that relation to the graph used for tracking
-   cycles */
+   cycles. With three large primes the graph is
+   really a hypergraph */
 
 void add_to_cycles(sieve_conf_t *conf, 
 			uint32 large_prime1, 
-			uint32 large_prime2);
+			uint32 large_prime2,
+			uint32 large_prime3);
+
+/* add the large primes of partial relations to the list
+   used for counting cycles exactly, and count the cycles 
+   the hypergraph cycle finder would build from such a list */
+
+void save_partial_primes(sieve_conf_t *conf, uint32 *primes,
+			uint32 num_partials);
+
+uint32 count_partial_cycles(uint32 *large_primes, uint32 num_partials);
+
+/* write one line of savefile output for a sieve relation
+   or polynomial 'a' value. Sieving threads buffer the line,
+   otherwise it goes to the savefile directly */
+
+void save_sieve_line(sieve_conf_t *conf, char *buf);
+
+/* pass the buffered output of a sieving thread to its
+   master copy, updating the relation counts and the graph
+   of partial relations */
+
+void flush_sieve_lines(sieve_conf_t *conf);
 
 /* encapsulate all of the information conerning a sieve
    relation and dump it to the savefile */
@@ -311,7 +505,25 @@ void save_relation(sieve_conf_t *conf,
 		  uint32 num_factors, 
 		  uint32 poly_index,
 		  uint32 large_prime1,
-		  uint32 large_prime2);
+		  uint32 large_prime2,
+		  uint32 large_prime3);
+
+/* batch factoring of the cofactors of partial relations.
+   qs_batch_init starts a new batch (copying the product of
+   primes from another configuration if src is not NULL),
+   qs_batch_add queues a cofactor too large to be a single 
+   large prime, and qs_batch_run factors everything queued,
+   saving the relations that are found */
+
+void qs_batch_init(sieve_conf_t *conf, sieve_conf_t *src);
+void qs_batch_free(sieve_conf_t *conf);
+void qs_batch_add(sieve_conf_t *conf,
+		  uint32 sieve_offset, 
+		  uint32 *fb_offsets, 
+		  uint32 num_factors, 
+		  uint32 poly_index,
+		  mp_t *res);
+void qs_batch_run(sieve_conf_t *conf);
 
 /* perform postprocessing on a list of relations */
 
@@ -324,6 +536,11 @@ void qs_filter_relations(sieve_conf_t *conf);
 void poly_init(sieve_conf_t *conf, uint32 sieve_size);
 void poly_free(sieve_conf_t *conf);
 
+/* allocate the polynomial scratch data for a sieving thread,
+   whose configuration was copied after poly_init was called */
+
+void poly_alloc(sieve_conf_t *conf);
+
 /* compute a random polynomial 'a' value, and also
    compute all of the 'b' values, all of the precomputed
    quantities for the 'b' values, and all of the initial
@@ -348,7 +565,17 @@ void build_derived_poly(sieve_conf_t *conf);
 	relation_list is the list of relations from the sieving stage
 	num_relations is the size of relation_list
 	cycle_list is the list of cycles that the QS filtering code builds
-	num_cycles is the number of cycles */
+	num_cycles is the number of cycles 
+	trial is NULL, except for the short runs used to tune the 
+		sieve parameters. These stop when the full and partial
+		relations together number obj->max_relations, print
+		nothing to the screen, and skip the postprocessing; 
+		the relation counts are returned in trial instead */
+
+typedef struct {
+	uint32 num_fulls;
+	uint32 num_partials;
+} sieve_trial_t;
 
 void do_sieving(msieve_obj *obj, mp_t *n, mp_t **poly_a_list, 
 		poly_t **poly_list, fb_t *factor_base, 
@@ -357,7 +584,8 @@ void do_sieving(msieve_obj *obj, mp_t *n, mp_t **poly_a_list,
 		relation_t **relation_list,
 		uint32 *num_relations,
 		la_col_t **cycle_list,
-		uint32 *num_cycles);
+		uint32 *num_cycles,
+		sieve_trial_t *trial);
 
 void qs_free_relation_list(relation_t *list, uint32 num_relations);
 
@@ -23,7 +23,6 @@ void poly_init(sieve_conf_t *conf, uint32 sieve_size) {
 	uint32 i, j;
 	uint32 start_bits;
 	uint32 num_factors, rem;
-	uint32 num_derived_poly;
 	mp_t t0, t1;
 	msieve_obj *obj = conf->obj;
 
@@ -208,9 +207,20 @@ void poly_init(sieve_conf_t *conf, uint32 sieve_size) {
 		}
 	}
 
+	poly_alloc(conf);
+	logprintf(obj, "polynomial 'A' values have %u factors\n", num_factors);
+}
+
+/*--------------------------------------------------------------------*/
+void poly_alloc(sieve_conf_t *conf) {
+
+	uint32 i;
+	uint32 num_factors = conf->num_poly_factors;
+	uint32 num_derived_poly = 1 << (num_factors - 1);
+	uint32 num_large = 0;
+
 	/* allocate scratch structures */
 
-	num_derived_poly = 1 << (num_factors - 1);
 	conf->next_poly_action = (uint8 *)xmalloc(num_derived_poly * 
 						sizeof(uint8));
 	conf->curr_b = (signed_mp_t *)xmalloc(num_derived_poly * 
@@ -221,22 +231,43 @@ void poly_init(sieve_conf_t *conf, uint32 sieve_size) {
 		conf->poly_b_small[i] = conf->poly_b_small[i-1] + 
 						conf->sieve_large_fb_start;
 	}
-	conf->poly_b_array = NULL;
-	if (conf->fb_size > conf->sieve_large_fb_start) {
-		conf->poly_b_array = (uint32 *)xmalloc(
-				num_factors * sizeof(uint32) *
-				(conf->fb_size - conf->sieve_large_fb_start));
+
+	memset(conf->poly_b_large, 0, sizeof(conf->poly_b_large));
+	conf->large_prime = NULL;
+	conf->large_root1 = NULL;
+	conf->large_root2 = NULL;
+	if (conf->fb_size > conf->sieve_large_fb_start)
+		num_large = conf->fb_size - conf->sieve_large_fb_start;
+	if (num_large == 0)
+		return;
+
+	conf->poly_b_large[0] = (uint32 *)aligned_malloc(
+				num_large * num_factors * sizeof(uint32), 64);
+	for (i = 1; i < num_factors; i++) {
+		conf->poly_b_large[i] = conf->poly_b_large[i-1] + 
+						num_large;
+	}
+
+	conf->large_prime = (uint32 *)aligned_malloc(
+				3 * num_large * sizeof(uint32), 64);
+	conf->large_root1 = conf->large_prime + num_large;
+	conf->large_root2 = conf->large_root1 + num_large;
+	for (i = 0; i < num_large; i++) {
+		conf->large_prime[i] = conf->factor_base[i + 
+					conf->sieve_large_fb_start].prime;
 	}
-	logprintf(obj, "polynomial 'A' values have %u factors\n", num_factors);
 }
 
 /*--------------------------------------------------------------------*/
 void poly_free(sieve_conf_t *conf) {
 
 	free(conf->next_poly_action);
-	free(conf->poly_b_array);
 	free(conf->poly_b_small[0]);
 	free(conf->curr_b);
+	if (conf->poly_b_large[0] != NULL) {
+		aligned_free(conf->poly_b_large[0]);
+		aligned_free(conf->large_prime);
+	}
 }
 
 /*--------------------------------------------------------------------*/
@@ -331,7 +362,6 @@ void build_base_poly(sieve_conf_t *conf) {
 	/* Build the next MPQS polynomial and prepare the
 	   factor base for using it */
 
-	msieve_obj *obj = conf->obj;
 	char buf[256];
 	uint32 i, j, k;
 	mp_t *a = &conf->curr_a;
@@ -344,7 +374,8 @@ void build_base_poly(sieve_conf_t *conf) {
 	uint32 *factor_bounds = conf->factor_bounds;
 	signed_mp_t *poly_tmp_b;
 	uint32 curr_poly_factor;
-	uint32 *poly_b_array;
+	uint32 large_fb_start = conf->sieve_large_fb_start;
+	uint32 **poly_b_large;
 	uint32 **poly_b_small;
 	uint32 sieve_size = conf->num_sieve_blocks *
 				conf->sieve_block_size / 2;
@@ -366,7 +397,7 @@ void build_base_poly(sieve_conf_t *conf) {
 		uint32 range = factor_bounds[bits+1] - factor_bounds[bits];
 
 		poly_factors[i] = factor_bounds[bits] + 
-				get_rand(&obj->seed1, &obj->seed2) % range;
+				get_rand(&conf->seed1, &conf->seed2) % range;
 
 		for (j = 0; j < i; j++) {
 			if (poly_factors[j] == poly_factors[i])
@@ -440,7 +471,7 @@ void build_base_poly(sieve_conf_t *conf) {
 	/* Initialize the factor base */
 
 	curr_poly_factor = 0;
-	poly_b_array = conf->poly_b_array;
+	poly_b_large = conf->poly_b_large;
 	poly_b_small = conf->poly_b_small;
 	poly_tmp_b = conf->poly_tmp_b;
 
@@ -490,14 +521,14 @@ void build_base_poly(sieve_conf_t *conf) {
 			   set of future polynomials that will reuse this
 			   'a' value. */
 
-			if (i >= conf->sieve_large_fb_start) {
+			if (i >= large_fb_start) {
 				for (j = 0; j < num_factors; j++) {
 					b_modp = mp_mod_1(&poly_tmp_b[j].num,
 							prime);
-					poly_b_array[j] = mp_modmul_1(a_modp, 
-							    b_modp, prime);
+					poly_b_large[j][i - large_fb_start] = 
+						mp_modmul_1(a_modp, 
+							b_modp, prime);
 				}
-				poly_b_array += num_factors;
 			}
 			else {
 				for (j = 0; j < num_factors; j++) {
@@ -509,6 +540,15 @@ void build_base_poly(sieve_conf_t *conf) {
 			}
 		}
 
+		/* roots of the primes that use the hashtable go in
+		   their own arrays, and do not need to be sorted */
+
+		if (i >= large_fb_start) {
+			conf->large_root1[i - large_fb_start] = root1;
+			conf->large_root2[i - large_fb_start] = root2;
+			continue;
+		}
+
 		/* The sieving code uses shortcuts that
 		   depend on root2 >= root1 at all times */
 
@@ -528,7 +568,8 @@ void build_base_poly(sieve_conf_t *conf) {
 	for (j = 0; j < conf->num_poly_factors; j++)
 		i += sprintf(buf + i, " %x", conf->poly_factors[j]);
 	i += sprintf(buf + i, "\n");
-	savefile_write_line(&obj->savefile, buf);
+	save_sieve_line(conf, buf);
+	strcpy(conf->curr_poly_a_line, buf);
 }
 
 /*--------------------------------------------------------------------*/
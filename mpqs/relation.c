@@ -42,15 +42,12 @@ static int compare_relations(const void *x, const void *y) {
 	relation_t *yy = (relation_t *)y;
 	uint32 i;
 
-	if (xx->large_prime[1] > yy->large_prime[1])
-		return 1;
-	if (xx->large_prime[1] < yy->large_prime[1])
-		return -1;
-
-	if (xx->large_prime[0] > yy->large_prime[0])
-		return 1;
-	if (xx->large_prime[0] < yy->large_prime[0])
-		return -1;
+	for (i = 3; i; i--) {
+		if (xx->large_prime[i-1] > yy->large_prime[i-1])
+			return 1;
+		if (xx->large_prime[i-1] < yy->large_prime[i-1])
+			return -1;
+	}
 
 	if (xx->num_factors > yy->num_factors)
 		return 1;
@@ -95,10 +92,147 @@ static uint32 purge_duplicate_relations(msieve_obj *obj,
 	return j;
 }
 
+/*--------------------------------------------------------------------*/
+static void sort_large_primes(uint32 prime1, uint32 prime2,
+				uint32 prime3, uint32 *primes) {
+
+	uint32 tmp;
+
+	if (prime1 > prime2) {
+		tmp = prime1; prime1 = prime2; prime2 = tmp;
+	}
+	if (prime2 > prime3) {
+		tmp = prime2; prime2 = prime3; prime3 = tmp;
+	}
+	if (prime1 > prime2) {
+		tmp = prime1; prime1 = prime2; prime2 = tmp;
+	}
+	primes[0] = prime1;
+	primes[1] = prime2;
+	primes[2] = prime3;
+}
+
+/*--------------------------------------------------------------------*/
+void save_sieve_line(sieve_conf_t *conf, char *buf) {
+
+	uint32 len;
+
+	if (conf->master == NULL) {
+		savefile_write_line(&conf->obj->savefile, buf);
+		return;
+	}
+
+	/* sieving threads cannot touch the savefile, and 
+	   keep a private list of lines instead */
+
+	len = strlen(buf);
+	if (conf->relation_buf_size + len + 1 >= conf->relation_buf_alloc) {
+		conf->relation_buf_alloc = 2 * (conf->relation_buf_alloc + len);
+		conf->relation_buf = (char *)xrealloc(conf->relation_buf,
+						conf->relation_buf_alloc);
+	}
+	strcpy(conf->relation_buf + conf->relation_buf_size, buf);
+	conf->relation_buf_size += len;
+}
+
+/*--------------------------------------------------------------------*/
+void save_partial_primes(sieve_conf_t *conf, uint32 *primes,
+			uint32 num_partials) {
+
+	/* add the large primes of partial relations to the
+	   list used for counting cycles exactly, if the 
+	   list is being kept */
+
+	if (conf->partial_primes == NULL || num_partials == 0)
+		return;
+
+	if (conf->num_partial_primes + num_partials > 
+				conf->partial_primes_alloc) {
+		conf->partial_primes_alloc = 2 * (conf->num_partial_primes +
+						num_partials);
+		conf->partial_primes = (uint32 *)xrealloc(
+					conf->partial_primes,
+					3 * conf->partial_primes_alloc *
+					sizeof(uint32));
+	}
+
+	memcpy(conf->partial_primes + 3 * conf->num_partial_primes,
+			primes, 3 * num_partials * sizeof(uint32));
+	conf->num_partial_primes += num_partials;
+}
+
+/*--------------------------------------------------------------------*/
+void flush_sieve_lines(sieve_conf_t *conf) {
+
+	/* move the buffered output of one sieving thread
+	   into the savefile, and update the relation and
+	   cycle counts of the master configuration.
+
+	   The savefile associates each relation with the
+	   most recent 'A' line before it, so if another 
+	   thread wrote to the savefile since this thread
+	   last did, the 'A' value in use when the buffer 
+	   was started must be repeated. The filtering code
+	   does not mind seeing an 'A' value more than once */
+
+	sieve_conf_t *master = conf->master;
+	savefile_t *savefile = &conf->obj->savefile;
+	char *buf = conf->relation_buf;
+	char *end = buf + conf->relation_buf_size;
+	uint32 *primes = conf->buf_partials;
+	uint32 i;
+
+	if (buf == end)
+		return;
+
+	mutex_lock(&master->relation_mutex);
+
+	if (master->last_writer != conf->thread_num &&
+	    buf[0] != 'A' && conf->poly_a_line[0] != 0) {
+		savefile_write_line(savefile, conf->poly_a_line);
+	}
+	master->last_writer = conf->thread_num;
+
+	while (buf < end) {
+		char *next = strchr(buf, '\n') + 1;
+		char save = *next;
+
+		*next = 0;
+		savefile_write_line(savefile, buf);
+		*next = save;
+		buf = next;
+	}
+
+	save_partial_primes(master, conf->buf_partials, 
+				conf->num_buf_partials);
+	mutex_unlock(&master->relation_mutex);
+
+	/* the buffer always ends with the current 'A' value in 
+	   effect, which the next buffer starts with */
+
+	strcpy(conf->poly_a_line, conf->curr_poly_a_line);
+	conf->relation_buf_size = 0;
+	conf->relation_buf[0] = 0;
+
+	/* add the partial relations to the graph. Other threads
+	   may be doing the same, and the counts are updated 
+	   atomically; the number of partials goes up last, so
+	   that a snapshot of the counts never overestimates the
+	   number of cycles */
+
+	atomic_add(&master->num_relations, conf->buf_fulls);
+	for (i = 0; i < conf->num_buf_partials; i++, primes += 3)
+		add_to_cycles(master, primes[0], primes[1], primes[2]);
+	atomic_add(&master->num_cycles, conf->num_buf_partials);
+	conf->buf_fulls = 0;
+	conf->num_buf_partials = 0;
+}
+
 /*--------------------------------------------------------------------*/
 void save_relation(sieve_conf_t *conf, uint32 sieve_offset,
 		uint32 *fb_offsets, uint32 num_factors, 
-		uint32 poly_index, uint32 large_prime1, uint32 large_prime2) {
+		uint32 poly_index, uint32 large_prime1, 
+		uint32 large_prime2, uint32 large_prime3) {
 
 	/* output a relation in ascii to a text file. The output
 	   format is
@@ -106,7 +240,9 @@ void save_relation(sieve_conf_t *conf, uint32 sieve_offset,
 	   R [-]<sieve_value> <poly_index> <list_of_fb_offsets> L <large_primes>
 
 	   All numbers are in hex without leading zeros, to save space. 
-	   One or both large primes may be 1
+	   Any of the large primes may be 1. There are normally two
+	   large primes, and a third is only printed for relations
+	   that need it
 	   
 	   NOTE: poly_index is local to the current 'a' value; hence if
 	   and 'a' value allows 128 polynomials then 0 <= poly_index < 128.
@@ -115,6 +251,7 @@ void save_relation(sieve_conf_t *conf, uint32 sieve_offset,
 	   factorization */
 
 	uint32 i, j;
+	uint32 primes[3];
 	char buf[LINE_BUF_SIZE];
 
 	i = sprintf(buf, "R ");
@@ -129,18 +266,52 @@ void save_relation(sieve_conf_t *conf, uint32 sieve_offset,
 	for (j = 0; j < num_factors; j++)
 		i += sprintf(buf + i, "%x ", fb_offsets[j]);
 
-	if (large_prime1 < large_prime2)
-		i += sprintf(buf + i, "L %x %x\n", large_prime1, large_prime2);
+	sort_large_primes(large_prime1, large_prime2, large_prime3, primes);
+
+	if (primes[2] == 1)
+		STAT_COUNT(conf, QS_COUNT_FULL);
+	else if (primes[1] == 1)
+		STAT_COUNT(conf, QS_COUNT_PARTIAL1);
+	else if (primes[0] == 1)
+		STAT_COUNT(conf, QS_COUNT_PARTIAL2);
+	else
+		STAT_COUNT(conf, QS_COUNT_PARTIAL3);
+
+	if (primes[0] == 1)
+		i += sprintf(buf + i, "L %x %x\n", primes[1], primes[2]);
 	else
-		i += sprintf(buf + i, "L %x %x\n", large_prime2, large_prime1);
+		i += sprintf(buf + i, "L %x %x %x\n", 
+				primes[0], primes[1], primes[2]);
 
-	savefile_write_line(&conf->obj->savefile, buf);
+	save_sieve_line(conf, buf);
 
 	/* for partial relations, also update the bookeeping for
-	   tracking the number of fundamental cycles */
+	   tracking the number of fundamental cycles. Sieving
+	   threads remember the large primes and leave that to
+	   flush_sieve_lines() */
+
+	if (conf->master != NULL) {
+		if (IS_FULL_RELATION(primes[0], primes[1], primes[2])) {
+			conf->buf_fulls++;
+			return;
+		}
+
+		if (conf->num_buf_partials == conf->buf_partials_alloc) {
+			conf->buf_partials_alloc = 2 * 
+					conf->buf_partials_alloc + 100;
+			conf->buf_partials = (uint32 *)xrealloc(
+					conf->buf_partials,
+					3 * conf->buf_partials_alloc *
+					sizeof(uint32));
+		}
+		memcpy(conf->buf_partials + 3 * conf->num_buf_partials++,
+				primes, sizeof(primes));
+		return;
+	}
 
-	if (large_prime1 != large_prime2) {
-		add_to_cycles(conf, large_prime1, large_prime2);
+	if (!IS_FULL_RELATION(primes[0], primes[1], primes[2])) {
+		add_to_cycles(conf, primes[0], primes[1], primes[2]);
+		save_partial_primes(conf, primes, 1);
 		conf->num_cycles++;
 	}
 	else {
@@ -149,40 +320,193 @@ void save_relation(sieve_conf_t *conf, uint32 sieve_offset,
 }
 
 /*--------------------------------------------------------------------*/
-void read_large_primes(char *buf, uint32 *prime1, uint32 *prime2) {
-
-	char *next_field;
-	uint32 p1, p2;
+/* the largest prime in the product used for batch factoring, and
+   the number of cofactors batched up before factoring them. The
+   product takes a few megabytes per sieving thread, and the batch
+   should be large enough that dividing it into the product is 
+   cheap compared to the effort of filling it */
+
+#define BATCH_MAX_PRIME (1 << 26)
+#define BATCH_SIZE 50000
+
+#define A_LINE_SIZE sizeof(((sieve_conf_t *)0)->curr_poly_a_line)
+
+static void save_batch_relation(void *print_data, int64 a, uint32 b,
+			uint32 *factors_r, uint32 num_factors_r, 
+			uint32 lp_r[MAX_LARGE_PRIMES],
+			uint32 *factors_a, uint32 num_factors_a, 
+			uint32 lp_a[MAX_LARGE_PRIMES]) {
+
+	/* callback for relations found by batch factoring.
+	   The top half of 'a' is the list offset of the 'A' line
+	   for the relation, which must precede the relation in
+	   the savefile; the bottom half is the sieve offset.
+	   The QS has no algebraic side, so the factors_a, 
+	   num_factors_a and lp_a arguments are always empty */
+
+	sieve_conf_t *conf = (sieve_conf_t *)print_data;
+	uint32 a_idx = (uint32)(a >> 32);
+
+	(void)factors_a;
+	(void)num_factors_a;
+	(void)lp_a;
+
+	if (a_idx != conf->batch_a_written) {
+		save_sieve_line(conf, conf->batch_a_lines + 
+					a_idx * A_LINE_SIZE);
+		conf->batch_a_written = a_idx;
+	}
 
-	*prime1 = p1 = 1;
-	*prime2 = p2 = 2;
-	if (*buf != 'L')
-		return;
+	save_relation(conf, (uint32)a, factors_r, num_factors_r, 
+			b, lp_r[0], lp_r[1], lp_r[2]);
+}
 
-	buf++;
-	while (isspace(*buf))
-		buf++;
-	if (isxdigit(*buf)) {
-		p1 = strtoul(buf, &next_field, 16);
-		buf = next_field;
+/*--------------------------------------------------------------------*/
+void qs_batch_init(sieve_conf_t *conf, sieve_conf_t *src) {
+
+	/* multiply together the primes between the factor base
+	   bound and a quarter of the large prime bound, or 
+	   BATCH_MAX_PRIME if that is smaller. The batch splits
+	   each cofactor into a part made of those primes and a 
+	   part made of larger primes. The larger part alone rules
+	   out most cofactors without any factoring: it is thrown
+	   away if it has more than two words, if it is one word 
+	   above the large prime bound, or if it has two words and
+	   is above the square of the large prime bound or below
+	   the square of the largest prime in the product (and so
+	   is a prime that is much too large).
+
+	   Cofactors that survive still need SQUFOF, tinyqs or
+	   tinyecm whenever either part has more than one prime:
+	   the part from the product when it holds several primes,
+	   and a two-word larger part, which holds two primes above
+	   the product. Triple large prime cofactors often have two
+	   or three primes above a quarter of the large prime bound,
+	   and when BATCH_MAX_PRIME is below that quarter, double
+	   large prime cofactors can have two primes above the 
+	   product as well */
+
+	if (src == NULL) {
+		uint32 min_prime = conf->factor_base[conf->fb_size - 1].prime;
+		uint32 max_prime = MIN(conf->large_prime_max / 4, 
+					BATCH_MAX_PRIME);
+
+		relation_batch_init(conf->obj, &conf->relation_batch,
+				min_prime, MAX(max_prime, 2 * min_prime),
+				conf->large_prime_max - 1, 
+				conf->large_prime_max - 1,
+				conf, save_batch_relation);
+		conf->relation_batch.target_relations = BATCH_SIZE;
 	}
 	else {
-		return;
+		relation_batch_init_copy(&conf->relation_batch,
+				&src->relation_batch, conf);
 	}
 
-	while (isspace(*buf))
-		buf++;
-	if (isxdigit(*buf))
-		p2 = strtoul(buf, &next_field, 16);
-	
-	if (p1 < p2) {
-		*prime1 = p1;
-		*prime2 = p2;
+	mpz_init(conf->batch_res);
+	mpz_init_set_ui(conf->batch_one, 1);
+	conf->num_batch_a = 0;
+	conf->batch_a_alloc = 100;
+	conf->batch_a_lines = (char *)xmalloc(conf->batch_a_alloc *
+						A_LINE_SIZE);
+}
+
+/*--------------------------------------------------------------------*/
+void qs_batch_free(sieve_conf_t *conf) {
+
+	relation_batch_free(&conf->relation_batch);
+	mpz_clear(conf->batch_res);
+	mpz_clear(conf->batch_one);
+	free(conf->batch_a_lines);
+}
+
+/*--------------------------------------------------------------------*/
+void qs_batch_add(sieve_conf_t *conf, uint32 sieve_offset,
+		uint32 *fb_offsets, uint32 num_factors, 
+		uint32 poly_index, mp_t *res) {
+
+	/* remember the current 'A' line if the batch 
+	   does not have it yet */
+
+	if (conf->num_batch_a == 0 || 
+	    strcmp(conf->batch_a_lines + (conf->num_batch_a - 1) * 
+	    		A_LINE_SIZE, conf->curr_poly_a_line) != 0) {
+
+		if (conf->num_batch_a == conf->batch_a_alloc) {
+			conf->batch_a_alloc *= 2;
+			conf->batch_a_lines = (char *)xrealloc(
+						conf->batch_a_lines,
+						conf->batch_a_alloc *
+						A_LINE_SIZE);
+		}
+		strcpy(conf->batch_a_lines + conf->num_batch_a * 
+				A_LINE_SIZE, conf->curr_poly_a_line);
+		conf->num_batch_a++;
 	}
-	else {
-		*prime1 = p2;
-		*prime2 = p1;
+
+	mp2gmp(res, conf->batch_res);
+	relation_batch_add((int64)(conf->num_batch_a - 1) << 32 | 
+				sieve_offset, poly_index, 
+			fb_offsets, num_factors, conf->batch_res,
+			NULL, 0, conf->batch_one, 
+			&conf->relation_batch);
+
+	if (conf->relation_batch.num_relations >= 
+			conf->relation_batch.target_relations)
+		qs_batch_run(conf);
+}
+
+/*--------------------------------------------------------------------*/
+void qs_batch_run(sieve_conf_t *conf) {
+
+	/* factor the batch; relations that are found will 
+	   repeat their 'A' lines, and if that happens the
+	   current 'A' line is repeated too, so that relations
+	   saved after this point refer to the right polynomial */
+
+	TIME1(conf, QS_TIME_BATCH)
+	conf->batch_a_written = (uint32)(-1);
+	relation_batch_run(&conf->relation_batch);
+
+	if (conf->batch_a_written != (uint32)(-1) &&
+	    strcmp(conf->batch_a_lines + conf->batch_a_written * 
+	    		A_LINE_SIZE, conf->curr_poly_a_line) != 0) {
+		save_sieve_line(conf, conf->curr_poly_a_line);
+	}
+	conf->num_batch_a = 0;
+	TIME2(conf, QS_TIME_BATCH)
+}
+
+/*--------------------------------------------------------------------*/
+void read_large_primes(char *buf, uint32 *prime1, 
+			uint32 *prime2, uint32 *prime3) {
+
+	char *next_field;
+	uint32 i;
+	uint32 p[3];
+
+	/* relations have two large primes, or three if
+	   the triple large prime variation is in use */
+
+	p[0] = 1;
+	p[1] = 2;
+	p[2] = 1;
+	if (*buf == 'L') {
+		buf++;
+		for (i = 0; i < 3; i++) {
+			while (isspace(*buf))
+				buf++;
+			if (!isxdigit(*buf))
+				break;
+			p[i] = strtoul(buf, &next_field, 16);
+			buf = next_field;
+		}
 	}
+
+	sort_large_primes(p[0], p[1], p[2], p);
+	*prime1 = p[0];
+	*prime2 = p[1];
+	*prime3 = p[2];
 }
 
 /*--------------------------------------------------------------------*/
@@ -274,7 +598,8 @@ static int32 read_relation(sieve_conf_t *conf,
 	r->poly_idx = poly_index;
 	r->num_factors = num_factors + num_poly_factors;
 	r->fb_offsets = (uint32 *)xmalloc(r->num_factors * sizeof(uint32));
-	read_large_primes(relation_buf, r->large_prime, r->large_prime + 1);
+	read_large_primes(relation_buf, r->large_prime, 
+			r->large_prime + 1, r->large_prime + 2);
 
 	/* combine the factors of the sieve value with
 	   the factors of the polynomial 'a' value; the 
@@ -344,12 +669,11 @@ static int32 read_relation(sieve_conf_t *conf,
 		if (mp_divrem_1(&t1.num, prime, &t1.num) != 0)
 			break;
 	}
-	if (r->large_prime[0] > 1)
-		if (mp_divrem_1(&t1.num, r->large_prime[0], &t1.num) != 0)
-			goto read_failed;
-	if (r->large_prime[1] > 1)
-		if (mp_divrem_1(&t1.num, r->large_prime[1], &t1.num) != 0)
+	for (i = 0; i < 3; i++) {
+		if (r->large_prime[i] > 1 &&
+		    mp_divrem_1(&t1.num, r->large_prime[i], &t1.num) != 0)
 			goto read_failed;
+	}
 
 	if (mp_is_one(&t1.num))
 		return 0;
@@ -412,60 +736,268 @@ static void read_poly_a(sieve_conf_t *conf,
 }
 
 /*--------------------------------------------------------------------*/
-static cycle_t *get_table_entry(cycle_t *table, uint32 *hashtable,
-				uint32 prime, uint32 new_entry_offset) {
+void cycle_graph_init(cycle_graph_t *g) {
+
+	g->chunks = (cycle_t **)xcalloc((size_t)MAX_CYCLE_CHUNKS,
+					sizeof(cycle_t *));
+	g->hashtable = (uint32 *)xcalloc((size_t)1 << LOG2_CYCLE_HASH,
+					sizeof(uint32));
+	g->size = 1;
+	g->components = 0;
+	g->vertices = 0;
+}
+
+/*--------------------------------------------------------------------*/
+void cycle_graph_free(cycle_graph_t *g) {
+
+	uint32 i;
+
+	if (g->chunks != NULL) {
+		for (i = 0; i < MAX_CYCLE_CHUNKS; i++)
+			free(g->chunks[i]);
+	}
+	free(g->chunks);
+	free(g->hashtable);
+	g->chunks = NULL;
+	g->hashtable = NULL;
+}
+
+/*--------------------------------------------------------------------*/
+static void cycle_graph_reset(cycle_graph_t *g) {
+
+	/* empty the graph but keep its memory */
+
+	memset(g->hashtable, 0, sizeof(uint32) << LOG2_CYCLE_HASH);
+	g->size = 1;
+	g->components = 0;
+	g->vertices = 0;
+}
 
-	/* return a pointer to a unique cycle_t specific
-	   to 'prime'. The value of 'prime' is hashed and
-	   the result used to index 'table'. If prime does
-	   not appear in table, specify 'new_entry_offset'
-	   as the table entry for prime.
+/*--------------------------------------------------------------------*/
+static uint32 alloc_table_entry(cycle_graph_t *g) {
+
+	/* reserve the next unused cycle_t in the graph. The
+	   entries live in chunks that never move once allocated,
+	   so that other threads can keep using the graph while
+	   it grows. If two threads both find a chunk missing,
+	   the one that loses the race to install it frees its
+	   own copy */
+
+	uint32 offset = atomic_add(&g->size, 1);
+	cycle_t * volatile *chunk = (cycle_t * volatile *)g->chunks + 
+					(offset >> LOG2_CYCLE_CHUNK);
+
+	if (*chunk == NULL) {
+		cycle_t *new_chunk = (cycle_t *)xmalloc(
+				sizeof(cycle_t) << LOG2_CYCLE_CHUNK);
+
+		if (!atomic_cas_ptr((void * volatile *)chunk, 
+					NULL, new_chunk))
+			free(new_chunk);
+	}
 
-	   Values of 'prime' which hash to the same offset
-	   in hashtable are connected by a linked list of
-	   offsets in 'table'. */
+	return offset;
+}
 
-	uint32 offset, first_offset;
-	cycle_t *entry = NULL;
+/*--------------------------------------------------------------------*/
+static uint32 find_table_entry(cycle_graph_t *g, uint32 prime) {
 
-	first_offset = HASH(prime);
-	offset = hashtable[first_offset];
+	/* return the offset of the cycle_t specific to 'prime',
+	   or zero if 'prime' is not in the graph. The value of 
+	   'prime' is hashed, and values of 'prime' which hash 
+	   to the same offset in the hashtable are connected by 
+	   a linked list of offsets into the graph */
 
-	/* follow the list of entries corresponding to
-	   primes that hash to 'offset', stopping if either
-	   the list runs out or we find an entry that's
-	   dedicated to 'prime' already in the table */
+	uint32 offset = g->hashtable[HASH(prime)];
 
 	while (offset != 0) {
-		entry = table + offset;
+		cycle_t *entry = CYCLE_ENTRY(g, offset);
 		if (entry->prime == prime)
 			break;
 		offset = entry->next;
 	}
 
-	/* if an entry was not found, initialize a new one */
+	return offset;
+}
+
+/*--------------------------------------------------------------------*/
+static uint32 add_table_entry(cycle_graph_t *g, uint32 prime) {
+
+	/* as above, except that a 'prime' which is not in 
+	   the graph yet gets a new cycle_t, which starts off
+	   as a connected component all by itself.
+	   
+	   Several threads can do this at the same time. The new
+	   entry is filled in completely before it is published,
+	   by swapping its offset into the head of its hash chain.
+	   If another thread changed the head first, that thread 
+	   may have added the same prime, so the chain is searched 
+	   again (a reserved entry that ends up unused is simply 
+	   wasted). Entries are never removed from a chain, so the
+	   search needs no lock either */
+
+	uint32 *bucket = g->hashtable + HASH(prime);
+	uint32 head, offset;
+	uint32 new_offset = 0;
+	cycle_t *entry;
+
+	while (1) {
+		head = *(volatile uint32 *)bucket;
+
+		for (offset = head; offset != 0; offset = entry->next) {
+			entry = CYCLE_ENTRY(g, offset);
+			if (entry->prime == prime)
+				return offset;
+		}
+
+		if (new_offset == 0) {
+			new_offset = alloc_table_entry(g);
+			entry = CYCLE_ENTRY(g, new_offset);
+			entry->prime = prime;
+			entry->data = new_offset;
+			entry->count = 0;
+		}
+		CYCLE_ENTRY(g, new_offset)->next = head;
+
+		if (atomic_cas(bucket, head, new_offset)) {
+
+			/* the vertex count goes up first, so that
+			   a thread reading the counts in between 
+			   only ever underestimates the number of
+			   cycles */
+
+			atomic_add(&g->vertices, 1);
+			atomic_add(&g->components, 1);
+			return new_offset;
+		}
+	}
+}
+
+/*--------------------------------------------------------------------*/
+static uint32 get_vertices(uint32 prime1, uint32 prime2, 
+			uint32 prime3, uint32 *vertices) {
+
+	/* given the (sorted) large primes of a relation, find
+	   the vertices of the graph that the relation connects.
+	   These are the primes that occur an odd number of times,
+	   with the 'prime' 1 added if there is an odd number of
+	   those. This makes every relation touch an even number
+	   of vertices, so that a relation with two large primes
+	   is an ordinary edge and a relation with three large 
+	   primes is an edge of a hypergraph with four vertices.
+	   Returns the number of vertices */
+
+	uint32 primes[3];
+	uint32 i, num_vertices;
+
+	primes[0] = prime1;
+	primes[1] = prime2;
+	primes[2] = prime3;
+
+	num_vertices = 0;
+	for (i = 0; i < 3; i++) {
+		if (primes[i] == 1)
+			continue;
+		if (i < 2 && primes[i] == primes[i+1]) {
+			i++;
+			continue;
+		}
+		vertices[++num_vertices] = primes[i];
+	}
+
+	if (num_vertices & 1) {
+		vertices[0] = 1;
+		return num_vertices + 1;
+	}
+
+	for (i = 0; i < num_vertices; i++)
+		vertices[i] = vertices[i+1];
+	return num_vertices;
+}
 
-	if (offset == 0) {
-		entry = table + new_entry_offset;
-		entry->next = hashtable[first_offset];
-		entry->prime = prime;
-		entry->data = 0;
-		entry->count = 0;
-		hashtable[first_offset] = new_entry_offset;
+/*--------------------------------------------------------------------*/
+static uint32 find_root(cycle_graph_t *g, uint32 offset) {
+
+	/* follow the pointers from the vertex at 'offset' up 
+	   to the root of its connected component, which is the
+	   vertex that points to itself. Along the way each vertex
+	   is made to point to its grandparent (path halving), 
+	   which keeps later searches short.
+
+	   Another thread may be changing the same pointers. 
+	   Vertices only ever point further up their tree, and a
+	   vertex that is not a root never becomes one again, so
+	   replacing a parent with a grandparent is always safe;
+	   the compare-and-swap only keeps this thread from undoing
+	   a bigger step made by another one */
+
+	while (1) {
+		cycle_t *entry = CYCLE_ENTRY(g, offset);
+		uint32 parent = entry->data;
+		uint32 grandparent;
+
+		if (parent == offset)
+			return offset;
+
+		grandparent = CYCLE_ENTRY(g, parent)->data;
+		if (grandparent != parent)
+			atomic_cas(&entry->data, parent, grandparent);
+		offset = grandparent;
 	}
+}
+
+/*--------------------------------------------------------------------*/
+static void merge_components(cycle_graph_t *g, 
+				uint32 offset1, uint32 offset2) {
+
+	/* If the roots for two vertices are different,
+	   then they lie within separate connected components,
+	   which an edge containing both vertices merges together.
+	   Hence the total number of components in the graph goes 
+	   down by one.
+
+	   Attach the component whose root is the larger prime
+	   to the other one; since small primes are more common,
+	   this will give the smaller root more edges, and will 
+	   potentially increase the number of cycles the graph 
+	   contains. 
+	   
+	   The merge happens by swapping the root of one component
+	   from itself to the other root. If another thread gets
+	   to either root first, the search for the roots starts 
+	   over. Because a root is only ever attached to a root
+	   with a smaller prime, concurrent merges cannot create a 
+	   loop, and every successful swap removes exactly one 
+	   component; the component count is therefore exact no 
+	   matter how the threads interleave */
+
+	while (1) {
+		uint32 root1 = find_root(g, offset1);
+		uint32 root2 = find_root(g, offset2);
+
+		if (root1 == root2)
+			return;
+
+		if (CYCLE_ENTRY(g, root1)->prime > 
+		    CYCLE_ENTRY(g, root2)->prime) {
+			uint32 tmp = root1;
+			root1 = root2;
+			root2 = tmp;
+		}
 
-	return entry;
+		if (atomic_cas(&CYCLE_ENTRY(g, root2)->data, root2, root1)) {
+			atomic_add(&g->components, (uint32)(-1));
+			return;
+		}
+	}
 }
 
 /*--------------------------------------------------------------------*/
-static uint32 add_to_hashtable(cycle_t *table, uint32 *hashtable, 
-			uint32 prime1, uint32 prime2, 
-			uint32 default_table_entry, 
-			uint32 *components, uint32 *vertices) {
+static void add_to_graph(cycle_graph_t *g, 
+			uint32 *primes, uint32 num_primes) {
 
 	/* update the list of cycles to reflect the presence
-	   of a partial relation with large primes 'prime1'
-	   and 'prime2'.
+	   of a partial relation with large primes 'primes'.
 
 	   There are three quantities to track, the number of
 	   edges, components and vertices. The number of cycles 
@@ -479,119 +1011,34 @@ static uint32 add_to_hashtable(cycle_t *table, uint32 *hashtable,
 	   to the same connected component. Think of a component
 	   as a tree of vertices; one prime is chosen arbitrarily
 	   as the 'root' of that tree.
-	   
-	   The number of new primes added to the graph (0, 1, or 2)
-	   is returned */
-
-	uint32 root[2];
-	uint32 root1, root2;
-	uint32 i;
-	uint32 num_new_entries = 0;
-
-	/* for each prime */
-
-	for (i = 0; i < 2; i++) {
-		uint32 prime = ((i == 0) ? prime1 : prime2);
-		uint32 offset; 
-		cycle_t *entry;
-
-		/* retrieve the cycle_t corresponding to that
-		   prime from the graph (or allocate a new one) */
-
-		entry = get_table_entry(table, hashtable,
-					prime, default_table_entry);
-		entry->count++;
-
-		if (entry->data == 0) {
 
-			/* if this prime has not occurred in the graph
-			   before, increment the number of vertices and
-			   the number of components, then make the table
-			   entry point to itself. */
+	   When the graph contains edges with four vertices, 
+	   e + c - v is only a lower bound on the number of 
+	   cycles; it becomes more accurate as the components 
+	   of the graph grow together */
 
-			num_new_entries++;
-			default_table_entry++;
-
-			offset = entry - table;
-			entry->data = offset;
-			(*components)++;
-			(*vertices)++;
-		}
-		else {
-			/* the prime is already in the table, which
-			   means we can follow a linked list of pointers
-			   to other primes until we reach a cycle_t
-			   that points to itself. This last cycle_t is
-			   the 'root' of the connected component that
-			   contains 'prime'. Save its value */
-
-			cycle_t *first_entry, *next_entry;
-
-			first_entry = entry;
-			next_entry = table + entry->data;
-			while (entry != next_entry) {
-				entry = next_entry;
-				next_entry = table + next_entry->data;
-			}
-				
-			/* Also perform path compression: now that we
-			   know the value of the root for this prime,
-			   make all of the pointers in the primes we
-			   visited along the way point back to this root.
-			   This will speed up future root lookups */
-
-			offset = entry->data;
-			entry = first_entry;
-			next_entry = table + entry->data;
-			while (entry != next_entry) {
-				entry->data = offset;
-				entry = next_entry;
-				next_entry = table + next_entry->data;
-			}
-		}
+	uint32 offsets[4];
+	uint32 i;
 
-		root[i] = offset;
+	for (i = 0; i < num_primes; i++) {
+		offsets[i] = add_table_entry(g, primes[i]);
+		atomic_add(&CYCLE_ENTRY(g, offsets[i])->count, 1);
 	}
-				
-	/* If the roots for prime1 and prime2 are different,
-	   then they lie within separate connected components.
-	   We're about to connect this edge to one of these
-	   components, and the presence of the other prime
-	   means that these two components are about to be
-	   merged together. Hence the total number of components
-	   in the graph goes down by one. */
-
-	root1 = root[0];
-	root2 = root[1];
-	if (root1 != root2)
-		(*components)--;
-	
-	/* This partial relation represents an edge in the
-	   graph; we have to attach this edge to one or the
-	   other of the connected components. Attach it to
-	   the component whose representative prime is smallest;
-	   since small primes are more common, this will give
-	   the smaller root more edges, and will potentially
-	   increase the number of cycles the graph contains */
-
-	if (table[root1].prime < table[root2].prime)
-		table[root2].data = root1;
-	else
-		table[root1].data = root2;
-	
-	return num_new_entries;
+
+	for (i = 1; i < num_primes; i++)
+		merge_components(g, offsets[0], offsets[i]);
 }
 
 /*--------------------------------------------------------------------*/
-void add_to_cycles(sieve_conf_t *conf, uint32 prime1, uint32 prime2) {
+void add_to_cycles(sieve_conf_t *conf, uint32 prime1, 
+			uint32 prime2, uint32 prime3) {
 
 	/* Top level routine for updating the graph of partial
-	   relations */
+	   relations. Sieving threads call this at the same time,
+	   without any locks */
 
-	uint32 table_size = conf->cycle_table_size;
-	uint32 table_alloc = conf->cycle_table_alloc;
-	cycle_t *table = conf->cycle_table;
-	uint32 *hashtable = conf->cycle_hashtable;
+	uint32 vertices[4];
+	uint32 num_vertices;
 
 	/* if we don't actually want to count cycles,
 	   just increment the number of vertices. This is
@@ -599,41 +1046,31 @@ void add_to_cycles(sieve_conf_t *conf, uint32 prime1, uint32 prime2) {
 	   code will never detect any cycles */
 
 	if (conf->obj->flags & MSIEVE_FLAG_SKIP_QS_CYCLES) {
-		conf->vertices++;
+		atomic_add(&conf->cycle_graph.vertices, 1);
 		return;
 	}
 
-	/* make sure there's room for new primes */
-
-	if (table_size + 2 >= table_alloc) {
-		table_alloc = conf->cycle_table_alloc = 2 * table_alloc;
-		conf->cycle_table = (cycle_t *)xrealloc(conf->cycle_table,
-						table_alloc * sizeof(cycle_t));
-		table = conf->cycle_table;
-	}
-
-	conf->cycle_table_size += add_to_hashtable(table, hashtable, 
-						prime1, prime2, 
-						table_size, 
-						&conf->components, 
-						&conf->vertices);
+	num_vertices = get_vertices(prime1, prime2, prime3, vertices);
+	add_to_graph(&conf->cycle_graph, vertices, num_vertices);
 }
 
 /*--------------------------------------------------------------------*/
 static uint32 purge_singletons(msieve_obj *obj, relation_t *list, 
 				uint32 num_relations,
-				cycle_t *table, uint32 *hashtable) {
+				cycle_graph_t *g) {
 	
 	/* given a list of relations and the graph from the
 	   sieving stage, remove any relation that contains
 	   a prime that only occurs once in the graph. Because
-	   removing a relation removes a second prime as well,
+	   removing a relation removes other primes as well,
 	   this process must be iterated until no more relations
 	   are removed */
 
 	uint32 num_left;
 	uint32 i, j, k;
 	uint32 passes = 0;
+	uint32 vertices[4];
+	uint32 num_vertices;
 
 	logprintf(obj, "begin with %u relations\n", num_relations);
 
@@ -644,40 +1081,44 @@ static uint32 purge_singletons(msieve_obj *obj, relation_t *list,
 
 		for (i = j = 0; i < num_relations; i++) {
 			relation_t *r = list + i;
-			uint32 prime;
 			cycle_t *entry;
 
 			/* full relations always survive */
 
-			if (r->large_prime[0] == r->large_prime[1]) {
+			if (IS_FULL_RELATION(r->large_prime[0],
+					     r->large_prime[1],
+					     r->large_prime[2])) {
 				list[j++] = list[i];
 				continue;
 			}
 
 			/* for each prime in that relation */
 
-			for (k = 0; k < 2; k++) {
-				prime = r->large_prime[k];
-				entry = get_table_entry(table, hashtable,
-							prime, 0);
-
-				/* if the relation is due to be removed,
-				   decrement the count of its other
-				   primes in the graph. The following is
-				   specialized for two primes */
-
-				if (entry->count < 2) {
-					prime = r->large_prime[k ^ 1];
-					entry = get_table_entry(table, 
-								hashtable, 
-								prime, 0);
-					entry->count--;
+			num_vertices = get_vertices(r->large_prime[0],
+						r->large_prime[1],
+						r->large_prime[2],
+						vertices);
+			for (k = 0; k < num_vertices; k++) {
+				entry = CYCLE_ENTRY(g, find_table_entry(g,
+							vertices[k]));
+				if (entry->count < 2)
 					break;
-				}
 			}
 
-			if (k == 2)
+			/* if the relation is due to be removed,
+			   decrement the count of all its primes 
+			   in the graph */
+
+			if (k == num_vertices) {
 				list[j++] = list[i];
+				continue;
+			}
+
+			for (k = 0; k < num_vertices; k++) {
+				entry = CYCLE_ENTRY(g, find_table_entry(g,
+							vertices[k]));
+				entry->count--;
+			}
 		}
 		num_relations = j;
 		passes++;
@@ -692,11 +1133,11 @@ static uint32 purge_singletons(msieve_obj *obj, relation_t *list,
 /*--------------------------------------------------------------------*/
 static void enumerate_cycle(msieve_obj *obj, 
 			    la_col_t *c, 
-			    cycle_t *table,
-			    cycle_t *entry1, cycle_t *entry2,
+			    cycle_graph_t *g,
+			    uint32 offset1, uint32 offset2,
 			    uint32 final_relation) {
 
-	/* given two entries out of the hashtable, corresponding
+	/* given two entries out of the graph, corresponding
 	   to two distinct primes, generate the list of relations
 	   that participate in the cycle that these two primes
 	   have just created. final_relation is the relation
@@ -714,25 +1155,25 @@ static void enumerate_cycle(msieve_obj *obj,
 	   the offset of the relation containing that prime */
 
 	num1 = 0;
-	while (entry1 != table + entry1->data) {
+	while (offset1 != CYCLE_ENTRY(g, offset1)->data) {
 		if (num1 >= 100) {
 			logprintf(obj, "warning: cycle too long, "
 					"skipping it\n");
 			return;
 		}
-		traceback1[num1++] = entry1->count;
-		entry1 = table + entry1->data;
+		traceback1[num1++] = CYCLE_ENTRY(g, offset1)->count;
+		offset1 = CYCLE_ENTRY(g, offset1)->data;
 	}
 
 	num2 = 0;
-	while (entry2 != table + entry2->data) {
+	while (offset2 != CYCLE_ENTRY(g, offset2)->data) {
 		if (num2 >= 100) {
 			logprintf(obj, "warning: cycle too long, "
 					"skipping it\n");
 			return;
 		}
-		traceback2[num2++] = entry2->count;
-		entry2 = table + entry2->data;
+		traceback2[num2++] = CYCLE_ENTRY(g, offset2)->count;
+		offset2 = CYCLE_ENTRY(g, offset2)->data;
 	}
 
 	/* Now walk backwards through the lists, until
@@ -778,243 +1219,450 @@ int sort_cycles(const void *x, const void *y) {
 }
 
 /*--------------------------------------------------------------------*/
-#define NUM_CYCLE_BINS 8
+/* A relation with three large primes is an edge of a hypergraph,
+   and the spanning tree method used for two large primes does
+   not work for those. Instead, the cycles are found by Gauss
+   elimination on the large primes: relations sharing the largest
+   remaining prime are combined with one of their number, chosen
+   to keep the combinations short, which then gets discarded. Any
+   combination whose large primes all cancel is a cycle. Since 
+   combinations only ever lose their largest prime, they are 
+   processed from a heap keyed by that prime. A combination of
+   k relations has at most 3*k large primes left */
+
+#define MAX_HYPERGRAPH_CYCLE 32
+
+typedef struct {
+	uint32 num_primes;
+	uint32 num_relations;
+	uint32 *primes;		/* the large primes left over, sorted */
+	uint32 *relations;	/* relation indices, sorted */
+} hyperedge_t;
+
+#define HEAP_KEY(h) ((h)->primes[(h)->num_primes - 1])
+
+static void heap_push(hyperedge_t **heap, uint32 *heap_size,
+			hyperedge_t *h) {
+
+	uint32 i = (*heap_size)++;
+
+	while (i > 0) {
+		uint32 parent = (i - 1) / 2;
+		if (HEAP_KEY(heap[parent]) >= HEAP_KEY(h))
+			break;
+		heap[i] = heap[parent];
+		i = parent;
+	}
+	heap[i] = h;
+}
 
-void qs_filter_relations(sieve_conf_t *conf) {
+static hyperedge_t * heap_pop(hyperedge_t **heap, uint32 *heap_size) {
 
-	/* Perform all of the postprocessing on the list
-	   of relations from the sieving phase. There are
-	   two main jobs, reading in all the relations that
-	   will be used and then determining the list of 
-	   cycles in which partial relations appear. Care
-	   should be taken to avoid wasting huge amounts of
-	   memory */
+	hyperedge_t *top = heap[0];
+	hyperedge_t *last = heap[--(*heap_size)];
+	uint32 i = 0;
 
-	msieve_obj *obj = conf->obj;
-	uint32 *hashtable = conf->cycle_hashtable;
-	cycle_t *table = conf->cycle_table;
-	uint32 num_poly_factors = conf->num_poly_factors;
-	uint32 num_derived_poly = 1 << (num_poly_factors - 1);
-	uint32 *final_poly_index;
-	uint32 num_relations, num_cycles, num_poly;
-	la_col_t *cycle_list;
-	relation_t *relation_list;
+	while (2 * i + 1 < *heap_size) {
+		uint32 child = 2 * i + 1;
+		if (child + 1 < *heap_size &&
+		    HEAP_KEY(heap[child + 1]) > HEAP_KEY(heap[child]))
+			child++;
+		if (HEAP_KEY(last) >= HEAP_KEY(heap[child]))
+			break;
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i] = last;
+	return top;
+}
 
-	uint32 i, passes, start;
-	uint32 curr_a_idx, curr_poly_idx, curr_rel; 
-	uint32 curr_expected, curr_saved, curr_cycle; 
-	uint32 total_poly_a;
-	uint32 poly_saved;
-	uint32 cycle_bins[NUM_CYCLE_BINS+1] = {0};
-	char buf[LINE_BUF_SIZE];
+static uint32 merge_sorted(uint32 *dest, uint32 *src1, uint32 n1, 
+			uint32 *src2, uint32 n2) {
 
- 	/* Rather than reading all the relations in and 
-	   then removing singletons, read only the large 
-	   primes of each relation into an initial list,
-	   remove the singletons, and then only read in
-	   the relations that survive. This avoids reading
-	   in useless relations (and usually the polynomials 
-	   they would need) */
+	/* merge two sorted lists of distinct numbers, removing 
+	   the numbers that appear in both lists */
 
-	savefile_open(&obj->savefile, SAVEFILE_READ);
+	uint32 i1 = 0, i2 = 0, n = 0;
 
-	relation_list = (relation_t *)xmalloc(10000 * sizeof(relation_t));
-	curr_rel = 10000;
-	i = 0;
-	total_poly_a = 0;
-	/* skip over the first line */
-	savefile_read_line(buf, sizeof(buf), &obj->savefile);
+	while (i1 < n1 && i2 < n2) {
+		if (src1[i1] < src2[i2])
+			dest[n++] = src1[i1++];
+		else if (src1[i1] > src2[i2])
+			dest[n++] = src2[i2++];
+		else
+			i1++, i2++;
+	}
+	while (i1 < n1)
+		dest[n++] = src1[i1++];
+	while (i2 < n2)
+		dest[n++] = src2[i2++];
+	return n;
+}
 
-	while (!savefile_eof(&obj->savefile)) {
-		char *start;
+static uint32 eliminate_hypergraph(hyperedge_t *edges, 
+				uint32 num_edges,
+				la_col_t *cycle_list,
+				uint32 *num_dropped_out) {
 
-		switch (buf[0]) {
-		case 'A':
-			total_poly_a++;
-			break;
+	/* the elimination itself. Every edge starts off as a 
+	   combination of one relation, and edges without large
+	   primes are cycles already. The cycles found go into
+	   cycle_list, or are only counted if cycle_list is NULL.
+	   All the lists of primes and relations in the edges 
+	   are either freed or handed to cycle_list */
 
-		case 'R':
-			start = strchr(buf, 'L');
-			if (start != NULL) {
-				uint32 prime1, prime2;
-				read_large_primes(start, &prime1, &prime2);
-				if (i == curr_rel) {
-					curr_rel = 3 * curr_rel / 2;
-					relation_list = (relation_t *)xrealloc(
-							relation_list,
-							curr_rel *
-							sizeof(relation_t));
-				}
-				relation_list[i].poly_idx = i;
-				relation_list[i].large_prime[0] = prime1;
-				relation_list[i].large_prime[1] = prime2;
-				i++;
-			}
-			break;
+	uint32 i, j;
+	uint32 num_cycles = 0;
+	uint32 num_dropped = 0;
+	uint32 heap_size = 0;
+	uint32 group_alloc = 100;
+	uint32 merge_buf[6 * MAX_HYPERGRAPH_CYCLE];
+	hyperedge_t **heap;
+	hyperedge_t **group;
+
+	heap = (hyperedge_t **)xmalloc(MAX(num_edges, 1) * 
+					sizeof(hyperedge_t *));
+	group = (hyperedge_t **)xmalloc(group_alloc * sizeof(hyperedge_t *));
+
+	for (i = 0; i < num_edges; i++) {
+		hyperedge_t *h = edges + i;
+
+		if (h->num_primes > 0) {
+			heap_push(heap, &heap_size, h);
+			continue;
 		}
 
-		savefile_read_line(buf, sizeof(buf), &obj->savefile);
+		if (cycle_list != NULL) {
+			la_col_t *c = cycle_list + num_cycles;
+			c->cycle.num_relations = h->num_relations;
+			c->cycle.list = h->relations;
+		}
+		else {
+			free(h->relations);
+		}
+		free(h->primes);
+		num_cycles++;
 	}
-	num_relations = i;
-	num_relations = purge_singletons(obj, relation_list, num_relations,
-					table, hashtable);
-	relation_list = (relation_t *)xrealloc(relation_list, num_relations * 
-							sizeof(relation_t));
 
-	/* Now we know how many relations to expect. Also
-	   initialize the lists of polynomial 'a' and 'b' values */
+	while (heap_size > 0) {
 
-	num_poly = 10000;
-	conf->poly_list = (poly_t *)xmalloc(num_poly * sizeof(poly_t));
-	conf->poly_a_list = (mp_t *)xmalloc(total_poly_a * sizeof(mp_t));
-	final_poly_index = (uint32 *)xmalloc(num_derived_poly * 
-						sizeof(uint32));
-	
-	/* initialize the running counts of relations and
-	   polynomials */
+		uint32 num_group = 0;
+		uint32 prime = HEAP_KEY(heap[0]);
+		hyperedge_t *pivot;
 
-	i = 0;
-	curr_expected = 0;
-	curr_saved = 0;
-	curr_rel = (uint32)(-1);
-	curr_poly_idx = (uint32)(-1);
-	curr_a_idx = (uint32)(-1);
-	poly_saved = 0;
-	logprintf(obj, "attempting to read %u relations\n", num_relations);
+		/* pull out all the combinations that contain
+		   the largest prime, and choose the shortest
+		   of them to eliminate that prime from the rest */
 
-	/* Read in the relations and the polynomials they use
-	   at the same time. */
+		while (heap_size > 0 && HEAP_KEY(heap[0]) == prime) {
+			if (num_group == group_alloc) {
+				group_alloc *= 2;
+				group = (hyperedge_t **)xrealloc(group,
+						group_alloc * 
+						sizeof(hyperedge_t *));
+			}
+			group[num_group++] = heap_pop(heap, &heap_size);
+		}
 
-	savefile_rewind(&obj->savefile);
+		for (i = 1, j = 0; i < num_group; i++) {
+			if (group[i]->num_relations < 
+					group[j]->num_relations)
+				j = i;
+		}
+		pivot = group[j];
+		group[j] = group[--num_group];
+
+		for (i = 0; i < num_group; i++) {
+			hyperedge_t *h = group[i];
+			uint32 n;
+
+			n = merge_sorted(merge_buf, 
+					h->relations, h->num_relations,
+					pivot->relations, 
+					pivot->num_relations);
+
+			if (n > MAX_HYPERGRAPH_CYCLE) {
+				num_dropped++;
+				free(h->relations);
+				free(h->primes);
+				continue;
+			}
+			h->relations = (uint32 *)xrealloc(h->relations,
+						n * sizeof(uint32));
+			memcpy(h->relations, merge_buf, n * sizeof(uint32));
+			h->num_relations = n;
+
+			n = merge_sorted(merge_buf, 
+					h->primes, h->num_primes,
+					pivot->primes, pivot->num_primes);
+			h->num_primes = n;
+
+			if (n == 0) {
+				if (cycle_list != NULL) {
+					la_col_t *c = cycle_list + num_cycles;
+					c->cycle.num_relations = 
+							h->num_relations;
+					c->cycle.list = h->relations;
+				}
+				else {
+					free(h->relations);
+				}
+				free(h->primes);
+				num_cycles++;
+				continue;
+			}
 
-	while (curr_expected < num_relations) {
-		
-		char *tmp;
-		relation_t *r;
+			h->primes = (uint32 *)xrealloc(h->primes,
+						n * sizeof(uint32));
+			memcpy(h->primes, merge_buf, n * sizeof(uint32));
+			heap_push(heap, &heap_size, h);
+		}
 
-		/* read in the next entity */
+		free(pivot->relations);
+		free(pivot->primes);
+	}
 
-		if (savefile_eof(&obj->savefile))
-			break;
-		savefile_read_line(buf, sizeof(buf), &obj->savefile);
+	free(heap);
+	free(group);
+	*num_dropped_out = num_dropped;
+	return num_cycles;
+}
 
-		switch (buf[0]) {
-		case 'A':
-			/* Read in a new 'a' value */
+static uint32 find_hypergraph_cycles(msieve_obj *obj,
+				relation_t *relation_list,
+				uint32 num_relations,
+				la_col_t **cycle_list_out) {
 
-			curr_a_idx++;
-			read_poly_a(conf, buf);
-			mp_copy(&conf->curr_a, conf->poly_a_list+curr_a_idx);
+	uint32 i, j;
+	uint32 num_cycles;
+	uint32 num_dropped;
+	hyperedge_t *edges;
+	la_col_t *cycle_list;
 
-			/* build all of the 'b' values associated with it */
+	edges = (hyperedge_t *)xmalloc(MAX(num_relations, 1) * 
+					sizeof(hyperedge_t));
+	cycle_list = (la_col_t *)xmalloc(MAX(num_relations, 1) * 
+					sizeof(la_col_t));
 
-			build_derived_poly(conf);
+	/* every relation starts off as its own combination;
+	   full relations have no vertices besides 1 */
 
-			/* all 'b' values start off unused */
+	for (i = 0; i < num_relations; i++) {
+		relation_t *r = relation_list + i;
+		hyperedge_t *h = edges + i;
+		uint32 vertices[4];
+		uint32 num_vertices;
+
+		num_vertices = get_vertices(r->large_prime[0], 
+					r->large_prime[1],
+					r->large_prime[2], 
+					vertices);
+		if (num_vertices > 0 && vertices[0] == 1) {
+			for (j = 1; j < num_vertices; j++)
+				vertices[j - 1] = vertices[j];
+			num_vertices--;
+		}
 
-			memset(final_poly_index, -1, num_derived_poly *
+		h->num_relations = 1;
+		h->relations = (uint32 *)xmalloc(sizeof(uint32));
+		h->relations[0] = i;
+		h->num_primes = num_vertices;
+		h->primes = NULL;
+
+		if (num_vertices > 0) {
+			h->primes = (uint32 *)xmalloc(num_vertices * 
 							sizeof(uint32));
-			break;
+			memcpy(h->primes, vertices, 
+					num_vertices * sizeof(uint32));
+		}
+	}
 
-		case 'R':
-			/* handle a new relation. First find the 
-			   large primes; these will determine
-	     		   if a relation is full or partial */
+	num_cycles = eliminate_hypergraph(edges, num_relations,
+					cycle_list, &num_dropped);
 
-			tmp = strchr(buf, 'L');
-			if (tmp == NULL)
-				break;
+	logprintf(obj, "found %u cycles from hypergraph, "
+			"dropped %u that were too long\n", 
+			num_cycles, num_dropped);
 
-			/* Check if this relation is needed. If it
-			   survived singleton removal then its 
-			   ordinal ID will be in the next entry 
-			   of relation_list. 
-		   
-			   First move up the index of relation_list 
-			   until the relation index to check is >= 
-			   the one we have (it may have gotten behind 
-			   because relations were corrupted) */
+	free(edges);
+	*cycle_list_out = (la_col_t *)xrealloc(cycle_list,
+					MAX(num_cycles, 1) * sizeof(la_col_t));
+	return num_cycles;
+}
 
-			curr_rel++;
-			while (curr_expected < num_relations &&
-				relation_list[curr_expected].poly_idx <
-						curr_rel) {
-				curr_expected++;
-			}
+/*--------------------------------------------------------------------*/
+static int compare_uint32(const void *x, const void *y) {
 
-			/* now check if the relation should be saved */
+	uint32 *xx = (uint32 *)x;
+	uint32 *yy = (uint32 *)y;
 
-			if (curr_expected >= num_relations ||
-			    relation_list[curr_expected].poly_idx != curr_rel)
-				break;
+	if (*xx > *yy)
+		return 1;
+	if (*xx < *yy)
+		return -1;
+	return 0;
+}
 
-			curr_expected++;
+uint32 count_partial_cycles(uint32 *large_primes, uint32 num_partials) {
 
-			/* convert the ASCII text of the relation to a
-			   relation_t, verifying correctness in the process */
+	/* count the cycles that find_hypergraph_cycles would
+	   build from a list of partial relations, given the
+	   three large primes of each relation. A relation with 
+	   a vertex that appears in no other relation cannot be
+	   part of a cycle, and removing it can leave other 
+	   vertices alone in turn; until late in the sieving,
+	   repeatedly removing these leaves only a small fraction
+	   of the relations to eliminate. The vertices are 
+	   replaced by their rank among all the vertices, which
+	   keeps their order and makes them easy to count */
 
-			r = relation_list + curr_saved;
-			if (read_relation(conf, buf, r) != 0) {
-				logprintf(obj, "failed to read relation %d\n", 
-							curr_expected - 1);
-				break;
+	uint32 i, j, k;
+	uint32 num_vertices, num_left, num_removed;
+	uint32 num_cycles, num_dropped;
+	uint32 *vertices;
+	uint8 *vertex_count;
+	uint32 *sorted;
+	uint32 *counts;
+	uint32 *left;
+	hyperedge_t *edges;
+
+	vertices = (uint32 *)xmalloc(3 * MAX(num_partials, 1) * 
+					sizeof(uint32));
+	vertex_count = (uint8 *)xmalloc(MAX(num_partials, 1));
+	sorted = (uint32 *)xmalloc(3 * MAX(num_partials, 1) * 
+					sizeof(uint32));
+
+	/* find the vertices of each relation, leaving out 1 */
+
+	for (i = num_vertices = 0; i < num_partials; i++) {
+		uint32 *p = large_primes + 3 * i;
+		uint32 *v = vertices + 3 * i;
+		uint32 tmp[4];
+		uint32 n = get_vertices(p[0], p[1], p[2], tmp);
+
+		for (j = k = 0; j < n; j++) {
+			if (tmp[j] != 1) {
+				v[k++] = tmp[j];
+				sorted[num_vertices++] = tmp[j];
 			}
+		}
+		vertex_count[i] = k;
+	}
 
-			curr_saved++;
+	qsort(sorted, (size_t)num_vertices, sizeof(uint32), compare_uint32);
+	for (i = j = 0; i < num_vertices; i++) {
+		if (j == 0 || sorted[i] != sorted[j - 1])
+			sorted[j++] = sorted[i];
+	}
+	num_vertices = j;
+
+	counts = (uint32 *)xcalloc(MAX(num_vertices, 1), sizeof(uint32));
+	for (i = 0; i < num_partials; i++) {
+		uint32 *v = vertices + 3 * i;
+
+		for (j = 0; j < vertex_count[i]; j++) {
+			uint32 *rank = (uint32 *)bsearch(v + j, sorted, 
+						(size_t)num_vertices,
+						sizeof(uint32), 
+						compare_uint32);
+			v[j] = rank - sorted;
+			counts[v[j]]++;
+		}
+	}
+	free(sorted);
 
-			/* if necessary, save the b value corresponding 
-			   to this relation */
+	/* remove singletons until none are left */
 
-			if (final_poly_index[r->poly_idx] == (uint32)(-1)) {
-				if (i == num_poly) {
-					num_poly *= 2;
-					conf->poly_list = (poly_t *)xrealloc(
-							conf->poly_list,
-							num_poly *
-							sizeof(poly_t));
-				}
-				conf->poly_list[i].a_idx = curr_a_idx;
-				signed_mp_copy(&(conf->curr_b[r->poly_idx]), 
-					&(conf->poly_list[i].b));
-				final_poly_index[r->poly_idx] = i;
-				r->poly_idx = i++;
+	left = (uint32 *)xmalloc(MAX(num_partials, 1) * sizeof(uint32));
+	for (i = 0; i < num_partials; i++)
+		left[i] = i;
+	num_left = num_partials;
+
+	do {
+		num_removed = 0;
+
+		for (i = j = 0; i < num_left; i++) {
+			uint32 *v = vertices + 3 * left[i];
+			uint32 n = vertex_count[left[i]];
+
+			for (k = 0; k < n; k++) {
+				if (counts[v[k]] < 2)
+					break;
 			}
-			else {
-				r->poly_idx = final_poly_index[r->poly_idx];
+
+			if (k == n) {
+				left[j++] = left[i];
+				continue;
 			}
 
-			break;  /* done with this relation */
+			for (k = 0; k < n; k++)
+				counts[v[k]]--;
+			num_removed++;
+		}
+		num_left = j;
+
+	} while (num_removed > 0);
+
+	/* eliminate the rest */
+
+	edges = (hyperedge_t *)xmalloc(MAX(num_left, 1) * 
+					sizeof(hyperedge_t));
+
+	for (i = 0; i < num_left; i++) {
+		hyperedge_t *h = edges + i;
+		uint32 n = vertex_count[left[i]];
+
+		h->num_relations = 1;
+		h->relations = (uint32 *)xmalloc(sizeof(uint32));
+		h->relations[0] = i;
+		h->num_primes = n;
+		h->primes = NULL;
+		if (n > 0) {
+			h->primes = (uint32 *)xmalloc(n * sizeof(uint32));
+			memcpy(h->primes, vertices + 3 * left[i],
+					n * sizeof(uint32));
 		}
 	}
 
-	/* update the structures with the counts of relations
-	   and polynomials actually recovered */
+	num_cycles = eliminate_hypergraph(edges, num_left, 
+					NULL, &num_dropped);
 
-	num_relations = curr_saved;
-	logprintf(obj, "recovered %u relations\n", num_relations);
-	logprintf(obj, "recovered %u polynomials\n", i);
-	savefile_close(&obj->savefile);
-	free(final_poly_index);
-	conf->poly_list = (poly_t *)xrealloc(conf->poly_list,
-					   i * sizeof(poly_t));
+	free(edges);
+	free(left);
+	free(counts);
+	free(vertex_count);
+	free(vertices);
+	return num_cycles;
+}
 
-	/* begin the cycle generation process by purging
-	   duplicate relations. For the sake of consistency, 
-	   always rebuild the graph afterwards */
+/*--------------------------------------------------------------------*/
+static uint32 find_graph_cycles(sieve_conf_t *conf, 
+				relation_t *relation_list,
+				uint32 num_relations,
+				la_col_t **cycle_list_out) {
 
-	num_relations = purge_duplicate_relations(obj, 
-				relation_list, num_relations);
+	/* find the cycles among a list of relations that
+	   have at most two large primes. These are stored
+	   in large_prime[1] and large_prime[2], with 
+	   large_prime[0] always 1. Relations may be permuted */
 
-	memset(hashtable, 0, sizeof(uint32) << LOG2_CYCLE_HASH);
-	conf->vertices = 0;
-	conf->components = 0;
-	conf->cycle_table_size = 1;
+	msieve_obj *obj = conf->obj;
+	cycle_graph_t *g = &conf->cycle_graph;
+	uint32 num_cycles;
+	la_col_t *cycle_list;
+	uint32 i, passes, start;
+	uint32 curr_cycle; 
+
+	cycle_graph_reset(g);
 
 	for (i = 0; i < num_relations; i++) {
 		relation_t *r = relation_list + i;
-		if (r->large_prime[0] != r->large_prime[1]) {
+		if (!IS_FULL_RELATION(r->large_prime[0],
+				      r->large_prime[1],
+				      r->large_prime[2])) {
 			add_to_cycles(conf, r->large_prime[0], 
-					r->large_prime[1]);
+					r->large_prime[1],
+					r->large_prime[2]);
 		}
 	}
 	
@@ -1022,7 +1670,7 @@ void qs_filter_relations(sieve_conf_t *conf) {
 	   this number includes cycles from both full and partial
 	   relations (the cycle for a full relation is trivial) */
 
-	num_cycles = num_relations + conf->components - conf->vertices;
+	num_cycles = num_relations + g->components - g->vertices;
 
 	/* The idea behind the cycle-finding code is this: the 
 	   graph is composed of a bunch of connected components, 
@@ -1069,10 +1717,10 @@ void qs_filter_relations(sieve_conf_t *conf) {
 	   to itself */
 
 	for (i = 0; i < (1 << LOG2_CYCLE_HASH); i++) {
-		uint32 offset = hashtable[i];
+		uint32 offset = g->hashtable[i];
 
 		while (offset != 0) {
-			cycle_t *entry = table + offset;
+			cycle_t *entry = CYCLE_ENTRY(g, offset);
 			if (offset != entry->data)
 				entry->data = 0;
 			offset = entry->next;
@@ -1097,10 +1745,11 @@ void qs_filter_relations(sieve_conf_t *conf) {
 		for (i = start; i < num_relations &&
 				curr_cycle < num_cycles; i++) {
 
+			uint32 offset1, offset2;
 			cycle_t *entry1, *entry2;
 			relation_t rtmp = relation_list[i];
 			
-			if (rtmp.large_prime[0] == rtmp.large_prime[1]) {
+			if (rtmp.large_prime[1] == rtmp.large_prime[2]) {
 
 				/* this is a full relation, and forms a
 				   cycle just by itself. Move it to position 
@@ -1124,10 +1773,10 @@ void qs_filter_relations(sieve_conf_t *conf) {
 			/* retrieve the cycle_t entries associated
 			   with the large primes in relation r. */
 
-			entry1 = get_table_entry(table, hashtable, 
-						rtmp.large_prime[0], 0);
-			entry2 = get_table_entry(table, hashtable, 
-						rtmp.large_prime[1], 0);
+			offset1 = find_table_entry(g, rtmp.large_prime[1]);
+			offset2 = find_table_entry(g, rtmp.large_prime[2]);
+			entry1 = CYCLE_ENTRY(g, offset1);
+			entry2 = CYCLE_ENTRY(g, offset2);
 
 			/* if both vertices do not point to other
 			   vertices, then neither prime has been added
@@ -1146,18 +1795,18 @@ void qs_filter_relations(sieve_conf_t *conf) {
 			   cycle this generates */
 
 			if (entry1->data == 0) {
-				entry1->data = entry2 - table;
+				entry1->data = offset2;
 				entry1->count = start;
 			}
 			else if (entry2->data == 0) {
-				entry2->data = entry1 - table;
+				entry2->data = offset1;
 				entry2->count = start;
 			}
 			else {
 				la_col_t *c = cycle_list + curr_cycle;
 				c->cycle.list = NULL;
-				enumerate_cycle(obj, c, table, entry1,
-						entry2, start);
+				enumerate_cycle(obj, c, g, offset1,
+						offset2, start);
 				if (c->cycle.list)
 					curr_cycle++;
 			}
@@ -1180,6 +1829,254 @@ void qs_filter_relations(sieve_conf_t *conf) {
 	num_cycles = curr_cycle;
 
 	logprintf(obj, "found %u cycles in %u passes\n", num_cycles, passes);
+	*cycle_list_out = cycle_list;
+	return num_cycles;
+}
+
+/*--------------------------------------------------------------------*/
+#define NUM_CYCLE_BINS 8
+
+void qs_filter_relations(sieve_conf_t *conf) {
+
+	/* Perform all of the postprocessing on the list
+	   of relations from the sieving phase. There are
+	   two main jobs, reading in all the relations that
+	   will be used and then determining the list of 
+	   cycles in which partial relations appear. Care
+	   should be taken to avoid wasting huge amounts of
+	   memory */
+
+	msieve_obj *obj = conf->obj;
+	uint32 num_poly_factors = conf->num_poly_factors;
+	uint32 num_derived_poly = 1 << (num_poly_factors - 1);
+	uint32 *final_poly_index;
+	uint32 num_relations, num_cycles, num_poly;
+	la_col_t *cycle_list;
+	relation_t *relation_list;
+
+	uint32 i;
+	uint32 curr_a_idx, curr_poly_idx, curr_rel; 
+	uint32 curr_expected, curr_saved; 
+	uint32 total_poly_a;
+	uint32 poly_saved;
+	uint32 cycle_bins[NUM_CYCLE_BINS+1] = {0};
+	char buf[LINE_BUF_SIZE];
+
+ 	/* Rather than reading all the relations in and 
+	   then removing singletons, read only the large 
+	   primes of each relation into an initial list,
+	   remove the singletons, and then only read in
+	   the relations that survive. This avoids reading
+	   in useless relations (and usually the polynomials 
+	   they would need) */
+
+	savefile_open(&obj->savefile, SAVEFILE_READ);
+
+	relation_list = (relation_t *)xmalloc(10000 * sizeof(relation_t));
+	curr_rel = 10000;
+	i = 0;
+	total_poly_a = 0;
+	/* skip over the first line */
+	savefile_read_line(buf, sizeof(buf), &obj->savefile);
+
+	while (!savefile_eof(&obj->savefile)) {
+		char *start;
+
+		switch (buf[0]) {
+		case 'A':
+			total_poly_a++;
+			break;
+
+		case 'R':
+			start = strchr(buf, 'L');
+			if (start != NULL) {
+				uint32 prime1, prime2, prime3;
+				read_large_primes(start, &prime1, 
+						&prime2, &prime3);
+				if (i == curr_rel) {
+					curr_rel = 3 * curr_rel / 2;
+					relation_list = (relation_t *)xrealloc(
+							relation_list,
+							curr_rel *
+							sizeof(relation_t));
+				}
+				relation_list[i].poly_idx = i;
+				relation_list[i].large_prime[0] = prime1;
+				relation_list[i].large_prime[1] = prime2;
+				relation_list[i].large_prime[2] = prime3;
+				i++;
+			}
+			break;
+		}
+
+		savefile_read_line(buf, sizeof(buf), &obj->savefile);
+	}
+	num_relations = i;
+	num_relations = purge_singletons(obj, relation_list, num_relations,
+					&conf->cycle_graph);
+	relation_list = (relation_t *)xrealloc(relation_list, num_relations * 
+							sizeof(relation_t));
+
+	/* Now we know how many relations to expect. Also
+	   initialize the lists of polynomial 'a' and 'b' values */
+
+	num_poly = 10000;
+	conf->poly_list = (poly_t *)xmalloc(num_poly * sizeof(poly_t));
+	conf->poly_a_list = (mp_t *)xmalloc(total_poly_a * sizeof(mp_t));
+	final_poly_index = (uint32 *)xmalloc(num_derived_poly * 
+						sizeof(uint32));
+	
+	/* initialize the running counts of relations and
+	   polynomials */
+
+	i = 0;
+	curr_expected = 0;
+	curr_saved = 0;
+	curr_rel = (uint32)(-1);
+	curr_poly_idx = (uint32)(-1);
+	curr_a_idx = (uint32)(-1);
+	poly_saved = 0;
+	logprintf(obj, "attempting to read %u relations\n", num_relations);
+
+	/* Read in the relations and the polynomials they use
+	   at the same time. */
+
+	savefile_rewind(&obj->savefile);
+
+	while (curr_expected < num_relations) {
+		
+		char *tmp;
+		relation_t *r;
+
+		/* read in the next entity */
+
+		if (savefile_eof(&obj->savefile))
+			break;
+		savefile_read_line(buf, sizeof(buf), &obj->savefile);
+
+		switch (buf[0]) {
+		case 'A':
+			/* Read in a new 'a' value */
+
+			curr_a_idx++;
+			read_poly_a(conf, buf);
+			mp_copy(&conf->curr_a, conf->poly_a_list+curr_a_idx);
+
+			/* build all of the 'b' values associated with it */
+
+			build_derived_poly(conf);
+
+			/* all 'b' values start off unused */
+
+			memset(final_poly_index, -1, num_derived_poly *
+							sizeof(uint32));
+			break;
+
+		case 'R':
+			/* handle a new relation. First find the 
+			   large primes; these will determine
+	     		   if a relation is full or partial */
+
+			tmp = strchr(buf, 'L');
+			if (tmp == NULL)
+				break;
+
+			/* Check if this relation is needed. If it
+			   survived singleton removal then its 
+			   ordinal ID will be in the next entry 
+			   of relation_list. 
+		   
+			   First move up the index of relation_list 
+			   until the relation index to check is >= 
+			   the one we have (it may have gotten behind 
+			   because relations were corrupted) */
+
+			curr_rel++;
+			while (curr_expected < num_relations &&
+				relation_list[curr_expected].poly_idx <
+						curr_rel) {
+				curr_expected++;
+			}
+
+			/* now check if the relation should be saved */
+
+			if (curr_expected >= num_relations ||
+			    relation_list[curr_expected].poly_idx != curr_rel)
+				break;
+
+			curr_expected++;
+
+			/* convert the ASCII text of the relation to a
+			   relation_t, verifying correctness in the process */
+
+			r = relation_list + curr_saved;
+			if (read_relation(conf, buf, r) != 0) {
+				logprintf(obj, "failed to read relation %d\n", 
+							curr_expected - 1);
+				break;
+			}
+
+			curr_saved++;
+
+			/* if necessary, save the b value corresponding 
+			   to this relation */
+
+			if (final_poly_index[r->poly_idx] == (uint32)(-1)) {
+				if (i == num_poly) {
+					num_poly *= 2;
+					conf->poly_list = (poly_t *)xrealloc(
+							conf->poly_list,
+							num_poly *
+							sizeof(poly_t));
+				}
+				conf->poly_list[i].a_idx = curr_a_idx;
+				signed_mp_copy(&(conf->curr_b[r->poly_idx]), 
+					&(conf->poly_list[i].b));
+				final_poly_index[r->poly_idx] = i;
+				r->poly_idx = i++;
+			}
+			else {
+				r->poly_idx = final_poly_index[r->poly_idx];
+			}
+
+			break;  /* done with this relation */
+		}
+	}
+
+	/* update the structures with the counts of relations
+	   and polynomials actually recovered */
+
+	num_relations = curr_saved;
+	logprintf(obj, "recovered %u relations\n", num_relations);
+	logprintf(obj, "recovered %u polynomials\n", i);
+	savefile_close(&obj->savefile);
+	free(final_poly_index);
+	conf->poly_list = (poly_t *)xrealloc(conf->poly_list,
+					   i * sizeof(poly_t));
+
+	/* begin the cycle generation process by purging
+	   duplicate relations. For the sake of consistency, 
+	   always rebuild the graph afterwards */
+
+	num_relations = purge_duplicate_relations(obj, 
+				relation_list, num_relations);
+
+	/* relations with three large primes need a more
+	   general cycle finder than relations with two */
+
+	for (i = 0; i < num_relations; i++) {
+		if (relation_list[i].large_prime[0] != 1)
+			break;
+	}
+
+	if (i < num_relations) {
+		num_cycles = find_hypergraph_cycles(obj, relation_list,
+						num_relations, &cycle_list);
+	}
+	else {
+		num_cycles = find_graph_cycles(conf, relation_list,
+						num_relations, &cycle_list);
+	}
 	
 	/* sort the list of cycles so that the cycles with
 	   the largest number of relations will come last. 
@@ -21,29 +21,494 @@ static void collect_relations(sieve_conf_t *conf,
 
 static uint32 do_sieving_internal(sieve_conf_t *conf,
 				  uint32 max_relations,
-				  qs_core_sieve_fcn core_sieve_fcn);
-
-#ifdef SIEVE_TIMING
-#define PRINT_TIME(var) printf(#var ": %lf (%4.1f%%)\n",		\
-		(double)(var) / 1.86e9,					\
-		100.0 * (double)(var) / (double)total_time);
-
-uint64 total_time;
-uint64 base_poly_time;
-uint64 next_poly_small_time;
-uint64 next_poly_large_time;
-uint64 plus_init_time;
-uint64 bucket_time;
-uint64 sieve_small_time;
-uint64 sieve_large_time;
-uint64 tf_plus_scan_time;
-uint64 tf_total_time;
-uint64 tf_small_time;
-uint64 tf_large_time;
+				  qs_core_sieve_fcn core_sieve_fcn,
+				  uint32 num_threads);
 
-#else
-#define PRINT_TIME(var) /* nothing */
-#endif
+static void check_cycle_counts(sieve_conf_t *conf);
+
+/* sieving is multithreaded when the factor base is large
+   enough that the per-thread setup cost does not matter
+   (roughly 55 digits and up) */
+
+#define MIN_FB_SIZE_TO_THREAD 2000
+#define MAX_SIEVE_THREADS 32
+
+/* triple large primes are used by default above this 
+   size of input (about 110 digits) */
+
+#define MIN_TLP_BITS 365
+
+/*--------------------------------------------------------------------*/
+static void alloc_sieve_arrays(sieve_conf_t *conf) {
+
+	uint32 i;
+	uint32 num_buckets = conf->poly_block * conf->num_sieve_blocks;
+
+	conf->sieve_array = (uint8 *)aligned_malloc(
+				(size_t)conf->sieve_block_size, 64);
+	conf->packed_fb = (packed_fb_t *)xmalloc(conf->sieve_large_fb_start *
+						sizeof(packed_fb_t));
+
+	/* set up the hashtable if it's going to be used; otherwise
+	   the rest of the sieve code will silently ignore it.
+	   
+	   There is one hash bin for every sieve block in the sieve
+	   interval; there are also twice as many such bins because
+	   we collect positive and negative sieve offsets into separate
+	   hashtables. Finally, we sieve over up to POLY_BLOCK_SIZE
+	   polynomials at the same time, so the number of hash bins
+	   is similarly multiplied.
+	   
+	   Needless to say, that's a *lot* of hash bins! The sieve
+	   interval must be extremely small to keep the hashtable
+	   size down; that's okay, very small sieve intervals are
+	   actually more likely to contain smooth relations */
+
+	conf->buckets = (bucket_t *)xcalloc((size_t)num_buckets,
+						sizeof(bucket_t));
+	if (conf->fb_size > conf->sieve_large_fb_start) {
+		for (i = 0; i < num_buckets; i++) {
+			conf->buckets[i].num_alloc = 1000;
+			conf->buckets[i].list = (bucket_entry_t *)
+					xmalloc(1000 * sizeof(bucket_entry_t));
+		}
+	}
+
+	/* TLP cofactors are split by tinyqs, which reuses
+	   one context for the whole of sieving */
+
+	conf->tinyqs_data = NULL;
+	if (conf->use_tlp)
+		conf->tinyqs_data = tinyqs_init();
+}
+
+/*--------------------------------------------------------------------*/
+static void free_sieve_arrays(sieve_conf_t *conf) {
+
+	uint32 i;
+	uint32 num_buckets = conf->poly_block * conf->num_sieve_blocks;
+
+	for (i = 0; i < num_buckets; i++)
+		free(conf->buckets[i].list);
+	free(conf->buckets);
+	free(conf->packed_fb);
+	aligned_free(conf->sieve_array);
+	if (conf->tinyqs_data != NULL)
+		conf->tinyqs_data = tinyqs_free(conf->tinyqs_data);
+}
+
+/*--------------------------------------------------------------------*/
+static void sieve_thread_init(sieve_conf_t *master, 
+				sieve_conf_t *conf,
+				uint32 thread_num) {
+
+	/* build the private configuration for one sieving 
+	   thread. Everything that sieving modifies is duplicated,
+	   including the factor base, since the roots of factor 
+	   base primes change with every polynomial. Each thread
+	   gets its own random stream, so that the threads
+	   choose different polynomial 'a' values */
+
+	*conf = *master;
+	conf->master = master;
+	conf->thread_num = thread_num;
+	conf->seed1 = get_rand(&master->seed1, &master->seed2);
+	conf->seed2 = get_rand(&master->seed1, &master->seed2);
+
+	conf->factor_base = (fb_t *)xmalloc(conf->fb_size * sizeof(fb_t));
+	memcpy(conf->factor_base, master->factor_base,
+			conf->fb_size * sizeof(fb_t));
+	alloc_sieve_arrays(conf);
+	poly_alloc(conf);
+
+	conf->relation_buf = NULL;
+	conf->relation_buf_size = 0;
+	conf->relation_buf_alloc = 0;
+	conf->poly_a_line[0] = 0;
+	conf->curr_poly_a_line[0] = 0;
+	conf->buf_fulls = 0;
+	conf->buf_partials = NULL;
+	conf->num_buf_partials = 0;
+	conf->buf_partials_alloc = 0;
+
+	if (conf->use_batch)
+		qs_batch_init(conf, master);
+
+	memset(&conf->cycle_graph, 0, sizeof(cycle_graph_t));
+	conf->partial_primes = NULL;
+
+	memset(conf->stats.time, 0, sizeof(conf->stats.time));
+	memset(conf->stats.count, 0, sizeof(conf->stats.count));
+}
+
+/*--------------------------------------------------------------------*/
+static void sieve_thread_free(sieve_conf_t *conf) {
+
+	uint32 i;
+	qs_stats_t *stats = &conf->master->stats;
+
+	for (i = 0; i < NUM_QS_TIMERS; i++)
+		stats->time[i] += conf->stats.time[i];
+	for (i = 0; i < NUM_QS_COUNTS; i++)
+		stats->count[i] += conf->stats.count[i];
+
+	free_sieve_arrays(conf);
+	poly_free(conf);
+	free(conf->factor_base);
+	free(conf->relation_buf);
+	free(conf->buf_partials);
+	if (conf->use_batch)
+		qs_batch_free(conf);
+}
+
+/*--------------------------------------------------------------------*/
+static uint32 count_combined(sieve_conf_t *conf) {
+
+	/* the number of cycles among the partial relations. 
+	   With triple large primes, e + c - v is a lower bound
+	   that stays far too low (and even negative) for most 
+	   of the sieving, and the exact count from the last
+	   call to update_exact_cycles is used instead */
+
+	cycle_graph_t *g = &conf->cycle_graph;
+	int32 combined;
+
+	if (conf->partial_primes != NULL)
+		return conf->exact_cycles;
+
+	combined = (int32)(conf->num_cycles + g->components - g->vertices);
+	return (uint32)MAX(combined, 0);
+}
+
+/*--------------------------------------------------------------------*/
+static void update_exact_cycles(sieve_conf_t *conf, 
+				uint32 max_relations,
+				uint32 threaded) {
+
+	/* count the cycles among the partial relations exactly,
+	   by running the elimination of the hypergraph cycle
+	   finder on their large primes. This costs about as much
+	   as the cycle finder does when sieving is over, so the
+	   first count only happens when there are enough relations
+	   that the cycles might suffice.
+	   
+	   The number of cycles then grows like a power of the 
+	   number of partial relations, with an exponent that 
+	   itself grows as sieving goes on; the last two counts 
+	   give the exponent, and the next count happens where
+	   the power law says the cycles will be enough. This
+	   is clamped to between 1/32 and 1/8 more partial 
+	   relations than the last count, so that counting costs
+	   little and sieving stops soon after enough cycles exist.
+	   
+	   With sieving threads, one thread counts a copy of the
+	   list while the others keep sieving */
+
+	uint32 num_partials = conf->num_partial_primes;
+	uint32 num_fulls = conf->num_relations;
+	uint32 *primes = conf->partial_primes;
+	uint32 cycles;
+	double next;
+
+	if (primes == NULL || 
+	    num_fulls + conf->exact_cycles >= max_relations ||
+	    num_fulls + num_partials < max_relations)
+		return;
+
+	if (conf->exact_partials > 0) {
+		double last = conf->exact_partials;
+		double need = max_relations - num_fulls;
+
+		next = 1.125 * last;
+		if (conf->prev_partials > 0 &&
+		    conf->prev_cycles > 0 &&
+		    conf->exact_cycles > conf->prev_cycles) {
+			double exponent = log((double)conf->exact_cycles / 
+						conf->prev_cycles) /
+					  log(last / conf->prev_partials);
+			next = last * pow(need / conf->exact_cycles, 
+					1.0 / exponent);
+		}
+		next = MIN(next, 1.125 * last);
+		next = MAX(next, (1.0 + 1.0 / 32) * last);
+
+		if (num_partials < next)
+			return;
+	}
+
+	if (threaded) {
+		if (!atomic_cas(&conf->counting_cycles, 0, 1))
+			return;
+
+		mutex_lock(&conf->relation_mutex);
+		num_partials = conf->num_partial_primes;
+		primes = (uint32 *)xmalloc(3 * num_partials * 
+						sizeof(uint32));
+		memcpy(primes, conf->partial_primes, 
+				3 * num_partials * sizeof(uint32));
+		mutex_unlock(&conf->relation_mutex);
+	}
+
+	cycles = count_partial_cycles(primes, num_partials);
+	conf->prev_cycles = conf->exact_cycles;
+	conf->prev_partials = conf->exact_partials;
+	conf->exact_cycles = cycles;
+	conf->exact_partials = num_partials;
+
+	if (threaded) {
+		free(primes);
+		conf->counting_cycles = 0;
+	}
+}
+
+/*--------------------------------------------------------------------*/
+static uint32 count_relations(sieve_conf_t *conf) {
+
+	/* tuning runs stop on the raw number of relations; 
+	   see time_sieve_params() */
+
+	if (conf->trial)
+		return conf->num_relations + conf->num_cycles;
+
+	return conf->num_relations + count_combined(conf);
+}
+
+/*--------------------------------------------------------------------*/
+static uint32 show_progress(sieve_conf_t *conf) {
+
+	return !conf->trial && (conf->obj->flags & 
+			(MSIEVE_FLAG_USE_LOGFILE | MSIEVE_FLAG_LOG_TO_STDOUT));
+}
+
+/*--------------------------------------------------------------------*/
+static void print_progress(sieve_conf_t *conf, uint32 max_relations) {
+
+	if (show_progress(conf)) {
+		fprintf(stderr, "%u relations (%u full + "
+			"%u combined from %u partial), need %u\r",
+				count_relations(conf),
+				conf->num_relations,
+				count_combined(conf),
+				conf->num_cycles,
+				max_relations);
+		fflush(stderr);
+	}
+}
+
+/*--------------------------------------------------------------------*/
+typedef struct {
+	sieve_conf_t *conf;
+	uint32 target_relations;
+	uint32 max_relations;
+	qs_core_sieve_fcn core_sieve_fcn;
+} sieve_thread_data_t;
+
+static void sieve_thread_run(void *data, int thread_num) {
+
+	/* keep sieving until the relations found by all
+	   threads are enough. Relations are passed to the
+	   master configuration in batches, and whichever
+	   thread notices that sieving is finished tells 
+	   the others */
+
+	sieve_thread_data_t *t = (sieve_thread_data_t *)data;
+	sieve_conf_t *conf = t->conf;
+	sieve_conf_t *master = conf->master;
+	msieve_obj *obj = conf->obj;
+
+	TIME1(conf, QS_TIME_TOTAL)
+	while (!(obj->flags & MSIEVE_FLAG_STOP_SIEVING) &&
+	       !master->sieving_done) {
+
+		collect_relations(conf, t->target_relations, 
+					t->core_sieve_fcn);
+		flush_sieve_lines(conf);
+		update_exact_cycles(master, t->max_relations, 1);
+
+		if (count_relations(master) >= t->max_relations)
+			master->sieving_done = 1;
+
+		mutex_lock(&master->relation_mutex);
+		print_progress(master, t->max_relations);
+		mutex_unlock(&master->relation_mutex);
+	}
+
+	/* relations still in the batch are found after 
+	   sieving stops, and only add to the total */
+
+	if (conf->use_batch) {
+		qs_batch_run(conf);
+		flush_sieve_lines(conf);
+	}
+	TIME2(conf, QS_TIME_TOTAL)
+}
+
+/*--------------------------------------------------------------------*/
+static void sieve_threaded(sieve_conf_t *conf, uint32 update,
+			uint32 max_relations, 
+			qs_core_sieve_fcn core_sieve_fcn,
+			uint32 num_threads) {
+
+	uint32 i;
+	sieve_conf_t *thread_conf;
+	sieve_thread_data_t *thread_data;
+	thread_control_t control = {NULL, NULL, NULL};
+	task_control_t task = {NULL, sieve_thread_run, NULL, NULL};
+	struct threadpool *pool;
+
+	mutex_init(&conf->relation_mutex);
+	conf->last_writer = num_threads;
+	conf->sieving_done = 0;
+
+	thread_conf = (sieve_conf_t *)xmalloc(num_threads * 
+					sizeof(sieve_conf_t));
+	thread_data = (sieve_thread_data_t *)xmalloc(num_threads * 
+					sizeof(sieve_thread_data_t));
+
+	for (i = 0; i < num_threads; i++) {
+		sieve_thread_data_t *t = thread_data + i;
+
+		sieve_thread_init(conf, thread_conf + i, i);
+		t->conf = thread_conf + i;
+		t->target_relations = MAX(update / num_threads, 1);
+		t->max_relations = max_relations;
+		t->core_sieve_fcn = core_sieve_fcn;
+	}
+
+	/* the calling thread does the work of the last thread */
+
+	pool = threadpool_init(num_threads - 1, num_threads, &control);
+
+	for (i = 0; i < num_threads - 1; i++) {
+		task.data = thread_data + i;
+		threadpool_add_task(pool, &task, 1);
+	}
+	sieve_thread_run(thread_data + i, i);
+
+	threadpool_drain(pool, 1);
+	threadpool_free(pool);
+
+	for (i = 0; i < num_threads; i++)
+		sieve_thread_free(thread_conf + i);
+	free(thread_conf);
+	free(thread_data);
+	mutex_free(&conf->relation_mutex);
+}
+
+/*--------------------------------------------------------------------*/
+static const char *timer_names[NUM_QS_TIMERS] = {
+	"total",
+	"  build 'a' and 'b' values",
+	"  next poly, sieved primes",
+	"  next poly, hashtable primes",
+	"  per-poly setup",
+	"  fill hashtable",
+	"  sieve small primes",
+	"  add hashtable entries",
+	"  scan sieve blocks",
+	"    check sieve values",
+	"      trial divide, sieved primes",
+	"      trial divide, hashtable",
+	"      split cofactors",
+	"  batch factor cofactors",
+};
+
+static void write_sieve_stats(sieve_conf_t *conf, char *filename,
+			uint32 num_threads, double wall_time,
+			double cpu_time, uint64 wall_clocks) {
+
+	/* append a summary of the sieving statistics to a file. 
+	   The timers count clock ticks, which are converted to 
+	   seconds using the ticks and the wall clock time that 
+	   elapsed while sieving. Times for the phases of sieving
+	   are summed over all threads */
+
+	uint32 i;
+	msieve_obj *obj = conf->obj;
+	qs_stats_t *stats = &conf->stats;
+	uint64 *count = stats->count;
+	double total = (double)MAX(stats->time[QS_TIME_TOTAL], 1);
+	double clocks_per_sec = 0;
+	uint64 num_rels;
+	mp_t n;
+	char *n_str;
+	FILE *fp;
+
+	fp = fopen(filename, "a");
+	if (fp == NULL) {
+		logprintf(obj, "error: cannot open QS statistics "
+				"file '%s'\n", filename);
+		return;
+	}
+
+	if (wall_time > 0)
+		clocks_per_sec = wall_clocks / wall_time;
+
+	mp_divrem_1(conf->n, conf->multiplier, &n);
+	n_str = mp_sprintf(&n, 10, obj->mp_sprintf_buf);
+	fprintf(fp, "QS statistics for %s (%u digits)\n",
+			n_str, (uint32)strlen(n_str));
+	fprintf(fp, "multiplier %u, %u factor base primes, "
+			"%u sieve blocks of %u bytes\n",
+			conf->multiplier, conf->fb_size, 
+			conf->num_sieve_blocks, conf->sieve_block_size);
+	fprintf(fp, "large prime bound %u, cutoffs %u and %u bits, "
+			"triple large primes %s, batch factoring %s\n",
+			conf->large_prime_max, conf->cutoff1, conf->cutoff2,
+			conf->use_tlp ? "on" : "off",
+			conf->use_batch ? "on" : "off");
+	fprintf(fp, "%u polynomials per pass and %u primes per block "
+			"in the hashtable\n", 
+			conf->poly_block, conf->fb_block);
+	fprintf(fp, "%u threads, %.2lf seconds elapsed, "
+			"%.2lf CPU seconds\n\n",
+			num_threads, wall_time, cpu_time);
+
+	fprintf(fp, "%-36s %10s %7s\n", "phase", "seconds", "percent");
+	for (i = 0; i < NUM_QS_TIMERS; i++) {
+		double t = (double)stats->time[i];
+
+		fprintf(fp, "%-36s %10.2lf %6.1lf%%\n", timer_names[i],
+				clocks_per_sec > 0 ? t / clocks_per_sec : 0,
+				100.0 * t / total);
+	}
+
+	fprintf(fp, "\n%u polynomials, %u sieve blocks\n",
+			(uint32)count[QS_COUNT_POLY],
+			(uint32)count[QS_COUNT_BLOCK]);
+	fprintf(fp, "sieve values above cutoff1:   %12" PRIu64 "\n",
+			count[QS_COUNT_CUTOFF1]);
+	fprintf(fp, "  and above cutoff2:          %12" PRIu64 "\n",
+			count[QS_COUNT_CUTOFF2]);
+	fprintf(fp, "    cofactor a useless prime: %12" PRIu64 "\n",
+			count[QS_COUNT_RES_SMALL]);
+	fprintf(fp, "    cofactor too large:       %12" PRIu64 "\n",
+			count[QS_COUNT_RES_BIG]);
+	fprintf(fp, "    cofactor split directly:  %12" PRIu64 "\n",
+			count[QS_COUNT_COFACTOR]);
+	fprintf(fp, "    cofactor batch factored:  %12" PRIu64 "\n\n",
+			count[QS_COUNT_BATCHED]);
+
+	num_rels = count[QS_COUNT_FULL] + count[QS_COUNT_PARTIAL1] +
+		   count[QS_COUNT_PARTIAL2] + count[QS_COUNT_PARTIAL3];
+	fprintf(fp, "%-22s %10s %12s %12s\n", "relations found", 
+			"count", "per second", "per CPU sec");
+	for (i = 0; i < 5; i++) {
+		static const char *names[5] = {
+			"full", "partial (1 large)", "partial (2 large)",
+			"partial (3 large)", "total" };
+		uint64 c = (i < 4) ? count[QS_COUNT_FULL + i] : num_rels;
+
+		fprintf(fp, "%-22s %10" PRIu64 " %12.2lf %12.2lf\n",
+				names[i], c, 
+				wall_time > 0 ? c / wall_time : 0,
+				cpu_time > 0 ? c / cpu_time : 0);
+	}
+	fprintf(fp, "\n");
+	fclose(fp);
+
+	logprintf(obj, "appended sieving statistics to '%s'\n", filename);
+}
 
 /*--------------------------------------------------------------------*/
 void do_sieving(msieve_obj *obj, mp_t *n, 
@@ -51,7 +516,8 @@ void do_sieving(msieve_obj *obj, mp_t *n,
 		fb_t *factor_base, uint32 *modsqrt_array,
 		sieve_param_t *params, uint32 multiplier,
 		relation_t **relation_list, uint32 *num_relations,
-		la_col_t **cycle_list, uint32 *num_cycles) {
+		la_col_t **cycle_list, uint32 *num_cycles,
+		sieve_trial_t *trial) {
 
 	sieve_conf_t conf;
 	uint32 bound;
@@ -64,7 +530,14 @@ void do_sieving(msieve_obj *obj, mp_t *n,
 	uint32 max_relations, relations_found;
 	uint32 sieve_block_size;
 	uint32 recip_cutoff;
+	uint32 num_threads;
 	qs_core_sieve_fcn core_sieve_fcn;
+	uint32 check_cycles = 0;
+
+	char stats_name[256];
+	double wall_time = 0;
+	double cpu_time = 0;
+	uint64 wall_clocks = 0;
 
 	/* fill in initial sieve parameters */
 
@@ -75,8 +548,18 @@ void do_sieving(msieve_obj *obj, mp_t *n,
 	conf.factor_base = factor_base;
 	conf.modsqrt_array = modsqrt_array;
 	conf.fb_size = params->fb_size;
+	conf.seed1 = obj->seed1;
+	conf.seed2 = obj->seed2;
+	conf.trial = (trial != NULL);
 	bits = mp_bits(conf.n);
 
+	/* determine the number of sieving threads */
+
+	num_threads = obj->num_threads;
+	if (num_threads < 2 || fb_size < MIN_FB_SIZE_TO_THREAD)
+		num_threads = 1;
+	num_threads = MIN(num_threads, MAX_SIEVE_THREADS);
+
 	/* decide on the size of one sieve block. If the L1
 	   cache size is 32kB then this is also the sieve block
 	   size, otherwise it is 64kB. The latter rule is needed
@@ -88,8 +571,6 @@ void do_sieving(msieve_obj *obj, mp_t *n,
 		conf.sieve_block_size = sieve_block_size = 32768;
 	else 
 		conf.sieve_block_size = sieve_block_size = 65536;
-	conf.sieve_array = (uint8 *)aligned_malloc(
-					(size_t)sieve_block_size, 64);
 
 	/* decide on the core sieving routine to use */
 
@@ -104,13 +585,39 @@ void do_sieving(msieve_obj *obj, mp_t *n,
 		core_sieve_fcn = qs_core_sieve_vc8_64k;
 	}
 #else
-	if (sieve_block_size == 32768) {
-		logprintf(obj, "using generic 32kb sieve core\n");
-		core_sieve_fcn = qs_core_sieve_generic_32k;
+
+#if defined(HAS_AVX_SIEVE_CORE)
+	if (obj->cpu == cpu_x86_avx512) {
+		if (sieve_block_size == 32768) {
+			logprintf(obj, "using AVX512 32kb sieve core\n");
+			core_sieve_fcn = qs_core_sieve_avx512_32k;
+		}
+		else {
+			logprintf(obj, "using AVX512 64kb sieve core\n");
+			core_sieve_fcn = qs_core_sieve_avx512_64k;
+		}
 	}
-	else {
-		logprintf(obj, "using generic 64kb sieve core\n");
-		core_sieve_fcn = qs_core_sieve_generic_64k;
+	else if (obj->cpu == cpu_x86_avx2) {
+		if (sieve_block_size == 32768) {
+			logprintf(obj, "using AVX2 32kb sieve core\n");
+			core_sieve_fcn = qs_core_sieve_avx2_32k;
+		}
+		else {
+			logprintf(obj, "using AVX2 64kb sieve core\n");
+			core_sieve_fcn = qs_core_sieve_avx2_64k;
+		}
+	}
+#endif
+
+	if (core_sieve_fcn == NULL) {
+		if (sieve_block_size == 32768) {
+			logprintf(obj, "using generic 32kb sieve core\n");
+			core_sieve_fcn = qs_core_sieve_generic_32k;
+		}
+		else {
+			logprintf(obj, "using generic 64kb sieve core\n");
+			core_sieve_fcn = qs_core_sieve_generic_64k;
+		}
 	}
 #endif
 
@@ -270,7 +777,6 @@ void do_sieving(msieve_obj *obj, mp_t *n,
 	}
 	conf.tf_large_cutoff = i;
 	conf.sieve_large_fb_start = i;
-	conf.packed_fb = (packed_fb_t *)xmalloc(i * sizeof(packed_fb_t));
 
 	/* The sieve code is optimized for sieving intervals that are
 	   extremely small. To reduce the overhead of using a large
@@ -285,12 +791,32 @@ void do_sieving(msieve_obj *obj, mp_t *n,
 
 	conf.poly_block = (uint32)((double)65536 / sieve_block_size *
 			100 / num_sieve_blocks + 1);
+	conf.fb_block = 200;
+
+	/* both sizes can be overridden; more polynomials per pass
+	   over the hashtable primes means more memory for hash
+	   bins, and fewer primes per block means less of the 
+	   factor base is in cache at once */
+
+	if (obj->nfs_args != NULL) {
+		const char *tmp;
+
+		tmp = strstr(obj->nfs_args, "qs_poly_block=");
+		if (tmp != NULL && atoi(tmp + 14) > 0)
+			conf.poly_block = atoi(tmp + 14);
+
+		tmp = strstr(obj->nfs_args, "qs_fb_block=");
+		if (tmp != NULL && atoi(tmp + 12) > 0)
+			conf.fb_block = atoi(tmp + 12);
+
+		conf.stats.enabled = get_arg_string(obj->nfs_args,
+						"qs_stats=", stats_name, 
+						sizeof(stats_name));
+	}
 
 	logprintf(obj, "processing polynomials in batches of %u\n", 
 			conf.poly_block);
 
-	conf.fb_block = 200;
-
  	bound = conf.factor_base[conf.fb_size - 1].prime;
 	logprintf(obj, "using a sieve bound of %u (%u primes)\n", 
 				bound, conf.fb_size);
@@ -320,6 +846,22 @@ void do_sieving(msieve_obj *obj, mp_t *n,
 	mp_mul_1(&conf.max_fb2, i, &conf.max_fb2);
 
 	mp_clear(&conf.large_prime_max2);
+	mp_clear(&conf.large_prime_max3);
+
+	/* compute max_fb3, the cube of the largest factor base prime */
+
+	mp_mul_1(&conf.max_fb2, i, &conf.max_fb3);
+
+	/* triple large primes are used for very large inputs,
+	   or whenever the user asks for them */
+
+	conf.use_tlp = (bits >= MIN_TLP_BITS);
+	if (obj->nfs_args != NULL) {
+		if (strstr(obj->nfs_args, "qs_tlp=1"))
+			conf.use_tlp = 1;
+		else if (strstr(obj->nfs_args, "qs_tlp=0"))
+			conf.use_tlp = 0;
+	}
 
 	/* fill in sieving cutoffs that leverage the small
 	   prime variation. Do not skip small primes if the
@@ -339,7 +881,7 @@ void do_sieving(msieve_obj *obj, mp_t *n,
 	else {
 		/* Turn on double large primes if n is 85 digits or more */
 
-		if (bits >= 282) {
+		if (bits >= 282 || conf.use_tlp) {
 			mp_t *large_max2 = &conf.large_prime_max2;
 
 			/* the double-large-prime cutoff is equal to
@@ -366,35 +908,34 @@ void do_sieving(msieve_obj *obj, mp_t *n,
 		else {
 			conf.cutoff2 = error_bits;
 		}
-		conf.cutoff1 = conf.cutoff2 + 30;
-		logprintf(obj, "using trial factoring cutoff "
-				"of %u bits\n", conf.cutoff2);
-	}
 
-	/* set up the hashtable if it's going to be used; otherwise
-	   the rest of the sieve code will silently ignore it.
-	   
-	   There is one hash bin for every sieve block in the sieve
-	   interval; there are also twice as many such bins because
-	   we collect positive and negative sieve offsets into separate
-	   hashtables. Finally, we sieve over up to POLY_BLOCK_SIZE
-	   polynomials at the same time, so the number of hash bins
-	   is similarly multiplied.
-	   
-	   Needless to say, that's a *lot* of hash bins! The sieve
-	   interval must be extremely small to keep the hashtable
-	   size down; that's okay, very small sieve intervals are
-	   actually more likely to contain smooth relations */
+		if (conf.use_tlp) {
+			mp_t *large_max3 = &conf.large_prime_max3;
+
+			/* the triple-large-prime cutoff is the single
+			   cutoff raised to the 2.7 power, for the same
+			   reason as above. The cofactors are split
+			   with tinyqs, which limits their size */
+
+			mp_mul_1(&conf.large_prime_max2,
+				(uint32)pow((double)bound, 0.9), 
+				large_max3);
+			if (mp_bits(large_max3) > SMALL_COMPOSITE_CUTOFF_BITS) {
+				mp_rshift(large_max3, mp_bits(large_max3) -
+						SMALL_COMPOSITE_CUTOFF_BITS,
+						large_max3);
+			}
 
-	conf.buckets = (bucket_t *)xcalloc((size_t)(conf.poly_block *
-							num_sieve_blocks), 
-							sizeof(bucket_t));
-	if (fb_size > conf.sieve_large_fb_start) {
-		for (i = 0; i < conf.poly_block * num_sieve_blocks; i++) {
-			conf.buckets[i].num_alloc = 1000;
-			conf.buckets[i].list = (bucket_entry_t *)
-					xmalloc(1000 * sizeof(bucket_entry_t));
+			conf.cutoff2 = mp_bits(large_max3);
+			logprintf(obj, "using triple large prime bound of "
+				"%s (%u-%u bits)\n",
+				mp_sprintf(large_max3, 10, obj->mp_sprintf_buf),
+				mp_bits(&conf.max_fb3), 
+				conf.cutoff2);
 		}
+		conf.cutoff1 = conf.cutoff2 + 30;
+		logprintf(obj, "using trial factoring cutoff "
+				"of %u bits\n", conf.cutoff2);
 	}
 
 	/* fill in miscellaneous parameters */
@@ -402,6 +943,34 @@ void do_sieving(msieve_obj *obj, mp_t *n,
 	conf.num_sieve_blocks = num_sieve_blocks;
 	conf.large_prime_max = bound;
 
+	/* the cofactors of partial relations are batch factored
+	   when triple large primes are in use, since then almost
+	   all cofactors are useless and tinyqs is expensive. The
+	   user can also ask for batch factoring of double large
+	   prime cofactors, though these usually split anyway */
+
+	conf.use_batch = (fb_size >= 800 && conf.use_tlp);
+	if (obj->nfs_args != NULL) {
+		if (strstr(obj->nfs_args, "qs_batch=1"))
+			conf.use_batch = 1;
+		else if (strstr(obj->nfs_args, "qs_batch=0"))
+			conf.use_batch = 0;
+	}
+	if (conf.use_batch)
+		qs_batch_init(&conf, NULL);
+
+	/* with several threads, the counts of relations and
+	   cycles can optionally be checked when sieving ends */
+
+	if (obj->nfs_args != NULL && 
+	    strstr(obj->nfs_args, "qs_cycle_check=1"))
+		check_cycles = 1;
+
+	/* sieving threads allocate their own sieve arrays */
+
+	if (num_threads == 1)
+		alloc_sieve_arrays(&conf);
+
 	/* initialize the polynomial generation code. Note that
 	   we do *not* use the sieve size that is input to specify
 	   the sizing of polynomials, but instead use the rounded value 
@@ -411,16 +980,16 @@ void do_sieving(msieve_obj *obj, mp_t *n,
 
 	/* initialize the bookkeeping for tracking partial relations */
 
-	conf.components = 0;
-	conf.vertices = 0;
+	memset(&conf.cycle_graph, 0, sizeof(cycle_graph_t));
 	if (!(obj->flags & MSIEVE_FLAG_SKIP_QS_CYCLES)) {
-		conf.cycle_hashtable = (uint32 *)xcalloc(
-					(size_t)(1 << LOG2_CYCLE_HASH),
-					sizeof(uint32));
-		conf.cycle_table_size = 1;
-		conf.cycle_table_alloc = 10000;
-		conf.cycle_table = (cycle_t *)xmalloc(conf.cycle_table_alloc * 
-							sizeof(cycle_t));
+		cycle_graph_init(&conf.cycle_graph);
+
+		if (conf.use_tlp && !conf.trial) {
+			conf.partial_primes_alloc = 10000;
+			conf.partial_primes = (uint32 *)xmalloc(3 * 
+						conf.partial_primes_alloc *
+						sizeof(uint32));
+		}
 	}
 
 	/* stop when this many relations are found */
@@ -434,23 +1003,24 @@ void do_sieving(msieve_obj *obj, mp_t *n,
 
 	obj->flags |= MSIEVE_FLAG_SIEVING_IN_PROGRESS;
 
-	TIME1(total_time)
+	if (conf.stats.enabled) {
+		wall_time = get_wall_time();
+		cpu_time = get_cpu_time();
+		wall_clocks = read_clock();
+	}
+
 	relations_found = do_sieving_internal(&conf, max_relations,
-						core_sieve_fcn);
-	TIME2(total_time)
-
-	PRINT_TIME(total_time);
-	PRINT_TIME(base_poly_time);
-	PRINT_TIME(next_poly_small_time);
-	PRINT_TIME(next_poly_large_time);
-	PRINT_TIME(plus_init_time);
-	PRINT_TIME(bucket_time);
-	PRINT_TIME(sieve_small_time);
-	PRINT_TIME(sieve_large_time);
-	PRINT_TIME(tf_plus_scan_time);
-	PRINT_TIME(tf_total_time);
-	PRINT_TIME(tf_small_time);
-	PRINT_TIME(tf_large_time);
+						core_sieve_fcn, num_threads);
+	obj->seed1 = conf.seed1;
+	obj->seed2 = conf.seed2;
+
+	if (conf.stats.enabled) {
+		wall_time = get_wall_time() - wall_time;
+		cpu_time = get_cpu_time() - cpu_time;
+		wall_clocks = read_clock() - wall_clocks;
+		write_sieve_stats(&conf, stats_name, num_threads,
+				wall_time, cpu_time, wall_clocks);
+	}
 
 	/* free all of the sieving structures first, to leave
 	   more memory for the postprocessing step. Do *not* free
@@ -461,19 +1031,24 @@ void do_sieving(msieve_obj *obj, mp_t *n,
 	savefile_close(&obj->savefile);
 	obj->flags &= ~MSIEVE_FLAG_SIEVING_IN_PROGRESS;
 
-	for (i = 0; i < conf.poly_block * num_sieve_blocks; i++) {
-		free(conf.buckets[i].list);
-	}
-	free(conf.buckets);
-	free(conf.packed_fb);
-	aligned_free(conf.sieve_array);
+	if (check_cycles && num_threads > 1 && !conf.trial &&
+	    !(obj->flags & MSIEVE_FLAG_SKIP_QS_CYCLES))
+		check_cycle_counts(&conf);
+
+	if (num_threads == 1)
+		free_sieve_arrays(&conf);
 
 	/* if enough relations are available, do the postprocessing
 	   and save the results where the rest of the program can
 	   find them. Don't run filter_relations() if the cycle-
-	   counting structures have not been initialized */
+	   counting structures have not been initialized, or if
+	   this was only a tuning run */
 
-	if (relations_found >= max_relations &&
+	if (trial != NULL) {
+		trial->num_fulls = conf.num_relations;
+		trial->num_partials = conf.num_cycles;
+	}
+	else if (relations_found >= max_relations &&
 	    !(obj->flags & MSIEVE_FLAG_SKIP_QS_CYCLES)) {
 	        if(obj->flags & (MSIEVE_FLAG_USE_LOGFILE |
 	    		   MSIEVE_FLAG_LOG_TO_STDOUT)) {
@@ -490,14 +1065,99 @@ void do_sieving(msieve_obj *obj, mp_t *n,
 	}
 
 	poly_free(&conf);
-	free(conf.cycle_table);
-	free(conf.cycle_hashtable);
+	cycle_graph_free(&conf.cycle_graph);
+	free(conf.partial_primes);
+	if (conf.use_batch)
+		qs_batch_free(&conf);
+}
+
+/*--------------------------------------------------------------------*/
+static void read_savefile_graph(sieve_conf_t *conf) {
+
+	/* Read in the large primes for all the relations
+	   in the savefile, and count the number of
+	   cycles that can be formed. Note that no check
+	   for duplicate or corrupted relations is made here;
+	   the cycle finder will rebuild everything from 
+	   scratch when sieving finishes, and does all the 
+	   verification at that point */
+
+	savefile_t *savefile = &conf->obj->savefile;
+	char buf[LINE_BUF_SIZE];
+
+	savefile_open(savefile, SAVEFILE_READ);
+	savefile_read_line(buf, sizeof(buf), savefile);
+
+	while (!savefile_eof(savefile)) {
+		uint32 primes[3];
+		char *tmp = strchr(buf, 'L');
+
+		if (buf[0] != 'R' || tmp == NULL) {
+			savefile_read_line(buf, sizeof(buf), savefile);
+			continue;
+		}
+
+		read_large_primes(tmp, primes + 0, primes + 1, primes + 2);
+		if (IS_FULL_RELATION(primes[0], primes[1], primes[2])) {
+			conf->num_relations++;
+		}
+		else {
+			add_to_cycles(conf, primes[0], primes[1], primes[2]);
+			save_partial_primes(conf, primes, 1);
+			conf->num_cycles++;
+		}
+		savefile_read_line(buf, sizeof(buf), savefile);
+	}
+	savefile_close(savefile);
+}
+
+/*--------------------------------------------------------------------*/
+static void check_cycle_counts(sieve_conf_t *conf) {
+
+	/* after several threads have updated the graph of
+	   partial relations at the same time, rebuild the 
+	   graph from the savefile with only one thread and
+	   make sure all the counts agree */
+
+	msieve_obj *obj = conf->obj;
+	sieve_conf_t check = *conf;
+	cycle_graph_t *g0 = &conf->cycle_graph;
+	cycle_graph_t *g1 = &check.cycle_graph;
+
+	check.num_relations = 0;
+	check.num_cycles = 0;
+	check.partial_primes = NULL;
+	cycle_graph_init(g1);
+	read_savefile_graph(&check);
+
+	if (check.num_relations == conf->num_relations &&
+	    check.num_cycles == conf->num_cycles &&
+	    g1->vertices == g0->vertices &&
+	    g1->components == g0->components) {
+		logprintf(obj, "cycle check: %u full, %u partial, "
+				"%u vertices, %u components match\n",
+				conf->num_relations, conf->num_cycles,
+				g0->vertices, g0->components);
+	}
+	else {
+		logprintf(obj, "error: cycle check failed; threads found "
+				"%u full, %u partial, %u vertices, "
+				"%u components but one thread finds "
+				"%u, %u, %u, %u\n",
+				conf->num_relations, conf->num_cycles,
+				g0->vertices, g0->components,
+				check.num_relations, check.num_cycles,
+				g1->vertices, g1->components);
+	}
+
+	cycle_graph_free(g1);
 }
 
 /*--------------------------------------------------------------------*/
 static uint32 do_sieving_internal(sieve_conf_t *conf, 
 				uint32 max_relations,
-				qs_core_sieve_fcn core_sieve_fcn) {
+				qs_core_sieve_fcn core_sieve_fcn,
+				uint32 num_threads) {
 
 	uint32 num_relations = 0;
 	uint32 update;
@@ -535,37 +1195,7 @@ static uint32 do_sieving_internal(sieve_conf_t *conf,
 		savefile_close(savefile);
 	}
 
-	/* Read in the large primes for all the relations
-	   in the savefile, and count the number of
-	   cycles that can be formed. Note that no check
-	   for duplicate or corrupted relations is made here;
-	   the cycle finder will rebuild everything from 
-	   scratch when sieving finishes, and does all the 
-	   verification at that point */
-
-	savefile_open(savefile, SAVEFILE_READ);
-	savefile_read_line(buf, sizeof(buf), savefile);
-
-	while (!savefile_eof(savefile)) {
-		uint32 prime1, prime2;
-		char *tmp = strchr(buf, 'L');
-
-		if (buf[0] != 'R' || tmp == NULL) {
-			savefile_read_line(buf, sizeof(buf), savefile);
-			continue;
-		}
-
-		read_large_primes(tmp, &prime1, &prime2);
-		if (prime1 == prime2) {
-			conf->num_relations++;
-		}
-		else {
-			add_to_cycles(conf, prime1, prime2);
-			conf->num_cycles++;
-		}
-		savefile_read_line(buf, sizeof(buf), savefile);
-	}
-	savefile_close(savefile);
+	read_savefile_graph(conf);
 
 	/* prepare the savefile for receiving more relations */
 
@@ -577,9 +1207,8 @@ static uint32 do_sieving_internal(sieve_conf_t *conf,
 						conf->num_cycles);
 	}
 
-	num_relations = conf->num_relations + 
-			conf->num_cycles +
-			conf->components - conf->vertices;
+	update_exact_cycles(conf, max_relations, 0);
+	num_relations = count_relations(conf);
 
 	/* choose how many full relations to collect before
 	   printing a progress update */
@@ -594,9 +1223,14 @@ static uint32 do_sieving_internal(sieve_conf_t *conf,
 		update = 200;
 	update = MIN(update, max_relations / 10);
 
-	if (num_relations < max_relations &&
-	    (obj->flags & (MSIEVE_FLAG_USE_LOGFILE |
-	    		   MSIEVE_FLAG_LOG_TO_STDOUT))) {
+	/* with triple large primes, full relations are rare and
+	   the number of cycles shoots up near the end, so update 
+	   more often to stop soon after there are enough cycles */
+
+	if (conf->partial_primes != NULL)
+		update = MAX(update / 4, 1);
+
+	if (num_relations < max_relations && show_progress(conf)) {
 		fprintf(stderr, "\nsieving in progress "
 				"(press Ctrl-C to pause)\n");
 	}
@@ -604,40 +1238,49 @@ static uint32 do_sieving_internal(sieve_conf_t *conf,
 	/* sieve until at least that many relations have
 	   been found, then update the number of fulls and
 	   partials. This way we can declare sieving to be
-	   finished the moment enough relations are available */
-
-	while (!(obj->flags & MSIEVE_FLAG_STOP_SIEVING) && 
-		num_relations < max_relations) {
-
-		collect_relations(conf, update, core_sieve_fcn);
-
-		num_relations = conf->num_relations + 
-				conf->num_cycles +
-				conf->components - conf->vertices;
-
-	    	if (obj->flags & (MSIEVE_FLAG_USE_LOGFILE |
-	    		   	  MSIEVE_FLAG_LOG_TO_STDOUT)) {
-			fprintf(stderr, "%u relations (%u full + "
-				"%u combined from %u partial), need %u\r",
-					num_relations,
-					conf->num_relations,
-					conf->num_cycles +
-					conf->components - conf->vertices,
-					conf->num_cycles,
-					max_relations);
-			fflush(stderr);
+	   finished the moment enough relations are available.
+	   With several threads, each thread finds a share of
+	   the relations between updates */
+
+	if (num_threads > 1 && num_relations < max_relations) {
+		logprintf(obj, "sieving with %u threads\n", num_threads);
+		sieve_threaded(conf, update, max_relations, 
+				core_sieve_fcn, num_threads);
+		num_relations = count_relations(conf);
+	}
+	else {
+		TIME1(conf, QS_TIME_TOTAL)
+		while (!(obj->flags & MSIEVE_FLAG_STOP_SIEVING) && 
+			num_relations < max_relations) {
+
+			collect_relations(conf, update, core_sieve_fcn);
+
+			update_exact_cycles(conf, max_relations, 0);
+			num_relations = count_relations(conf);
+			print_progress(conf, max_relations);
+		}
+
+		if (conf->use_batch) {
+			qs_batch_run(conf);
+			num_relations = count_relations(conf);
 		}
+		TIME2(conf, QS_TIME_TOTAL)
 	}
 
-	if (obj->flags & (MSIEVE_FLAG_USE_LOGFILE |
-	    		   MSIEVE_FLAG_LOG_TO_STDOUT))
+	if (show_progress(conf))
 		fprintf(stderr, "\n");
 
+	if (conf->trial) {
+		logprintf(obj, "trial found %u full and %u partial "
+				"relations\n", conf->num_relations,
+				conf->num_cycles);
+		return num_relations;
+	}
+
 	logprintf(obj, "%u relations (%u full + %u combined from "
 			"%u partial), need %u\n",
 				num_relations, conf->num_relations,
-				conf->num_cycles +
-				conf->components - conf->vertices,
+				count_combined(conf),
 				conf->num_cycles,
 				max_relations);
 	return num_relations;
@@ -663,9 +1306,9 @@ static void collect_relations(sieve_conf_t *conf,
 		   big factorizations there may be thousands
 		   of them */
 
-		TIME1(base_poly_time)
+		TIME1(conf, QS_TIME_BASE_POLY)
 		build_base_poly(conf);
-		TIME2(base_poly_time)
+		TIME2(conf, QS_TIME_BASE_POLY)
 
 		/* Do the sieving for all polynomials, handling
 		   batches of polynomials at a time. */
@@ -693,6 +1336,13 @@ static void collect_relations(sieve_conf_t *conf,
 			     (num_poly > 1024 && i > 2000))) {
 				return;
 			}
+
+			/* sieving threads also stop when another 
+			   thread has found the last relations needed */
+
+			if (conf->master != NULL && 
+			    conf->master->sieving_done)
+				return;
 		}
 	}
 }
@@ -700,6 +1350,79 @@ static void collect_relations(sieve_conf_t *conf,
 /*--------------------------------------------------------------------*/
 static mp_t two = {1, {2}};
 
+static void check_tlp_residue(sieve_conf_t *conf, mp_t *res,
+			uint32 abs_offset, uint32 *fb_offsets,
+			uint32 num_factors, uint32 poly_index) {
+
+	/* 'res' is too large to be the product of two large
+	   primes; see if it is the product of three of them */
+
+	mp_t exponent, ans, factor1, factor2;
+	mp_t *small, *big;
+	uint32 i;
+
+	/* 'res' must not be too large, and has to have at
+	   least three factors above the factor base bound */
+
+	if (mp_cmp(res, &conf->large_prime_max3) > 0 ||
+	    mp_cmp(res, &conf->max_fb3) < 0) {
+		STAT_COUNT(conf, QS_COUNT_RES_BIG);
+		return;
+	}
+
+	mp_sub_1(res, 1, &exponent);
+	mp_expo(&two, &exponent, res, &ans);
+	if (mp_is_one(&ans)) {
+		STAT_COUNT(conf, QS_COUNT_RES_SMALL);
+		return;
+	}
+
+	/* split off one factor, which must be a prime less
+	   than the single large prime bound. The other must
+	   be a composite that splits into two such primes */
+
+	STAT_COUNT(conf, QS_COUNT_COFACTOR);
+	TIME1(conf, QS_TIME_COFACTOR)
+	i = tinyqs(conf->tinyqs_data, res, &factor1, &factor2);
+	TIME2(conf, QS_TIME_COFACTOR)
+	if (i == 0)
+		return;
+
+	if (mp_cmp(&factor1, &factor2) < 0) {
+		small = &factor1;
+		big = &factor2;
+	}
+	else {
+		small = &factor2;
+		big = &factor1;
+	}
+
+	if (small->nwords != 1 || small->val[0] >= conf->large_prime_max)
+		return;
+	if (mp_cmp(big, &conf->max_fb2) < 0 ||
+	    mp_cmp(big, &conf->large_prime_max2) > 0)
+		return;
+
+	mp_sub_1(big, 1, &exponent);
+	mp_expo(&two, &exponent, big, &ans);
+	if (mp_is_one(&ans))
+		return;
+
+	TIME1(conf, QS_TIME_COFACTOR)
+	i = squfof(big);
+	TIME2(conf, QS_TIME_COFACTOR)
+	if (i <= 1)
+		return;
+
+	mp_divrem_1(big, i, big);
+	if (i < conf->large_prime_max && big->nwords == 1 &&
+			big->val[0] < conf->large_prime_max) {
+		save_relation(conf, abs_offset, fb_offsets, 
+				num_factors, poly_index,
+				small->val[0], i, big->val[0]);
+	}
+}
+
 uint32 check_sieve_val(sieve_conf_t *conf, int32 sieve_offset,
 			uint32 bits, mp_t *a, signed_mp_t *b, signed_mp_t *c,
 			uint32 poly_index, bucket_t *hash_bucket) {
@@ -762,6 +1485,7 @@ uint32 check_sieve_val(sieve_conf_t *conf, int32 sieve_offset,
 	       used by the hashtable-based trial factoring code
 	*/
 
+	STAT_COUNT(conf, QS_COUNT_CUTOFF1);
 	tf_offset = (sieve_offset + sieve_size / 2);
 	index = tf_offset & (sieve_block_size - 1);
 
@@ -907,11 +1631,13 @@ uint32 check_sieve_val(sieve_conf_t *conf, int32 sieve_offset,
 	if (bits <= cutoff2)
 		return 0;
 
+	STAT_COUNT(conf, QS_COUNT_CUTOFF2);
+
 	/* Now perform trial division for the rest of the
 	   "small" factor base primes. Begin with those whose
 	   reciprocal assumes numerators up to 2^32 */
 
-	TIME1(tf_small_time)
+	TIME1(conf, QS_TIME_TF_SMALL)
 	for (; i < tf_med_recip1_cutoff; i++) {
 		fb_t *fbptr = factor_base + i;
 		uint32 prime = fbptr->prime;
@@ -1031,7 +1757,7 @@ uint32 check_sieve_val(sieve_conf_t *conf, int32 sieve_offset,
 			} while (j == 0);
 		}
 	}
-	TIME2(tf_small_time)
+	TIME2(conf, QS_TIME_TF_SMALL)
 
 	list = hash_bucket->list;
 
@@ -1046,7 +1772,7 @@ uint32 check_sieve_val(sieve_conf_t *conf, int32 sieve_offset,
 	   the number of entries in list[] is much smaller
 	   than the full factor base (5-10x smaller) */
 
-	TIME1(tf_large_time)
+	TIME1(conf, QS_TIME_TF_LARGE)
 	for (i = 0; i < hash_bucket->num_used; i++) {
 
 #ifdef MANUAL_PREFETCH
@@ -1065,7 +1791,7 @@ uint32 check_sieve_val(sieve_conf_t *conf, int32 sieve_offset,
 			} while (j == 0);
 		}
 	}
-	TIME2(tf_large_time)
+	TIME2(conf, QS_TIME_TF_LARGE)
 
 	/* encode the sign of sieve_offset into its top bit */
 
@@ -1075,7 +1801,7 @@ uint32 check_sieve_val(sieve_conf_t *conf, int32 sieve_offset,
 
 	if (res.nwords == 1 && res.val[0] == 1) {
 		save_relation(conf, abs_offset, fb_offsets, 
-				num_factors, poly_index, 1, 1);
+				num_factors, poly_index, 1, 1, 1);
 		return 1;
 	}
 
@@ -1084,7 +1810,7 @@ uint32 check_sieve_val(sieve_conf_t *conf, int32 sieve_offset,
 
 	if (res.nwords == 1 && res.val[0] < conf->large_prime_max) {
 		save_relation(conf, abs_offset, fb_offsets, 
-				num_factors, poly_index, 1, res.val[0]);
+				num_factors, poly_index, 1, 1, res.val[0]);
 		return 0;
 	}
 
@@ -1094,28 +1820,64 @@ uint32 check_sieve_val(sieve_conf_t *conf, int32 sieve_offset,
 	   Note that single large prime relations will
 	   always fail at this point */
 	
-	if (mp_cmp(&res, &conf->max_fb2) < 0)
+	if (mp_cmp(&res, &conf->max_fb2) < 0) {
+		STAT_COUNT(conf, QS_COUNT_RES_SMALL);
 		return 0;
+	}
 	
 	/* 'res' is not too small; see if it's too big */
 
-	if (mp_cmp(&res, &conf->large_prime_max2) > 0)
+	if (mp_cmp(&res, &conf->large_prime_max2) > 0) {
+		if (!conf->use_tlp) {
+			STAT_COUNT(conf, QS_COUNT_RES_BIG);
+			return 0;
+		}
+
+		if (!conf->use_batch) {
+			check_tlp_residue(conf, &res, abs_offset, 
+					fb_offsets, num_factors, 
+					poly_index);
+		}
+		else if (mp_cmp(&res, &conf->large_prime_max3) <= 0 &&
+			 mp_cmp(&res, &conf->max_fb3) >= 0) {
+			STAT_COUNT(conf, QS_COUNT_BATCHED);
+			qs_batch_add(conf, abs_offset, fb_offsets,
+					num_factors, poly_index, &res);
+		}
+		else {
+			STAT_COUNT(conf, QS_COUNT_RES_BIG);
+		}
 		return 0;
+	}
 	
 	/* perform a base-2 pseudoprime test to make sure
 	   'res' is composite */
 	
 	mp_sub_1(&res, 1, &exponent);
 	mp_expo(&two, &exponent, &res, &ans);
-	if (mp_is_one(&ans))
+	if (mp_is_one(&ans)) {
+		STAT_COUNT(conf, QS_COUNT_RES_SMALL);
 		return 0;
+	}
+	
+	/* let the batch factoring deal with 'res' if possible */
+
+	if (conf->use_batch) {
+		STAT_COUNT(conf, QS_COUNT_BATCHED);
+		qs_batch_add(conf, abs_offset, fb_offsets,
+				num_factors, poly_index, &res);
+		return 0;
+	}
 	
 	/* *finally* attempt to factor 'res'; if successful,
 	   and both factors are smaller than the single 
 	   large prime bound, save 'res' as a partial-partial 
 	   relation */
 	
+	STAT_COUNT(conf, QS_COUNT_COFACTOR);
+	TIME1(conf, QS_TIME_COFACTOR)
 	i = squfof(&res);
+	TIME2(conf, QS_TIME_COFACTOR)
 	if (i > 1) {
 		mp_divrem_1(&res, i, &res);
 		if (i < conf->large_prime_max && res.nwords == 1 &&
@@ -1128,13 +1890,13 @@ uint32 check_sieve_val(sieve_conf_t *conf, int32 sieve_offset,
 
 				save_relation(conf, abs_offset, fb_offsets, 
 						num_factors, poly_index,
-						i, res.val[0]);
+						1, i, res.val[0]);
 				return 1;
 			}
 			else {
 				save_relation(conf, abs_offset, fb_offsets, 
 						num_factors, poly_index,
-						i, res.val[0]);
+						1, i, res.val[0]);
 			}
 		}
 	}
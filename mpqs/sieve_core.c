@@ -15,6 +15,16 @@ $Id$
 #include <common.h>
 #include "mpqs.h"
 
+/* this file is compiled several times: the generic versions
+   use at most SSE2, while the versions with HAS_AVX2 or
+   HAS_AVX512BW defined are built with compiler flags that
+   allow those instructions, and are only called when the 
+   CPU has them */
+
+#if defined(HAS_AVX2) || defined(HAS_AVX512BW)
+#include <immintrin.h>
+#endif
+
 #if BLOCK_KB == 32
 #define SIEVE_BLOCK_SIZE 32768
 #define LOG2_SIEVE_BLOCK_SIZE 15
@@ -77,7 +87,7 @@ static void fill_sieve_block(sieve_conf_t *conf,
 	   will update many locations within the block, and this
 	   phase will run very fast */
 
-	TIME1(sieve_small_time)
+	TIME1(conf, QS_TIME_SIEVE_SMALL)
 
 	for (i = sieve_small_fb_start; i < sieve_large_fb_start; i++) {
 		packed_fb_t *pfbptr = packed_fb + i;
@@ -121,7 +131,7 @@ static void fill_sieve_block(sieve_conf_t *conf,
 		pfbptr->next_loc2 = root2 - SIEVE_BLOCK_SIZE;
 	}
 
-	TIME2(sieve_small_time)
+	TIME2(conf, QS_TIME_SIEVE_SMALL)
 
 	/* Now update the sieve block with the rest of the
 	   factor base. All of the offsets to update have
@@ -131,7 +141,7 @@ static void fill_sieve_block(sieve_conf_t *conf,
 	   previous loop, and memory access to the hashtable
 	   entry is predictable and can be prefetched */
 
-	TIME1(sieve_large_time)
+	TIME1(conf, QS_TIME_SIEVE_LARGE)
 	list = hash_bucket->list;
 	num_large = hash_bucket->num_used;
 
@@ -151,9 +161,236 @@ static void fill_sieve_block(sieve_conf_t *conf,
 	for (; i < num_large; i++) {
 		sieve_array[list[i].sieve_offset] -= list[i].logprime;
 	}
-	TIME2(sieve_large_time)
+	TIME2(conf, QS_TIME_SIEVE_LARGE)
+}
+
+/*--------------------------------------------------------------------*/
+#if defined(HAS_AVX2) || defined(HAS_AVX512BW)
+
+static uint32 scan_sieve_block(sieve_conf_t *conf,
+				mp_t *a, signed_mp_t *b, signed_mp_t *c,
+				int32 block_start,
+				uint32 cutoff1,
+				uint32 poly_index,
+				bucket_t *hashtable) {
+				
+	/* compare 64 sieve values at a time to the cutoff,
+	   using unsigned byte comparisons. The result is a
+	   bitmask of exactly the values that need trial 
+	   factoring, so there are no false alarms to weed
+	   out one byte at a time */
+
+	uint32 i, j;
+	uint8 *sieve_array = conf->sieve_array;
+	uint32 relations_found = 0;
+#if defined(HAS_AVX512BW)
+	__m512i cutoff = _mm512_set1_epi8((char)cutoff1);
+#else
+	/* AVX2 only has signed byte compares, so flip the
+	   top bit of both operands */
+	__m256i sign = _mm256_set1_epi8((char)0x80);
+	__m256i cutoff = _mm256_set1_epi8((char)(cutoff1 ^ 0x80));
+#endif
+
+	if (cutoff1 >= 255)
+		return 0;
+
+	TIME1(conf, QS_TIME_SCAN)
+	for (i = 0; i < SIEVE_BLOCK_SIZE; i += 64) {
+
+		uint64 mask;
+#if defined(HAS_AVX512BW)
+		mask = _mm512_cmpgt_epu8_mask(
+				_mm512_load_si512(sieve_array + i), cutoff);
+#else
+		__m256i v0 = _mm256_load_si256((__m256i *)(sieve_array + i));
+		__m256i v1 = _mm256_load_si256((__m256i *)(sieve_array + i + 32));
+
+		v0 = _mm256_cmpgt_epi8(_mm256_xor_si256(v0, sign), cutoff);
+		v1 = _mm256_cmpgt_epi8(_mm256_xor_si256(v1, sign), cutoff);
+		mask = (uint64)(uint32)_mm256_movemask_epi8(v1) << 32 |
+			(uint32)_mm256_movemask_epi8(v0);
+#endif
+
+		while (mask != 0) {
+			j = i + __builtin_ctzll(mask);
+			mask &= mask - 1;
+
+			TIME1(conf, QS_TIME_TF)
+			relations_found += 
+				check_sieve_val(conf, 
+					block_start + (int32)j, 
+					cutoff1 + 257 - sieve_array[j],
+					a, b, c, poly_index,
+					hashtable);
+			TIME2(conf, QS_TIME_TF)
+		}
+	}
+	TIME2(conf, QS_TIME_SCAN)
+
+	return relations_found;
+}
+
+/*--------------------------------------------------------------------*/
+static uint32 next_large_roots(uint32 *prime, uint32 *root1, 
+				uint32 *root2, uint32 *poly_b, 
+				uint32 num_fb, uint32 do_add) {
+
+	/* switch the roots of the factor base primes used in
+	   the hashtable to those of the next polynomial. Primes,
+	   roots and corrections are all in separate arrays, so 
+	   this is a modular add or subtract on a whole vector of 
+	   primes at a time. For prime p and roots r < p, the 
+	   minimum of (r +- m) and (r +- m -+ p) as unsigned numbers 
+	   is the reduced result. Returns the number of primes 
+	   handled; the caller deals with the rest */
+
+	uint32 i;
+
+#if defined(HAS_AVX512BW)
+	for (i = 0; i + 16 <= num_fb; i += 16) {
+
+		__m512i p = _mm512_loadu_si512(prime + i);
+		__m512i m = _mm512_loadu_si512(poly_b + i);
+		__m512i r1 = _mm512_loadu_si512(root1 + i);
+		__m512i r2 = _mm512_loadu_si512(root2 + i);
+
+		if (do_add) {
+			r1 = _mm512_add_epi32(r1, m);
+			r2 = _mm512_add_epi32(r2, m);
+			r1 = _mm512_min_epu32(r1, _mm512_sub_epi32(r1, p));
+			r2 = _mm512_min_epu32(r2, _mm512_sub_epi32(r2, p));
+		}
+		else {
+			r1 = _mm512_sub_epi32(r1, m);
+			r2 = _mm512_sub_epi32(r2, m);
+			r1 = _mm512_min_epu32(r1, _mm512_add_epi32(r1, p));
+			r2 = _mm512_min_epu32(r2, _mm512_add_epi32(r2, p));
+		}
+		_mm512_storeu_si512(root1 + i, r1);
+		_mm512_storeu_si512(root2 + i, r2);
+	}
+#else
+	for (i = 0; i + 8 <= num_fb; i += 8) {
+
+		__m256i p = _mm256_loadu_si256((__m256i *)(prime + i));
+		__m256i m = _mm256_loadu_si256((__m256i *)(poly_b + i));
+		__m256i r1 = _mm256_loadu_si256((__m256i *)(root1 + i));
+		__m256i r2 = _mm256_loadu_si256((__m256i *)(root2 + i));
+
+		if (do_add) {
+			r1 = _mm256_add_epi32(r1, m);
+			r2 = _mm256_add_epi32(r2, m);
+			r1 = _mm256_min_epu32(r1, _mm256_sub_epi32(r1, p));
+			r2 = _mm256_min_epu32(r2, _mm256_sub_epi32(r2, p));
+		}
+		else {
+			r1 = _mm256_sub_epi32(r1, m);
+			r2 = _mm256_sub_epi32(r2, m);
+			r1 = _mm256_min_epu32(r1, _mm256_add_epi32(r1, p));
+			r2 = _mm256_min_epu32(r2, _mm256_add_epi32(r2, p));
+		}
+		_mm256_storeu_si256((__m256i *)(root1 + i), r1);
+		_mm256_storeu_si256((__m256i *)(root2 + i), r2);
+	}
+#endif
+
+	return i;
 }
 
+/*--------------------------------------------------------------------*/
+static uint32 next_small_roots(fb_t *fb, uint32 num_fb,
+				uint32 *poly_b, uint32 do_add) {
+
+	/* as above, but for the factor base primes that are
+	   sieved directly. Here the roots must be kept in 
+	   ascending order, and entries with invalid roots must
+	   not change. poly_b[i] is the root correction for 
+	   prime i. Returns the number of primes handled */
+
+	uint32 i;
+
+#if defined(HAS_AVX512BW)
+	__m512i prime_mask = _mm512_set1_epi32(MAX_FB_PRIME);
+	__m512i invalid = _mm512_set1_epi32((int32)INVALID_ROOT);
+	__m512i prime_idx = _mm512_setr_epi32(0, 0, 0, 0, 4, 4, 4, 4, 
+					8, 8, 8, 8, 12, 12, 12, 12);
+	__m512i root_idx = _mm512_setr_epi32(1, 1, 1, 1, 5, 5, 5, 5, 
+					9, 9, 9, 9, 13, 13, 13, 13);
+	__m512i b_idx = _mm512_setr_epi32(0, 0, 0, 0, 1, 1, 1, 1, 
+					2, 2, 2, 2, 3, 3, 3, 3);
+
+	for (i = 0; i + 4 <= num_fb; i += 4, fb += 4) {
+
+		__m512i f = _mm512_loadu_si512(fb);
+		__m512i p = _mm512_and_si512(prime_mask,
+				_mm512_permutexvar_epi32(prime_idx, f));
+		__m512i m = _mm512_permutexvar_epi32(b_idx,
+				_mm512_castsi128_si512(_mm_loadu_si128(
+					(__m128i *)(poly_b + i))));
+		__mmask16 valid = 0x6666 & _mm512_cmpneq_epi32_mask(
+				_mm512_permutexvar_epi32(root_idx, f), invalid);
+		__m512i r, swap;
+
+		if (do_add) {
+			r = _mm512_add_epi32(f, m);
+			r = _mm512_min_epu32(r, _mm512_sub_epi32(r, p));
+		}
+		else {
+			r = _mm512_sub_epi32(f, m);
+			r = _mm512_min_epu32(r, _mm512_add_epi32(r, p));
+		}
+
+		/* put the smaller root first */
+
+		swap = _mm512_shuffle_epi32(r, _MM_SHUFFLE(3, 1, 2, 0));
+		r = _mm512_mask_blend_epi32(0x4444, 
+				_mm512_min_epu32(r, swap),
+				_mm512_max_epu32(r, swap));
+		_mm512_mask_storeu_epi32(fb, valid, r);
+	}
+#else
+	__m256i prime_mask = _mm256_set1_epi32(MAX_FB_PRIME);
+	__m256i invalid = _mm256_set1_epi32((int32)INVALID_ROOT);
+	__m256i b_idx = _mm256_setr_epi32(0, 0, 0, 0, 1, 1, 1, 1);
+
+	for (i = 0; i + 2 <= num_fb; i += 2, fb += 2) {
+
+		__m256i f = _mm256_loadu_si256((__m256i *)fb);
+		__m256i p = _mm256_and_si256(prime_mask,
+				_mm256_shuffle_epi32(f, 0x00));
+		__m256i m = _mm256_permutevar8x32_epi32(
+				_mm256_castsi128_si256(_mm_loadl_epi64(
+					(__m128i *)(poly_b + i))), b_idx);
+		__m256i is_invalid = _mm256_cmpeq_epi32(invalid,
+				_mm256_shuffle_epi32(f, 0x55));
+		__m256i r, swap;
+
+		if (do_add) {
+			r = _mm256_add_epi32(f, m);
+			r = _mm256_min_epu32(r, _mm256_sub_epi32(r, p));
+		}
+		else {
+			r = _mm256_sub_epi32(f, m);
+			r = _mm256_min_epu32(r, _mm256_add_epi32(r, p));
+		}
+
+		/* put the smaller root first */
+
+		swap = _mm256_shuffle_epi32(r, _MM_SHUFFLE(3, 1, 2, 0));
+		r = _mm256_blend_epi32(_mm256_min_epu32(r, swap),
+				_mm256_max_epu32(r, swap), 0x44);
+		r = _mm256_blend_epi32(f, r, 0x66);
+		_mm256_storeu_si256((__m256i *)fb, 
+				_mm256_blendv_epi8(r, f, is_invalid));
+	}
+#endif
+
+	return i;
+}
+
+#else /* !HAS_AVX2 && !HAS_AVX512BW */
+
 /*--------------------------------------------------------------------*/
 #define PACKED_SIEVE_MASK ((uint64)0x80808080 << 32 | 0x80808080)
 
@@ -177,7 +414,7 @@ static uint32 scan_sieve_block(sieve_conf_t *conf,
 	uint64 *packed_sieve = (uint64 *)conf->sieve_array;
 	uint32 relations_found = 0;
 
-	TIME1(tf_plus_scan_time)
+	TIME1(conf, QS_TIME_SCAN)
 	for (i = 0; i < SIEVE_BLOCK_SIZE / 8; i += 8) {
 
 		/* test 64 sieve values at a time for large
@@ -245,18 +482,18 @@ static uint32 scan_sieve_block(sieve_conf_t *conf,
 		for (j = 0; j < 64; j++) {
 			uint32 bits = sieve_array[8 * i + j];
 			if (bits > cutoff1) {
-				TIME1(tf_total_time)
+				TIME1(conf, QS_TIME_TF)
 				relations_found += 
 					check_sieve_val(conf, 
 						block_start + (int32)(8*i+j), 
 						cutoff1 + 257 - bits,
 						a, b, c, poly_index,
 						hashtable);
-				TIME2(tf_total_time)
+				TIME2(conf, QS_TIME_TF)
 			}
 		}
 	}
-	TIME2(tf_plus_scan_time)
+	TIME2(conf, QS_TIME_SCAN)
 
 #if defined(SCAN_MMX)
 	asm volatile("emms");
@@ -265,6 +502,8 @@ static uint32 scan_sieve_block(sieve_conf_t *conf,
 	return relations_found;
 }
 
+#endif /* HAS_AVX2 || HAS_AVX512BW */
+
 /*--------------------------------------------------------------------*/
 
 uint32 ROUTINE_NAME(sieve_conf_t *conf, 
@@ -338,7 +577,7 @@ uint32 ROUTINE_NAME(sieve_conf_t *conf,
 
 	   In short: black magic, awful mess, really fast. */
 
-	uint32 i, j, k, m, n;
+	uint32 i, j, k, m;
 	uint32 relations_found = 0;
 	uint32 num_sieve_blocks = conf->num_sieve_blocks;
 	uint32 sieve_size;
@@ -349,6 +588,7 @@ uint32 ROUTINE_NAME(sieve_conf_t *conf,
 	bucket_t *buckets;
 	uint32 poly_index;
 	uint32 *poly_b_array;
+	uint32 large_fb_start = conf->sieve_large_fb_start;
 
 	/* all hash bins start off empty */
 
@@ -356,15 +596,17 @@ uint32 ROUTINE_NAME(sieve_conf_t *conf,
 		conf->buckets[i].num_used = 0;
 	}
 
-	poly_b_array = conf->poly_b_array;
 	sieve_size = num_sieve_blocks * SIEVE_BLOCK_SIZE;
-	i = conf->sieve_large_fb_start;
+	i = large_fb_start;
 
 	/* for each block of factor base primes */
 
 	while (i < fb_size) {
 		uint32 fb_block = MIN(conf->fb_block, fb_size - i);
 		fb_t *fb_start = factor_base + i;
+		uint32 *prime_start = conf->large_prime + (i - large_fb_start);
+		uint32 *root1_start = conf->large_root1 + (i - large_fb_start);
+		uint32 *root2_start = conf->large_root2 + (i - large_fb_start);
 
 		buckets = conf->buckets;
 		poly_index = poly_start;
@@ -374,12 +616,11 @@ uint32 ROUTINE_NAME(sieve_conf_t *conf,
 		for (j = 0; j < num_poly; j++) {
 
 			uint32 next_action;
-			uint32 *poly_b_start;
 
-			TIME1(bucket_time)
+			TIME1(conf, QS_TIME_BUCKET)
 			for (k = 0; k < fb_block; k++) {
 				fb_t *fbptr = fb_start + k;
-				uint32 prime = fbptr->prime;
+				uint32 prime = prime_start[k];
 				uint32 root1, root2;
 				uint8 logprime = fbptr->logprime;
 
@@ -394,7 +635,7 @@ uint32 ROUTINE_NAME(sieve_conf_t *conf,
 				   value to determine the hash bin of 
 				   polynomial j to update */
 
-				root1 = fbptr->root1;
+				root1 = root1_start[k];
 				while (root1 < sieve_size) {
 					add_to_hashtable(buckets + 
 					       	(root1>>LOG2_SIEVE_BLOCK_SIZE),
@@ -403,7 +644,7 @@ uint32 ROUTINE_NAME(sieve_conf_t *conf,
 					root1 += prime;
 				}
 	
-				root2 = fbptr->root2;
+				root2 = root2_start[k];
 				while (root2 < sieve_size) {
 					add_to_hashtable(buckets + 
 					       	(root2>>LOG2_SIEVE_BLOCK_SIZE),
@@ -412,7 +653,7 @@ uint32 ROUTINE_NAME(sieve_conf_t *conf,
 					root2 += prime;
 				}
 			}
-			TIME2(bucket_time)
+			TIME2(conf, QS_TIME_BUCKET)
 
 			/* this block has finished sieving for polynomial
 			   j; now select the new roots for polynomial j+1.
@@ -425,8 +666,8 @@ uint32 ROUTINE_NAME(sieve_conf_t *conf,
 
 			k = poly_index;
 			next_action = conf->next_poly_action[k];
-			poly_b_start = poly_b_array;
-			n = next_action & 0x7f;
+			poly_b_array = conf->poly_b_large[next_action & 0x7f] +
+						(i - large_fb_start);
 			
 			/* Update the two roots for each prime in the block.
 			   Do not sort them in ascending order; the loop 
@@ -434,40 +675,36 @@ uint32 ROUTINE_NAME(sieve_conf_t *conf,
 			   branch required to do so takes a large fraction 
 			   of the total poly initialization time! */
 
-			TIME1(next_poly_large_time)
+			TIME1(conf, QS_TIME_NEXT_POLY_LARGE)
+			k = 0;
+#if defined(HAS_AVX2) || defined(HAS_AVX512BW)
+			k = next_large_roots(prime_start, root1_start,
+					root2_start, poly_b_array,
+					fb_block, next_action & 0x80);
+#endif
 			if (next_action & 0x80) {
-				for (k = 0; k < fb_block; 
-					k++, poly_b_start += num_factors) {
+				for (; k < fb_block; k++) {
+					uint32 prime = prime_start[k];
 		
-					fb_t *fbptr = fb_start + k;
-					uint32 prime = fbptr->prime;
-					uint32 root1 = fbptr->root1;
-					uint32 root2 = fbptr->root2;
-		
-					m = poly_b_start[n];
-					root1 = mp_modadd_1(root1, m, prime);
-					root2 = mp_modadd_1(root2, m, prime);
-					fbptr->root1 = root1;
-					fbptr->root2 = root2;
+					m = poly_b_array[k];
+					root1_start[k] = mp_modadd_1(
+						root1_start[k], m, prime);
+					root2_start[k] = mp_modadd_1(
+						root2_start[k], m, prime);
 				}
 			}
 			else {
-				for (k = 0; k < fb_block; 
-					k++, poly_b_start += num_factors) {
-		
-					fb_t *fbptr = fb_start + k;
-					uint32 prime = fbptr->prime;
-					uint32 root1 = fbptr->root1;
-					uint32 root2 = fbptr->root2;
+				for (; k < fb_block; k++) {
+					uint32 prime = prime_start[k];
 		
-					m = poly_b_start[n];
-					root1 = mp_modsub_1(root1, m, prime);
-					root2 = mp_modsub_1(root2, m, prime);
-					fbptr->root1 = root1;
-					fbptr->root2 = root2;
+					m = poly_b_array[k];
+					root1_start[k] = mp_modsub_1(
+						root1_start[k], m, prime);
+					root2_start[k] = mp_modsub_1(
+						root2_start[k], m, prime);
 				}
 			}
-			TIME2(next_poly_large_time)
+			TIME2(conf, QS_TIME_NEXT_POLY_LARGE)
 
 			/* polynomial j is finished; point to the
 			   hash bins for polynomial j+1 */
@@ -479,7 +716,6 @@ uint32 ROUTINE_NAME(sieve_conf_t *conf,
 		   go on to the next block */
 
 		i += fb_block;
-		poly_b_array += fb_block * num_factors;
 	}
 
 	/* All of the hashtables have been filled; now proceed
@@ -506,7 +742,7 @@ uint32 ROUTINE_NAME(sieve_conf_t *conf,
 		   got to do, so we must update the temporary roots as
 		   we go from sieve block to sieve block */
 
-		TIME1(plus_init_time)
+		TIME1(conf, QS_TIME_POLY_SETUP)
 		for (j = MIN_FB_OFFSET + 1; 
 				j < conf->sieve_large_fb_start; j++) {
 			fb_t *fbptr = factor_base + j;
@@ -544,7 +780,8 @@ uint32 ROUTINE_NAME(sieve_conf_t *conf,
 		else
 			cutoff1 = 0;
 
-		TIME2(plus_init_time)
+		TIME2(conf, QS_TIME_POLY_SETUP)
+		STAT_COUNT(conf, QS_COUNT_POLY);
 
 		/* for each sieve block */
 
@@ -557,6 +794,7 @@ uint32 ROUTINE_NAME(sieve_conf_t *conf,
 
 			memset(conf->sieve_array, (int8)(cutoff1 - 1), 
 				(size_t)SIEVE_BLOCK_SIZE);
+			STAT_COUNT(conf, QS_COUNT_BLOCK);
 	
 			/* do the sieving and add in the values from the
 			   hash bin corresponding to this sieve block */
@@ -584,9 +822,15 @@ uint32 ROUTINE_NAME(sieve_conf_t *conf,
 		poly_b_array = conf->poly_b_small[next_action & 0x7f];
 		k = conf->sieve_large_fb_start;
 
-		TIME1(next_poly_small_time)
+		TIME1(conf, QS_TIME_NEXT_POLY_SMALL)
+		j = MIN_FB_OFFSET + 1;
+#if defined(HAS_AVX2) || defined(HAS_AVX512BW)
+		j += next_small_roots(factor_base + j, k - j,
+					poly_b_array + j, 
+					next_action & 0x80);
+#endif
 		if (next_action & 0x80) {
-			for (j = MIN_FB_OFFSET + 1; j < k; j++) {
+			for (; j < k; j++) {
 	
 				fb_t *fbptr = factor_base + j;
 				uint32 prime = fbptr->prime;
@@ -610,7 +854,7 @@ uint32 ROUTINE_NAME(sieve_conf_t *conf,
 			}
 		}
 		else {
-			for (j = MIN_FB_OFFSET + 1; j < k; j++) {
+			for (; j < k; j++) {
 	
 				fb_t *fbptr = factor_base + j;
 				uint32 prime = fbptr->prime;
@@ -633,7 +877,7 @@ uint32 ROUTINE_NAME(sieve_conf_t *conf,
 				}
 			}
 		}
-		TIME2(next_poly_small_time)
+		TIME2(conf, QS_TIME_NEXT_POLY_SMALL)
 		buckets += num_sieve_blocks;
 	}
 
@@ -150,7 +150,7 @@ uint32 find_factors(msieve_obj *obj, mp_t *n,
 				   into y until all of the sieve values
 				   for this relation have been processed */
 
-				for (k = 0; k < 2; k++) {
+				for (k = 0; k < 3; k++) {
 					prime = relation->large_prime[k];
 					if (prime == 1)
 						continue;